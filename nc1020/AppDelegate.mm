@@ -6,6 +6,7 @@
 //  Copyright (c) 2015年 rainyx. All rights reserved.
 //
 
+#import "nc1020.h"
 #import "AppDelegate.h"
 #import "WQXRootViewController.h"
 
@@ -15,11 +16,33 @@
 
 @implementation AppDelegate
 
+#ifdef NC1020_PHASES
+// Debug builds trace the host phases while the app is active when the
+// phaseTrace user default is set, and write Documents/phases.json whenever
+// it goes to the background, for chrome://tracing or Perfetto.
+- (BOOL)tracesPhases {
+    return [[NSUserDefaults standardUserDefaults] boolForKey:@"phaseTrace"];
+}
+
+- (void)writePhaseTrace {
+    wqx::StopPhaseTrace();
+    NSArray *paths = NSSearchPathForDirectoriesInDomains(NSDocumentDirectory, NSUserDomainMask, YES);
+    NSString *path = [paths.firstObject stringByAppendingPathComponent:@"phases.json"];
+    if (wqx::WritePhaseTrace([path UTF8String])) {
+        NSLog(@"Phase trace written to %@", path);
+    } else {
+        NSLog(@"Cannot write phase trace %@", path);
+    }
+}
+#endif
 
 - (BOOL)application:(UIApplication *)application didFinishLaunchingWithOptions:(NSDictionary *)launchOptions {
     // Override point for customization after application launch.
     self.window = [[UIWindow alloc] initWithFrame:[UIScreen mainScreen].bounds];
 
+#ifdef NC1020_PHASES
+    wqx::SetPhaseThreadName("main");
+#endif
     UIViewController *rootViewController = [[WQXRootViewController alloc] init];
         
     [self.window setBackgroundColor:[UIColor whiteColor]];
@@ -36,6 +59,11 @@
 - (void)applicationDidEnterBackground:(UIApplication *)application {
     // Use this method to release shared resources, save user data, invalidate timers, and store enough application state information to restore your application to its current state in case it is terminated later.
     // If your application supports background execution, this method is called instead of applicationWillTerminate: when the user quits.
+#ifdef NC1020_PHASES
+    if ([self tracesPhases]) {
+        [self writePhaseTrace];
+    }
+#endif
 }
 
 - (void)applicationWillEnterForeground:(UIApplication *)application {
@@ -44,6 +72,11 @@
 
 - (void)applicationDidBecomeActive:(UIApplication *)application {
     // Restart any tasks that were paused (or not yet started) while the application was inactive. If the application was previously in the background, optionally refresh the user interface.
+#ifdef NC1020_PHASES
+    if ([self tracesPhases]) {
+        wqx::StartPhaseTrace();
+    }
+#endif
 }
 
 - (void)applicationWillTerminate:(UIApplication *)application {
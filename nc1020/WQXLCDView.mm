@@ -8,6 +8,7 @@
 
 #import "WQXLCDView.h"
 #import "nc1020.h"
+#import "lcd_render.h"
 #import <QuartzCore/QuartzCore.h>
 #import "WQX.hpp"
 #import "WQXToolbox.h"
@@ -21,15 +22,23 @@
 {
     uint8_t *_wqcLcdBuffer;
     uint8_t *_iosLcdBuffer;
+    uint64_t _frameSequence;
     UIColor *_backgroundColor;
     UIColor *_foregroundColor;
     
     BOOL _needUpdate;
+    wqx::lcd_render_options_t _renderOptions;
 }
 
 - (void)initVars {
     _wqcLcdBuffer = (uint8_t *)malloc(WQX_LCD_BUFF_SIZE);
     _iosLcdBuffer = (uint8_t *)malloc(IOS_LCD_BUFF_SIZE);
+    _frameSequence = 0;
+    // Alpha mask, first column cleared by the renderer.
+    _renderOptions.format = wqx::LCD_FORMAT_GRAY8;
+    _renderOptions.scale = 1;
+    _renderOptions.off_color = 0x00;
+    _renderOptions.on_color = 0xFF;
     
     _backgroundColor = kWQXLCDBackgroundColor;
     _foregroundColor = [UIColor blackColor];
@@ -70,20 +79,14 @@
 // An empty implementation adversely affects performance during animation.
 - (void)drawRect:(CGRect)rect {
     
-    if (!_needUpdate || !wqx::CopyLcdBuffer(_wqcLcdBuffer)) return;
+    if (!_needUpdate) return;
     
-    int index = 0;
-    for (int i=0; i<WQX_LCD_BUFF_SIZE; i++) {
-        uint8_t p = _wqcLcdBuffer[i];
-        for (int j=0; j<8; j++) {
-            _iosLcdBuffer[index++] = (uint8_t) ((p & (1 << (7 - j))) != 0 ? 0xFF : 0x00);
-        }
-    }
-    
-    // Erases first column pixels of the lcd buffer.
-    for (int i=0; i<LCD_HEIGHT; i++) {
-        _iosLcdBuffer[i*LCD_WIDTH] = 0;
+    // Takes the newest published frame without stopping the emulation,
+    // the last one stays on screen when nothing newer came.
+    if (wqx::CopyLatestFrame(_wqcLcdBuffer, &_frameSequence)) {
+        wqx::RenderLcd(_wqcLcdBuffer, NULL, _renderOptions, _iosLcdBuffer, LCD_WIDTH);
     }
+    if (_frameSequence == 0) return;
     
     CGContextRef ctx = UIGraphicsGetCurrentContext();
     [_backgroundColor setFill];
@@ -7,6 +7,7 @@
 //
 
 #import "nc1020.h"
+#import "pacer.h"
 #import "WQXRootViewController.h"
 #import "WQXScreenLayout.h"
 #import "WQXDefaultScreenLayout.h"
@@ -58,7 +59,15 @@
     NSLog(@"RAM path %s", rom.norFlashPath.c_str());
     NSLog(@"ROM path %s", rom.romPath.c_str());
     wqx::Initialize(rom);
+    // The saved clock moves on by the time the app was closed.
+    wqx::SetClockCatchUp(true);
     wqx::LoadNC1020();
+    // Opt-in: once the guest powers down the loop thread blocks until a key
+    // or the guest's alarm instead of emulating its idle loop. The guest's
+    // own idle code does not run meanwhile, so it is off by default.
+    if ([[NSUserDefaults standardUserDefaults] boolForKey:@"lowPower"]) {
+        wqx::SetLowPower(true);
+    }
     
     [[_layout lcdView] beginUpdate];
     _wqxLoopThread = [[NSThread alloc] initWithTarget:self selector:@selector(wqxloopThreadCallback) object:nil];
@@ -118,12 +127,29 @@
 }
 
 - (void)wqxloopThreadCallback {
+#ifdef NC1020_PHASES
+    wqx::SetPhaseThreadName("emulation");
+#endif
+    uint64_t lcdGeneration = 0;
+    wqx::pacer_options_t pacerOptions;
+    pacerOptions.slice_ms = 20;
+    pacerOptions.max_slice_ms = 100;
+    pacerOptions.max_catch_up_ms = 250;
+    pacerOptions.speed_up = false;
+    wqx::Pacer pacer(NULL, pacerOptions);
     while (true) {
-        wqx::RunTimeSlice(20, false);
-        dispatch_sync(dispatch_get_main_queue(), ^{
-            [[_layout lcdView] setNeedsDisplay];
-        });
-        [NSThread sleepForTimeInterval:0.02];
+        // Sleeps until the slice is due on the wall clock, so the time spent
+        // here doesn't slow the guest down.
+        pacer.Tick();
+        // The core publishes finished frames, the view takes the newest one
+        // when it draws. Nothing here waits for the main thread.
+        uint64_t generation = wqx::GetLcdGeneration();
+        if (generation != lcdGeneration) {
+            lcdGeneration = generation;
+            dispatch_async(dispatch_get_main_queue(), ^{
+                [[_layout lcdView] setNeedsDisplay];
+            });
+        }
     }
 }
 
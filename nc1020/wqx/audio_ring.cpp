@@ -0,0 +1,64 @@
+#include "audio_ring.h"
+#include <string.h>
+
+namespace wqx {
+
+const size_t AudioRing::BLOCK_SAMPLES;
+const size_t AudioRing::BLOCKS;
+
+AudioRing::AudioRing() :
+	head(0),
+	offset(0),
+	tail(0),
+	dropped(0) {
+}
+
+bool AudioRing::Push(uint64_t cycle, uint64_t end_cycle, const int16_t* samples, size_t count){
+	if (count == 0) {
+		return true;
+	}
+	size_t pushed = tail.load(std::memory_order_relaxed);
+	if (pushed - head.load(std::memory_order_acquire) == BLOCKS) {
+		dropped.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+	Block& block = blocks[pushed % BLOCKS];
+	block.cycle = cycle;
+	block.end_cycle = end_cycle;
+	block.count = count < BLOCK_SAMPLES ? count : BLOCK_SAMPLES;
+	memcpy(block.samples, samples, block.count * sizeof(int16_t));
+	tail.store(pushed + 1, std::memory_order_release);
+	return true;
+}
+
+size_t AudioRing::Read(int16_t* samples, size_t count, uint64_t* cycle){
+	size_t popped = head.load(std::memory_order_relaxed);
+	size_t available = tail.load(std::memory_order_acquire);
+	size_t read = 0;
+	while (read < count && popped != available) {
+		const Block& block = blocks[popped % BLOCKS];
+		if (read == 0 && cycle) {
+			*cycle = block.cycle + (block.end_cycle - block.cycle) * offset / block.count;
+		}
+		size_t copied = block.count - offset;
+		if (copied > count - read) {
+			copied = count - read;
+		}
+		memcpy(samples + read, block.samples + offset, copied * sizeof(int16_t));
+		read += copied;
+		offset += copied;
+		if (offset == block.count) {
+			offset = 0;
+			popped++;
+		}
+	}
+	head.store(popped, std::memory_order_release);
+	return read;
+}
+
+void AudioRing::Clear(){
+	offset = 0;
+	head.store(tail.load(std::memory_order_acquire), std::memory_order_release);
+}
+
+}
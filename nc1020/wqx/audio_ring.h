@@ -0,0 +1,59 @@
+#ifndef AUDIO_RING_H_
+#define AUDIO_RING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+namespace wqx {
+
+/**
+ * AudioRing
+ * wait free single producer single consumer ring of pcm blocks, from the
+ * emulation thread to an audio callback. every block carries the emulated
+ * cycles of its first sample and of the one after its last, so the reader
+ * knows when each sample was played however many blocks were dropped.
+ * a full ring drops what is pushed, never what is being read.
+ */
+class AudioRing {
+public:
+	static const size_t BLOCK_SAMPLES = 256;
+	static const size_t BLOCKS = 64;
+
+	AudioRing();
+
+	// producer side, count at most BLOCK_SAMPLES. false when full.
+	bool Push(uint64_t cycle, uint64_t end_cycle, const int16_t* samples, size_t count);
+	uint64_t Dropped() const { return dropped.load(std::memory_order_relaxed); }
+
+	// consumer side. copies up to count samples and returns how many, cycle
+	// (may be NULL) receives the emulated cycle of the first.
+	size_t Read(int16_t* samples, size_t count, uint64_t* cycle);
+	// drops everything queued, also consumer side.
+	void Clear();
+
+private:
+	struct Block {
+		uint64_t cycle;
+		uint64_t end_cycle;
+		size_t count;
+		int16_t samples[BLOCK_SAMPLES];
+	};
+
+	Block blocks[BLOCKS];
+	// next block to read and samples of it already read, consumer only.
+	std::atomic<size_t> head;
+	size_t offset;
+	// keeps the two indices off each other's cache line.
+	char padding[64];
+	// next block to write, producer only.
+	std::atomic<size_t> tail;
+	std::atomic<uint64_t> dropped;
+
+	AudioRing(const AudioRing&);
+	AudioRing& operator=(const AudioRing&);
+};
+
+}
+
+#endif /* AUDIO_RING_H_ */
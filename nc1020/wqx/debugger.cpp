@@ -0,0 +1,461 @@
+#include "debugger.h"
+
+#ifdef NC1020_DEBUGGER
+#include "disasm.h"
+#include "nc1020_machine.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace wqx {
+
+bool ParseBreakpoint(const std::string& text, int kinds, breakpoint_t* breakpoint){
+	size_t split = text.find(" if ");
+	std::string where = text.substr(0, split);
+	while (!where.empty() && where[where.size() - 1] == ' ') {
+		where.erase(where.size() - 1);
+	}
+	breakpoint->kinds = kinds;
+	breakpoint->condition = split == std::string::npos ? "" : text.substr(split + 4);
+	return ParseLocation(where, &breakpoint->physical, &breakpoint->address);
+}
+
+static const char* REGISTERS[] = {
+	"a", "x", "y", "sp", "ps", "pc", "value", "bank", "volume"
+};
+
+// recursive descent, one function per precedence level, emitting the
+// program in postfix order.
+class ConditionParser {
+public:
+	ConditionParser(const std::string& text, std::vector<Condition::Op>* program) :
+		text(text),
+		position(0),
+		program(program),
+		depth(0),
+		max_depth(0),
+		failed(false) {
+	}
+
+	bool Parse(){
+		LogicalOr();
+		Skip();
+		return !failed && position == text.size() && max_depth <= Condition::MAX_DEPTH;
+	}
+
+private:
+	const std::string& text;
+	size_t position;
+	std::vector<Condition::Op>* program;
+	size_t depth;
+	size_t max_depth;
+	bool failed;
+
+	void Skip(){
+		while (position < text.size() && text[position] == ' ') {
+			position++;
+		}
+	}
+	// takes token when it comes next, but not the start of a longer
+	// operator such as & of &&.
+	bool Accept(const char* token, const char* longer = NULL){
+		Skip();
+		size_t length = strlen(token);
+		if (text.compare(position, length, token) != 0 ||
+			(longer && text.compare(position, strlen(longer), longer) == 0)) {
+			return false;
+		}
+		position += length;
+		return true;
+	}
+	void Emit(uint8_t code, uint32_t operand = 0){
+		Condition::Op op;
+		op.code = code;
+		op.operand = operand;
+		program->push_back(op);
+		if (code == Condition::OP_NUMBER || code == Condition::OP_REGISTER) {
+			max_depth = ++depth > max_depth ? depth : max_depth;
+		} else if (code != Condition::OP_PEEK && code != Condition::OP_NOT) {
+			depth--;
+		}
+	}
+
+	void LogicalOr(){
+		LogicalAnd();
+		while (Accept("||")) {
+			LogicalAnd();
+			Emit(Condition::OP_LOGICAL_OR);
+		}
+	}
+	void LogicalAnd(){
+		Comparison();
+		while (Accept("&&")) {
+			Comparison();
+			Emit(Condition::OP_LOGICAL_AND);
+		}
+	}
+	void Comparison(){
+		Sum();
+		// longer tokens first.
+		static const struct {
+			const char* token;
+			uint8_t code;
+		} COMPARISONS[] = {
+			{"==", Condition::OP_EQUAL},
+			{"!=", Condition::OP_NOT_EQUAL},
+			{"<=", Condition::OP_LESS_EQUAL},
+			{"<", Condition::OP_LESS},
+			{">=", Condition::OP_GREATER_EQUAL},
+			{">", Condition::OP_GREATER}
+		};
+		for (size_t i=0; i<sizeof(COMPARISONS) / sizeof(COMPARISONS[0]); i++) {
+			if (Accept(COMPARISONS[i].token)) {
+				Sum();
+				Emit(COMPARISONS[i].code);
+				return;
+			}
+		}
+	}
+	void Sum(){
+		Bits();
+		for (;;) {
+			if (Accept("+")) {
+				Bits();
+				Emit(Condition::OP_ADD);
+			} else if (Accept("-")) {
+				Bits();
+				Emit(Condition::OP_SUB);
+			} else {
+				return;
+			}
+		}
+	}
+	void Bits(){
+		Unary();
+		for (;;) {
+			if (Accept("&", "&&")) {
+				Unary();
+				Emit(Condition::OP_AND);
+			} else if (Accept("^")) {
+				Unary();
+				Emit(Condition::OP_XOR);
+			} else if (Accept("|", "||")) {
+				Unary();
+				Emit(Condition::OP_OR);
+			} else {
+				return;
+			}
+		}
+	}
+	void Unary(){
+		if (Accept("!", "!=")) {
+			Unary();
+			Emit(Condition::OP_NOT);
+			return;
+		}
+		Primary();
+	}
+	void Primary(){
+		if (Accept("(")) {
+			LogicalOr();
+			failed |= !Accept(")");
+			return;
+		}
+		if (Accept("[")) {
+			LogicalOr();
+			failed |= !Accept("]");
+			Emit(Condition::OP_PEEK);
+			return;
+		}
+		Skip();
+		if (position < text.size() && (text[position] == '$' || isdigit((uint8_t)text[position]))) {
+			if (text[position] == '$') {
+				position++;
+			} else if (text.compare(position, 2, "0x") == 0) {
+				position += 2;
+			}
+			const char* start = text.c_str() + position;
+			char* end;
+			unsigned long number = strtoul(start, &end, 16);
+			failed |= end == start;
+			position += end - start;
+			Emit(Condition::OP_NUMBER, (uint32_t)number);
+			return;
+		}
+		size_t end = position;
+		while (end < text.size() && isalpha((uint8_t)text[end])) {
+			end++;
+		}
+		std::string name = text.substr(position, end - position);
+		for (size_t i=0; i<sizeof(REGISTERS) / sizeof(REGISTERS[0]); i++) {
+			if (name == REGISTERS[i]) {
+				position = end;
+				Emit(Condition::OP_REGISTER, (uint32_t)i);
+				return;
+			}
+		}
+		failed = true;
+		// keeps the depth balanced for the rest of the parse.
+		Emit(Condition::OP_NUMBER, 0);
+	}
+};
+
+bool Condition::Compile(const std::string& text){
+	program.clear();
+	ConditionParser parser(text, &program);
+	bool blank = text.find_first_not_of(' ') == std::string::npos;
+	if (blank || !parser.Parse()) {
+		program.clear();
+		return blank;
+	}
+	return true;
+}
+
+bool Condition::Evaluate(Machine* machine, uint8_t value) const {
+	if (program.empty()) {
+		return true;
+	}
+	uint32_t stack[MAX_DEPTH];
+	size_t top = 0;
+	for (size_t i=0; i<program.size(); i++) {
+		const Op& op = program[i];
+		if (op.code == OP_NUMBER) {
+			stack[top++] = op.operand;
+			continue;
+		}
+		if (op.code == OP_REGISTER) {
+			uint32_t registers[] = {
+				machine->reg_a, machine->reg_x, machine->reg_y, machine->reg_sp,
+				machine->reg_ps, machine->reg_pc, value, machine->ram_io[0x00],
+				machine->ram_io[0x0D]
+			};
+			stack[top++] = registers[op.operand];
+			continue;
+		}
+		if (op.code == OP_PEEK) {
+			uint16_t addr = (uint16_t)stack[top - 1];
+			uint8_t* page = machine->memmap[addr >> 13];
+			stack[top - 1] = page ? page[addr & 0x1FFF] : 0;
+			continue;
+		}
+		if (op.code == OP_NOT) {
+			stack[top - 1] = !stack[top - 1];
+			continue;
+		}
+		uint32_t right = stack[--top];
+		uint32_t& left = stack[top - 1];
+		switch (op.code) {
+		case OP_AND: left &= right; break;
+		case OP_XOR: left ^= right; break;
+		case OP_OR: left |= right; break;
+		case OP_ADD: left += right; break;
+		case OP_SUB: left -= right; break;
+		case OP_EQUAL: left = left == right; break;
+		case OP_NOT_EQUAL: left = left != right; break;
+		case OP_LESS: left = left < right; break;
+		case OP_LESS_EQUAL: left = left <= right; break;
+		case OP_GREATER: left = left > right; break;
+		case OP_GREATER_EQUAL: left = left >= right; break;
+		case OP_LOGICAL_AND: left = left && right; break;
+		case OP_LOGICAL_OR: left = left || right; break;
+		}
+	}
+	return stack[0] != 0;
+}
+
+Debugger::Debugger() :
+	next_id(1),
+	exec_pages(0),
+	stopped(false),
+	skipping(false),
+	skip_pc(0),
+	skip_cycle(0) {
+	memset(&hit, 0, sizeof(hit));
+}
+
+int Debugger::Add(const breakpoint_t& breakpoint){
+	Entry entry;
+	entry.id = next_id;
+	entry.breakpoint = breakpoint;
+	if (!entry.condition.Compile(breakpoint.condition)) {
+		return -1;
+	}
+	entries.push_back(entry);
+	return next_id++;
+}
+
+bool Debugger::Remove(int id){
+	for (size_t i=0; i<entries.size(); i++) {
+		if (entries[i].id == id) {
+			entries.erase(entries.begin() + i);
+			return true;
+		}
+	}
+	return false;
+}
+
+const Debugger::Entry* Debugger::Find(int id) const {
+	for (size_t i=0; i<entries.size(); i++) {
+		if (entries[i].id == id) {
+			return &entries[i];
+		}
+	}
+	return NULL;
+}
+
+void Debugger::Resume(Machine* machine){
+	stopped = false;
+	Map(machine);
+}
+
+void Debugger::Map(Machine* machine){
+	uint8_t pages[3] = {0, 0, 0};
+	for (size_t i=0; i<8; i++) {
+		uint32_t base = machine->memmap[i] ? machine->Locate(machine->memmap[i]) : 0;
+		for (size_t j=0; j<entries.size(); j++) {
+			const breakpoint_t& breakpoint = entries[j].breakpoint;
+			bool mapped = breakpoint.physical ?
+				base && breakpoint.address - base < 0x2000 :
+				breakpoint.address >> 13 == i;
+			if (!mapped) {
+				continue;
+			}
+			for (size_t k=0; k<3; k++) {
+				if (breakpoint.kinds & (1 << k)) {
+					pages[k] |= 1 << i;
+				}
+			}
+		}
+	}
+	exec_pages = pages[0];
+	machine->break_pages = pending.empty() ? pages[0] : 0xFF;
+	machine->read_pages = pages[1];
+	machine->write_pages = pages[2];
+}
+
+void Debugger::Access(Machine* machine, break_kind_t kind, uint16_t addr, uint8_t value){
+	uint32_t location = Locate(machine, addr);
+	for (size_t i=0; i<entries.size(); i++) {
+		const breakpoint_t& breakpoint = entries[i].breakpoint;
+		if (!(breakpoint.kinds & kind) ||
+			breakpoint.address != (breakpoint.physical ? location : addr)) {
+			continue;
+		}
+		break_hit_t access;
+		access.id = entries[i].id;
+		access.kind = kind;
+		access.pc = machine->inst_pc;
+		access.address = addr;
+		access.location = location;
+		access.value = value;
+		access.cycle = 0;
+		pending.push_back(access);
+		// the next instruction boundary checks it, on any page.
+		machine->break_pages = 0xFF;
+	}
+}
+
+void Debugger::Stop(const break_hit_t& hit){
+	this->hit = hit;
+	stopped = true;
+	skipping = hit.kind == BREAK_EXEC;
+	skip_pc = hit.pc;
+	skip_cycle = hit.cycle;
+}
+
+bool Debugger::CheckAccesses(Machine* machine){
+	if (pending.empty()) {
+		return false;
+	}
+	machine->break_pages = exec_pages;
+	for (size_t i=0; i<pending.size(); i++) {
+		const Entry* entry = Find(pending[i].id);
+		if (entry && entry->condition.Evaluate(machine, pending[i].value)) {
+			break_hit_t access = pending[i];
+			access.cycle = machine->GetCycleCount();
+			pending.clear();
+			Stop(access);
+			return true;
+		}
+	}
+	pending.clear();
+	return false;
+}
+
+bool Debugger::Check(Machine* machine){
+	if (CheckAccesses(machine)) {
+		return true;
+	}
+	uint16_t pc = machine->reg_pc;
+	uint64_t cycle = machine->GetCycleCount();
+	if (!(exec_pages & (1 << (pc >> 13))) ||
+		(skipping && pc == skip_pc && cycle == skip_cycle)) {
+		return false;
+	}
+	uint32_t location = Locate(machine, pc);
+	for (size_t i=0; i<entries.size(); i++) {
+		const Entry& entry = entries[i];
+		const breakpoint_t& breakpoint = entry.breakpoint;
+		uint8_t opcode = machine->memmap[pc >> 13][pc & 0x1FFF];
+		if (!(breakpoint.kinds & BREAK_EXEC) ||
+			breakpoint.address != (breakpoint.physical ? location : pc) ||
+			!entry.condition.Evaluate(machine, opcode)) {
+			continue;
+		}
+		break_hit_t exec;
+		exec.id = entry.id;
+		exec.kind = BREAK_EXEC;
+		exec.pc = pc;
+		exec.address = pc;
+		exec.location = location;
+		exec.value = opcode;
+		exec.cycle = cycle;
+		Stop(exec);
+		return true;
+	}
+	return false;
+}
+
+int AddBreakpoint(Machine* machine, const breakpoint_t& breakpoint){
+	if (machine->debugger == NULL) {
+		machine->debugger = new Debugger();
+	}
+	int id = machine->debugger->Add(breakpoint);
+	if (machine->debugger->Empty()) {
+		ClearBreakpoints(machine);
+		return id;
+	}
+	machine->debugger->Map(machine);
+	return id;
+}
+
+void RemoveBreakpoint(Machine* machine, int id){
+	if (machine->debugger == NULL || !machine->debugger->Remove(id)) {
+		return;
+	}
+	if (machine->debugger->Empty()) {
+		ClearBreakpoints(machine);
+	} else {
+		machine->debugger->Map(machine);
+	}
+}
+
+void ClearBreakpoints(Machine* machine){
+	delete machine->debugger;
+	machine->debugger = NULL;
+	machine->break_pages = 0;
+	machine->read_pages = 0;
+	machine->write_pages = 0;
+}
+
+bool GetBreak(Machine* machine, break_hit_t* hit){
+	if (machine->debugger == NULL || !machine->debugger->Stopped()) {
+		return false;
+	}
+	*hit = machine->debugger->Hit();
+	return true;
+}
+
+}
+
+#endif /* NC1020_DEBUGGER */
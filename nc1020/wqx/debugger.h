@@ -0,0 +1,115 @@
+#ifndef DEBUGGER_H_
+#define DEBUGGER_H_
+
+#include "nc1020.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace wqx {
+
+#ifdef NC1020_DEBUGGER
+
+// "<where>[ if <condition>]" into a breakpoint of the given BREAK_ kinds,
+// where being a cpu address or a physical location as ParseLocation takes
+// them. the condition is left to AddBreakpoint.
+extern bool ParseBreakpoint(const std::string& text, int kinds, breakpoint_t* breakpoint);
+
+/**
+ * Condition
+ * a breakpoint condition compiled to a little stack program. hex numbers
+ * ($A0, or 0A0 with a leading digit), the registers a x y sp ps pc, value
+ * (the byte a watchpoint saw, the opcode for a breakpoint), bank and
+ * volume (io $00 and $0D) and [expression] for the byte at a cpu address,
+ * with ! and parentheses and the binary operators, tightest first, & ^ |
+ * + - then == != < <= > >= then && then ||. unlike C the bit operators
+ * bind tighter than the comparisons, "ps & 01 == 0" tests the carry.
+ */
+class Condition {
+public:
+	// false, leaving the condition empty, when text does not parse.
+	bool Compile(const std::string& text);
+	// an empty condition is always true.
+	bool Empty() const { return program.empty(); }
+	bool Evaluate(Machine* machine, uint8_t value) const;
+
+	enum {
+		OP_NUMBER, OP_REGISTER, OP_PEEK, OP_NOT,
+		OP_AND, OP_XOR, OP_OR, OP_ADD, OP_SUB,
+		OP_EQUAL, OP_NOT_EQUAL, OP_LESS, OP_LESS_EQUAL, OP_GREATER, OP_GREATER_EQUAL,
+		OP_LOGICAL_AND, OP_LOGICAL_OR
+	};
+	struct Op {
+		uint8_t code;
+		uint32_t operand;
+	};
+	static const size_t MAX_DEPTH = 32;
+
+private:
+	std::vector<Op> program;
+};
+
+/**
+ * Debugger
+ * the breakpoints and watchpoints of a machine, built only with
+ * NC1020_DEBUGGER. Map marks the memmap pages holding any of them in the
+ * machine's page masks; Execute and Load and Store call in only for those,
+ * and not at all while the machine has no Debugger. a watchpoint access is
+ * noted when it happens and checked at the next instruction boundary,
+ * where the registers are known.
+ */
+class Debugger {
+public:
+	Debugger();
+
+	// an id, -1 for a condition that does not compile.
+	int Add(const breakpoint_t& breakpoint);
+	bool Remove(int id);
+	bool Empty() const { return entries.empty(); }
+
+	// when Execute starts: goes on from the last stop.
+	void Resume(Machine* machine);
+	// marks the pages of the machine's memmap holding breakpoints and
+	// watchpoints, after every change to it.
+	void Map(Machine* machine);
+	// a load or store of value at addr by the instruction at inst_pc.
+	void Access(Machine* machine, break_kind_t kind, uint16_t addr, uint8_t value);
+	bool Pending() const { return !pending.empty(); }
+	// at an instruction boundary, with the machine's registers stored.
+	// true to stop in front of the instruction at reg_pc.
+	bool Check(Machine* machine);
+	// the accesses only, when Execute ends.
+	bool CheckAccesses(Machine* machine);
+	bool Stopped() const { return stopped; }
+	const break_hit_t& Hit() const { return hit; }
+
+private:
+	struct Entry {
+		int id;
+		breakpoint_t breakpoint;
+		Condition condition;
+	};
+
+	std::vector<Entry> entries;
+	int next_id;
+	// accesses watchpoints saw, their conditions not checked yet.
+	std::vector<break_hit_t> pending;
+	uint8_t exec_pages;
+	bool stopped;
+	break_hit_t hit;
+	// after a stop at a breakpoint, the instruction it stopped in front of
+	// runs when the machine goes on.
+	bool skipping;
+	uint16_t skip_pc;
+	uint64_t skip_cycle;
+
+	const Entry* Find(int id) const;
+	void Stop(const break_hit_t& hit);
+};
+
+#endif /* NC1020_DEBUGGER */
+
+}
+
+#endif /* DEBUGGER_H_ */
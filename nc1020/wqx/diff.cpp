@@ -0,0 +1,380 @@
+#include "diff.h"
+#include "disasm.h"
+#include "lockstep.h"
+#include "nc1020_machine.h"
+#include <stdio.h>
+#include <string.h>
+
+namespace wqx {
+
+class SwitchEngine : public DiffEngine {
+public:
+	const char* Name() const { return "switch"; }
+	bool CanStep() const { return true; }
+	void RunInstructions(Machine* machine, size_t insts){
+		machine->Execute((size_t)-1, insts);
+	}
+	void RunSlice(Machine* machine, size_t time_slice){
+		machine->RunTimeSlice(time_slice, false);
+	}
+};
+
+// the twin starts every slice from the machine's state, so both lanes sit on
+// the same pc and run as a cohort for as long as the group lets them.
+class LockstepEngine : public DiffEngine {
+public:
+	LockstepEngine() :
+		twin(NULL) {
+	}
+	~LockstepEngine(){
+		if (twin) {
+			DestroyMachine(twin);
+		}
+	}
+	const char* Name() const { return "lockstep"; }
+	bool CanStep() const { return false; }
+	void RunInstructions(Machine* machine, size_t insts){
+	}
+	void RunSlice(Machine* machine, size_t time_slice){
+		if (twin == NULL) {
+			twin = CreateMachine(machine->nc1020_rom, machine->rom_buff);
+			snapshot.resize(SnapshotSize());
+		}
+		machine->SaveSnapshot(&snapshot[0]);
+		twin->LoadSnapshot(&snapshot[0]);
+		LockstepGroup group;
+		group.AddLane(machine);
+		group.AddLane(twin);
+		group.RunTimeSlice(time_slice, false);
+	}
+
+private:
+	Machine* twin;
+	std::vector<uint8_t> snapshot;
+};
+
+DiffEngine* CreateDiffEngine(const std::string& name){
+	if (name == "switch") {
+		return new SwitchEngine();
+	}
+	if (name == "lockstep") {
+		return new LockstepEngine();
+	}
+	return NULL;
+}
+
+static uint8_t PeekAt(Machine* machine, uint16_t addr){
+	return machine->memmap[addr >> 13][addr & 0x1FFF];
+}
+
+// where a step of DIFF_BLOCK ends.
+static bool IsFlow(uint8_t opcode){
+	switch (opcode) {
+	case 0x10: case 0x30: case 0x50: case 0x70:
+	case 0x90: case 0xB0: case 0xD0: case 0xF0:
+	case 0x4C: case 0x6C: case 0x20: case 0x60: case 0x40: case 0x00:
+		return true;
+	default:
+		return false;
+	}
+}
+
+// fnv-1a, 64 bit.
+static uint64_t Hash(const uint8_t* data, size_t size){
+	uint64_t hash = 0xCBF29CE484222325ull;
+	for (size_t i=0; i<size; i++) {
+		hash = (hash ^ data[i]) * 0x100000001B3ull;
+	}
+	return hash;
+}
+
+static size_t FirstDifference(const uint8_t* a, const uint8_t* b, size_t size){
+	size_t i = 0;
+	while (i < size && a[i] == b[i]) {
+		i++;
+	}
+	return i;
+}
+
+DiffRunner::DiffRunner(Machine* a, DiffEngine* engine_a, Machine* b, DiffEngine* engine_b,
+	const diff_options_t& options) :
+	options(options),
+	slices(0),
+	steps(0),
+	slice_insts(0),
+	slice_end(0),
+	slice_ended(false),
+	start_context(options.context),
+	start_context_next(0),
+	context(options.context),
+	context_next(0),
+	diverged(false) {
+	machines[0] = a;
+	machines[1] = b;
+	engines[0] = engine_a;
+	engines[1] = engine_b;
+	starts[0].resize(SnapshotSize());
+	starts[1].resize(SnapshotSize());
+	// both go through the snapshot, so neither keeps anything it does not
+	// carry.
+	a->SaveSnapshot(&starts[0][0]);
+	a->LoadSnapshot(&starts[0][0]);
+	b->LoadSnapshot(&starts[0][0]);
+}
+
+void DiffRunner::ApplyKey(uint8_t key_id, bool down_or_up){
+	machines[0]->ApplyKey(key_id, down_or_up);
+	machines[1]->ApplyKey(key_id, down_or_up);
+}
+
+bool DiffRunner::RunSlice(){
+	if (diverged) {
+		return false;
+	}
+	// slices end relative to cycle_base, the cycles carried over count in.
+	slice_end = machines[0]->cycle_base + options.time_slice * CYCLES_MS;
+	slice_insts = 0;
+	slice_ended = false;
+	if (options.granularity != DIFF_INSTRUCTION) {
+		machines[0]->SaveSnapshot(&starts[0][0]);
+		machines[1]->SaveSnapshot(&starts[1][0]);
+		start_context = context;
+		start_context_next = context_next;
+	}
+
+	bool same;
+	if (options.granularity == DIFF_SLICE) {
+		engines[0]->RunSlice(machines[0], options.time_slice);
+		engines[1]->RunSlice(machines[1], options.time_slice);
+		steps++;
+		same = Compare(true);
+	} else {
+		same = StepSlice(options.granularity == DIFF_INSTRUCTION);
+	}
+	if (!same) {
+		diverged = true;
+		if (options.granularity == DIFF_INSTRUCTION) {
+			Describe(!slice_ended);
+		} else {
+			Replay();
+		}
+	}
+	slices++;
+	return !diverged;
+}
+
+void DiffRunner::StepFirst(){
+	Machine* machine = machines[0];
+	if (options.context) {
+		Retired& retired = context[context_next++ % options.context];
+		retired.index = slice_insts;
+		retired.pc = machine->reg_pc;
+		retired.a = machine->reg_a;
+		retired.ps = machine->reg_ps;
+		retired.x = machine->reg_x;
+		retired.y = machine->reg_y;
+		retired.sp = machine->reg_sp;
+		for (size_t i=0; i<sizeof(retired.bytes); i++) {
+			retired.bytes[i] = PeekAt(machine, (uint16_t)(retired.pc + i));
+		}
+		retired.location = Locate(machine, retired.pc);
+	}
+	engines[0]->RunInstructions(machine, 1);
+	slice_insts++;
+}
+
+bool DiffRunner::StepSlice(bool by_instruction){
+	Machine* first = machines[0];
+	while (first->GetCycleCount() < slice_end) {
+		size_t insts = 0;
+		bool flow;
+		do {
+			flow = by_instruction || IsFlow(PeekAt(first, first->reg_pc));
+			StepFirst();
+			insts++;
+		} while (!flow && first->GetCycleCount() < slice_end);
+		engines[1]->RunInstructions(machines[1], insts);
+		steps++;
+		if (!Compare(false)) {
+			return false;
+		}
+	}
+	return EndSlice();
+}
+
+bool DiffRunner::EndSlice(){
+	slice_ended = true;
+	for (size_t i=0; i<2; i++) {
+		machines[i]->EndSlice((size_t)(slice_end - machines[i]->cycle_base));
+	}
+	return Compare(true);
+}
+
+void DiffRunner::Replay(){
+	if (!engines[0]->CanStep()) {
+		Describe(false);
+		return;
+	}
+	// without the second engine stepping, the first one replays alone for
+	// the context and the second keeps the state its slice ended in.
+	bool both = engines[1]->CanStep();
+	std::string seen = difference;
+	machines[0]->LoadSnapshot(&starts[0][0]);
+	if (both) {
+		machines[1]->LoadSnapshot(&starts[1][0]);
+	}
+	context = start_context;
+	context_next = start_context_next;
+	slice_insts = 0;
+	while (machines[0]->GetCycleCount() < slice_end) {
+		StepFirst();
+		if (both) {
+			engines[1]->RunInstructions(machines[1], 1);
+			if (!Compare(false)) {
+				Describe(true);
+				return;
+			}
+		}
+	}
+	machines[0]->EndSlice((size_t)(slice_end - machines[0]->cycle_base));
+	if (both) {
+		machines[1]->EndSlice((size_t)(slice_end - machines[1]->cycle_base));
+	}
+	if (Compare(true)) {
+		difference = seen + " (not seen again on replay)";
+	}
+	Describe(false);
+}
+
+bool DiffRunner::Compare(bool nor){
+	Machine* a = machines[0];
+	Machine* b = machines[1];
+	const struct {
+		const char* name;
+		uint64_t a;
+		uint64_t b;
+	} fields[] = {
+		{"pc", a->reg_pc, b->reg_pc},
+		{"a", a->reg_a, b->reg_a},
+		{"x", a->reg_x, b->reg_x},
+		{"y", a->reg_y, b->reg_y},
+		{"ps", a->reg_ps, b->reg_ps},
+		{"sp", a->reg_sp, b->reg_sp},
+		{"cycle", a->GetCycleCount(), b->GetCycleCount()},
+	};
+	char text[96];
+	for (size_t i=0; i<sizeof(fields) / sizeof(fields[0]); i++) {
+		if (fields[i].a != fields[i].b) {
+			snprintf(text, sizeof(text), "%s differs", fields[i].name);
+			difference = text;
+			return false;
+		}
+	}
+	for (size_t i=0; i<8; i++) {
+		if (Locate(a, (uint16_t)(i * 0x2000)) != Locate(b, (uint16_t)(i * 0x2000))) {
+			snprintf(text, sizeof(text), "memory map differs at $%04zX", i * 0x2000);
+			difference = text;
+			return false;
+		}
+	}
+	if (memcmp(a->ram_buff, b->ram_buff, 0x8000) != 0) {
+		snprintf(text, sizeof(text), "ram differs at $%04zX",
+			FirstDifference(a->ram_buff, b->ram_buff, 0x8000));
+		difference = text;
+		return false;
+	}
+	if (nor && memcmp(a->nor_buff, b->nor_buff, NOR_SIZE) != 0) {
+		size_t offset = FirstDifference(a->nor_buff, b->nor_buff, NOR_SIZE);
+		snprintf(text, sizeof(text), "nor differs at bank %02zx offset %04zx",
+			offset / 0x8000, offset % 0x8000);
+		difference = text;
+		return false;
+	}
+	difference.clear();
+	return true;
+}
+
+static void Row(std::string* text, const char* name, const std::string& a, const std::string& b){
+	char line[128];
+	snprintf(line, sizeof(line), "  %-8s %-20s %-20s%s\n", name, a.c_str(), b.c_str(),
+		a == b ? "" : " *");
+	*text += line;
+}
+
+static std::string Hex(uint64_t value, int digits){
+	char text[24];
+	snprintf(text, sizeof(text), "%0*llX", digits, (unsigned long long)value);
+	return text;
+}
+
+static std::string Next(Machine* machine){
+	uint8_t bytes[3];
+	for (size_t i=0; i<sizeof(bytes); i++) {
+		bytes[i] = PeekAt(machine, (uint16_t)(machine->reg_pc + i));
+	}
+	char text[32];
+	Disassemble(machine->reg_pc, bytes, text, sizeof(text));
+	return text;
+}
+
+void DiffRunner::Describe(bool pinpointed){
+	char line[160];
+	if (pinpointed) {
+		snprintf(line, sizeof(line),
+			"diverged at instruction %llu of slice %llu (step %llu, cycle %llu): %s\n",
+			(unsigned long long)(slice_insts - 1), (unsigned long long)slices,
+			(unsigned long long)steps, (unsigned long long)machines[0]->GetCycleCount(),
+			difference.c_str());
+	} else {
+		snprintf(line, sizeof(line),
+			"diverged by the end of slice %llu (step %llu, cycle %llu): %s\n",
+			(unsigned long long)slices, (unsigned long long)steps,
+			(unsigned long long)machines[0]->GetCycleCount(), difference.c_str());
+	}
+	report = line;
+
+	size_t shown = context_next < context.size() ? context_next : context.size();
+	if (shown) {
+		snprintf(line, sizeof(line), "last %zu instructions of %s, slice instruction, location, pc:\n",
+			shown, engines[0]->Name());
+		report += line;
+	}
+	for (size_t i=context_next - shown; i<context_next; i++) {
+		const Retired& retired = context[i % context.size()];
+		char code[32];
+		size_t length = Disassemble(retired.pc, retired.bytes, code, sizeof(code));
+		char bytes[12] = "";
+		for (size_t j=0; j<length; j++) {
+			snprintf(bytes + j * 3, sizeof(bytes) - j * 3, "%02X ", retired.bytes[j]);
+		}
+		snprintf(line, sizeof(line),
+			"  %8llu %-12s %04X  %-9s %-14s a=%02X x=%02X y=%02X ps=%02X sp=%02X\n",
+			(unsigned long long)retired.index, LocationName(retired.location).c_str(), retired.pc,
+			bytes, code, retired.a, retired.x, retired.y, retired.ps, retired.sp);
+		report += line;
+	}
+
+	Machine* a = machines[0];
+	Machine* b = machines[1];
+	snprintf(line, sizeof(line), "  %-8s %-20s %s\n", "", engines[0]->Name(), engines[1]->Name());
+	report += line;
+	Row(&report, "pc", Hex(a->reg_pc, 4), Hex(b->reg_pc, 4));
+	Row(&report, "a", Hex(a->reg_a, 2), Hex(b->reg_a, 2));
+	Row(&report, "x", Hex(a->reg_x, 2), Hex(b->reg_x, 2));
+	Row(&report, "y", Hex(a->reg_y, 2), Hex(b->reg_y, 2));
+	Row(&report, "ps", Hex(a->reg_ps, 2), Hex(b->reg_ps, 2));
+	Row(&report, "sp", Hex(a->reg_sp, 2), Hex(b->reg_sp, 2));
+	snprintf(line, sizeof(line), "%llu", (unsigned long long)a->GetCycleCount());
+	std::string cycle_a = line;
+	snprintf(line, sizeof(line), "%llu", (unsigned long long)b->GetCycleCount());
+	Row(&report, "cycle", cycle_a, line);
+	for (size_t i=0; i<8; i++) {
+		snprintf(line, sizeof(line), "map %04zX", i * 0x2000);
+		Row(&report, line, LocationName(Locate(a, (uint16_t)(i * 0x2000))), LocationName(Locate(b, (uint16_t)(i * 0x2000))));
+	}
+	Row(&report, "ram", Hex(Hash(a->ram_buff, 0x8000), 16), Hex(Hash(b->ram_buff, 0x8000), 16));
+	Row(&report, "nor", Hex(Hash(a->nor_buff, NOR_SIZE), 16), Hex(Hash(b->nor_buff, NOR_SIZE), 16));
+	Row(&report, "next", Next(a), Next(b));
+}
+
+}
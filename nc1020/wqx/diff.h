@@ -0,0 +1,125 @@
+#ifndef DIFF_H_
+#define DIFF_H_
+
+#include "nc1020.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace wqx {
+
+/**
+ * DiffEngine
+ * one way of running a machine, for DiffRunner to hold against another.
+ * "switch" is the reference, the interpreter of RunTimeSlice; "lockstep"
+ * runs the machine as a lane of a LockstepGroup next to a twin of itself,
+ * so that its cohort path is the one taken.
+ */
+class DiffEngine {
+public:
+	virtual ~DiffEngine() {}
+
+	virtual const char* Name() const = 0;
+	// whether RunInstructions works, engines running whole slices only
+	// can be compared at slice granularity.
+	virtual bool CanStep() const = 0;
+	// runs insts instructions, whatever the slice.
+	virtual void RunInstructions(Machine* machine, size_t insts) = 0;
+	// runs a time slice of the given ms and ends it, like RunTimeSlice.
+	virtual void RunSlice(Machine* machine, size_t time_slice) = 0;
+};
+
+// NULL for an unknown name.
+extern DiffEngine* CreateDiffEngine(const std::string& name);
+
+typedef enum {
+	DIFF_INSTRUCTION,
+	// the instructions up to and including the next branch, jump, call,
+	// return or BRK of the first machine.
+	DIFF_BLOCK,
+	DIFF_SLICE
+} diff_granularity_t;
+
+typedef struct {
+	diff_granularity_t granularity;
+	size_t time_slice;
+	// instructions of the first machine shown before a divergence.
+	size_t context;
+} diff_options_t;
+
+/**
+ * DiffRunner
+ * runs two machines from the same state in lockstep, each through its own
+ * engine, and compares them after every step: registers, the cycle count,
+ * the memory map and the ram after each step, the nor at the end of every
+ * slice. the first divergence stops the run. when it is seen after a block
+ * or a slice, both machines go back to the start of the slice and replay
+ * it an instruction at a time to find the instruction that diverged, when
+ * the engines can step. the first engine should be the reference.
+ */
+class DiffRunner {
+public:
+	// b starts from a snapshot of a.
+	DiffRunner(Machine* a, DiffEngine* engine_a, Machine* b, DiffEngine* engine_b,
+		const diff_options_t& options);
+
+	// runs both machines for a slice. false once they diverged.
+	bool RunSlice();
+	// a key on both machines, between two steps.
+	void ApplyKey(uint8_t key_id, bool down_or_up);
+
+	uint64_t Slices() const { return slices; }
+	uint64_t Steps() const { return steps; }
+	// the divergence with the instructions before it and both states.
+	const std::string& Report() const { return report; }
+
+private:
+	// an instruction of the first machine, as it was about to run.
+	struct Retired {
+		uint64_t index;
+		uint16_t pc;
+		uint8_t a;
+		uint8_t ps;
+		uint8_t x;
+		uint8_t y;
+		uint8_t sp;
+		uint8_t bytes[3];
+		uint32_t location;
+	};
+
+	Machine* machines[2];
+	DiffEngine* engines[2];
+	diff_options_t options;
+
+	uint64_t slices;
+	uint64_t steps;
+	// instructions of the first machine in the current slice.
+	uint64_t slice_insts;
+	uint64_t slice_end;
+	bool slice_ended;
+	// both machines and the context at the start of the slice, to replay
+	// it from.
+	std::vector<uint8_t> starts[2];
+	std::vector<Retired> start_context;
+	size_t start_context_next;
+	std::vector<Retired> context;
+	size_t context_next;
+	bool diverged;
+	std::string difference;
+	std::string report;
+
+	bool StepSlice(bool by_instruction);
+	void StepFirst();
+	bool EndSlice();
+	void Replay();
+	bool Compare(bool nor);
+	void Describe(bool pinpointed);
+
+	DiffRunner(const DiffRunner&);
+	DiffRunner& operator=(const DiffRunner&);
+};
+
+}
+
+#endif /* DIFF_H_ */
@@ -0,0 +1,384 @@
+#include "disasm.h"
+#include "nc1020_machine.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace wqx {
+
+static const opcode_info_t OPCODES[0x100] = {
+	// 0x00
+	{"BRK", MODE_BRK}, {"ORA", MODE_INDIRECT_X}, {"???", MODE_IMPLIED}, {"???", MODE_IMPLIED}, {"???", MODE_IMPLIED}, {"ORA", MODE_ZERO_PAGE}, {"ASL", MODE_ZERO_PAGE}, {"???", MODE_IMPLIED},
+	// 0x08
+	{"PHP", MODE_IMPLIED}, {"ORA", MODE_IMMEDIATE}, {"ASL", MODE_ACCUMULATOR}, {"???", MODE_IMPLIED}, {"???", MODE_IMPLIED}, {"ORA", MODE_ABSOLUTE}, {"ASL", MODE_ABSOLUTE}, {"???", MODE_IMPLIED},
+	// 0x10
+	{"BPL", MODE_RELATIVE}, {"ORA", MODE_INDIRECT_Y}, {"???", MODE_IMPLIED}, {"???", MODE_IMPLIED}, {"???", MODE_IMPLIED}, {"ORA", MODE_ZERO_PAGE_X}, {"ASL", MODE_ZERO_PAGE_X}, {"???", MODE_IMPLIED},
+	// 0x18
+	{"CLC", MODE_IMPLIED}, {"ORA", MODE_ABSOLUTE_Y}, {"???", MODE_IMPLIED}, {"???", MODE_IMPLIED}, {"???", MODE_IMPLIED}, {"ORA", MODE_ABSOLUTE_X}, {"ASL", MODE_ABSOLUTE_X}, {"???", MODE_IMPLIED},
+	// 0x20
+	{"JSR", MODE_ABSOLUTE}, {"AND", MODE_INDIRECT_X}, {"???", MODE_IMPLIED}, {"???", MODE_IMPLIED}, {"BIT", MODE_ZERO_PAGE}, {"AND", MODE_ZERO_PAGE}, {"ROL", MODE_ZERO_PAGE}, {"???", MODE_IMPLIED},
+	// 0x28
+	{"PLP", MODE_IMPLIED}, {"AND", MODE_IMMEDIATE}, {"ROL", MODE_ACCUMULATOR}, {"???", MODE_IMPLIED}, {"BIT", MODE_ABSOLUTE}, {"AND", MODE_ABSOLUTE}, {"ROL", MODE_ABSOLUTE}, {"???", MODE_IMPLIED},
+	// 0x30
+	{"BMI", MODE_RELATIVE}, {"AND", MODE_INDIRECT_Y}, {"???", MODE_IMPLIED}, {"???", MODE_IMPLIED}, {"???", MODE_IMPLIED}, {"AND", MODE_ZERO_PAGE_X}, {"ROL", MODE_ZERO_PAGE_X}, {"???", MODE_IMPLIED},
+	// 0x38
+	{"SEC", MODE_IMPLIED}, {"AND", MODE_ABSOLUTE_Y}, {"???", MODE_IMPLIED}, {"???", MODE_IMPLIED}, {"???", MODE_IMPLIED}, {"AND", MODE_ABSOLUTE_X}, {"ROL", MODE_ABSOLUTE_X}, {"???", MODE_IMPLIED},
+	// 0x40
+	{"RTI", MODE_IMPLIED}, {"EOR", MODE_INDIRECT_X}, {"???", MODE_IMPLIED}, {"???", MODE_IMPLIED}, {"???", MODE_IMPLIED}, {"EOR", MODE_ZERO_PAGE}, {"LSR", MODE_ZERO_PAGE}, {"???", MODE_IMPLIED},
+	// 0x48
+	{"PHA", MODE_IMPLIED}, {"EOR", MODE_IMMEDIATE}, {"LSR", MODE_ACCUMULATOR}, {"???", MODE_IMPLIED}, {"JMP", MODE_ABSOLUTE}, {"EOR", MODE_ABSOLUTE}, {"LSR", MODE_ABSOLUTE}, {"???", MODE_IMPLIED},
+	// 0x50
+	{"BVC", MODE_RELATIVE}, {"EOR", MODE_INDIRECT_Y}, {"???", MODE_IMPLIED}, {"???", MODE_IMPLIED}, {"???", MODE_IMPLIED}, {"EOR", MODE_ZERO_PAGE_X}, {"LSR", MODE_ZERO_PAGE_X}, {"???", MODE_IMPLIED},
+	// 0x58
+	{"CLI", MODE_IMPLIED}, {"EOR", MODE_ABSOLUTE_Y}, {"???", MODE_IMPLIED}, {"???", MODE_IMPLIED}, {"???", MODE_IMPLIED}, {"EOR", MODE_ABSOLUTE_X}, {"LSR", MODE_ABSOLUTE_X}, {"???", MODE_IMPLIED},
+	// 0x60
+	{"RTS", MODE_IMPLIED}, {"ADC", MODE_INDIRECT_X}, {"???", MODE_IMPLIED}, {"???", MODE_IMPLIED}, {"???", MODE_IMPLIED}, {"ADC", MODE_ZERO_PAGE}, {"ROR", MODE_ZERO_PAGE}, {"???", MODE_IMPLIED},
+	// 0x68
+	{"PLA", MODE_IMPLIED}, {"ADC", MODE_IMMEDIATE}, {"ROR", MODE_ACCUMULATOR}, {"???", MODE_IMPLIED}, {"JMP", MODE_INDIRECT}, {"ADC", MODE_ABSOLUTE}, {"ROR", MODE_ABSOLUTE}, {"???", MODE_IMPLIED},
+	// 0x70
+	{"BVS", MODE_RELATIVE}, {"ADC", MODE_INDIRECT_Y}, {"???", MODE_IMPLIED}, {"???", MODE_IMPLIED}, {"???", MODE_IMPLIED}, {"ADC", MODE_ZERO_PAGE_X}, {"ROR", MODE_ZERO_PAGE_X}, {"???", MODE_IMPLIED},
+	// 0x78
+	{"SEI", MODE_IMPLIED}, {"ADC", MODE_ABSOLUTE_Y}, {"???", MODE_IMPLIED}, {"???", MODE_IMPLIED}, {"???", MODE_IMPLIED}, {"ADC", MODE_ABSOLUTE_X}, {"ROR", MODE_ABSOLUTE_X}, {"???", MODE_IMPLIED},
+	// 0x80
+	{"???", MODE_IMPLIED}, {"STA", MODE_INDIRECT_X}, {"???", MODE_IMPLIED}, {"???", MODE_IMPLIED}, {"STY", MODE_ZERO_PAGE}, {"STA", MODE_ZERO_PAGE}, {"STX", MODE_ZERO_PAGE}, {"???", MODE_IMPLIED},
+	// 0x88
+	{"DEY", MODE_IMPLIED}, {"???", MODE_IMPLIED}, {"TXA", MODE_IMPLIED}, {"???", MODE_IMPLIED}, {"STY", MODE_ABSOLUTE}, {"STA", MODE_ABSOLUTE}, {"STX", MODE_ABSOLUTE}, {"???", MODE_IMPLIED},
+	// 0x90
+	{"BCC", MODE_RELATIVE}, {"STA", MODE_INDIRECT_Y}, {"???", MODE_IMPLIED}, {"???", MODE_IMPLIED}, {"STY", MODE_ZERO_PAGE_X}, {"STA", MODE_ZERO_PAGE_X}, {"STX", MODE_ZERO_PAGE_Y}, {"???", MODE_IMPLIED},
+	// 0x98
+	{"TYA", MODE_IMPLIED}, {"STA", MODE_ABSOLUTE_Y}, {"TXS", MODE_IMPLIED}, {"???", MODE_IMPLIED}, {"???", MODE_IMPLIED}, {"STA", MODE_ABSOLUTE_X}, {"???", MODE_IMPLIED}, {"???", MODE_IMPLIED},
+	// 0xA0
+	{"LDY", MODE_IMMEDIATE}, {"LDA", MODE_INDIRECT_X}, {"LDX", MODE_IMMEDIATE}, {"???", MODE_IMPLIED}, {"LDY", MODE_ZERO_PAGE}, {"LDA", MODE_ZERO_PAGE}, {"LDX", MODE_ZERO_PAGE}, {"???", MODE_IMPLIED},
+	// 0xA8
+	{"TAY", MODE_IMPLIED}, {"LDA", MODE_IMMEDIATE}, {"TAX", MODE_IMPLIED}, {"???", MODE_IMPLIED}, {"LDY", MODE_ABSOLUTE}, {"LDA", MODE_ABSOLUTE}, {"LDX", MODE_ABSOLUTE}, {"???", MODE_IMPLIED},
+	// 0xB0
+	{"BCS", MODE_RELATIVE}, {"LDA", MODE_INDIRECT_Y}, {"???", MODE_IMPLIED}, {"???", MODE_IMPLIED}, {"LDY", MODE_ZERO_PAGE_X}, {"LDA", MODE_ZERO_PAGE_X}, {"LDX", MODE_ZERO_PAGE_Y}, {"???", MODE_IMPLIED},
+	// 0xB8
+	{"CLV", MODE_IMPLIED}, {"LDA", MODE_ABSOLUTE_Y}, {"TSX", MODE_IMPLIED}, {"???", MODE_IMPLIED}, {"LDY", MODE_ABSOLUTE_X}, {"LDA", MODE_ABSOLUTE_X}, {"LDX", MODE_ABSOLUTE_Y}, {"???", MODE_IMPLIED},
+	// 0xC0
+	{"CPY", MODE_IMMEDIATE}, {"CMP", MODE_INDIRECT_X}, {"???", MODE_IMPLIED}, {"???", MODE_IMPLIED}, {"CPY", MODE_ZERO_PAGE}, {"CMP", MODE_ZERO_PAGE}, {"DEC", MODE_ZERO_PAGE}, {"???", MODE_IMPLIED},
+	// 0xC8
+	{"INY", MODE_IMPLIED}, {"CMP", MODE_IMMEDIATE}, {"DEX", MODE_IMPLIED}, {"???", MODE_IMPLIED}, {"CPY", MODE_ABSOLUTE}, {"CMP", MODE_ABSOLUTE}, {"DEC", MODE_ABSOLUTE}, {"???", MODE_IMPLIED},
+	// 0xD0
+	{"BNE", MODE_RELATIVE}, {"CMP", MODE_INDIRECT_Y}, {"???", MODE_IMPLIED}, {"???", MODE_IMPLIED}, {"???", MODE_IMPLIED}, {"CMP", MODE_ZERO_PAGE_X}, {"DEC", MODE_ZERO_PAGE_X}, {"???", MODE_IMPLIED},
+	// 0xD8
+	{"CLD", MODE_IMPLIED}, {"CMP", MODE_ABSOLUTE_Y}, {"???", MODE_IMPLIED}, {"???", MODE_IMPLIED}, {"???", MODE_IMPLIED}, {"CMP", MODE_ABSOLUTE_X}, {"DEC", MODE_ABSOLUTE_X}, {"???", MODE_IMPLIED},
+	// 0xE0
+	{"CPX", MODE_IMMEDIATE}, {"SBC", MODE_INDIRECT_X}, {"???", MODE_IMPLIED}, {"???", MODE_IMPLIED}, {"CPX", MODE_ZERO_PAGE}, {"SBC", MODE_ZERO_PAGE}, {"INC", MODE_ZERO_PAGE}, {"???", MODE_IMPLIED},
+	// 0xE8
+	{"INX", MODE_IMPLIED}, {"SBC", MODE_IMMEDIATE}, {"NOP", MODE_IMPLIED}, {"???", MODE_IMPLIED}, {"CPX", MODE_ABSOLUTE}, {"SBC", MODE_ABSOLUTE}, {"INC", MODE_ABSOLUTE}, {"???", MODE_IMPLIED},
+	// 0xF0
+	{"BEQ", MODE_RELATIVE}, {"SBC", MODE_INDIRECT_Y}, {"???", MODE_IMPLIED}, {"???", MODE_IMPLIED}, {"???", MODE_IMPLIED}, {"SBC", MODE_ZERO_PAGE_X}, {"INC", MODE_ZERO_PAGE_X}, {"???", MODE_IMPLIED},
+	// 0xF8
+	{"SED", MODE_IMPLIED}, {"SBC", MODE_ABSOLUTE_Y}, {"???", MODE_IMPLIED}, {"???", MODE_IMPLIED}, {"???", MODE_IMPLIED}, {"SBC", MODE_ABSOLUTE_X}, {"INC", MODE_ABSOLUTE_X}, {"???", MODE_IMPLIED},
+};
+
+static const size_t MODE_LENGTHS[] = {
+	1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 2, 2, 2, 2
+};
+
+const opcode_info_t& OpcodeInfo(uint8_t opcode){
+	return OPCODES[opcode];
+}
+
+size_t InstructionLength(uint8_t opcode){
+	return MODE_LENGTHS[OPCODES[opcode].mode];
+}
+
+// operand names the operand's target, NULL to show it as a number.
+static void FormatInstruction(uint16_t pc, const uint8_t* bytes, const char* operand,
+	char* text, size_t size){
+	const opcode_info_t& info = OPCODES[bytes[0]];
+	uint8_t byte = bytes[1];
+	uint16_t word = bytes[1] | (bytes[2] << 8);
+	char number[8];
+	switch (info.mode) {
+	case MODE_IMMEDIATE:
+	case MODE_BRK:
+		snprintf(number, sizeof(number), "#$%02X", byte);
+		break;
+	case MODE_ZERO_PAGE:
+	case MODE_ZERO_PAGE_X:
+	case MODE_ZERO_PAGE_Y:
+	case MODE_INDIRECT_X:
+	case MODE_INDIRECT_Y:
+		snprintf(number, sizeof(number), "$%02X", byte);
+		break;
+	case MODE_RELATIVE:
+		snprintf(number, sizeof(number), "$%04X", (uint16_t)(pc + 2 + (int8_t)byte));
+		break;
+	default:
+		snprintf(number, sizeof(number), "$%04X", word);
+		break;
+	}
+	const char* arg = operand ? operand : number;
+	switch (info.mode) {
+	case MODE_IMPLIED: snprintf(text, size, "%s", info.mnemonic); break;
+	case MODE_ACCUMULATOR: snprintf(text, size, "%s A", info.mnemonic); break;
+	case MODE_ZERO_PAGE_X:
+	case MODE_ABSOLUTE_X: snprintf(text, size, "%s %s,X", info.mnemonic, arg); break;
+	case MODE_ZERO_PAGE_Y:
+	case MODE_ABSOLUTE_Y: snprintf(text, size, "%s %s,Y", info.mnemonic, arg); break;
+	case MODE_INDIRECT: snprintf(text, size, "%s (%s)", info.mnemonic, arg); break;
+	case MODE_INDIRECT_X: snprintf(text, size, "%s (%s,X)", info.mnemonic, arg); break;
+	case MODE_INDIRECT_Y: snprintf(text, size, "%s (%s),Y", info.mnemonic, arg); break;
+	default: snprintf(text, size, "%s %s", info.mnemonic, arg); break;
+	}
+}
+
+size_t Disassemble(uint16_t pc, const uint8_t* bytes, char* text, size_t size){
+	FormatInstruction(pc, bytes, NULL, text, size);
+	return MODE_LENGTHS[OPCODES[bytes[0]].mode];
+}
+
+std::string LocationName(uint32_t location){
+	char name[24];
+	uint32_t offset = location & PHYS_OFFSET_MASK;
+	switch (location & ~PHYS_OFFSET_MASK) {
+	case PHYS_RAM: snprintf(name, sizeof(name), "ram+%04x", offset); break;
+	case PHYS_ROM: snprintf(name, sizeof(name), "rom%03x+%04x", offset / 0x8000, offset % 0x8000); break;
+	case PHYS_NOR: snprintf(name, sizeof(name), "nor%02x+%04x", offset / 0x8000, offset % 0x8000); break;
+	default: snprintf(name, sizeof(name), "-"); break;
+	}
+	return name;
+}
+
+// a hex number taking all of text, below limit.
+static bool ParseHex(const std::string& text, uint32_t limit, uint32_t* value){
+	char* end;
+	unsigned long parsed = strtoul(text.c_str(), &end, 16);
+	if (text.empty() || *end != '\0' || parsed >= limit) {
+		return false;
+	}
+	*value = (uint32_t)parsed;
+	return true;
+}
+
+bool ParseLocation(const std::string& text, bool* physical, uint32_t* address){
+	size_t plus = text.find('+');
+	if (plus == std::string::npos) {
+		*physical = false;
+		return ParseHex(text, 0x10000, address);
+	}
+	std::string space = text.substr(0, 3);
+	std::string bank = text.substr(3, plus - 3);
+	uint32_t bank_idx = 0;
+	uint32_t offset;
+	if (space == "ram" && bank.empty() && ParseHex(text.substr(plus + 1), 0x8000, &offset)) {
+		*address = PHYS_RAM | offset;
+	} else if (space == "nor" && ParseHex(bank, 0x20, &bank_idx) &&
+		ParseHex(text.substr(plus + 1), 0x8000, &offset)) {
+		*address = PHYS_NOR | (bank_idx * 0x8000 + offset);
+	} else if (space == "rom" && ParseHex(bank, 0x300, &bank_idx) &&
+		ParseHex(text.substr(plus + 1), 0x8000, &offset)) {
+		*address = PHYS_ROM | (bank_idx * 0x8000 + offset);
+	} else {
+		return false;
+	}
+	*physical = true;
+	return true;
+}
+
+
+int32_t OperandAddress(const instruction_t& instruction){
+	uint8_t byte = instruction.bytes[1];
+	uint16_t word = instruction.bytes[1] | (instruction.bytes[2] << 8);
+	switch (OPCODES[instruction.bytes[0]].mode) {
+	case MODE_ZERO_PAGE:
+	case MODE_ZERO_PAGE_X:
+	case MODE_ZERO_PAGE_Y:
+	case MODE_INDIRECT_X:
+	case MODE_INDIRECT_Y:
+		return byte;
+	case MODE_ABSOLUTE:
+	case MODE_ABSOLUTE_X:
+	case MODE_ABSOLUTE_Y:
+	case MODE_INDIRECT:
+		return word;
+	case MODE_RELATIVE:
+		return (uint16_t)(instruction.pc + 2 + (int8_t)byte);
+	default:
+		return -1;
+	}
+}
+
+SymbolTable::SymbolTable() :
+	syscalls(0x100),
+	syscall_count(0) {
+}
+
+bool SymbolTable::Load(const std::string& path){
+	FILE* file = fopen(path.c_str(), "r");
+	if (file == NULL) {
+		return false;
+	}
+	char line[256];
+	while (fgets(line, sizeof(line), file)) {
+		char* comment = strchr(line, '#');
+		if (comment) {
+			*comment = 0;
+		}
+		char first[64];
+		char second[128];
+		char third[128];
+		int fields = sscanf(line, "%63s %127s %127s", first, second, third);
+		bool physical;
+		uint32_t address;
+		if (fields == 3 && strcmp(first, "brk") == 0) {
+			char* end;
+			unsigned long number = strtoul(second, &end, 16);
+			if (*end == '\0' && number <= 0xFF) {
+				AddSyscall((uint8_t)number, third);
+			}
+		} else if (fields == 2 && ParseLocation(first, &physical, &address)) {
+			if (physical) {
+				AddLocation(address, second);
+			} else {
+				AddAddress((uint16_t)address, second);
+			}
+		}
+	}
+	fclose(file);
+	return true;
+}
+
+void SymbolTable::AddLocation(uint32_t location, const std::string& name){
+	locations[location] = name;
+}
+
+void SymbolTable::AddAddress(uint16_t addr, const std::string& name){
+	addresses[addr] = name;
+}
+
+void SymbolTable::AddSyscall(uint8_t number, const std::string& name){
+	syscall_count += syscalls[number].empty();
+	syscalls[number] = name;
+}
+
+const char* SymbolTable::FindLocation(uint32_t location) const {
+	std::unordered_map<uint32_t, std::string>::const_iterator found = locations.find(location);
+	return found == locations.end() ? NULL : found->second.c_str();
+}
+
+const char* SymbolTable::FindAddress(uint16_t addr) const {
+	std::unordered_map<uint16_t, std::string>::const_iterator found = addresses.find(addr);
+	return found == addresses.end() ? NULL : found->second.c_str();
+}
+
+const char* SymbolTable::FindSyscall(uint8_t number) const {
+	return syscalls[number].empty() ? NULL : syscalls[number].c_str();
+}
+
+Disassembler::Disassembler(Machine* machine) :
+	machine(machine),
+	symbols(NULL) {
+}
+
+const uint8_t* Disassembler::Bytes(uint32_t location, size_t* available) const {
+	uint32_t offset = location & PHYS_OFFSET_MASK;
+	const uint8_t* base;
+	size_t size;
+	switch (location & ~PHYS_OFFSET_MASK) {
+	case PHYS_RAM: base = machine->ram_buff; size = 0x8000; break;
+	case PHYS_ROM: base = machine->rom_buff; size = ROM_SIZE; break;
+	case PHYS_NOR: base = machine->nor_buff; size = NOR_SIZE; break;
+	default: return NULL;
+	}
+	if (offset >= size) {
+		return NULL;
+	}
+	*available = 0x8000 - offset % 0x8000;
+	return base + offset;
+}
+
+// bytes past the end of the bank read as 0.
+static void Fill(instruction_t* instruction, uint16_t pc, const uint8_t* bytes, size_t available){
+	instruction->pc = pc;
+	instruction->length = (uint8_t)MODE_LENGTHS[OPCODES[bytes[0]].mode];
+	instruction->bytes[0] = bytes[0];
+	instruction->bytes[1] = available > 1 ? bytes[1] : 0;
+	instruction->bytes[2] = available > 2 ? bytes[2] : 0;
+}
+
+const std::vector<instruction_t>& Disassembler::DecodeBank(uint32_t location, uint16_t pc){
+	size_t available;
+	const uint8_t* bytes = Bytes(location, &available);
+	if (bytes == NULL) {
+		return none;
+	}
+	bool writable = (location & ~PHYS_OFFSET_MASK) != PHYS_ROM;
+	Bank& bank = banks[location];
+	if (!bank.instructions.empty() && bank.pc == pc &&
+		(!writable || memcmp(&bank.bytes[0], bytes, available) == 0)) {
+		return bank.instructions;
+	}
+	bank.pc = pc;
+	if (writable) {
+		bank.bytes.assign(bytes, bytes + available);
+	}
+	bank.instructions.clear();
+	bank.instructions.reserve(available);
+	for (size_t offset=0; offset<available; ) {
+		instruction_t instruction;
+		Fill(&instruction, (uint16_t)(pc + offset), bytes + offset, available - offset);
+		bank.instructions.push_back(instruction);
+		offset += instruction.length;
+	}
+	return bank.instructions;
+}
+
+instruction_t Disassembler::Decode(uint32_t location, uint16_t pc) const {
+	instruction_t instruction;
+	size_t available;
+	const uint8_t* bytes = Bytes(location, &available);
+	if (bytes == NULL) {
+		static const uint8_t NOTHING[3] = {0, 0, 0};
+		Fill(&instruction, pc, NOTHING, 3);
+	} else {
+		Fill(&instruction, pc, bytes, available);
+	}
+	return instruction;
+}
+
+instruction_t Disassembler::DecodeAt(uint16_t pc) const {
+	return Decode(Locate(machine, pc), pc);
+}
+
+size_t Disassembler::Format(const instruction_t& instruction, uint32_t location,
+	char* text, size_t size) const {
+	const char* operand = NULL;
+	int32_t target = OperandAddress(instruction);
+	if (symbols && target >= 0) {
+		// code in the banked window reaches its own bank there, whatever
+		// $00 holds now.
+		uint32_t space = location & ~PHYS_OFFSET_MASK;
+		bool banked = (space == PHYS_ROM || space == PHYS_NOR) &&
+			instruction.pc >= 0x4000 && instruction.pc < 0xC000 &&
+			target >= 0x4000 && target < 0xC000;
+		uint32_t target_location = banked ?
+			(location & ~(uint32_t)0x7FFF) + (uint32_t)(target - 0x4000) :
+			Locate(machine, (uint16_t)target);
+		operand = symbols->FindLocation(target_location);
+		if (operand == NULL) {
+			operand = symbols->FindAddress((uint16_t)target);
+		}
+	}
+	FormatInstruction(instruction.pc, instruction.bytes, operand, text, size);
+	const char* syscall = symbols && OPCODES[instruction.bytes[0]].mode == MODE_BRK ?
+		symbols->FindSyscall(instruction.bytes[1]) : NULL;
+	if (syscall) {
+		size_t used = strlen(text);
+		snprintf(text + used, size > used ? size - used : 0, " ; %s", syscall);
+	}
+	return instruction.length;
+}
+
+const char* Disassembler::Label(const instruction_t& instruction, uint32_t location) const {
+	if (symbols == NULL) {
+		return NULL;
+	}
+	const char* label = symbols->FindLocation(location);
+	return label ? label : symbols->FindAddress(instruction.pc);
+}
+
+}
@@ -0,0 +1,148 @@
+#ifndef DISASM_H_
+#define DISASM_H_
+
+#include "nc1020.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace wqx {
+
+// addressing modes of the 6502 instructions the interpreter implements.
+// BRK takes the byte after it along, the interpreter skips it.
+typedef enum {
+	MODE_IMPLIED,
+	MODE_ACCUMULATOR,
+	MODE_IMMEDIATE,
+	MODE_ZERO_PAGE,
+	MODE_ZERO_PAGE_X,
+	MODE_ZERO_PAGE_Y,
+	MODE_ABSOLUTE,
+	MODE_ABSOLUTE_X,
+	MODE_ABSOLUTE_Y,
+	MODE_INDIRECT,
+	MODE_INDIRECT_X,
+	MODE_INDIRECT_Y,
+	MODE_RELATIVE,
+	MODE_BRK
+} addressing_mode_t;
+
+typedef struct {
+	// "???" for the opcodes the interpreter runs as one byte no-ops.
+	const char* mnemonic;
+	addressing_mode_t mode;
+} opcode_info_t;
+
+extern const opcode_info_t& OpcodeInfo(uint8_t opcode);
+// bytes an instruction takes, opcode included.
+extern size_t InstructionLength(uint8_t opcode);
+// the instruction in bytes (at least 3 of them) at pc as text, such as
+// "LDA $1234,X" or "BNE $E012". returns its length.
+extern size_t Disassemble(uint16_t pc, const uint8_t* bytes, char* text, size_t size);
+
+// a physical location (see Locate) as "ram+0456", "nor03+1234" or
+// "rom185+1234" for volume 1 bank 85, "-" for 0.
+extern std::string LocationName(uint32_t location);
+// reads one of those back, or a cpu address such as "E123" with physical
+// set false. all numbers are hex.
+extern bool ParseLocation(const std::string& text, bool* physical, uint32_t* address);
+
+// an instruction as decoded, seen by the cpu at pc. bytes past its length
+// are 0.
+typedef struct {
+	uint16_t pc;
+	uint8_t length;
+	uint8_t bytes[3];
+} instruction_t;
+
+// the cpu address the operand refers to, a branch's target, -1 for the
+// modes without one.
+extern int32_t OperandAddress(const instruction_t& instruction);
+
+/**
+ * SymbolTable
+ * names for physical locations, cpu addresses and BRK syscall numbers, read
+ * from symbol files with lines of
+ *   <location> <name>      rom000+2019 main_loop, or a cpu address such as
+ *                          0456 key_buffer for what does not move
+ *   brk <number> <name>    brk 8A show_text, for BRK #$8A
+ * in hex, '#' starting a comment. lines that do not parse are skipped.
+ */
+class SymbolTable {
+public:
+	SymbolTable();
+
+	// adds the symbols of the file, false when it cannot be read.
+	bool Load(const std::string& path);
+	void AddLocation(uint32_t location, const std::string& name);
+	void AddAddress(uint16_t addr, const std::string& name);
+	void AddSyscall(uint8_t number, const std::string& name);
+	// NULL when there is none.
+	const char* FindLocation(uint32_t location) const;
+	const char* FindAddress(uint16_t addr) const;
+	const char* FindSyscall(uint8_t number) const;
+	size_t Size() const { return locations.size() + addresses.size() + syscall_count; }
+
+private:
+	std::unordered_map<uint32_t, std::string> locations;
+	std::unordered_map<uint16_t, std::string> addresses;
+	std::vector<std::string> syscalls;
+	size_t syscall_count;
+};
+
+/**
+ * Disassembler
+ * decodes a machine's code by physical location, so the same pc reads as
+ * the code of whichever bank and volume holds it. a bank decodes in one
+ * linear sweep into a cache kept per start location: rom stays valid, nor
+ * and ram are compared with the bytes they were decoded from and decoded
+ * again once those changed, so a 32 KB bank costs a memcmp when it did
+ * not. Format names what the symbols know: the operand's target, looked up
+ * in the instruction's own bank for the $4000 to $BFFF window and under the
+ * current banks elsewhere, and BRK syscalls.
+ */
+class Disassembler {
+public:
+	explicit Disassembler(Machine* machine);
+
+	void SetSymbols(const SymbolTable* symbols) { this->symbols = symbols; }
+	// the instructions from location to the end of its 32 KB bank, the
+	// first at cpu address pc. empty for a location outside ram, nor and
+	// rom. valid until the next DecodeBank.
+	const std::vector<instruction_t>& DecodeBank(uint32_t location, uint16_t pc);
+	// one instruction, never cached.
+	instruction_t Decode(uint32_t location, uint16_t pc) const;
+	// the instruction at pc under the machine's current banks.
+	instruction_t DecodeAt(uint16_t pc) const;
+	// like Disassemble, with symbols: "LDA key_buffer,X", "JSR main_loop",
+	// "BRK #$8A ; show_text". returns the length of the instruction.
+	size_t Format(const instruction_t& instruction, uint32_t location, char* text, size_t size) const;
+	// the symbol of the instruction itself, NULL for none.
+	const char* Label(const instruction_t& instruction, uint32_t location) const;
+
+private:
+	struct Bank {
+		uint16_t pc;
+		// a copy of the bytes decoded, for nor and ram.
+		std::vector<uint8_t> bytes;
+		std::vector<instruction_t> instructions;
+	};
+
+	Machine* machine;
+	const SymbolTable* symbols;
+	std::unordered_map<uint32_t, Bank> banks;
+	std::vector<instruction_t> none;
+
+	// the bytes at location up to the end of its bank, NULL outside ram,
+	// nor and rom.
+	const uint8_t* Bytes(uint32_t location, size_t* available) const;
+
+	Disassembler(const Disassembler&);
+	Disassembler& operator=(const Disassembler&);
+};
+
+}
+
+#endif /* DISASM_H_ */
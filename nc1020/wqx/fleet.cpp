@@ -0,0 +1,266 @@
+#include "fleet.h"
+#include "nc1020_machine.h"
+#include "stats_page.h"
+#include "work_pool.h"
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+namespace wqx {
+    using std::string;
+    using std::vector;
+
+static double Now(){
+	return std::chrono::duration<double>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool LoadKeyScript(const string& path, vector<key_event_t>& events){
+	FILE* file = path == "-" ? stdin : fopen(path.c_str(), "r");
+	if (file == NULL) {
+		return false;
+	}
+	char line[256];
+	while (fgets(line, sizeof(line), file)) {
+		char* comment = strchr(line, '#');
+		if (comment) {
+			*comment = 0;
+		}
+		char* cursor = line;
+		char* end;
+		unsigned long long time_ms = strtoull(cursor, &end, 10);
+		if (end == cursor) {
+			continue;
+		}
+		cursor = end;
+		unsigned long key_id = strtoul(cursor, &end, 0);
+		if (end == cursor || key_id > 0xFF) {
+			continue;
+		}
+		cursor = end;
+		while (*cursor == ' ' || *cursor == '\t') {
+			cursor++;
+		}
+		key_event_t event;
+		event.time_ms = time_ms;
+		event.key_id = (uint8_t)key_id;
+		event.down_or_up = !(strncmp(cursor, "up", 2) == 0 || *cursor == '0');
+		events.push_back(event);
+	}
+	if (file != stdin) {
+		fclose(file);
+	}
+	struct ByTime {
+		bool operator()(const key_event_t& a, const key_event_t& b) const {
+			return a.time_ms < b.time_ms;
+		}
+	};
+	std::stable_sort(events.begin(), events.end(), ByTime());
+	return true;
+}
+
+Fleet::Fleet(const string& rom_path, const fleet_options_t& options) :
+	options(options),
+	rom_image(LoadRomImage(rom_path)),
+	rom_path(rom_path),
+	pool(new WorkPool(options.threads)),
+	stats_page(NULL),
+	start_time(0) {
+	if (this->options.slice_ms == 0) {
+		this->options.slice_ms = 20;
+	}
+	memset(&stats, 0, sizeof(stats));
+}
+
+Fleet::~Fleet() {
+	delete pool;
+	for (size_t i=0; i<sessions.size(); i++) {
+		DestroyMachine(sessions[i]->machine);
+		delete sessions[i];
+	}
+	if (rom_image) {
+		FreeRomImage(rom_image);
+	}
+}
+
+size_t Fleet::AddSession(const string& nor_path, const string& states_path,
+	const vector<key_event_t>& script) {
+	WqxRom rom;
+	rom.romPath = rom_path;
+	rom.norFlashPath = nor_path;
+	rom.statesPath = states_path;
+	Session* session = new Session();
+	session->machine = CreateMachine(rom, rom_image);
+	session->deadline = 0;
+	memset(&session->stats, 0, sizeof(session->stats));
+	session->stats_slot = -1;
+	LoadNC1020(session->machine);
+	SetLatencyTracking(session->machine, options.latency);
+	SetLowPower(session->machine, options.park_slept);
+	// scheduled by cycle as wqx-run does, so a session runs the same as it
+	// would alone, whatever the slice length and the other sessions.
+	uint64_t start = GetCycleCount(session->machine);
+	for (size_t i=0; i<script.size(); i++) {
+		ScheduleKey(session->machine, start + script[i].time_ms * CYCLES_MS,
+			script[i].key_id, script[i].down_or_up);
+	}
+	sessions.push_back(session);
+	return sessions.size() - 1;
+}
+
+void Fleet::RunSession(void* context, size_t index) {
+	Fleet* fleet = (Fleet*)context;
+	Session* session = fleet->sessions[index];
+	size_t slice_ms = fleet->options.slice_ms;
+	double begin = Now();
+	RunTimeSlice(session->machine, slice_ms, false);
+	double end = Now();
+	fleet_session_stats_t& stats = session->stats;
+	stats.host_ms += (end - begin) * 1000;
+	stats.emulated_ms += slice_ms;
+	stats.slices++;
+	if (fleet->stats_page) {
+		fleet->stats_page->Publish(session->stats_slot);
+	}
+	if (fleet->options.realtime) {
+		double lag = (end - session->deadline) * 1000;
+		stats.last_lag_ms = lag > 0 ? lag : 0;
+		stats.total_lag_ms += stats.last_lag_ms;
+		if (stats.last_lag_ms > stats.max_lag_ms) {
+			stats.max_lag_ms = stats.last_lag_ms;
+		}
+	}
+}
+
+void Fleet::SetStatsPage(StatsPage* page) {
+	stats_page = page;
+	for (size_t i=0; i<sessions.size(); i++) {
+		const string& nor_path = sessions[i]->machine->nc1020_rom.norFlashPath;
+		sessions[i]->stats_slot = page ? page->Add(sessions[i]->machine,
+			nor_path.substr(nor_path.find_last_of('/') + 1)) : -1;
+	}
+}
+
+void Fleet::Run() {
+	size_t slice_ms = options.slice_ms;
+	start_time = Now();
+	vector<double> costs(sessions.size());
+	for (uint64_t elapsed_ms = 0; elapsed_ms < options.duration_ms; elapsed_ms += slice_ms) {
+		double deadline = start_time + (elapsed_ms + slice_ms) / 1000.0;
+		order.clear();
+		for (size_t i=0; i<sessions.size(); i++) {
+			Session* session = sessions[i];
+			session->stats.parked = options.park_slept && session->machine->IsParked();
+			if (session->stats.parked) {
+				RunTimeSlice(session->machine, slice_ms, false);
+				session->stats.parked_ms += slice_ms;
+				stats.parked_slices++;
+				if (stats_page) {
+					stats_page->Publish(session->stats_slot);
+				}
+				continue;
+			}
+			session->deadline = deadline;
+			costs[i] = session->stats.slices ?
+				session->stats.host_ms / session->stats.slices : 0;
+			order.push_back(i);
+		}
+		// deal the most expensive sessions first so they end up spread over
+		// different threads, stealing evens out the rest.
+		struct ByCost {
+			const vector<double>* costs;
+			bool operator()(size_t a, size_t b) const {
+				return (*costs)[a] > (*costs)[b];
+			}
+		} by_cost = { &costs };
+		std::stable_sort(order.begin(), order.end(), by_cost);
+		pool->Run(order.data(), order.size(), &Fleet::RunSession, this);
+		stats.session_slices += order.size();
+		stats.emulated_cycles += (uint64_t)order.size() * slice_ms * CYCLES_MS;
+		stats.ticks++;
+		if (options.realtime) {
+			double wait = deadline - Now();
+			if (wait > 0) {
+				std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+			}
+		}
+	}
+	stats.sessions = sessions.size();
+	stats.threads = pool->Threads();
+	stats.wall_seconds = Now() - start_time;
+	stats.emulated_mhz = stats.wall_seconds > 0 ?
+		stats.emulated_cycles / stats.wall_seconds / 1e6 : 0;
+}
+
+void Fleet::SaveAll() {
+	for (size_t i=0; i<sessions.size(); i++) {
+		SaveNC1020(sessions[i]->machine);
+		if (stats_page) {
+			stats_page->Publish(sessions[i]->stats_slot);
+		}
+	}
+}
+
+void Fleet::PrintLatency(FILE* out) const {
+	latency_stats_t total;
+	memset(&total, 0, sizeof(total));
+	for (size_t i=0; i<sessions.size(); i++) {
+		latency_stats_t session;
+		GetLatencyStats(sessions[i]->machine, &session);
+		MergeLatencyStats(&total, &session);
+	}
+	PrintLatencyStats(out, &total);
+}
+
+void Fleet::PrintReport(FILE* out, size_t worst_sessions) const {
+	double realtime_ratio = stats.wall_seconds > 0 && stats.sessions ?
+		stats.session_slices * options.slice_ms / 1000.0 /
+		stats.sessions / stats.wall_seconds : 0;
+	fprintf(out, "sessions        %zu\n", stats.sessions);
+	fprintf(out, "threads         %zu\n", stats.threads);
+	fprintf(out, "ticks           %llu x %zu ms\n",
+		(unsigned long long)stats.ticks, options.slice_ms);
+	fprintf(out, "wall time       %.3f s\n", stats.wall_seconds);
+	fprintf(out, "emulated        %.1f MHz (%.2fx real time per session)\n",
+		stats.emulated_mhz, realtime_ratio);
+	fprintf(out, "slices run      %llu, parked %llu\n",
+		(unsigned long long)stats.session_slices,
+		(unsigned long long)stats.parked_slices);
+	if (options.latency) {
+		PrintLatency(out);
+	}
+	if (!options.realtime || sessions.empty()) {
+		return;
+	}
+	vector<size_t> worst;
+	double total_lag = 0;
+	uint64_t slices = 0;
+	for (size_t i=0; i<sessions.size(); i++) {
+		total_lag += sessions[i]->stats.total_lag_ms;
+		slices += sessions[i]->stats.slices;
+		worst.push_back(i);
+	}
+	struct ByMaxLag {
+		const vector<Session*>* sessions;
+		bool operator()(size_t a, size_t b) const {
+			return (*sessions)[a]->stats.max_lag_ms > (*sessions)[b]->stats.max_lag_ms;
+		}
+	} by_max_lag = { &sessions };
+	std::stable_sort(worst.begin(), worst.end(), by_max_lag);
+	fprintf(out, "lag             avg %.3f ms, max %.3f ms\n",
+		slices ? total_lag / slices : 0,
+		sessions[worst[0]]->stats.max_lag_ms);
+	if (worst_sessions > worst.size()) {
+		worst_sessions = worst.size();
+	}
+	for (size_t i=0; i<worst_sessions; i++) {
+		const fleet_session_stats_t& s = sessions[worst[i]]->stats;
+		fprintf(out, "  session %-6zu lag avg %.3f ms max %.3f ms, parked %llu ms, host %.1f ms\n",
+			worst[i], s.slices ? s.total_lag_ms / s.slices : 0, s.max_lag_ms,
+			(unsigned long long)s.parked_ms, s.host_ms);
+	}
+}
+
+}
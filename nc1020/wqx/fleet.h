@@ -0,0 +1,119 @@
+#ifndef FLEET_H_
+#define FLEET_H_
+
+#include "nc1020.h"
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+namespace wqx {
+
+class WorkPool;
+class StatsPage;
+
+typedef struct {
+	uint64_t time_ms;
+	uint8_t key_id;
+	bool down_or_up;
+} key_event_t;
+
+// input script, one event per line: "<time_ms> <key_id> <down|up>".
+// key_id accepts hex with a 0x prefix, '#' starts a comment. path "-" reads
+// stdin.
+extern bool LoadKeyScript(const std::string& path, std::vector<key_event_t>& events);
+
+typedef struct {
+	size_t threads;
+	size_t slice_ms;
+	uint64_t duration_ms;
+	bool realtime;
+	bool park_slept;
+	// follow key to pixel latency in every session, see SetLatencyTracking.
+	bool latency;
+} fleet_options_t;
+
+typedef struct {
+	uint64_t emulated_ms;
+	uint64_t parked_ms;
+	uint64_t slices;
+	bool parked;
+	// how late a slice finished against its real-time deadline.
+	double last_lag_ms;
+	double max_lag_ms;
+	double total_lag_ms;
+	// host time spent inside RunTimeSlice.
+	double host_ms;
+} fleet_session_stats_t;
+
+typedef struct {
+	size_t sessions;
+	size_t threads;
+	uint64_t ticks;
+	uint64_t emulated_cycles;
+	uint64_t session_slices;
+	uint64_t parked_slices;
+	double wall_seconds;
+	double emulated_mhz;
+} fleet_stats_t;
+
+/**
+ * Fleet
+ * many independent machines sharing one rom image, advanced one time slice
+ * per tick on a work stealing pool. with park_slept the machines run in low
+ * power mode (see SetLowPower), and sessions whose machine is parked have
+ * their slice skipped in constant time on the calling thread: the timers
+ * and the rtc still move on, so an alarm wakes them as it would a full run.
+ */
+class Fleet {
+public:
+	Fleet(const std::string& rom_path, const fleet_options_t& options);
+	~Fleet();
+
+	bool IsRomLoaded() const { return rom_image != NULL; }
+
+	size_t AddSession(const std::string& nor_path,
+		const std::string& states_path, const std::vector<key_event_t>& script);
+	size_t Sessions() const { return sessions.size(); }
+	Machine* GetMachine(size_t index) { return sessions[index]->machine; }
+
+	// publishes every session's stats after each of its slices, in the
+	// order they were added. call after adding the sessions.
+	void SetStatsPage(StatsPage* page);
+	// run every session for options.duration_ms of timeline.
+	void Run();
+	void SaveAll();
+
+	const fleet_stats_t& Stats() const { return stats; }
+	const fleet_session_stats_t& SessionStats(size_t index) const {
+		return sessions[index]->stats;
+	}
+	void PrintReport(FILE* out, size_t worst_sessions) const;
+
+private:
+	struct Session {
+		Machine* machine;
+		double deadline;
+		fleet_session_stats_t stats;
+		int stats_slot;
+	};
+
+	static void RunSession(void* context, size_t index);
+	void PrintLatency(FILE* out) const;
+
+	fleet_options_t options;
+	uint8_t* rom_image;
+	std::string rom_path;
+	std::vector<Session*> sessions;
+	std::vector<size_t> order;
+	WorkPool* pool;
+	StatsPage* stats_page;
+	double start_time;
+	fleet_stats_t stats;
+
+	Fleet(const Fleet&);
+	Fleet& operator=(const Fleet&);
+};
+
+}
+
+#endif /* FLEET_H_ */
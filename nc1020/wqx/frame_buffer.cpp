@@ -0,0 +1,70 @@
+#include "frame_buffer.h"
+#include <string.h>
+
+namespace wqx {
+
+const size_t FrameBuffer::FRAME_SIZE;
+
+FrameBuffer::FrameBuffer() :
+	newest(0),
+	sequence(0),
+	next(0) {
+	for (size_t i=0; i<3; i++) {
+		slots[i].version.store(0, std::memory_order_relaxed);
+		slots[i].sequence.store(0, std::memory_order_relaxed);
+		slots[i].cycle.store(0, std::memory_order_relaxed);
+		for (size_t j=0; j<FRAME_WORDS; j++) {
+			slots[i].words[j].store(0, std::memory_order_relaxed);
+		}
+	}
+}
+
+void FrameBuffer::Publish(const uint8_t* frame, uint64_t cycle){
+	uint64_t published = sequence.load(std::memory_order_relaxed) + 1;
+	// never the newest slot, readers of it have two frames' time to finish.
+	next = (next + 1) % 3;
+	Slot& slot = slots[next];
+	uint64_t version = slot.version.load(std::memory_order_relaxed);
+	slot.version.store(version + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	for (size_t i=0; i<FRAME_WORDS; i++) {
+		uint64_t word;
+		memcpy(&word, frame + i * 8, 8);
+		slot.words[i].store(word, std::memory_order_relaxed);
+	}
+	slot.sequence.store(published, std::memory_order_relaxed);
+	slot.cycle.store(cycle, std::memory_order_relaxed);
+	slot.version.store(version + 2, std::memory_order_release);
+	newest.store(next, std::memory_order_release);
+	sequence.store(published, std::memory_order_release);
+}
+
+bool FrameBuffer::Latest(uint8_t* frame, uint64_t* sequence, uint64_t* cycle) const {
+	for (;;) {
+		const Slot& slot = slots[newest.load(std::memory_order_acquire)];
+		uint64_t version = slot.version.load(std::memory_order_acquire);
+		if (version & 1) {
+			continue;
+		}
+		uint64_t published = slot.sequence.load(std::memory_order_relaxed);
+		if (published == 0 || published <= *sequence) {
+			return false;
+		}
+		for (size_t i=0; i<FRAME_WORDS; i++) {
+			uint64_t word = slot.words[i].load(std::memory_order_relaxed);
+			memcpy(frame + i * 8, &word, 8);
+		}
+		uint64_t shown = slot.cycle.load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (slot.version.load(std::memory_order_relaxed) != version) {
+			continue;
+		}
+		*sequence = published;
+		if (cycle) {
+			*cycle = shown;
+		}
+		return true;
+	}
+}
+
+}
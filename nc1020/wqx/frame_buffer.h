@@ -0,0 +1,59 @@
+#ifndef FRAME_BUFFER_H_
+#define FRAME_BUFFER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+namespace wqx {
+
+/**
+ * FrameBuffer
+ * lock free hand off of finished lcd frames from the emulation thread to
+ * any number of readers. the writer rotates over three slots, so the slot
+ * being written is never the newest one, and never blocks. every slot
+ * carries a version that is odd while it is written; a reader copies the
+ * newest slot and keeps the copy only if the version did not move. its
+ * slot is written again by the third publish after it, so the copy fails
+ * only when two more frames were published and a third was begun during it.
+ *
+ * frame words are atomics so the concurrent copy is well defined.
+ */
+class FrameBuffer {
+public:
+	static const size_t FRAME_SIZE = 1600;
+
+	FrameBuffer();
+
+	// writer side, one thread.
+	void Publish(const uint8_t* frame, uint64_t cycle);
+
+	// copies the newest frame when it is newer than *sequence and updates
+	// *sequence (start from 0), false when there is nothing newer. cycle may
+	// be NULL.
+	bool Latest(uint8_t* frame, uint64_t* sequence, uint64_t* cycle) const;
+	uint64_t Sequence() const { return sequence.load(std::memory_order_acquire); }
+
+private:
+	static const size_t FRAME_WORDS = FRAME_SIZE / 8;
+
+	struct Slot {
+		std::atomic<uint64_t> version;
+		std::atomic<uint64_t> sequence;
+		std::atomic<uint64_t> cycle;
+		std::atomic<uint64_t> words[FRAME_WORDS];
+	};
+
+	Slot slots[3];
+	std::atomic<uint32_t> newest;
+	std::atomic<uint64_t> sequence;
+	// writer only.
+	uint32_t next;
+
+	FrameBuffer(const FrameBuffer&);
+	FrameBuffer& operator=(const FrameBuffer&);
+};
+
+}
+
+#endif /* FRAME_BUFFER_H_ */
@@ -0,0 +1,492 @@
+#include "frame_recorder.h"
+#include "lcd_render.h"
+#include "nc1020_machine.h"
+#include <string.h>
+
+namespace wqx {
+    using std::string;
+    using std::vector;
+
+static const char FRAME_MAGIC[8] = {'W', 'Q', 'X', 'F', 'R', 'A', 'M', 'E'};
+static const uint32_t FRAME_VERSION = 1;
+static const size_t HEADER_SIZE = 16;
+
+static void AppendVarint(vector<uint8_t>& out, uint64_t value){
+	while (value >= 0x80) {
+		out.push_back((uint8_t)(value | 0x80));
+		value >>= 7;
+	}
+	out.push_back((uint8_t)value);
+}
+
+static bool GetVarint(const uint8_t* data, size_t size, size_t& pos, uint64_t& value){
+	value = 0;
+	for (size_t shift=0; shift<64 && pos<size; shift+=7) {
+		uint8_t byte = data[pos++];
+		value |= (uint64_t)(byte & 0x7F) << shift;
+		if (!(byte & 0x80)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool ReadVarint(FILE* file, uint64_t& value){
+	value = 0;
+	for (size_t shift=0; shift<64; shift+=7) {
+		int byte = fgetc(file);
+		if (byte == EOF) {
+			return false;
+		}
+		value |= (uint64_t)(byte & 0x7F) << shift;
+		if (!(byte & 0x80)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// data xor base (zeros when base is NULL) as equal / literal runs.
+static void PackRuns(const uint8_t* base, const uint8_t* data, size_t size,
+	vector<uint8_t>& out){
+	out.clear();
+	size_t i = 0;
+	while (i < size) {
+		size_t same = 0;
+		while (i + same < size && data[i + same] == (base ? base[i + same] : 0)) {
+			same++;
+		}
+		i += same;
+		size_t literal = 0;
+		// a literal run ends at two equal bytes, one costs less inline.
+		while (i + literal < size) {
+			size_t at = i + literal;
+			bool equal = data[at] == (base ? base[at] : 0);
+			bool next_equal = at + 1 >= size || data[at + 1] == (base ? base[at + 1] : 0);
+			if (equal && next_equal) {
+				break;
+			}
+			literal++;
+		}
+		AppendVarint(out, same);
+		AppendVarint(out, literal);
+		for (size_t j=0; j<literal; j++) {
+			out.push_back(data[i + j] ^ (base ? base[i + j] : 0));
+		}
+		i += literal;
+	}
+}
+
+static bool UnpackRuns(const uint8_t* packed, size_t packed_size, uint8_t* data, size_t size){
+	size_t i = 0;
+	size_t pos = 0;
+	while (pos < packed_size) {
+		uint64_t same;
+		uint64_t literal;
+		if (!GetVarint(packed, packed_size, pos, same) ||
+			!GetVarint(packed, packed_size, pos, literal) ||
+			same > size - i || literal > size - i - same ||
+			literal > packed_size - pos) {
+			return false;
+		}
+		i += same;
+		for (size_t j=0; j<literal; j++) {
+			data[i + j] ^= packed[pos + j];
+		}
+		i += literal;
+		pos += literal;
+	}
+	return true;
+}
+
+FrameRecorder::FrameRecorder() :
+	machine(NULL),
+	file(NULL),
+	failed(false),
+	keyframe_cycles(0),
+	next_keyframe(0),
+	last_cycle(0),
+	frames(0),
+	bytes(0),
+	has_frame(false) {
+}
+
+FrameRecorder::~FrameRecorder() {
+	Stop();
+}
+
+bool FrameRecorder::Start(Machine* machine, const string& path, size_t keyframe_ms){
+	Stop();
+	file = fopen(path.c_str(), "wb");
+	if (file == NULL) {
+		return false;
+	}
+	failed = false;
+	uint8_t header[HEADER_SIZE];
+	memcpy(header, FRAME_MAGIC, 8);
+	for (size_t i=0; i<4; i++) {
+		header[8 + i] = (uint8_t)(FRAME_VERSION >> (i * 8));
+	}
+	header[12] = (uint8_t)LCD_WIDTH;
+	header[13] = (uint8_t)(LCD_WIDTH >> 8);
+	header[14] = (uint8_t)LCD_HEIGHT;
+	header[15] = (uint8_t)(LCD_HEIGHT >> 8);
+	if (!Write(header, sizeof(header))) {
+		fclose(file);
+		file = NULL;
+		return false;
+	}
+
+	this->machine = machine;
+	keyframe_cycles = (uint64_t)(keyframe_ms ? keyframe_ms : 60000) * CYCLES_MS;
+	next_keyframe = 0;
+	last_cycle = 0;
+	frames = 0;
+	bytes = sizeof(header);
+	has_frame = false;
+	uint8_t frame[LCD_SIZE];
+	if (CopyLcdBuffer(machine, frame)) {
+		WriteFrame(GetCycleCount(machine), frame);
+	}
+	SetFrameListener(machine, &FrameRecorder::OnFrame, this);
+	return true;
+}
+
+void FrameRecorder::OnFrame(void* context, uint64_t cycle, const uint8_t* frame){
+	((FrameRecorder*)context)->WriteFrame(cycle, frame);
+}
+
+bool FrameRecorder::Write(const void* data, size_t size){
+	if (!failed && fwrite(data, 1, size, file) != size) {
+		failed = true;
+	}
+	return !failed;
+}
+
+void FrameRecorder::WriteFrame(uint64_t cycle, const uint8_t* frame){
+	if (failed) {
+		return;
+	}
+	bool key = !has_frame || cycle >= next_keyframe;
+	if (!key && memcmp(frame, previous, LCD_SIZE) == 0) {
+		return;
+	}
+	if (key) {
+		next_keyframe = cycle + keyframe_cycles;
+	}
+	PackRuns(key ? NULL : previous, frame, LCD_SIZE, packed);
+	record_header.clear();
+	record_header.push_back(key ? 'K' : 'D');
+	AppendVarint(record_header, cycle - last_cycle);
+	AppendVarint(record_header, packed.size());
+	// a failed write shows in Stop.
+	if (!Write(&record_header[0], record_header.size()) ||
+		(!packed.empty() && !Write(&packed[0], packed.size()))) {
+		return;
+	}
+	bytes += record_header.size() + packed.size();
+	frames++;
+	last_cycle = cycle;
+	memcpy(previous, frame, LCD_SIZE);
+	has_frame = true;
+}
+
+bool FrameRecorder::Stop(){
+	if (file == NULL) {
+		return !failed;
+	}
+	SetFrameListener(machine, NULL, NULL);
+	if (fclose(file) != 0) {
+		failed = true;
+	}
+	file = NULL;
+	machine = NULL;
+	return !failed;
+}
+
+FrameReader::FrameReader() :
+	file(NULL),
+	last_cycle(0) {
+	memset(current, 0, sizeof(current));
+}
+
+FrameReader::~FrameReader() {
+	Close();
+}
+
+bool FrameReader::Open(const string& path){
+	Close();
+	file = fopen(path.c_str(), "rb");
+	if (file == NULL) {
+		return false;
+	}
+	uint8_t header[HEADER_SIZE];
+	if (fread(header, 1, sizeof(header), file) != sizeof(header) ||
+		memcmp(header, FRAME_MAGIC, 8) != 0 || header[8] != FRAME_VERSION ||
+		(header[12] | header[13] << 8) != LCD_WIDTH ||
+		(header[14] | header[15] << 8) != LCD_HEIGHT) {
+		Close();
+		return false;
+	}
+	last_cycle = 0;
+	memset(current, 0, sizeof(current));
+	return true;
+}
+
+void FrameReader::Close(){
+	if (file) {
+		fclose(file);
+		file = NULL;
+	}
+}
+
+bool FrameReader::Next(uint8_t* frame, uint64_t* cycle){
+	if (file == NULL) {
+		return false;
+	}
+	int type = fgetc(file);
+	uint64_t delta;
+	uint64_t size;
+	if ((type != 'K' && type != 'D') || !ReadVarint(file, delta) ||
+		!ReadVarint(file, size) || size > LCD_SIZE * 3) {
+		return false;
+	}
+	packed.resize((size_t)size);
+	if (size && fread(&packed[0], 1, (size_t)size, file) != size) {
+		return false;
+	}
+	if (type == 'K') {
+		memset(current, 0, sizeof(current));
+	}
+	if (!UnpackRuns(size ? &packed[0] : NULL, (size_t)size, current, LCD_SIZE)) {
+		return false;
+	}
+	last_cycle += delta;
+	memcpy(frame, current, LCD_SIZE);
+	*cycle = last_cycle;
+	return true;
+}
+
+bool ExportY4m(const string& capture, const string& path, size_t fps, size_t scale){
+	FrameReader reader;
+	if (fps == 0 || !reader.Open(capture)) {
+		return false;
+	}
+	uint8_t frame[LCD_SIZE];
+	uint8_t next[LCD_SIZE];
+	uint64_t cycle;
+	uint64_t next_cycle;
+	if (!reader.Next(frame, &cycle)) {
+		return false;
+	}
+	FILE* file = fopen(path.c_str(), "wb");
+	if (file == NULL) {
+		return false;
+	}
+	lcd_render_options_t options;
+	options.format = LCD_FORMAT_GRAY8;
+	options.scale = scale;
+	options.off_color = 0xFF;
+	options.on_color = 0x00;
+	size_t width = LcdRenderWidth(options);
+	size_t height = LcdRenderHeight(options);
+	vector<uint8_t> pixels(width * height);
+	RenderLcd(frame, NULL, options, &pixels[0], width);
+	bool written = fprintf(file, "YUV4MPEG2 W%zu H%zu F%zu:1 Ip A1:1 Cmono\n",
+		width, height, fps) > 0;
+
+	uint64_t start = cycle;
+	bool has_next = reader.Next(next, &next_cycle);
+	for (uint64_t i=0; written; i++) {
+		uint64_t time = start + i * CYCLES_SECOND / fps;
+		bool changed = false;
+		while (has_next && next_cycle <= time) {
+			memcpy(frame, next, LCD_SIZE);
+			changed = true;
+			has_next = reader.Next(next, &next_cycle);
+		}
+		if (changed) {
+			RenderLcd(frame, NULL, options, &pixels[0], width);
+		}
+		written = fputs("FRAME\n", file) != EOF &&
+			fwrite(&pixels[0], 1, pixels.size(), file) == pixels.size();
+		if (!has_next) {
+			break;
+		}
+	}
+	if (fclose(file) != 0) {
+		written = false;
+	}
+	return written;
+}
+
+static uint32_t Crc32(uint32_t crc, const uint8_t* data, size_t size){
+	struct Table {
+		uint32_t entries[256];
+	};
+	// built once, thread safe as a local static.
+	static const Table table = []() {
+		Table table;
+		for (uint32_t i=0; i<256; i++) {
+			uint32_t c = i;
+			for (size_t k=0; k<8; k++) {
+				c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+			}
+			table.entries[i] = c;
+		}
+		return table;
+	}();
+	crc = ~crc;
+	for (size_t i=0; i<size; i++) {
+		crc = table.entries[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+static void PutBE32(uint8_t* p, uint32_t value){
+	p[0] = (uint8_t)(value >> 24);
+	p[1] = (uint8_t)(value >> 16);
+	p[2] = (uint8_t)(value >> 8);
+	p[3] = (uint8_t)value;
+}
+
+static void PutBE16(uint8_t* p, uint16_t value){
+	p[0] = (uint8_t)(value >> 8);
+	p[1] = (uint8_t)value;
+}
+
+static bool WritePngChunk(FILE* file, const char* type, const uint8_t* data, size_t size){
+	uint8_t head[8];
+	PutBE32(head, (uint32_t)size);
+	memcpy(head + 4, type, 4);
+	uint32_t crc = Crc32(0, head + 4, 4);
+	crc = Crc32(crc, data, size);
+	uint8_t tail[4];
+	PutBE32(tail, crc);
+	return fwrite(head, 1, sizeof(head), file) == sizeof(head) &&
+		(size == 0 || fwrite(data, 1, size, file) == size) &&
+		fwrite(tail, 1, sizeof(tail), file) == sizeof(tail);
+}
+
+// one frame as a zlib stream of a single stored block: rows of a filter
+// byte and 20 bytes of 1 bit gray, white for pixels off.
+static void ZlibFrame(const uint8_t* frame, vector<uint8_t>& out){
+	const size_t raw_size = LCD_HEIGHT * (LCD_ROW_BYTES + 1);
+	size_t start = out.size();
+	out.resize(start + 2 + 5 + raw_size + 4);
+	uint8_t* p = &out[start];
+	p[0] = 0x78;
+	p[1] = 0x01;
+	p[2] = 0x01;
+	p[3] = (uint8_t)raw_size;
+	p[4] = (uint8_t)(raw_size >> 8);
+	p[5] = (uint8_t)~raw_size;
+	p[6] = (uint8_t)(~raw_size >> 8);
+	uint8_t* raw = p + 7;
+	for (size_t row=0; row<LCD_HEIGHT; row++) {
+		uint8_t* line = raw + row * (LCD_ROW_BYTES + 1);
+		line[0] = 0;
+		for (size_t i=0; i<LCD_ROW_BYTES; i++) {
+			line[1 + i] = (uint8_t)~frame[row * LCD_ROW_BYTES + i];
+		}
+		line[1] |= 0x80;
+	}
+	uint32_t a = 1;
+	uint32_t b = 0;
+	for (size_t i=0; i<raw_size; i++) {
+		a = (a + raw[i]) % 65521;
+		b = (b + a) % 65521;
+	}
+	PutBE32(raw + raw_size, (b << 16) | a);
+}
+
+static bool WriteFrameControl(FILE* file, uint32_t sequence, uint64_t shown_cycles){
+	uint8_t fctl[26];
+	PutBE32(fctl, sequence);
+	PutBE32(fctl + 4, (uint32_t)LCD_WIDTH);
+	PutBE32(fctl + 8, (uint32_t)LCD_HEIGHT);
+	PutBE32(fctl + 12, 0);
+	PutBE32(fctl + 16, 0);
+	uint64_t ms = shown_cycles / CYCLES_MS;
+	if (ms <= 0xFFFF) {
+		PutBE16(fctl + 20, (uint16_t)ms);
+		PutBE16(fctl + 22, 1000);
+	} else {
+		uint64_t seconds = ms / 1000;
+		PutBE16(fctl + 20, (uint16_t)(seconds > 0xFFFF ? 0xFFFF : seconds));
+		PutBE16(fctl + 22, 1);
+	}
+	fctl[24] = 0;
+	fctl[25] = 0;
+	return WritePngChunk(file, "fcTL", fctl, sizeof(fctl));
+}
+
+bool ExportApng(const string& capture, const string& path){
+	FrameReader reader;
+	if (!reader.Open(capture)) {
+		return false;
+	}
+	uint8_t frame[LCD_SIZE];
+	uint8_t next[LCD_SIZE];
+	uint64_t cycle;
+	uint64_t next_cycle;
+	if (!reader.Next(frame, &cycle)) {
+		return false;
+	}
+	FILE* file = fopen(path.c_str(), "wb");
+	if (file == NULL) {
+		return false;
+	}
+	static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+	bool written = fwrite(signature, 1, sizeof(signature), file) == sizeof(signature);
+	uint8_t ihdr[13];
+	PutBE32(ihdr, (uint32_t)LCD_WIDTH);
+	PutBE32(ihdr + 4, (uint32_t)LCD_HEIGHT);
+	ihdr[8] = 1;
+	ihdr[9] = 0;
+	ihdr[10] = 0;
+	ihdr[11] = 0;
+	ihdr[12] = 0;
+	written = written && WritePngChunk(file, "IHDR", ihdr, sizeof(ihdr));
+	// the frame count is patched in once it is known.
+	long actl_offset = ftell(file);
+	uint8_t actl[8] = {0};
+	written = written && actl_offset >= 0 && WritePngChunk(file, "acTL", actl, sizeof(actl));
+
+	uint32_t sequence = 0;
+	uint32_t count = 0;
+	vector<uint8_t> data;
+	bool has_next = reader.Next(next, &next_cycle);
+	while (written) {
+		written = WriteFrameControl(file, sequence++,
+			has_next ? next_cycle - cycle : CYCLES_SECOND);
+		data.clear();
+		if (count == 0) {
+			ZlibFrame(frame, data);
+			written = written && WritePngChunk(file, "IDAT", &data[0], data.size());
+		} else {
+			data.resize(4);
+			PutBE32(&data[0], sequence++);
+			ZlibFrame(frame, data);
+			written = written && WritePngChunk(file, "fdAT", &data[0], data.size());
+		}
+		count++;
+		if (!has_next) {
+			break;
+		}
+		memcpy(frame, next, LCD_SIZE);
+		cycle = next_cycle;
+		has_next = reader.Next(next, &next_cycle);
+	}
+	written = written && WritePngChunk(file, "IEND", NULL, 0);
+
+	PutBE32(actl, count);
+	written = written && fseek(file, actl_offset, SEEK_SET) == 0 &&
+		WritePngChunk(file, "acTL", actl, sizeof(actl));
+	if (fclose(file) != 0) {
+		written = false;
+	}
+	return written;
+}
+
+}
@@ -0,0 +1,89 @@
+#ifndef FRAME_RECORDER_H_
+#define FRAME_RECORDER_H_
+
+#include "nc1020.h"
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+namespace wqx {
+
+/**
+ * lcd captures
+ * FrameRecorder listens to the frames a machine produces and stores each one
+ * that differs from the last as the xor against it, zero run coded, with the
+ * emulated cycle it was shown at. every keyframe_ms of emulated time a full
+ * frame is stored instead so a damaged capture can be read from the next
+ * one. an idle screen costs nothing and a blinking cursor a few bytes per
+ * change, a day of a session fits in a few MB.
+ *
+ * file layout:
+ *   "WQXFRAME", u32 version, u16 width, u16 height (little endian)
+ *   records of u8 type ('K' full frame, 'D' delta), varint cycles since the
+ *   previous record (the first is absolute), varint payload size, payload
+ *   of (varint equal bytes, varint literal bytes, literals) runs of the
+ *   frame xor the previous one ('K' against zeros).
+ */
+class FrameRecorder {
+public:
+	FrameRecorder();
+	~FrameRecorder();
+
+	bool Start(Machine* machine, const std::string& path, size_t keyframe_ms);
+	// false when any write failed, or closing the file did. frames after a
+	// failed write are dropped, the capture reads up to the last whole one.
+	bool Stop();
+	bool IsRecording() const { return file != NULL; }
+	bool Failed() const { return failed; }
+
+	uint64_t Frames() const { return frames; }
+	uint64_t Bytes() const { return bytes; }
+
+private:
+	static void OnFrame(void* context, uint64_t cycle, const uint8_t* frame);
+	void WriteFrame(uint64_t cycle, const uint8_t* frame);
+	bool Write(const void* data, size_t size);
+
+	Machine* machine;
+	FILE* file;
+	bool failed;
+	uint64_t keyframe_cycles;
+	uint64_t next_keyframe;
+	uint64_t last_cycle;
+	uint64_t frames;
+	uint64_t bytes;
+	bool has_frame;
+	uint8_t previous[1600];
+	std::vector<uint8_t> record_header;
+	std::vector<uint8_t> packed;
+};
+
+class FrameReader {
+public:
+	FrameReader();
+	~FrameReader();
+
+	bool Open(const std::string& path);
+	void Close();
+	// the next frame and the cycle it was shown at, false at the end.
+	bool Next(uint8_t* frame, uint64_t* cycle);
+
+private:
+	FILE* file;
+	uint64_t last_cycle;
+	uint8_t current[1600];
+	std::vector<uint8_t> packed;
+};
+
+// constant rate gray video ("C mono"), each output frame shows the capture
+// frame current at its time. false when the capture cannot be read or a
+// write fails.
+extern bool ExportY4m(const std::string& capture, const std::string& path,
+	size_t fps, size_t scale);
+// animated png, 1 bit gray, every frame shown as long as it was on screen.
+// uses stored deflate blocks so it needs no zlib. false as ExportY4m.
+extern bool ExportApng(const std::string& capture, const std::string& path);
+
+}
+
+#endif /* FRAME_RECORDER_H_ */
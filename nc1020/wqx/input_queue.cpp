@@ -0,0 +1,38 @@
+#include "input_queue.h"
+
+namespace wqx {
+
+const size_t InputQueue::CAPACITY;
+const size_t InputQueue::RELEASE_SLOTS;
+
+InputQueue::InputQueue() :
+	head(0),
+	tail(0) {
+}
+
+bool InputQueue::Push(const key_input_t& input){
+	size_t pushed = tail.load(std::memory_order_relaxed);
+	size_t limit = input.down_or_up ? CAPACITY - RELEASE_SLOTS : CAPACITY;
+	if (pushed - head.load(std::memory_order_acquire) >= limit) {
+		return false;
+	}
+	items[pushed % CAPACITY] = input;
+	tail.store(pushed + 1, std::memory_order_release);
+	return true;
+}
+
+bool InputQueue::Pop(key_input_t* input){
+	size_t popped = head.load(std::memory_order_relaxed);
+	if (popped == tail.load(std::memory_order_acquire)) {
+		return false;
+	}
+	*input = items[popped % CAPACITY];
+	head.store(popped + 1, std::memory_order_release);
+	return true;
+}
+
+bool InputQueue::Empty() const {
+	return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+}
+
+}
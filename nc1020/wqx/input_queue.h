@@ -0,0 +1,66 @@
+#ifndef INPUT_QUEUE_H_
+#define INPUT_QUEUE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+namespace wqx {
+
+typedef struct {
+	uint64_t cycle;
+	// steady clock ns of the SetKey call, 0 for scheduled keys.
+	uint64_t host_ns;
+	uint8_t key_id;
+	bool down_or_up;
+} key_input_t;
+
+/**
+ * InputQueue
+ * wait free single producer single consumer ring of keys, from the thread
+ * calling SetKey to the thread running the machine. each side owns one
+ * index and only reads the other, neither ever waits or retries. the
+ * consumer polls it at the start of a slice and between the chunks of at
+ * most CYCLES_INPUT_POLL cycles RunCycles runs, so an empty queue costs
+ * one load per chunk.
+ *
+ * the last RELEASE_SLOTS slots take key releases only: a press is dropped
+ * before the release of a key already down could be, which would leave it
+ * held.
+ *
+ * one producer at a time; handing the producer role to another thread
+ * needs the usual happens before (a join, a lock) between the two.
+ */
+class InputQueue {
+public:
+	// far more keys than a person or a script presses between two polls.
+	static const size_t CAPACITY = 256;
+	// one for every key of the keypad matrix.
+	static const size_t RELEASE_SLOTS = 64;
+
+	InputQueue();
+
+	// producer side. false when the queue is full, the key is dropped; for
+	// a press, when no more than RELEASE_SLOTS are free.
+	bool Push(const key_input_t& input);
+	// consumer side. false when the queue is empty.
+	bool Pop(key_input_t* input);
+	bool Empty() const;
+
+private:
+	key_input_t items[CAPACITY];
+	// next slot to pop, written by the consumer only.
+	std::atomic<size_t> head;
+	// keeps the two indices off each other's cache line. not alignas, a
+	// Machine is allocated with plain new.
+	char padding[64];
+	// next slot to push, written by the producer only.
+	std::atomic<size_t> tail;
+
+	InputQueue(const InputQueue&);
+	InputQueue& operator=(const InputQueue&);
+};
+
+}
+
+#endif /* INPUT_QUEUE_H_ */
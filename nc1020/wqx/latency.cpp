@@ -0,0 +1,167 @@
+#include "nc1020.h"
+#include "nc1020_machine.h"
+#include <string.h>
+
+namespace wqx {
+
+// key presses followed at once for SetLatencyTracking, more count as
+// unanswered.
+static const size_t LATENCY_PROBES = 64;
+
+uint64_t Machine::HostNanos(){
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Machine::ProbeKey(bool down_or_up, uint64_t host_ns) {
+	if (!latency_tracking || speculating || !down_or_up) {
+		return;
+	}
+	if (latency_probes.size() >= LATENCY_PROBES) {
+		latency_probes.pop_front();
+		latency_stats.keys++;
+		latency_stats.unanswered++;
+	}
+	latency_probe_t probe;
+	probe.cycle = GetCycleCount();
+	probe.host_ns = host_ns;
+	probe.lcd_cycle = 0;
+	probe.shown_ns = 0;
+	latency_probes.push_back(probe);
+	probing = true;
+}
+
+void Machine::LcdWritten() {
+	// with no lcd set up the window is the zero page.
+	if (!lcd_addr) {
+		return;
+	}
+	if (speculating) {
+		ahead_written = true;
+		return;
+	}
+	for (size_t i=0; i<latency_probes.size(); i++) {
+		if (!latency_probes[i].lcd_cycle) {
+			latency_probes[i].lcd_cycle = GetCycleCount();
+		}
+	}
+	probing = false;
+}
+
+static void AddLatency(latency_histogram_t& histogram, double ms){
+	size_t bucket = ms < LATENCY_BUCKETS - 1 ? (size_t)ms : LATENCY_BUCKETS - 1;
+	histogram.buckets[bucket]++;
+	histogram.count++;
+	histogram.total_ms += ms;
+	if (ms > histogram.max_ms) {
+		histogram.max_ms = ms;
+	}
+}
+
+void Machine::FinishProbes() {
+	uint64_t now = HostNanos();
+	while (!latency_probes.empty()) {
+		const latency_probe_t& probe = latency_probes.front();
+		if (probe.lcd_cycle) {
+			uint64_t shown = probe.shown_ns ? probe.shown_ns : now;
+			AddLatency(latency_stats.emulated,
+				(double)(probe.lcd_cycle - probe.cycle) / CYCLES_MS);
+			AddLatency(latency_stats.host,
+				shown > probe.host_ns ? (shown - probe.host_ns) / 1e6 : 0);
+		} else if (GetCycleCount() - probe.cycle >= LATENCY_TIMEOUT_MS * CYCLES_MS) {
+			latency_stats.unanswered++;
+			probing = latency_probes.size() > 1;
+		} else {
+			break;
+		}
+		latency_stats.keys++;
+		latency_probes.pop_front();
+	}
+}
+
+void SetLatencyTracking(Machine* machine, bool tracking){
+	machine->latency_tracking = tracking;
+	if (!tracking) {
+		machine->latency_probes.clear();
+		machine->probing = false;
+	}
+}
+
+void GetLatencyStats(Machine* machine, latency_stats_t* stats){
+	*stats = machine->latency_stats;
+}
+
+void ResetLatencyStats(Machine* machine){
+	memset(&machine->latency_stats, 0, sizeof(machine->latency_stats));
+}
+
+static void MergeHistogram(latency_histogram_t& into, const latency_histogram_t& from){
+	for (size_t i=0; i<LATENCY_BUCKETS; i++) {
+		into.buckets[i] += from.buckets[i];
+	}
+	into.count += from.count;
+	into.total_ms += from.total_ms;
+	if (from.max_ms > into.max_ms) {
+		into.max_ms = from.max_ms;
+	}
+}
+
+void MergeLatencyStats(latency_stats_t* into, const latency_stats_t* from){
+	into->keys += from->keys;
+	into->unanswered += from->unanswered;
+	MergeHistogram(into->emulated, from->emulated);
+	MergeHistogram(into->host, from->host);
+}
+
+double LatencyPercentile(const latency_histogram_t* histogram, double fraction){
+	if (histogram->count == 0) {
+		return 0;
+	}
+	uint64_t rank = (uint64_t)(fraction * histogram->count);
+	if (rank >= histogram->count) {
+		rank = histogram->count - 1;
+	}
+	uint64_t seen = 0;
+	for (size_t i=0; i<LATENCY_BUCKETS - 1; i++) {
+		seen += histogram->buckets[i];
+		if (seen > rank) {
+			return i + 1 < histogram->max_ms ? (double)(i + 1) : histogram->max_ms;
+		}
+	}
+	return histogram->max_ms;
+}
+
+static void PrintHistogram(FILE* out, const char* name, const latency_histogram_t& histogram){
+	fprintf(out, "  %-13s p50 %.1f ms, p90 %.1f ms, p99 %.1f ms, max %.3f ms, avg %.3f ms\n",
+		name, LatencyPercentile(&histogram, 0.5), LatencyPercentile(&histogram, 0.9),
+		LatencyPercentile(&histogram, 0.99), histogram.max_ms,
+		histogram.count ? histogram.total_ms / histogram.count : 0);
+}
+
+void PrintLatencyStats(FILE* out, const latency_stats_t* stats){
+	fprintf(out, "key latency     %llu presses, %llu unanswered\n",
+		(unsigned long long)stats->keys, (unsigned long long)stats->unanswered);
+	if (stats->emulated.count == 0) {
+		return;
+	}
+	PrintHistogram(out, "emulated", stats->emulated);
+	PrintHistogram(out, "host", stats->host);
+	// the emulated histogram in 10 ms steps.
+	for (size_t from=0; from<LATENCY_BUCKETS; from+=10) {
+		size_t to = from + 10 < LATENCY_BUCKETS ? from + 10 : LATENCY_BUCKETS;
+		uint64_t count = 0;
+		for (size_t i=from; i<to; i++) {
+			count += stats->emulated.buckets[i];
+		}
+		if (count == 0) {
+			continue;
+		}
+		if (to == LATENCY_BUCKETS) {
+			fprintf(out, "  %3zu+ ms       %llu\n", from, (unsigned long long)count);
+		} else {
+			fprintf(out, "  %3zu-%-3zu ms    %llu\n", from, to, (unsigned long long)count);
+		}
+	}
+}
+
+}
@@ -0,0 +1,225 @@
+#include "lcd_render.h"
+#include "nc1020_machine.h"
+#include <string.h>
+#if !defined(NC1020_NO_SIMD) && defined(__SSE2__)
+#define LCD_RENDER_SSE2
+#include <emmintrin.h>
+#if defined(__AVX2__)
+#define LCD_RENDER_AVX2
+#include <immintrin.h>
+#endif
+#endif
+
+namespace wqx {
+
+static size_t Scale(const lcd_render_options_t& options){
+	return options.scale < 1 ? 1 : (options.scale > 8 ? 8 : options.scale);
+}
+
+size_t LcdRenderWidth(const lcd_render_options_t& options){
+	return LCD_WIDTH * Scale(options);
+}
+
+size_t LcdRenderHeight(const lcd_render_options_t& options){
+	return LCD_HEIGHT * Scale(options);
+}
+
+size_t LcdRenderPixelBytes(const lcd_render_options_t& options){
+	return options.format == LCD_FORMAT_RGBA8888 ? 4 : 1;
+}
+
+#if defined(LCD_RENDER_SSE2) && !defined(LCD_RENDER_AVX2)
+// 16 lcd bytes to 128 pixel masks: each byte is spread over 8 lanes by
+// unpacking it with itself, then every lane tests its own bit.
+static inline void Expand16(const uint8_t* bits, uint8_t* mask){
+	const __m128i bit = _mm_setr_epi8(
+		-128, 64, 32, 16, 8, 4, 2, 1, -128, 64, 32, 16, 8, 4, 2, 1);
+	__m128i v = _mm_loadu_si128((const __m128i*)bits);
+	__m128i lo = _mm_unpacklo_epi8(v, v);
+	__m128i hi = _mm_unpackhi_epi8(v, v);
+	__m128i quads[4] = {
+		_mm_unpacklo_epi16(lo, lo), _mm_unpackhi_epi16(lo, lo),
+		_mm_unpacklo_epi16(hi, hi), _mm_unpackhi_epi16(hi, hi),
+	};
+	for (size_t i=0; i<4; i++) {
+		__m128i a = _mm_unpacklo_epi32(quads[i], quads[i]);
+		__m128i b = _mm_unpackhi_epi32(quads[i], quads[i]);
+		a = _mm_cmpeq_epi8(_mm_and_si128(a, bit), bit);
+		b = _mm_cmpeq_epi8(_mm_and_si128(b, bit), bit);
+		_mm_storeu_si128((__m128i*)(mask + i * 32), a);
+		_mm_storeu_si128((__m128i*)(mask + i * 32 + 16), b);
+	}
+}
+#endif
+
+// one lcd row to LCD_WIDTH bytes, 0xFF for pixels on.
+static void PlainExpandRow(const uint8_t* bits, uint8_t* mask){
+	for (size_t i=0; i<LCD_ROW_BYTES; i++) {
+		for (size_t j=0; j<8; j++) {
+			mask[i * 8 + j] = (bits[i] & (0x80 >> j)) ? 0xFF : 0x00;
+		}
+	}
+}
+
+static void ExpandRow(const uint8_t* bits, uint8_t* mask){
+#if defined(LCD_RENDER_AVX2)
+	const __m256i select = _mm256_setr_epi8(
+		0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+		2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+	const __m256i bit = _mm256_setr_epi8(
+		-128, 64, 32, 16, 8, 4, 2, 1, -128, 64, 32, 16, 8, 4, 2, 1,
+		-128, 64, 32, 16, 8, 4, 2, 1, -128, 64, 32, 16, 8, 4, 2, 1);
+	for (size_t i=0; i<LCD_ROW_BYTES; i+=4) {
+		int32_t word;
+		memcpy(&word, bits + i, 4);
+		__m256i x = _mm256_shuffle_epi8(_mm256_set1_epi32(word), select);
+		x = _mm256_cmpeq_epi8(_mm256_and_si256(x, bit), bit);
+		_mm256_storeu_si256((__m256i*)(mask + i * 8), x);
+	}
+#elif defined(LCD_RENDER_SSE2)
+	// the row is 20 bytes, two overlapping halves cover it.
+	Expand16(bits, mask);
+	Expand16(bits + 4, mask + 32);
+#else
+	PlainExpandRow(bits, mask);
+#endif
+}
+
+#if defined(LCD_RENDER_SSE2)
+// stores v with every byte (gray) or dword (rgba) repeated S times.
+template <size_t S> static inline void StoreGray(__m128i v, uint8_t* out){
+	StoreGray<S / 2>(_mm_unpacklo_epi8(v, v), out);
+	StoreGray<S / 2>(_mm_unpackhi_epi8(v, v), out + 8 * S);
+}
+template <> inline void StoreGray<1>(__m128i v, uint8_t* out){
+	_mm_storeu_si128((__m128i*)out, v);
+}
+
+template <size_t S> static inline void StoreRgba(__m128i v, uint8_t* out){
+	StoreRgba<S / 2>(_mm_unpacklo_epi32(v, v), out);
+	StoreRgba<S / 2>(_mm_unpackhi_epi32(v, v), out + 8 * S);
+}
+template <> inline void StoreRgba<1>(__m128i v, uint8_t* out){
+	_mm_storeu_si128((__m128i*)out, v);
+}
+
+template <size_t S> static void GrayRow(const uint8_t* mask, uint32_t off, uint32_t on,
+	uint8_t* out){
+	const __m128i base = _mm_set1_epi8((char)off);
+	const __m128i diff = _mm_set1_epi8((char)(off ^ on));
+	for (size_t i=0; i<LCD_WIDTH; i+=16) {
+		__m128i m = _mm_loadu_si128((const __m128i*)(mask + i));
+		StoreGray<S>(_mm_xor_si128(base, _mm_and_si128(m, diff)), out + i * S);
+	}
+}
+
+template <size_t S> static void RgbaRow(const uint8_t* mask, uint32_t off, uint32_t on,
+	uint8_t* out){
+	const __m128i base = _mm_set1_epi32((int)off);
+	const __m128i diff = _mm_set1_epi32((int)(off ^ on));
+	for (size_t i=0; i<LCD_WIDTH; i+=16) {
+		__m128i m = _mm_loadu_si128((const __m128i*)(mask + i));
+		__m128i lo = _mm_unpacklo_epi8(m, m);
+		__m128i hi = _mm_unpackhi_epi8(m, m);
+		__m128i quads[4] = {
+			_mm_unpacklo_epi16(lo, lo), _mm_unpackhi_epi16(lo, lo),
+			_mm_unpacklo_epi16(hi, hi), _mm_unpackhi_epi16(hi, hi),
+		};
+		for (size_t j=0; j<4; j++) {
+			__m128i pixels = _mm_xor_si128(base, _mm_and_si128(quads[j], diff));
+			StoreRgba<S>(pixels, out + (i + j * 4) * S * 4);
+		}
+	}
+}
+#endif
+
+// every pixel is written as a full 8 byte (gray) or 32 byte (rgba) run of
+// its color and the next pixel overwrites what lies past its own scale, so
+// any scale up to 8 takes one fixed size copy per pixel; only the pixels at
+// the end of the row are copied at their exact size.
+static void PlainRow(const uint8_t* mask, const lcd_render_options_t& options,
+	size_t scale, uint8_t* out){
+	size_t pixel_bytes = LcdRenderPixelBytes(options);
+	uint8_t runs[2][32];
+	for (size_t i=0; i<32; i+=pixel_bytes) {
+		for (size_t j=0; j<pixel_bytes; j++) {
+			runs[0][i + j] = (uint8_t)(options.off_color >> (j * 8));
+			runs[1][i + j] = (uint8_t)(options.on_color >> (j * 8));
+		}
+	}
+	size_t run = pixel_bytes == 1 ? 8 : 32;
+	size_t step = scale * pixel_bytes;
+	size_t end = LCD_WIDTH * step;
+	size_t i = 0;
+	for (; i * step + run <= end; i++) {
+		memcpy(out + i * step, runs[mask[i] & 1], run);
+	}
+	for (; i<LCD_WIDTH; i++) {
+		memcpy(out + i * step, runs[mask[i] & 1], step);
+	}
+}
+
+static void RenderRow(const uint8_t* mask, const lcd_render_options_t& options,
+	size_t scale, uint8_t* out){
+#if defined(LCD_RENDER_SSE2)
+	uint32_t off = options.off_color;
+	uint32_t on = options.on_color;
+	if (options.format == LCD_FORMAT_GRAY8) {
+		switch (scale) {
+		case 1: GrayRow<1>(mask, off, on, out); return;
+		case 2: GrayRow<2>(mask, off, on, out); return;
+		case 4: GrayRow<4>(mask, off, on, out); return;
+		case 8: GrayRow<8>(mask, off, on, out); return;
+		}
+	} else {
+		switch (scale) {
+		case 1: RgbaRow<1>(mask, off, on, out); return;
+		case 2: RgbaRow<2>(mask, off, on, out); return;
+		case 4: RgbaRow<4>(mask, off, on, out); return;
+		case 8: RgbaRow<8>(mask, off, on, out); return;
+		}
+	}
+#endif
+	PlainRow(mask, options, scale, out);
+}
+
+static void Render(const uint8_t* frame, const uint8_t* dirty_rows,
+	const lcd_render_options_t& options, uint8_t* pixels, size_t stride,
+	bool plain){
+	size_t scale = Scale(options);
+	size_t row_size = LCD_WIDTH * scale * LcdRenderPixelBytes(options);
+	uint8_t mask[LCD_WIDTH];
+	for (size_t row=0; row<LCD_HEIGHT; row++) {
+		if (dirty_rows && !(dirty_rows[row >> 3] & (1 << (row & 7)))) {
+			continue;
+		}
+		uint8_t* out = pixels + row * scale * stride;
+		if (plain) {
+			PlainExpandRow(frame + row * LCD_ROW_BYTES, mask);
+			mask[0] = 0;
+			PlainRow(mask, options, scale, out);
+		} else {
+			ExpandRow(frame + row * LCD_ROW_BYTES, mask);
+			mask[0] = 0;
+			RenderRow(mask, options, scale, out);
+		}
+		for (size_t i=1; i<scale; i++) {
+			memcpy(out + i * stride, out, row_size);
+		}
+	}
+}
+
+void RenderLcd(const uint8_t* frame, const uint8_t* dirty_rows,
+	const lcd_render_options_t& options, uint8_t* pixels, size_t stride){
+#ifdef NC1020_PHASES
+	Phase phase("RenderLcd");
+#endif
+	Render(frame, dirty_rows, options, pixels, stride, false);
+}
+
+void RenderLcdPlain(const uint8_t* frame, const uint8_t* dirty_rows,
+	const lcd_render_options_t& options, uint8_t* pixels, size_t stride){
+	Render(frame, dirty_rows, options, pixels, stride, true);
+}
+
+}
@@ -0,0 +1,49 @@
+#ifndef LCD_RENDER_H_
+#define LCD_RENDER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace wqx {
+
+typedef enum {
+	LCD_FORMAT_GRAY8,
+	LCD_FORMAT_RGBA8888,
+} lcd_format_t;
+
+typedef struct {
+	lcd_format_t format;
+	// integer upscaling, 1 to 8.
+	size_t scale;
+	// pixels off and on: a gray level, or r | g << 8 | b << 16 | a << 24
+	// (bytes r, g, b, a in memory).
+	uint32_t off_color;
+	uint32_t on_color;
+} lcd_render_options_t;
+
+extern size_t LcdRenderWidth(const lcd_render_options_t& options);
+extern size_t LcdRenderHeight(const lcd_render_options_t& options);
+extern size_t LcdRenderPixelBytes(const lcd_render_options_t& options);
+
+/**
+ * RenderLcd
+ * converts a 1600 byte lcd frame (160x80, 1 bit per pixel, msb first) into
+ * LcdRenderWidth x LcdRenderHeight pixels, rows stride bytes apart. the
+ * first column carries no picture and is drawn off, as WQXLCDView always
+ * did. when dirty_rows is not NULL (the bitmap CopyLcdBufferIfChanged
+ * returns) only those lcd rows are converted, the rest of pixels is kept.
+ *
+ * sse2 kernels when the build targets them, avx2 with NC1020_AVX2, plain c
+ * otherwise or with NC1020_NO_SIMD defined.
+ */
+extern void RenderLcd(const uint8_t* frame, const uint8_t* dirty_rows,
+	const lcd_render_options_t& options, uint8_t* pixels, size_t stride);
+
+// RenderLcd through the plain c kernels whatever the build, the reference
+// the simd ones are tested against.
+extern void RenderLcdPlain(const uint8_t* frame, const uint8_t* dirty_rows,
+	const lcd_render_options_t& options, uint8_t* pixels, size_t stride);
+
+}
+
+#endif /* LCD_RENDER_H_ */
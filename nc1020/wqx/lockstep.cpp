@@ -0,0 +1,479 @@
+#include "lockstep.h"
+#include "nc1020_machine.h"
+#include <string.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace wqx {
+
+// instructions each lane runs on its own when no two lanes share a pc.
+static const size_t SCALAR_BURST = 64;
+
+#if defined(__AVX2__)
+typedef __m256i lanes_t;
+
+static inline lanes_t Get(const uint16_t* p) { return _mm256_load_si256((const __m256i*)p); }
+static inline void Put(uint16_t* p, lanes_t v) { _mm256_store_si256((__m256i*)p, v); }
+static inline lanes_t Splat(uint16_t v) { return _mm256_set1_epi16((short)v); }
+static inline lanes_t And(lanes_t a, lanes_t b) { return _mm256_and_si256(a, b); }
+static inline lanes_t Or(lanes_t a, lanes_t b) { return _mm256_or_si256(a, b); }
+static inline lanes_t Xor(lanes_t a, lanes_t b) { return _mm256_xor_si256(a, b); }
+static inline lanes_t Add(lanes_t a, lanes_t b) { return _mm256_add_epi16(a, b); }
+static inline lanes_t Sub(lanes_t a, lanes_t b) { return _mm256_sub_epi16(a, b); }
+static inline lanes_t Shl1(lanes_t a) { return _mm256_slli_epi16(a, 1); }
+static inline lanes_t Shl7(lanes_t a) { return _mm256_slli_epi16(a, 7); }
+static inline lanes_t Shr1(lanes_t a) { return _mm256_srli_epi16(a, 1); }
+static inline lanes_t Shr7(lanes_t a) { return _mm256_srli_epi16(a, 7); }
+static inline lanes_t Shr8(lanes_t a) { return _mm256_srli_epi16(a, 8); }
+static inline lanes_t IsZero(lanes_t a) { return _mm256_cmpeq_epi16(a, _mm256_setzero_si256()); }
+static inline lanes_t IsEqual(lanes_t a, lanes_t b) { return _mm256_cmpeq_epi16(a, b); }
+static inline lanes_t Blend(lanes_t mask, lanes_t on, lanes_t off) {
+	return _mm256_blendv_epi8(off, on, mask);
+}
+static inline lanes_t Mask(uint32_t bits) {
+	const lanes_t lane_bits = _mm256_setr_epi16(
+		0x0001, 0x0002, 0x0004, 0x0008, 0x0010, 0x0020, 0x0040, 0x0080,
+		0x0100, 0x0200, 0x0400, 0x0800, 0x1000, 0x2000, 0x4000, (short)0x8000);
+	return _mm256_cmpeq_epi16(_mm256_and_si256(Splat((uint16_t)bits), lane_bits), lane_bits);
+}
+static inline uint32_t Bits(lanes_t mask) {
+	// one byte per lane, packs works per 128 bit half.
+	uint32_t bytes = (uint32_t)_mm256_movemask_epi8(
+		_mm256_packs_epi16(mask, _mm256_setzero_si256()));
+	return (bytes & 0xFF) | ((bytes >> 8) & 0xFF00);
+}
+#else
+typedef struct {
+	uint16_t v[LOCKSTEP_LANES];
+} lanes_t;
+
+#define LANES_OP(name, expr) \
+	static inline lanes_t name(lanes_t a, lanes_t b) { \
+		lanes_t r; \
+		for (size_t i=0; i<LOCKSTEP_LANES; i++) { r.v[i] = (uint16_t)(expr); } \
+		return r; \
+	}
+#define LANES_UNARY(name, expr) \
+	static inline lanes_t name(lanes_t a) { \
+		lanes_t r; \
+		for (size_t i=0; i<LOCKSTEP_LANES; i++) { r.v[i] = (uint16_t)(expr); } \
+		return r; \
+	}
+
+static inline lanes_t Get(const uint16_t* p) { lanes_t r; memcpy(r.v, p, sizeof(r.v)); return r; }
+static inline void Put(uint16_t* p, lanes_t v) { memcpy(p, v.v, sizeof(v.v)); }
+static inline lanes_t Splat(uint16_t v) {
+	lanes_t r;
+	for (size_t i=0; i<LOCKSTEP_LANES; i++) { r.v[i] = v; }
+	return r;
+}
+LANES_OP(And, a.v[i] & b.v[i])
+LANES_OP(Or, a.v[i] | b.v[i])
+LANES_OP(Xor, a.v[i] ^ b.v[i])
+LANES_OP(Add, a.v[i] + b.v[i])
+LANES_OP(Sub, a.v[i] - b.v[i])
+LANES_OP(IsEqual, a.v[i] == b.v[i] ? 0xFFFF : 0)
+LANES_UNARY(Shl1, a.v[i] << 1)
+LANES_UNARY(Shl7, a.v[i] << 7)
+LANES_UNARY(Shr1, a.v[i] >> 1)
+LANES_UNARY(Shr7, a.v[i] >> 7)
+LANES_UNARY(Shr8, a.v[i] >> 8)
+LANES_UNARY(IsZero, a.v[i] == 0 ? 0xFFFF : 0)
+static inline lanes_t Blend(lanes_t mask, lanes_t on, lanes_t off) {
+	lanes_t r;
+	for (size_t i=0; i<LOCKSTEP_LANES; i++) { r.v[i] = mask.v[i] ? on.v[i] : off.v[i]; }
+	return r;
+}
+static inline lanes_t Mask(uint32_t bits) {
+	lanes_t r;
+	for (size_t i=0; i<LOCKSTEP_LANES; i++) { r.v[i] = (bits >> i) & 1 ? 0xFFFF : 0; }
+	return r;
+}
+static inline uint32_t Bits(lanes_t mask) {
+	uint32_t bits = 0;
+	for (size_t i=0; i<LOCKSTEP_LANES; i++) { bits |= (mask.v[i] ? 1u : 0u) << i; }
+	return bits;
+}
+#undef LANES_OP
+#undef LANES_UNARY
+#endif
+
+static inline uint32_t PopCount(uint32_t bits) { return __builtin_popcount(bits); }
+static inline size_t LowestBit(uint32_t bits) { return __builtin_ctz(bits); }
+
+// ps with n and z taken from the 8 bit value r, same as
+// "reg_ps &= 0x7D; reg_ps |= (r & 0x80) | (!r << 1);".
+static inline lanes_t SetNZ(lanes_t ps, lanes_t r) {
+	return Or(And(ps, Splat(0x7D)),
+		Or(And(r, Splat(0x80)), And(IsZero(r), Splat(0x02))));
+}
+
+// flags of cmp/cpx/cpy against an immediate.
+static inline lanes_t Compare(lanes_t ps, lanes_t reg, lanes_t imm) {
+	lanes_t diff = Sub(Add(reg, Splat(0x100)), imm);
+	lanes_t r = And(diff, Splat(0xFF));
+	return Or(And(ps, Splat(0x7C)),
+		Or(Or(And(r, Splat(0x80)), And(IsZero(r), Splat(0x02))), Shr8(diff)));
+}
+
+LockstepGroup::LockstepGroup() :
+	lanes(0) {
+	memset(machines, 0, sizeof(machines));
+	memset(&stats, 0, sizeof(stats));
+}
+
+bool LockstepGroup::AddLane(Machine* machine) {
+	if (lanes == LOCKSTEP_LANES) {
+		return false;
+	}
+	machines[lanes++] = machine;
+	return true;
+}
+
+void LockstepGroup::LoadLane(size_t lane) {
+	Machine* m = machines[lane];
+	pc[lane] = m->reg_pc;
+	a[lane] = m->reg_a;
+	x[lane] = m->reg_x;
+	y[lane] = m->reg_y;
+	sp[lane] = m->reg_sp;
+	ps[lane] = m->reg_ps;
+	cycles[lane] = m->cycles;
+	event_cycles[lane] = m->timer0_cycles < m->timer1_cycles ?
+		m->timer0_cycles : m->timer1_cycles;
+	irq_pending[lane] = m->should_irq;
+	plain_fetch[lane] = !m->wake_up_pending &&
+		!(m->fp_step == 4 && m->fp_type == 2) &&
+		!(m->fp_step == 6 && m->fp_type == 3);
+}
+
+void LockstepGroup::StoreLane(size_t lane) {
+	Machine* m = machines[lane];
+	m->reg_pc = pc[lane];
+	m->reg_a = (uint8_t)a[lane];
+	m->reg_x = (uint8_t)x[lane];
+	m->reg_y = (uint8_t)y[lane];
+	m->reg_sp = (uint8_t)sp[lane];
+	m->reg_ps = (uint8_t)ps[lane];
+	m->cycles = cycles[lane];
+}
+
+void LockstepGroup::StepLane(size_t lane) {
+	StoreLane(lane);
+	machines[lane]->Step();
+	LoadLane(lane);
+}
+
+uint32_t LockstepGroup::SamePc(uint16_t value, uint32_t candidates) const {
+	return Bits(IsEqual(Get(pc), Splat(value))) & candidates;
+}
+
+uint32_t LockstepGroup::FormCohort(uint32_t active) const {
+	uint32_t best = 0;
+	uint32_t left = active;
+	while (left) {
+		uint32_t group = SamePc(pc[LowestBit(left)], active);
+		if (PopCount(group) > PopCount(best)) {
+			best = group;
+		}
+		left &= ~group;
+	}
+	return best;
+}
+
+uint32_t LockstepGroup::SameCode(uint32_t cohort, size_t leader) const {
+	uint8_t** leader_map = machines[leader]->memmap;
+	uint16_t addr = pc[leader];
+	uint16_t addr1 = addr + 1;
+	uint16_t addr2 = addr + 2;
+	uint32_t same = cohort;
+	uint32_t left = cohort & ~(1u << leader);
+	while (left) {
+		size_t lane = LowestBit(left);
+		left &= left - 1;
+		uint8_t** map = machines[lane]->memmap;
+		// the rom is shared, so equal page pointers mean equal code.
+		if (map[addr >> 13] == leader_map[addr >> 13] &&
+			map[addr1 >> 13] == leader_map[addr1 >> 13] &&
+			map[addr2 >> 13] == leader_map[addr2 >> 13]) {
+			continue;
+		}
+		if (map[addr >> 13][addr & 0x1FFF] != leader_map[addr >> 13][addr & 0x1FFF] ||
+			map[addr1 >> 13][addr1 & 0x1FFF] != leader_map[addr1 >> 13][addr1 & 0x1FFF] ||
+			map[addr2 >> 13][addr2 & 0x1FFF] != leader_map[addr2 >> 13][addr2 & 0x1FFF]) {
+			same &= ~(1u << lane);
+		}
+	}
+	return same;
+}
+
+bool LockstepGroup::ExecuteVector(uint32_t cohort, size_t leader) {
+	uint8_t** map = machines[leader]->memmap;
+	uint16_t addr = pc[leader];
+	uint16_t addr1 = addr + 1;
+	uint16_t addr2 = addr + 2;
+	uint8_t opcode = map[addr >> 13][addr & 0x1FFF];
+	uint8_t operand = map[addr1 >> 13][addr1 & 0x1FFF];
+	uint8_t operand_hi = map[addr2 >> 13][addr2 & 0x1FFF];
+
+	// immediates are fetched through Load by the interpreter.
+	bool plain = addr1 >= IO_LIMIT;
+	for (uint32_t left = cohort; plain && left; left &= left - 1) {
+		plain = plain_fetch[LowestBit(left)];
+	}
+
+	lanes_t ra = Get(a);
+	lanes_t rx = Get(x);
+	lanes_t ry = Get(y);
+	lanes_t rsp = Get(sp);
+	lanes_t rps = Get(ps);
+	lanes_t imm = Splat(operand);
+	lanes_t ff = Splat(0xFF);
+	uint16_t next_pc = addr1;
+	size_t cost = 2;
+	uint32_t taken = 0;
+	uint8_t flag = 0;
+	bool on_set = false;
+
+	switch (opcode) {
+	// register transfers and steps.
+	case 0xAA: rx = ra; rps = SetNZ(rps, rx); break;
+	case 0xA8: ry = ra; rps = SetNZ(rps, ry); break;
+	case 0x8A: ra = rx; rps = SetNZ(rps, ra); break;
+	case 0x98: ra = ry; rps = SetNZ(rps, ra); break;
+	case 0x9A: rsp = rx; break;
+	case 0xBA: rx = rsp; rps = SetNZ(rps, rx); break;
+	case 0xE8: rx = And(Add(rx, Splat(1)), ff); rps = SetNZ(rps, rx); break;
+	case 0xC8: ry = And(Add(ry, Splat(1)), ff); rps = SetNZ(rps, ry); break;
+	case 0xCA: rx = And(Sub(rx, Splat(1)), ff); rps = SetNZ(rps, rx); break;
+	case 0x88: ry = And(Sub(ry, Splat(1)), ff); rps = SetNZ(rps, ry); break;
+	// flags.
+	case 0x18: rps = And(rps, Splat(0xFE)); break;
+	case 0x38: rps = Or(rps, Splat(0x01)); break;
+	case 0x58: rps = And(rps, Splat(0xFB)); break;
+	case 0x78: rps = Or(rps, Splat(0x04)); break;
+	case 0xD8: rps = And(rps, Splat(0xF7)); break;
+	case 0xF8: rps = Or(rps, Splat(0x08)); break;
+	case 0xB8: rps = And(rps, Splat(0xBF)); break;
+	case 0xEA: break;
+	// accumulator shifts.
+	case 0x0A: {
+		lanes_t carry = Shr7(ra);
+		ra = And(Shl1(ra), ff);
+		rps = Or(SetNZ(And(rps, Splat(0x7C)), ra), carry);
+	}
+		break;
+	case 0x4A: {
+		lanes_t carry = And(ra, Splat(0x01));
+		ra = Shr1(ra);
+		rps = Or(SetNZ(And(rps, Splat(0x7C)), ra), carry);
+	}
+		break;
+	case 0x2A: {
+		lanes_t carry = Shr7(ra);
+		ra = And(Or(Shl1(ra), And(rps, Splat(0x01))), ff);
+		rps = Or(SetNZ(And(rps, Splat(0x7C)), ra), carry);
+	}
+		break;
+	case 0x6A: {
+		lanes_t carry = And(ra, Splat(0x01));
+		ra = Or(Shr1(ra), And(Shl7(rps), Splat(0x80)));
+		rps = Or(SetNZ(And(rps, Splat(0x7C)), ra), carry);
+	}
+		break;
+	// immediates.
+	case 0xA9: case 0xA2: case 0xA0: case 0x29: case 0x09: case 0x49:
+	case 0x69: case 0xE9: case 0xC9: case 0xE0: case 0xC0:
+		if (!plain) {
+			return false;
+		}
+		next_pc = addr + 2;
+		switch (opcode) {
+		case 0xA9: ra = imm; rps = SetNZ(rps, ra); break;
+		case 0xA2: rx = imm; rps = SetNZ(rps, rx); break;
+		case 0xA0: ry = imm; rps = SetNZ(rps, ry); break;
+		case 0x29: ra = And(ra, imm); rps = SetNZ(rps, ra); break;
+		case 0x09: ra = Or(ra, imm); rps = SetNZ(rps, ra); break;
+		case 0x49: ra = Xor(ra, imm); rps = SetNZ(rps, ra); break;
+		case 0x69: {
+			lanes_t sum = Add(Add(ra, imm), And(rps, Splat(0x01)));
+			lanes_t r = And(sum, ff);
+			lanes_t overflow = Shr1(And(And(Xor(Xor(ra, imm), Splat(0x80)), Xor(ra, r)), Splat(0x80)));
+			rps = Or(Or(SetNZ(And(rps, Splat(0x3C)), r), Shr8(sum)), overflow);
+			ra = r;
+		}
+			break;
+		case 0xE9: {
+			lanes_t diff = Sub(Add(Add(ra, Splat(0xFF)), And(rps, Splat(0x01))), imm);
+			lanes_t r = And(diff, ff);
+			lanes_t overflow = Shr1(And(And(Xor(ra, imm), Xor(ra, r)), Splat(0x80)));
+			rps = Or(Or(SetNZ(And(rps, Splat(0x3C)), r), Shr8(diff)), overflow);
+			ra = r;
+		}
+			break;
+		case 0xC9: rps = Compare(rps, ra, imm); break;
+		case 0xE0: rps = Compare(rps, rx, imm); break;
+		case 0xC0: rps = Compare(rps, ry, imm); break;
+		}
+		break;
+	case 0x4C:
+		next_pc = operand | (operand_hi << 8);
+		cost = 3;
+		break;
+	// branches, the lanes may part here.
+	case 0x10: flag = 0x80; on_set = false; break;
+	case 0x30: flag = 0x80; on_set = true; break;
+	case 0x50: flag = 0x40; on_set = false; break;
+	case 0x70: flag = 0x40; on_set = true; break;
+	case 0x90: flag = 0x01; on_set = false; break;
+	case 0xB0: flag = 0x01; on_set = true; break;
+	case 0xD0: flag = 0x02; on_set = false; break;
+	case 0xF0: flag = 0x02; on_set = true; break;
+	default:
+		return false;
+	}
+
+	lanes_t mask = Mask(cohort);
+	if (flag) {
+		uint16_t fall = addr + 2;
+		uint16_t target = fall + (int8_t)operand;
+		uint32_t clear = Bits(IsZero(And(rps, Splat(flag))));
+		taken = (on_set ? ~clear : clear) & cohort;
+		Put(pc, Blend(And(mask, Mask(taken)), Splat(target), Blend(mask, Splat(fall), Get(pc))));
+		size_t extra = !((fall ^ target) & 0xFF00) << 1;
+		for (uint32_t left = cohort; left; left &= left - 1) {
+			size_t lane = LowestBit(left);
+			cycles[lane] += 2 + ((taken >> lane) & 1 ? extra : 0);
+		}
+		return true;
+	}
+
+	Put(a, Blend(mask, ra, Get(a)));
+	Put(x, Blend(mask, rx, Get(x)));
+	Put(y, Blend(mask, ry, Get(y)));
+	Put(sp, Blend(mask, rsp, Get(sp)));
+	Put(ps, Blend(mask, rps, Get(ps)));
+	Put(pc, Blend(mask, Splat(next_pc), Get(pc)));
+	for (uint32_t left = cohort; left; left &= left - 1) {
+		cycles[LowestBit(left)] += cost;
+	}
+	return true;
+}
+
+void LockstepGroup::ServiceLanes(uint32_t cohort) {
+	for (uint32_t left = cohort; left; left &= left - 1) {
+		size_t lane = LowestBit(left);
+		if (cycles[lane] >= event_cycles[lane] ||
+			(irq_pending[lane] && !(ps[lane] & 0x04))) {
+			StoreLane(lane);
+			machines[lane]->ServiceTimers();
+			LoadLane(lane);
+		}
+	}
+}
+
+void LockstepGroup::RunTimeSlice(size_t time_slice, bool speed_up) {
+	size_t end_cycles = time_slice * CYCLES_MS;
+	uint32_t active = 0;
+	for (size_t i=0; i<lanes; i++) {
+		machines[i]->speed_up = speed_up;
+		machines[i]->DrainInput();
+		LoadLane(i);
+		if (cycles[i] < end_cycles) {
+			active |= 1u << i;
+		}
+	}
+
+	uint32_t cohort = 0;
+	while (active) {
+		cohort &= active;
+		if (PopCount(cohort) < 2) {
+			cohort = FormCohort(active);
+		}
+		if (PopCount(cohort) < 2) {
+			// nothing shared, every lane runs on its own for a while.
+			for (uint32_t left = active; left; left &= left - 1) {
+				size_t lane = LowestBit(left);
+				StoreLane(lane);
+				stats.scalar_insts += machines[lane]->Execute(end_cycles, SCALAR_BURST);
+				LoadLane(lane);
+				if (cycles[lane] >= end_cycles) {
+					active &= ~(1u << lane);
+				}
+			}
+			cohort = 0;
+			continue;
+		}
+
+		size_t leader = LowestBit(cohort);
+		uint32_t same = SameCode(cohort, leader);
+		if (same != cohort) {
+			stats.splits++;
+			cohort = same;
+		}
+		if (ExecuteVector(cohort, leader)) {
+			stats.vector_insts++;
+			stats.vector_lane_insts += PopCount(cohort);
+#ifdef NC1020_COUNTERS
+			for (uint32_t left = cohort; left; left &= left - 1) {
+				machines[LowestBit(left)]->counters.insts++;
+			}
+#endif
+			ServiceLanes(cohort);
+		} else {
+			for (uint32_t left = cohort; left; left &= left - 1) {
+				StepLane(LowestBit(left));
+			}
+			stats.cohort_lane_insts += PopCount(cohort);
+		}
+		for (uint32_t left = cohort; left; left &= left - 1) {
+			size_t lane = LowestBit(left);
+			if (cycles[lane] >= end_cycles) {
+				active &= ~(1u << lane);
+			}
+		}
+		cohort &= active;
+		if (!cohort) {
+			continue;
+		}
+
+		// lanes that branched away or took an irq leave, the larger part
+		// of the cohort carries on.
+		leader = LowestBit(cohort);
+		uint32_t with_leader = SamePc(pc[leader], cohort);
+		if (with_leader != cohort) {
+			uint32_t rest = cohort & ~with_leader;
+			uint32_t other = SamePc(pc[LowestBit(rest)], rest);
+			cohort = PopCount(other) > PopCount(with_leader) ? other : with_leader;
+			leader = LowestBit(cohort);
+			stats.splits++;
+		}
+
+		// lanes outside catch up with the cohort one instruction at a time
+		// and join it as soon as they reach its pc.
+		uint32_t outside = active & ~cohort;
+		for (uint32_t left = outside; left; left &= left - 1) {
+			size_t lane = LowestBit(left);
+			if (cycles[lane] < cycles[leader] && pc[lane] != pc[leader]) {
+				StepLane(lane);
+				stats.scalar_insts++;
+				if (cycles[lane] >= end_cycles) {
+					active &= ~(1u << lane);
+				}
+			}
+		}
+		uint32_t joining = SamePc(pc[leader], active & ~cohort);
+		if (joining) {
+			cohort |= joining;
+			stats.joins += PopCount(joining);
+		}
+	}
+
+	for (size_t i=0; i<lanes; i++) {
+		StoreLane(i);
+		machines[i]->EndSlice(end_cycles);
+	}
+}
+
+}
@@ -0,0 +1,81 @@
+#ifndef LOCKSTEP_H_
+#define LOCKSTEP_H_
+
+#include "nc1020.h"
+
+namespace wqx {
+
+static const size_t LOCKSTEP_LANES = 16;
+
+typedef struct {
+	// instructions run once for a whole cohort and the lanes they covered.
+	uint64_t vector_insts;
+	uint64_t vector_lane_insts;
+	// instructions the cohort ran lane by lane (memory, stack, io).
+	uint64_t cohort_lane_insts;
+	// instructions of lanes outside the cohort.
+	uint64_t scalar_insts;
+	uint64_t splits;
+	uint64_t joins;
+} lockstep_stats_t;
+
+/**
+ * LockstepGroup
+ * experimental engine running up to LOCKSTEP_LANES machines together. the
+ * registers of all lanes live in structure of arrays form; lanes sitting on
+ * the same pc with the same code form a cohort and register-only opcodes run
+ * once for the whole cohort (avx2 with NC1020_AVX2). memory opcodes run lane
+ * by lane through the scalar interpreter. lanes that branch away drop out to
+ * scalar stepping and rejoin once their pc meets the cohort again.
+ *
+ * every lane retires exactly the instruction sequence RunTimeSlice would
+ * while no keys arrive. keys queued with SetKey are polled only at the start
+ * of the slice rather than every 1/256 s, keys bound to a cycle with
+ * ScheduleKey are not supported here.
+ */
+class LockstepGroup {
+public:
+	LockstepGroup();
+
+	// false once all lanes are taken.
+	bool AddLane(Machine* machine);
+	size_t Lanes() const { return lanes; }
+
+	void RunTimeSlice(size_t time_slice, bool speed_up);
+
+	const lockstep_stats_t& Stats() const { return stats; }
+
+private:
+	void LoadLane(size_t lane);
+	void StoreLane(size_t lane);
+	void StepLane(size_t lane);
+	uint32_t SamePc(uint16_t value, uint32_t candidates) const;
+	uint32_t FormCohort(uint32_t active) const;
+	uint32_t SameCode(uint32_t cohort, size_t leader) const;
+	bool ExecuteVector(uint32_t cohort, size_t leader);
+	void ServiceLanes(uint32_t cohort);
+
+	Machine* machines[LOCKSTEP_LANES];
+	size_t lanes;
+
+	alignas(32) uint16_t pc[LOCKSTEP_LANES];
+	alignas(32) uint16_t a[LOCKSTEP_LANES];
+	alignas(32) uint16_t x[LOCKSTEP_LANES];
+	alignas(32) uint16_t y[LOCKSTEP_LANES];
+	alignas(32) uint16_t sp[LOCKSTEP_LANES];
+	alignas(32) uint16_t ps[LOCKSTEP_LANES];
+	size_t cycles[LOCKSTEP_LANES];
+	// earliest timer deadline and pending irq of each lane, so the cohort
+	// only drops into ServiceTimers when something is due.
+	size_t event_cycles[LOCKSTEP_LANES];
+	bool irq_pending[LOCKSTEP_LANES];
+	// operand fetches through Load have no side effects (no flash status
+	// read or wake up key pending), so they can be read once for the cohort.
+	bool plain_fetch[LOCKSTEP_LANES];
+
+	lockstep_stats_t stats;
+};
+
+}
+
+#endif /* LOCKSTEP_H_ */
@@ -0,0 +1,432 @@
+// 64 bit file offsets where off_t is not already.
+#define _FILE_OFFSET_BITS 64
+#include "movie.h"
+#include "nc1020_machine.h"
+#include <string.h>
+#include <sys/types.h>
+#include <algorithm>
+
+namespace wqx {
+    using std::string;
+    using std::vector;
+
+static const char MOVIE_MAGIC[8] = {'W', 'Q', 'X', 'M', 'O', 'V', 'I', 'E'};
+static const char INDEX_MAGIC[8] = {'W', 'Q', 'X', 'M', 'O', 'V', 'I', 'X'};
+static const uint32_t MOVIE_VERSION = 1;
+static const size_t HEADER_SIZE = 16;
+static const size_t CHUNK_HEADER_SIZE = 5;
+static const size_t FOOTER_SIZE = 16;
+static const size_t INDEX_ENTRY_SIZE = 24;
+// equal bytes it takes to end a literal run of the keyframe delta.
+static const size_t DELTA_MIN_RUN = 8;
+
+static void PutU32(uint8_t* p, uint32_t value){
+	for (size_t i=0; i<4; i++) {
+		p[i] = (uint8_t)(value >> (i * 8));
+	}
+}
+
+static void PutU64(uint8_t* p, uint64_t value){
+	for (size_t i=0; i<8; i++) {
+		p[i] = (uint8_t)(value >> (i * 8));
+	}
+}
+
+static uint32_t GetU32(const uint8_t* p){
+	uint32_t value = 0;
+	for (size_t i=0; i<4; i++) {
+		value |= (uint32_t)p[i] << (i * 8);
+	}
+	return value;
+}
+
+static uint64_t GetU64(const uint8_t* p){
+	uint64_t value = 0;
+	for (size_t i=0; i<8; i++) {
+		value |= (uint64_t)p[i] << (i * 8);
+	}
+	return value;
+}
+
+static void AppendU32(vector<uint8_t>& out, uint32_t value){
+	uint8_t bytes[4];
+	PutU32(bytes, value);
+	out.insert(out.end(), bytes, bytes + 4);
+}
+
+// data xor base as (u32 equal bytes, u32 literal bytes, literals) runs.
+static void PackDelta(const uint8_t* base, const uint8_t* data, size_t size,
+	vector<uint8_t>& out){
+	out.clear();
+	size_t i = 0;
+	while (i < size) {
+		size_t same = 0;
+		while (i + same < size && base[i + same] == data[i + same]) {
+			same++;
+		}
+		i += same;
+		size_t literal = 0;
+		size_t run = 0;
+		while (i + literal + run < size && run < DELTA_MIN_RUN) {
+			if (base[i + literal + run] == data[i + literal + run]) {
+				run++;
+			} else {
+				literal += run + 1;
+				run = 0;
+			}
+		}
+		AppendU32(out, (uint32_t)same);
+		AppendU32(out, (uint32_t)literal);
+		for (size_t j=0; j<literal; j++) {
+			out.push_back(base[i + j] ^ data[i + j]);
+		}
+		i += literal;
+	}
+}
+
+static bool UnpackDelta(const uint8_t* base, const uint8_t* packed, size_t packed_size,
+	uint8_t* data, size_t size){
+	memcpy(data, base, size);
+	size_t i = 0;
+	size_t p = 0;
+	while (p + 8 <= packed_size) {
+		size_t same = GetU32(packed + p);
+		size_t literal = GetU32(packed + p + 4);
+		p += 8;
+		if (same > size - i || literal > size - i - same || literal > packed_size - p) {
+			return false;
+		}
+		i += same;
+		for (size_t j=0; j<literal; j++) {
+			data[i + j] ^= packed[p + j];
+		}
+		i += literal;
+		p += literal;
+	}
+	return p == packed_size;
+}
+
+MovieRecorder::MovieRecorder() :
+	machine(NULL),
+	file(NULL),
+	failed(false),
+	keyframe_cycles(0),
+	next_keyframe(0),
+	keys(0) {
+}
+
+MovieRecorder::~MovieRecorder() {
+	Stop();
+}
+
+bool MovieRecorder::Start(Machine* machine, const string& path, size_t keyframe_ms){
+	Stop();
+	file = fopen(path.c_str(), "wb");
+	if (file == NULL) {
+		return false;
+	}
+	failed = false;
+	uint8_t header[HEADER_SIZE];
+	memcpy(header, MOVIE_MAGIC, 8);
+	PutU32(header + 8, MOVIE_VERSION);
+	PutU32(header + 12, (uint32_t)SnapshotSize());
+	if (!Write(header, sizeof(header))) {
+		fclose(file);
+		file = NULL;
+		return false;
+	}
+
+	this->machine = machine;
+	keyframe_cycles = (uint64_t)(keyframe_ms ? keyframe_ms : 1000) * CYCLES_MS;
+	keys = 0;
+	index.clear();
+	start.resize(SnapshotSize());
+	current.resize(SnapshotSize());
+	if (!WriteKeyframe('S')) {
+		fclose(file);
+		file = NULL;
+		return false;
+	}
+	SetInputListener(machine, &MovieRecorder::OnInput, this);
+	return true;
+}
+
+bool MovieRecorder::Write(const void* data, size_t size){
+	if (!failed && fwrite(data, 1, size, file) != size) {
+		failed = true;
+	}
+	return !failed;
+}
+
+bool MovieRecorder::WriteChunkHeader(char type, size_t size){
+	uint8_t header[CHUNK_HEADER_SIZE];
+	header[0] = (uint8_t)type;
+	PutU32(header + 1, (uint32_t)size);
+	return Write(header, sizeof(header));
+}
+
+void MovieRecorder::OnInput(void* context, uint64_t cycle, uint8_t key_id, bool down_or_up){
+	MovieRecorder* recorder = (MovieRecorder*)context;
+	uint8_t chunk[10];
+	PutU64(chunk, cycle);
+	chunk[8] = key_id;
+	chunk[9] = down_or_up ? 1 : 0;
+	// a failed write shows in the next Update.
+	if (recorder->WriteChunkHeader('E', sizeof(chunk))) {
+		recorder->Write(chunk, sizeof(chunk));
+	}
+	recorder->keys++;
+}
+
+bool MovieRecorder::WriteKeyframe(char type){
+	off_t offset = ftello(file);
+	if (offset < 0) {
+		failed = true;
+		return false;
+	}
+	movie_keyframe_t keyframe;
+	keyframe.cycle = GetCycleCount(machine);
+	keyframe.keys_before = keys;
+	keyframe.offset = (uint64_t)offset;
+	index.push_back(keyframe);
+	next_keyframe = keyframe.cycle + keyframe_cycles;
+
+	uint8_t* data;
+	size_t size;
+	if (type == 'S') {
+		SaveSnapshot(machine, &start[0]);
+		data = &start[0];
+		size = start.size();
+	} else {
+		SaveSnapshot(machine, &current[0]);
+		PackDelta(&start[0], &current[0], current.size(), packed);
+		data = &packed[0];
+		size = packed.size();
+	}
+	uint8_t fields[16];
+	PutU64(fields, keyframe.cycle);
+	PutU64(fields + 8, keyframe.keys_before);
+	return WriteChunkHeader(type, sizeof(fields) + size) &&
+		Write(fields, sizeof(fields)) &&
+		Write(data, size);
+}
+
+bool MovieRecorder::Update(){
+	if (file && !failed && GetCycleCount(machine) >= next_keyframe) {
+		WriteKeyframe('K');
+	}
+	return !failed;
+}
+
+bool MovieRecorder::Stop(){
+	if (file == NULL) {
+		return !failed;
+	}
+	SetInputListener(machine, NULL, NULL);
+	uint8_t end[8];
+	PutU64(end, GetCycleCount(machine));
+	WriteChunkHeader('X', sizeof(end));
+	Write(end, sizeof(end));
+
+	// no index after a failed write, the player scans what made it.
+	off_t index_offset = failed ? -1 : ftello(file);
+	if (index_offset >= 0) {
+		uint8_t count[4];
+		PutU32(count, (uint32_t)index.size());
+		Write(count, sizeof(count));
+		for (size_t i=0; i<index.size(); i++) {
+			uint8_t entry[INDEX_ENTRY_SIZE];
+			PutU64(entry, index[i].cycle);
+			PutU64(entry + 8, index[i].keys_before);
+			PutU64(entry + 16, index[i].offset);
+			Write(entry, sizeof(entry));
+		}
+		uint8_t footer[FOOTER_SIZE];
+		PutU64(footer, (uint64_t)index_offset);
+		memcpy(footer + 8, INDEX_MAGIC, 8);
+		Write(footer, sizeof(footer));
+	} else {
+		failed = true;
+	}
+	if (fclose(file) != 0) {
+		failed = true;
+	}
+	file = NULL;
+	machine = NULL;
+	return !failed;
+}
+
+MoviePlayer::MoviePlayer() :
+	file(NULL),
+	snapshot_size(0),
+	end_cycle(0) {
+}
+
+MoviePlayer::~MoviePlayer() {
+	Close();
+}
+
+void MoviePlayer::Close(){
+	if (file) {
+		fclose(file);
+		file = NULL;
+	}
+	keyframes.clear();
+	keys.clear();
+	end_cycle = 0;
+}
+
+bool MoviePlayer::Open(const string& path){
+	Close();
+	file = fopen(path.c_str(), "rb");
+	if (file == NULL) {
+		return false;
+	}
+	uint8_t header[HEADER_SIZE];
+	if (fread(header, 1, sizeof(header), file) != sizeof(header) ||
+		memcmp(header, MOVIE_MAGIC, 8) != 0 ||
+		GetU32(header + 8) != MOVIE_VERSION ||
+		GetU32(header + 12) != SnapshotSize()) {
+		Close();
+		return false;
+	}
+	snapshot_size = SnapshotSize();
+	start.resize(snapshot_size);
+	snapshot.resize(snapshot_size);
+	// a recording that was never stopped has no index, its keyframes are
+	// found while scanning for keys.
+	ReadIndex();
+	Scan();
+	if (keyframes.empty() || !LoadKeyframe(0)) {
+		Close();
+		return false;
+	}
+	start = snapshot;
+	return true;
+}
+
+bool MoviePlayer::ReadIndex(){
+	uint8_t footer[FOOTER_SIZE];
+	if (fseeko(file, -(off_t)FOOTER_SIZE, SEEK_END) != 0 ||
+		fread(footer, 1, sizeof(footer), file) != sizeof(footer) ||
+		memcmp(footer + 8, INDEX_MAGIC, 8) != 0) {
+		return false;
+	}
+	uint8_t count[4];
+	if (fseeko(file, (off_t)GetU64(footer), SEEK_SET) != 0 ||
+		fread(count, 1, sizeof(count), file) != sizeof(count)) {
+		return false;
+	}
+	vector<movie_keyframe_t> entries(GetU32(count));
+	for (size_t i=0; i<entries.size(); i++) {
+		uint8_t entry[INDEX_ENTRY_SIZE];
+		if (fread(entry, 1, sizeof(entry), file) != sizeof(entry)) {
+			return false;
+		}
+		entries[i].cycle = GetU64(entry);
+		entries[i].keys_before = GetU64(entry + 8);
+		entries[i].offset = GetU64(entry + 16);
+	}
+	if (entries.empty()) {
+		return false;
+	}
+	keyframes.swap(entries);
+	return true;
+}
+
+void MoviePlayer::Scan(){
+	bool indexed = !keyframes.empty();
+	fseeko(file, (off_t)HEADER_SIZE, SEEK_SET);
+	for (;;) {
+		off_t offset = ftello(file);
+		uint8_t header[CHUNK_HEADER_SIZE];
+		if (fread(header, 1, sizeof(header), file) != sizeof(header)) {
+			break;
+		}
+		char type = (char)header[0];
+		size_t size = GetU32(header + 1);
+		uint8_t fields[16];
+		if (type == 'E' && size == 10) {
+			if (fread(fields, 1, 10, file) != 10) {
+				break;
+			}
+			movie_key_t key;
+			key.cycle = GetU64(fields);
+			key.key_id = fields[8];
+			key.down_or_up = fields[9] != 0;
+			keys.push_back(key);
+			end_cycle = key.cycle;
+		} else if ((type == 'S' || type == 'K') && size >= 16) {
+			if (fread(fields, 1, 16, file) != 16) {
+				break;
+			}
+			if (!indexed) {
+				movie_keyframe_t keyframe;
+				keyframe.cycle = GetU64(fields);
+				keyframe.keys_before = GetU64(fields + 8);
+				keyframe.offset = (uint64_t)offset;
+				keyframes.push_back(keyframe);
+			}
+			end_cycle = std::max(end_cycle, GetU64(fields));
+			fseeko(file, (off_t)(size - 16), SEEK_CUR);
+		} else if (type == 'X' && size == 8) {
+			if (fread(fields, 1, 8, file) != 8) {
+				break;
+			}
+			end_cycle = GetU64(fields);
+			break;
+		} else {
+			break;
+		}
+	}
+}
+
+bool MoviePlayer::LoadKeyframe(size_t index){
+	uint8_t header[CHUNK_HEADER_SIZE + 16];
+	if (fseeko(file, (off_t)keyframes[index].offset, SEEK_SET) != 0 ||
+		fread(header, 1, sizeof(header), file) != sizeof(header)) {
+		return false;
+	}
+	char type = (char)header[0];
+	size_t size = GetU32(header + 1) - 16;
+	if (type == 'S') {
+		return size == snapshot_size &&
+			fread(&snapshot[0], 1, size, file) == size;
+	}
+	if (type != 'K') {
+		return false;
+	}
+	packed.resize(size);
+	if (size && fread(&packed[0], 1, size, file) != size) {
+		return false;
+	}
+	return UnpackDelta(&start[0], size ? &packed[0] : NULL, size, &snapshot[0], snapshot_size);
+}
+
+bool MoviePlayer::Seek(Machine* machine, uint64_t cycle){
+	if (keyframes.empty()) {
+		return false;
+	}
+	struct ByCycle {
+		bool operator()(uint64_t cycle, const movie_keyframe_t& keyframe) const {
+			return cycle < keyframe.cycle;
+		}
+	};
+	size_t index = std::upper_bound(keyframes.begin(), keyframes.end(), cycle, ByCycle()) -
+		keyframes.begin();
+	index = index ? index - 1 : 0;
+	if (!LoadKeyframe(index)) {
+		return false;
+	}
+	LoadSnapshot(machine, &snapshot[0]);
+	for (size_t i=keyframes[index].keys_before; i<keys.size(); i++) {
+		ScheduleKey(machine, keys[i].cycle, keys[i].key_id, keys[i].down_or_up);
+	}
+	uint64_t now = GetCycleCount(machine);
+	if (cycle > now) {
+		RunCycles(machine, (size_t)(cycle - now), false);
+	}
+	return true;
+}
+
+}
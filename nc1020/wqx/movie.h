@@ -0,0 +1,112 @@
+#ifndef MOVIE_H_
+#define MOVIE_H_
+
+#include "nc1020.h"
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+namespace wqx {
+
+typedef struct {
+	uint64_t cycle;
+	// keys applied before the keyframe was taken.
+	uint64_t keys_before;
+	uint64_t offset;
+} movie_keyframe_t;
+
+typedef struct {
+	uint64_t cycle;
+	uint8_t key_id;
+	bool down_or_up;
+} movie_key_t;
+
+/**
+ * input movies
+ * a movie holds the machine as it was when recording started and every key
+ * applied after that, stamped with the emulated cycle it reached the machine
+ * at. applying the same keys at the same cycles to the same start replays
+ * the session bit for bit, whatever slices the player runs. keyframes are
+ * taken every keyframe_ms of emulated time and stored as a delta against the
+ * start, so seeking restores the keyframe before the target and emulates at
+ * most keyframe_ms from there.
+ *
+ * the timer1 speed up is not part of the movie, record and play without it.
+ *
+ * file layout, little endian:
+ *   "WQXMOVIE", u32 version, u32 snapshot size
+ *   chunks of u8 type, u32 payload size, payload:
+ *     'S' u64 cycle, u64 0, raw snapshot of the start
+ *     'K' u64 cycle, u64 keys before, snapshot xor start, zero run coded
+ *     'E' u64 cycle, u8 key_id, u8 down_or_up
+ *     'X' u64 cycle, end of the recording
+ *   index: u32 count, count * (u64 cycle, u64 keys before, u64 chunk offset)
+ *   u64 index offset, "WQXMOVIX"
+ */
+class MovieRecorder {
+public:
+	MovieRecorder();
+	~MovieRecorder();
+
+	bool Start(Machine* machine, const std::string& path, size_t keyframe_ms);
+	// call between slices, takes the keyframes that are due. false once a
+	// write failed, the movie is then cut short.
+	bool Update();
+	// false when any write failed, or closing the file did.
+	bool Stop();
+	bool IsRecording() const { return file != NULL; }
+	bool Failed() const { return failed; }
+
+private:
+	static void OnInput(void* context, uint64_t cycle, uint8_t key_id, bool down_or_up);
+	bool Write(const void* data, size_t size);
+	bool WriteChunkHeader(char type, size_t size);
+	bool WriteKeyframe(char type);
+
+	Machine* machine;
+	FILE* file;
+	bool failed;
+	uint64_t keyframe_cycles;
+	uint64_t next_keyframe;
+	uint64_t keys;
+	std::vector<uint8_t> start;
+	std::vector<uint8_t> current;
+	std::vector<uint8_t> packed;
+	std::vector<movie_keyframe_t> index;
+};
+
+class MoviePlayer {
+public:
+	MoviePlayer();
+	~MoviePlayer();
+
+	bool Open(const std::string& path);
+	void Close();
+
+	uint64_t StartCycle() const { return keyframes.empty() ? 0 : keyframes[0].cycle; }
+	uint64_t EndCycle() const { return end_cycle; }
+	const std::vector<movie_key_t>& Keys() const { return keys; }
+	const std::vector<movie_keyframe_t>& Keyframes() const { return keyframes; }
+
+	// puts the machine at the first instruction boundary at or after cycle
+	// and schedules the keys that follow, RunTimeSlice plays on from there.
+	bool Seek(Machine* machine, uint64_t cycle);
+
+private:
+	bool ReadIndex();
+	void Scan();
+	bool LoadKeyframe(size_t index);
+
+	FILE* file;
+	size_t snapshot_size;
+	uint64_t end_cycle;
+	std::vector<movie_keyframe_t> keyframes;
+	std::vector<movie_key_t> keys;
+	std::vector<uint8_t> start;
+	std::vector<uint8_t> snapshot;
+	std::vector<uint8_t> packed;
+};
+
+}
+
+#endif /* MOVIE_H_ */
@@ -1,152 +1,17 @@
 #include "nc1020.h"
+#include "nc1020_machine.h"
 #include <string>
+#include <new>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
+#include <sys/stat.h>
 
 namespace wqx {
     using std::string;
-    
-    // cpu cycles per second (cpu freq).
-    const size_t CYCLES_SECOND = 5120000;
-    const size_t TIMER0_FREQ = 2;
-    const size_t TIMER1_FREQ = 0x100;
-    // cpu cycles per timer0 period (1/2 s).
-    const size_t CYCLES_TIMER0 = CYCLES_SECOND / TIMER0_FREQ;
-    // cpu cycles per timer1 period (1/256 s).
-    const size_t CYCLES_TIMER1 = CYCLES_SECOND / TIMER1_FREQ;
-    // speed up
-    const size_t CYCLES_TIMER1_SPEED_UP = CYCLES_SECOND / TIMER1_FREQ / 20;
-    // cpu cycles per ms (1/1000 s).
-    const size_t CYCLES_MS = CYCLES_SECOND / 1000;
-    
-    static const size_t ROM_SIZE = 0x8000 * 0x300;
-    static const size_t NOR_SIZE = 0x8000 * 0x20;
-    
-    static const uint16_t IO_LIMIT = 0x40;
-#define IO_API
-    typedef uint8_t (IO_API *io_read_func_t)(uint8_t);
-    typedef void (IO_API *io_write_func_t)(uint8_t, uint8_t);
-    
-    const uint16_t NMI_VEC = 0xFFFA;
-    const uint16_t RESET_VEC = 0xFFFC;
-    const uint16_t IRQ_VEC = 0xFFFE;
-    
-    const size_t VERSION = 0x06;
-
-typedef struct {
-	uint16_t reg_pc;
-	uint8_t reg_a;
-	uint8_t reg_ps;
-	uint8_t reg_x;
-	uint8_t reg_y;
-	uint8_t reg_sp;
-} cpu_states_t;
-
-typedef struct {
-	size_t version;
-	cpu_states_t cpu;
-	uint8_t ram[0x8000];
-
-	uint8_t bak_40[0x40];
-
-	uint8_t clock_data[80];
-	uint8_t clock_flags;
-
-	uint8_t jg_wav_data[0x20];
-	uint8_t jg_wav_flags;
-	uint8_t jg_wav_idx;
-	bool jg_wav_playing;
-
-	uint8_t fp_step;
-	uint8_t fp_type;
-	uint8_t fp_bank_idx;
-	uint8_t fp_bak1;
-	uint8_t fp_bak2;
-	uint8_t fp_buff[0x100];
-
-	bool slept;
-	bool should_wake_up;
-	bool pending_wake_up;
-	uint8_t wake_up_flags;
-
-	bool timer0_toggle;
-	size_t cycles;
-	size_t timer0_cycles;
-	size_t timer1_cycles;
-	bool should_irq;
-
-	size_t lcd_addr;
-	uint8_t keypad_matrix[8];
-} nc1020_states_t;
-
-static WqxRom nc1020_rom;
-
-static uint8_t rom_buff[ROM_SIZE];
-static uint8_t nor_buff[NOR_SIZE];
-
-static uint8_t* rom_volume0[0x100];
-static uint8_t* rom_volume1[0x100];
-static uint8_t* rom_volume2[0x100];
-
-static uint8_t* nor_banks[0x20];
-static uint8_t* bbs_pages[0x10];
-
-static uint8_t* memmap[8];
-static nc1020_states_t nc1020_states;
-
-static size_t& version = nc1020_states.version;
-
-static uint16_t& reg_pc = nc1020_states.cpu.reg_pc;
-static uint8_t& reg_a = nc1020_states.cpu.reg_a;
-static uint8_t& reg_ps = nc1020_states.cpu.reg_ps;
-static uint8_t& reg_x = nc1020_states.cpu.reg_x;
-static uint8_t& reg_y = nc1020_states.cpu.reg_y;
-static uint8_t& reg_sp = nc1020_states.cpu.reg_sp;
-
-static uint8_t* ram_buff = nc1020_states.ram;
-static uint8_t* stack = ram_buff + 0x100;
-static uint8_t* ram_io = ram_buff;
-static uint8_t* ram_40 = ram_buff + 0x40;
-static uint8_t* ram_page0 = ram_buff;
-static uint8_t* ram_page1 = ram_buff + 0x2000;
-static uint8_t* ram_page2 = ram_buff + 0x4000;
-static uint8_t* ram_page3 = ram_buff + 0x6000;
-
-static uint8_t* clock_buff = nc1020_states.clock_data;
-static uint8_t& clock_flags = nc1020_states.clock_flags;
-
-static uint8_t* jg_wav_buff = nc1020_states.jg_wav_data;
-static uint8_t& jg_wav_flags = nc1020_states.jg_wav_flags;
-static uint8_t& jg_wav_index = nc1020_states.jg_wav_idx;
-static bool& jg_wav_playing = nc1020_states.jg_wav_playing;
-
-static uint8_t* bak_40 = nc1020_states.bak_40;
-static uint8_t& fp_step = nc1020_states.fp_step;
-static uint8_t& fp_type = nc1020_states.fp_type;
-static uint8_t& fp_bank_idx = nc1020_states.fp_bank_idx;
-static uint8_t& fp_bak1 = nc1020_states.fp_bak1;
-static uint8_t& fp_bak2 = nc1020_states.fp_bak2;
-static uint8_t* fp_buff = nc1020_states.fp_buff;
-
-static bool& slept = nc1020_states.slept;
-static bool& should_wake_up = nc1020_states.should_wake_up;
-static bool& wake_up_pending = nc1020_states.pending_wake_up;
-static uint8_t& wake_up_key = nc1020_states.wake_up_flags;
-
-static bool& should_irq = nc1020_states.should_irq;
-static bool& timer0_toggle = nc1020_states.timer0_toggle;
-static size_t& cycles = nc1020_states.cycles;
-static size_t& timer0_cycles = nc1020_states.timer0_cycles;
-static size_t& timer1_cycles = nc1020_states.timer1_cycles;
-
-static uint8_t* keypad_matrix = nc1020_states.keypad_matrix;
-static size_t& lcd_addr = nc1020_states.lcd_addr;
-
-static io_read_func_t io_read[0x40];
-static io_write_func_t io_write[0x40];
-
-uint8_t* GetBank(uint8_t bank_idx){
+
+uint8_t* Machine::GetBank(uint8_t bank_idx){
 	uint8_t volume_idx = ram_io[0x0D];
     if (bank_idx < 0x20) {
     	return nor_banks[bank_idx];
@@ -162,16 +27,21 @@ uint8_t* GetBank(uint8_t bank_idx){
     return NULL;
 }
 
-void SwitchBank(){
+void Machine::SwitchBank(){
 	uint8_t bank_idx = ram_io[0x00];
 	uint8_t* bank = GetBank(bank_idx);
     memmap[2] = bank;
     memmap[3] = bank + 0x2000;
     memmap[4] = bank + 0x4000;
     memmap[5] = bank + 0x6000;
+#ifdef NC1020_DEBUGGER
+	if (debugger) {
+		debugger->Map(this);
+	}
+#endif
 }
 
-uint8_t** GetVolumm(uint8_t volume_idx){
+uint8_t** Machine::GetVolumm(uint8_t volume_idx){
 	if ((volume_idx & 0x03) == 0x01) {
 		return rom_volume1;
 	} else if ((volume_idx & 0x03) == 0x03) {
@@ -181,7 +51,7 @@ uint8_t** GetVolumm(uint8_t volume_idx){
 	}
 }
 
-void SwitchVolume(){
+void Machine::SwitchVolume(){
 	uint8_t volume_idx = ram_io[0x0D];
     uint8_t** volume = GetVolumm(volume_idx);
     for (int i=0; i<4; i++) {
@@ -198,11 +68,101 @@ void SwitchVolume(){
     SwitchBank();
 }
 
-void GenerateAndPlayJGWav(){
+static const int16_t JG_AMPLITUDE = 0x1800;
+
+#ifdef NC1020_JG_PLACEHOLDER
+// the jg chip's command format is not documented, this is made up: every
+// byte of a command plays 1 / JG_TONES_PER_SECOND s of square wave at
+// JG_TONE_HZ / byte, 0 rests, so programs at least sound with their rhythm.
+static const size_t JG_TONE_HZ = 32768;
+static const size_t JG_TONES_PER_SECOND = 32;
+#endif
 
+void Machine::GenerateAndPlayJGWav(uint64_t cycle){
+#ifdef NC1020_JG_PLACEHOLDER
+	if (!audio_rate || speculating) {
+		return;
+	}
+	// queued behind what still plays.
+	uint64_t start = AudioSampleAt(cycle);
+	if (start < audio_sample) {
+		start = audio_sample;
+	}
+	if (!audio_tones.empty() && audio_tones.back().end > start) {
+		start = audio_tones.back().end;
+	}
+	uint64_t length = audio_rate / JG_TONES_PER_SECOND;
+	for (size_t i=0; i<jg_wav_index; i++) {
+		size_t hz = jg_wav_buff[i] ? JG_TONE_HZ / jg_wav_buff[i] : 0;
+		if (hz && hz < audio_rate / 2) {
+			jg_tone_t tone;
+			tone.start = start;
+			tone.end = start + length;
+			tone.phase = 0;
+			tone.step = (uint32_t)(((uint64_t)hz << 32) / audio_rate);
+			audio_tones.push_back(tone);
+		}
+		start += length;
+	}
+#else
+	// the chip is not emulated, the audio stays silent.
+	(void)cycle;
+#endif
 }
 
-uint8_t* GetPtr40(uint8_t index){
+uint64_t Machine::AudioSampleAt(uint64_t cycle){
+	return cycle > audio_origin ? (cycle - audio_origin) * audio_rate / CYCLES_SECOND : 0;
+}
+
+uint64_t Machine::AudioSampleCycle(uint64_t sample){
+	return audio_origin + sample * CYCLES_SECOND / audio_rate;
+}
+
+void Machine::ResetAudio(){
+	audio_origin = GetCycleCount();
+	audio_sample = 0;
+	audio_tones.clear();
+}
+
+void Machine::RenderAudio(){
+	uint64_t end = AudioSampleAt(GetCycleCount());
+	int16_t block[AudioRing::BLOCK_SAMPLES];
+	while (audio_sample < end) {
+		size_t count = end - audio_sample < AudioRing::BLOCK_SAMPLES ?
+			(size_t)(end - audio_sample) : AudioRing::BLOCK_SAMPLES;
+		size_t filled = 0;
+		while (filled < count) {
+			uint64_t at = audio_sample + filled;
+			while (!audio_tones.empty() && audio_tones.front().end <= at) {
+				audio_tones.pop_front();
+			}
+			if (audio_tones.empty() || audio_tones.front().start > at) {
+				size_t silent = count - filled;
+				if (!audio_tones.empty() && audio_tones.front().start - at < silent) {
+					silent = (size_t)(audio_tones.front().start - at);
+				}
+				memset(block + filled, 0, silent * sizeof(int16_t));
+				filled += silent;
+				continue;
+			}
+			jg_tone_t& tone = audio_tones.front();
+			size_t played = tone.end - at < count - filled ?
+				(size_t)(tone.end - at) : count - filled;
+			for (size_t i=0; i<played; i++) {
+				block[filled++] = tone.phase & 0x80000000u ? JG_AMPLITUDE : -JG_AMPLITUDE;
+				tone.phase += tone.step;
+			}
+		}
+		uint64_t cycle = AudioSampleCycle(audio_sample);
+		audio_ring.Push(cycle, AudioSampleCycle(audio_sample + count), block, count);
+		if (audio_listener) {
+			audio_listener(audio_listener_context, cycle, block, count);
+		}
+		audio_sample += count;
+	}
+}
+
+uint8_t* Machine::GetPtr40(uint8_t index){
     if (index < 4) {
         return ram_io;
     } else {
@@ -210,41 +170,58 @@ uint8_t* GetPtr40(uint8_t index){
     }
 }
 
-uint8_t IO_API ReadXX(uint8_t addr){
+uint32_t Machine::Locate(const uint8_t* cell) const {
+	uintptr_t address = (uintptr_t)cell;
+	if (address - (uintptr_t)ram_buff < 0x8000) {
+		return PHYS_RAM | (uint32_t)(address - (uintptr_t)ram_buff);
+	}
+	if (address - (uintptr_t)rom_buff < ROM_SIZE) {
+		return PHYS_ROM | (uint32_t)(address - (uintptr_t)rom_buff);
+	}
+	if (address - (uintptr_t)nor_buff < NOR_SIZE) {
+		return PHYS_NOR | (uint32_t)(address - (uintptr_t)nor_buff);
+	}
+	return 0;
+}
+
+uint8_t IO_API Machine::ReadXX(uint8_t addr){
 	return ram_io[addr];
 }
 
-uint8_t IO_API Read06(uint8_t addr){
+uint8_t IO_API Machine::Read06(uint8_t addr){
 	return ram_io[addr];
 }
 
-uint8_t IO_API Read3B(uint8_t addr){
+uint8_t IO_API Machine::Read3B(uint8_t addr){
     if (!(ram_io[0x3D] & 0x03)) {
         return clock_buff[0x3B] & 0xFE;
     }
     return ram_io[addr];
 }
 
-uint8_t IO_API Read3F(uint8_t addr){
+uint8_t IO_API Machine::Read3F(uint8_t addr){
     uint8_t idx = ram_io[0x3E];
     return idx < 80 ? clock_buff[idx] : 0;
 }
 
-void IO_API WriteXX(uint8_t addr, uint8_t value){
+void IO_API Machine::WriteXX(uint8_t addr, uint8_t value){
     ram_io[addr] = value;
 }
 
 
 // switch bank.
-void IO_API Write00(uint8_t addr, uint8_t value){
+void IO_API Machine::Write00(uint8_t addr, uint8_t value){
     uint8_t old_value = ram_io[addr];
     ram_io[addr] = value;
     if (value != old_value) {
     	SwitchBank();
+#ifdef NC1020_COUNTERS
+		counters.bank_switches[0]++;
+#endif
     }
 }
 
-void IO_API Write05(uint8_t addr, uint8_t value){
+void IO_API Machine::Write05(uint8_t addr, uint8_t value){
 	uint8_t old_value = ram_io[addr];
 	ram_io[addr] = value;
 	if ((old_value ^ value) & 0x08) {
@@ -252,21 +229,22 @@ void IO_API Write05(uint8_t addr, uint8_t value){
 	}
 }
 
-void IO_API Write06(uint8_t addr, uint8_t value){
+void IO_API Machine::Write06(uint8_t addr, uint8_t value){
     ram_io[addr] = value;
     if (!lcd_addr) {
     	lcd_addr = ((ram_io[0x0C] & 0x03) << 12) | (value << 4);
+    	MarkLcdDirty();
     }
     ram_io[0x09] &= 0xFE;
 }
 
-void IO_API Write08(uint8_t addr, uint8_t value){
+void IO_API Machine::Write08(uint8_t addr, uint8_t value){
     ram_io[addr] = value;
     ram_io[0x0B] &= 0xFE;
 }
 
 // keypad matrix.
-void IO_API Write09(uint8_t addr, uint8_t value){
+void IO_API Machine::Write09(uint8_t addr, uint8_t value){
     ram_io[addr] = value;
     switch (value){
     case 0x01: ram_io[0x08] = keypad_matrix[0]; break;
@@ -301,30 +279,44 @@ void IO_API Write09(uint8_t addr, uint8_t value){
 }
 
 // roabbs
-void IO_API Write0A(uint8_t addr, uint8_t value){
+void IO_API Machine::Write0A(uint8_t addr, uint8_t value){
     uint8_t old_value = ram_io[addr];
     ram_io[addr] = value;
     if (value != old_value) {
         memmap[6] = bbs_pages[value & 0x0F];
+#ifdef NC1020_COUNTERS
+		counters.bank_switches[1]++;
+#endif
+#ifdef NC1020_DEBUGGER
+		if (debugger) {
+			debugger->Map(this);
+		}
+#endif
     }
 }
 
 // switch volume
-void IO_API Write0D(uint8_t addr, uint8_t value){
+void IO_API Machine::Write0D(uint8_t addr, uint8_t value){
 	uint8_t old_value = ram_io[addr];
     ram_io[addr] = value;
     if (value != old_value) {
         SwitchVolume();
+#ifdef NC1020_COUNTERS
+		counters.bank_switches[2]++;
+#endif
     }
 }
 
 // zp40 switch
-void IO_API Write0F(uint8_t addr, uint8_t value){
+void IO_API Machine::Write0F(uint8_t addr, uint8_t value){
 	uint8_t old_value = ram_io[addr];
     ram_io[addr] = value;
     old_value &= 0x07;
     value &= 0x07;
     if (value != old_value) {
+#ifdef NC1020_COUNTERS
+		counters.bank_switches[3]++;
+#endif
         uint8_t* ptr_new = GetPtr40(value);
         if (old_value) {
             memcpy(GetPtr40(old_value), ram_40, 0x40);
@@ -336,7 +328,7 @@ void IO_API Write0F(uint8_t addr, uint8_t value){
     }
 }
 
-void IO_API Write20(uint8_t addr, uint8_t value){
+void IO_API Machine::Write20(uint8_t addr, uint8_t value){
     ram_io[addr] = value;
     if (value == 0x80 || value == 0x40) {
         memset(jg_wav_buff, 0, 0x20);
@@ -346,7 +338,7 @@ void IO_API Write20(uint8_t addr, uint8_t value){
     }
 }
 
-void IO_API Write23(uint8_t addr, uint8_t value){
+void IO_API Machine::Write23(uint8_t addr, uint8_t value){
     ram_io[addr] = value;
     if (value == 0xC2) {
         jg_wav_buff[jg_wav_index] = ram_io[0x22];
@@ -360,7 +352,7 @@ void IO_API Write23(uint8_t addr, uint8_t value){
         jg_wav_flags = 0;
         if (jg_wav_index) {
             if (!jg_wav_playing) {
-                GenerateAndPlayJGWav();
+                GenerateAndPlayJGWav(cycle_base + io_cycles);
                 jg_wav_index = 0;
             }
         }
@@ -371,7 +363,7 @@ void IO_API Write23(uint8_t addr, uint8_t value){
 }
 
 // clock.
-void IO_API Write3F(uint8_t addr, uint8_t value){
+void IO_API Machine::Write3F(uint8_t addr, uint8_t value){
     ram_io[addr] = value;
     uint8_t idx = ram_io[0x3E];
     if (idx >= 0x07) {
@@ -392,7 +384,7 @@ void IO_API Write3F(uint8_t addr, uint8_t value){
     }
 }
 
-void AdjustTime(){
+void Machine::AdjustTime(){
     if (++ clock_buff[0] >= 60) {
         clock_buff[0] = 0;
         if (++ clock_buff[1] >= 60) {
@@ -405,7 +397,7 @@ void AdjustTime(){
     }
 }
 
-bool IsCountDown(){
+bool Machine::IsCountDown(){
     if (!(clock_buff[10] & 0x02) ||
         !(clock_flags & 0x02)) {
         return false;
@@ -417,6 +409,136 @@ bool IsCountDown(){
         );
 }
 
+// seconds from now to the first second whose position in period lies in
+// [first, first + width).
+static uint64_t SecondsUntil(uint64_t now, uint64_t period, uint64_t first, uint64_t width){
+    uint64_t next = (now + 1) % period;
+    if (next >= first && next < first + width) {
+        return 1;
+    }
+    return (first + period - next) % period + 1;
+}
+
+// one field of the clock counted ticks times the way AdjustTime counts it,
+// in constant time: a value at or over limit rolls over on its next tick,
+// keeping the bits of keep, except 255 which wraps to 0 without a carry.
+// returns the carries into the next field.
+static uint64_t CountClockField(uint8_t* field, uint64_t ticks, uint8_t limit, uint8_t keep){
+    uint64_t carries = 0;
+    if (ticks && *field >= limit) {
+        uint8_t value = *field + 1;
+        if (value >= limit) {
+            *field = value & keep;
+            carries++;
+        } else {
+            *field = value;
+        }
+        ticks--;
+    }
+    if (*field >= limit) {
+        // hours of just bit 6 or 7: every tick carries a day and leaves
+        // them as they are.
+        return carries + ticks;
+    }
+    uint64_t total = *field + ticks;
+    *field = (uint8_t)(total % limit);
+    return carries + total / limit;
+}
+
+// AdjustTime run ticks times on clock.
+static void CountClock(uint8_t* clock, uint64_t ticks){
+    uint64_t minutes = CountClockField(&clock[0], ticks, 60, 0);
+    uint64_t hours = CountClockField(&clock[1], minutes, 60, 0);
+    uint64_t days = CountClockField(&clock[2], hours, 24, 0xC0);
+    clock[3] += (uint8_t)days;
+}
+
+// the fields IsCountDown compares, against the time in clock.
+static bool AlarmMatches(const uint8_t* clock){
+    return ((clock[7] & 0x80) && !((clock[7] ^ clock[2]) & 0x1F)) ||
+        ((clock[6] & 0x80) && !((clock[6] ^ clock[1]) & 0x3F)) ||
+        ((clock[5] & 0x80) && !((clock[5] ^ clock[0]) & 0x3F));
+}
+
+uint64_t Machine::SecondsToAlarm(){
+    if (!(clock_buff[10] & 0x02) ||
+        !(clock_flags & 0x02)) {
+        return 0;
+    }
+    // as IsCountDown: any set field matching goes off, checked every second.
+    uint8_t clock[8];
+    memcpy(clock, clock_buff, sizeof(clock));
+    uint64_t elapsed = 0;
+    if (clock[0] >= 60) {
+        CountClock(clock, 1);
+        elapsed = 1;
+        if (AlarmMatches(clock)) {
+            return elapsed;
+        }
+    }
+    // minutes out of range, and hours out of range but for the ones that
+    // stay put, settle at their next rollover. up to then a minute at a
+    // time: minute and hour hold while the seconds run up to 59, then one
+    // tick moves them on.
+    while (clock[1] >= 60 || (clock[2] >= 24 && (clock[2] & 0x3F))) {
+        uint64_t steady = 59 - clock[0];
+        uint64_t due = 0;
+        if (steady && (((clock[7] & 0x80) && !((clock[7] ^ clock[2]) & 0x1F)) ||
+            ((clock[6] & 0x80) && !((clock[6] ^ clock[1]) & 0x3F)))) {
+            due = 1;
+        }
+        uint64_t second = clock[5] & 0x3F;
+        if ((clock[5] & 0x80) && second > clock[0] && second < 60 &&
+            (!due || second - clock[0] < due)) {
+            due = second - clock[0];
+        }
+        if (due) {
+            return elapsed + due;
+        }
+        CountClock(clock, steady + 1);
+        elapsed += steady + 1;
+        if (AlarmMatches(clock)) {
+            return elapsed;
+        }
+    }
+    uint64_t second = clock[0];
+    uint64_t minute = clock[1];
+    uint64_t hour = clock[2];
+    uint64_t alarm = 0;
+    if ((clock[5] & 0x80) && (clock[5] & 0x3F) < 60) {
+        alarm = SecondsUntil(second, 60, clock[5] & 0x3F, 1);
+    }
+    if ((clock[6] & 0x80) && (clock[6] & 0x3F) < 60) {
+        uint64_t due = SecondsUntil(minute * 60 + second, 3600, (clock[6] & 0x3F) * 60, 60);
+        alarm = alarm && alarm < due ? alarm : due;
+    }
+    if ((clock[7] & 0x80) && hour >= 24) {
+        // hours of just bit 6 or 7 read as 0 for good.
+        if (!(clock[7] & 0x1F)) {
+            alarm = 1;
+        }
+    } else if ((clock[7] & 0x80) && (clock[7] & 0x1F) < 24) {
+        uint64_t due = SecondsUntil((hour * 60 + minute) * 60 + second, 86400,
+            (clock[7] & 0x1F) * 3600, 3600);
+        alarm = alarm && alarm < due ? alarm : due;
+    }
+    return alarm ? elapsed + alarm : 0;
+}
+
+void Machine::AdvanceClock(uint64_t seconds){
+    if (seconds == 0) {
+        return;
+    }
+    uint64_t alarm = SecondsToAlarm();
+    if (alarm && alarm <= seconds) {
+        // what ServiceTimers does on the timer0 event that finds it.
+        ram_io[0x3D] = 0x20;
+        clock_flags &= 0xFD;
+        should_irq = true;
+    }
+    CountClock(clock_buff, seconds);
+}
+
 /**
  * ProcessBinary
  * encrypt or decrypt wqx's binary file. just flip every bank.
@@ -430,46 +552,87 @@ void ProcessBinary(uint8_t* dest, uint8_t* src, size_t size){
     }
 }
 
-void LoadRom(){
+bool ReadRomImage(const string& path, uint8_t* rom_buff){
+	FILE* file = fopen(path.c_str(), "rb");
+	if (file == NULL) {
+		return false;
+	}
 	uint8_t* temp_buff = (uint8_t*)malloc(ROM_SIZE);
-	FILE* file = fopen(nc1020_rom.romPath.c_str(), "rb");
 	fread(temp_buff, 1, ROM_SIZE, file);
 	ProcessBinary(rom_buff, temp_buff, ROM_SIZE);
 	free(temp_buff);
 	fclose(file);
+	return true;
 }
 
-void LoadNor(){
-	uint8_t* temp_buff = (uint8_t*)malloc(NOR_SIZE);
+uint8_t* LoadRomImage(const string& path){
+	uint8_t* rom_buff = (uint8_t*)malloc(ROM_SIZE);
+	if (!ReadRomImage(path, rom_buff)) {
+		free(rom_buff);
+		return NULL;
+	}
+	return rom_buff;
+}
+
+void FreeRomImage(uint8_t* rom_buff){
+	free(rom_buff);
+}
+
+void Machine::LoadRom(){
+	ReadRomImage(nc1020_rom.romPath, rom_buff);
+}
+
+void Machine::LoadNor(){
 	FILE* file = fopen(nc1020_rom.norFlashPath.c_str(), "rb");
+	if (file == NULL) {
+		return;
+	}
+	uint8_t* temp_buff = (uint8_t*)malloc(NOR_SIZE);
 	fread(temp_buff, 1, NOR_SIZE, file);
 	ProcessBinary(nor_buff, temp_buff, NOR_SIZE);
 	free(temp_buff);
 	fclose(file);
 }
 
-void SaveNor(){
-	uint8_t* temp_buff = (uint8_t*)malloc(NOR_SIZE);
+bool Machine::SaveNor(){
+#ifdef NC1020_PHASES
+	Phase phase("SaveNor");
+#endif
 	FILE* file = fopen(nc1020_rom.norFlashPath.c_str(), "wb");
+	if (file == NULL) {
+		return false;
+	}
+	uint8_t* temp_buff = (uint8_t*)malloc(NOR_SIZE);
 	ProcessBinary(temp_buff, nor_buff, NOR_SIZE);
-	fwrite(temp_buff, 1, NOR_SIZE, file);
-	fflush(file);
+	bool ok = fwrite(temp_buff, 1, NOR_SIZE, file) == NOR_SIZE;
+	ok = fflush(file) == 0 && ok;
 	free(temp_buff);
-	fclose(file);
+	return fclose(file) == 0 && ok;
 }
 
-inline uint8_t & Peek(uint8_t addr) {
+inline uint8_t & Machine::Peek(uint8_t addr) {
 	return ram_buff[addr];
 }
-inline uint8_t & Peek(uint16_t addr) {
+inline uint8_t & Machine::Peek(uint16_t addr) {
 	return memmap[addr / 0x2000][addr % 0x2000];
 }
-inline uint16_t PeekW(uint16_t addr) {
+inline uint16_t Machine::PeekW(uint16_t addr) {
 	return Peek(addr) | (Peek((uint16_t) (addr + 1)) << 8);
 }
-inline uint8_t Load(uint16_t addr) {
+inline uint8_t Machine::Load(uint16_t addr) {
+#ifdef NC1020_DEBUGGER
+	if (read_pages & (1 << (addr >> 13))) {
+		debugger->Access(this, BREAK_READ, addr, Peek(addr));
+	}
+#endif
 	if (addr < IO_LIMIT) {
-		return io_read[addr](addr);
+#ifdef NC1020_COUNTERS
+		counters.io_reads++;
+#if NC1020_COUNTERS >= 2
+		counters.io_port_reads[addr]++;
+#endif
+#endif
+		return (this->*io_read[addr])(addr);
 	}
 	if (((fp_step == 4 && fp_type == 2) ||
 		(fp_step == 6 && fp_type == 3)) &&
@@ -483,18 +646,52 @@ inline uint8_t Load(uint16_t addr) {
 	}
 	return Peek(addr);
 }
-inline void Store(uint16_t addr, uint8_t value) {
+inline void Machine::StoreRam(uint8_t* cell, uint8_t value) {
+	*cell = value;
+	size_t offset = cell - ram_buff - lcd_addr;
+	if (offset < LCD_SIZE) {
+		size_t row = offset / LCD_ROW_BYTES;
+		lcd_dirty[row >> 3] |= 1 << (row & 7);
+		lcd_changed = true;
+		lcd_written = true;
+#ifdef NC1020_COUNTERS
+		counters.lcd_writes++;
+#endif
+	}
+}
+void Machine::BackupNor(size_t bank_idx) {
+	nor_saved |= 1u << bank_idx;
+	memcpy(&nor_backup[0x8000 * bank_idx], nor_banks[bank_idx], 0x8000);
+}
+inline void Machine::TouchNor(size_t bank_idx) {
+	if (speculating && !(nor_saved & (1u << bank_idx))) {
+		BackupNor(bank_idx);
+	}
+}
+inline void Machine::Store(uint16_t addr, uint8_t value, size_t cycles) {
+#ifdef NC1020_DEBUGGER
+	if (write_pages & (1 << (addr >> 13))) {
+		debugger->Access(this, BREAK_WRITE, addr, value);
+	}
+#endif
 	if (addr < IO_LIMIT) {
-		io_write[addr](addr, value);
+#ifdef NC1020_COUNTERS
+		counters.io_writes++;
+#if NC1020_COUNTERS >= 2
+		counters.io_port_writes[addr]++;
+#endif
+#endif
+		io_cycles = cycles;
+		(this->*io_write[addr])(addr, value);
 		return;
 	}
 	if (addr < 0x4000) {
-		Peek(addr) = value;
+		StoreRam(&Peek(addr), value);
 		return;
 	}
 	uint8_t* page = memmap[addr >> 13];
 	if (page == ram_page2 || page == ram_page3) {
-		page[addr & 0x1FFF] = value;
+		StoreRam(page + (addr & 0x1FFF), value);
 		return;
 	}
 	if (addr >= 0xE000) {
@@ -533,6 +730,9 @@ inline void Store(uint16_t addr, uint8_t value) {
         	case 0x78: fp_type = 6; break;
         	}
             if (fp_type) {
+#ifdef NC1020_COUNTERS
+                counters.flash_commands[fp_type]++;
+#endif
                 if (fp_type == 1) {
                     fp_bank_idx = bank_idx;
                     fp_bak1 = bank[0x4000];
@@ -545,12 +745,14 @@ inline void Store(uint16_t addr, uint8_t value) {
     } else if (fp_step == 3) {
         if (fp_type == 1) {
             if (value == 0xF0) {
+                TouchNor(bank_idx);
                 bank[0x4000] = fp_bak1;
                 bank[0x4001] = fp_bak2;
                 fp_step = 0;
                 return;
             }
         } else if (fp_type == 2) {
+            TouchNor(bank_idx);
             bank[addr - 0x4000] &= value;
             fp_step = 4;
             return;
@@ -574,6 +776,7 @@ inline void Store(uint16_t addr, uint8_t value) {
     } else if (fp_step == 5) {
         if (addr == 0x5555 && value == 0x10) {
         	for (size_t i=0; i<0x20; i++) {
+                TouchNor(i);
                 memset(nor_banks[i], 0xFF, 0x8000);
             }
             if (fp_type == 5) {
@@ -584,6 +787,7 @@ inline void Store(uint16_t addr, uint8_t value) {
         }
         if (fp_type == 3) {
             if (value == 0x30) {
+                TouchNor(bank_idx);
                 memset(bank + (addr - (addr % 0x800) - 0x4000), 0xFF, 0x800);
                 fp_step = 6;
                 return;
@@ -600,11 +804,113 @@ inline void Store(uint16_t addr, uint8_t value) {
         fp_step = 0;
         return;
     }
+    flash_errors++;
     printf("error occurs when operate in flash!");
 }
 
-void Initialize(WqxRom rom) {
-    nc1020_rom = rom;
+Machine::Machine(const WqxRom& rom, uint8_t* shared_rom) :
+	nc1020_rom(rom),
+	rom_buff(shared_rom),
+	owns_rom(shared_rom == NULL),
+	version(nc1020_states.version),
+	reg_pc(nc1020_states.cpu.reg_pc),
+	reg_a(nc1020_states.cpu.reg_a),
+	reg_ps(nc1020_states.cpu.reg_ps),
+	reg_x(nc1020_states.cpu.reg_x),
+	reg_y(nc1020_states.cpu.reg_y),
+	reg_sp(nc1020_states.cpu.reg_sp),
+	ram_buff(nc1020_states.ram),
+	stack(ram_buff + 0x100),
+	ram_io(ram_buff),
+	ram_40(ram_buff + 0x40),
+	ram_page0(ram_buff),
+	ram_page1(ram_buff + 0x2000),
+	ram_page2(ram_buff + 0x4000),
+	ram_page3(ram_buff + 0x6000),
+	clock_buff(nc1020_states.clock_data),
+	clock_flags(nc1020_states.clock_flags),
+	jg_wav_buff(nc1020_states.jg_wav_data),
+	jg_wav_flags(nc1020_states.jg_wav_flags),
+	jg_wav_index(nc1020_states.jg_wav_idx),
+	jg_wav_playing(nc1020_states.jg_wav_playing),
+	bak_40(nc1020_states.bak_40),
+	fp_step(nc1020_states.fp_step),
+	fp_type(nc1020_states.fp_type),
+	fp_bank_idx(nc1020_states.fp_bank_idx),
+	fp_bak1(nc1020_states.fp_bak1),
+	fp_bak2(nc1020_states.fp_bak2),
+	fp_buff(nc1020_states.fp_buff),
+	slept(nc1020_states.slept),
+	should_wake_up(nc1020_states.should_wake_up),
+	wake_up_pending(nc1020_states.pending_wake_up),
+	wake_up_key(nc1020_states.wake_up_flags),
+	should_irq(nc1020_states.should_irq),
+	timer0_toggle(nc1020_states.timer0_toggle),
+	cycles(nc1020_states.cycles),
+	timer0_cycles(nc1020_states.timer0_cycles),
+	timer1_cycles(nc1020_states.timer1_cycles),
+	keypad_matrix(nc1020_states.keypad_matrix),
+	lcd_addr(nc1020_states.lcd_addr),
+	speed_up(false),
+	cycle_base(0),
+	input_listener(NULL),
+	input_listener_context(NULL),
+	input_waiting(false),
+	low_power(false),
+	low_power_hold(0),
+	input_held(false),
+	clock_catch_up(false),
+	run_ahead_cycles(0),
+	speculating(false),
+	ahead_cycle_base(0),
+	ahead_low_power_hold(0),
+	nor_saved(0),
+	latency_tracking(false),
+	probing(false),
+	lcd_written(false),
+	ahead_written(false),
+	lcd_changed(false),
+	lcd_generation(0),
+	frame_listener(NULL),
+	frame_listener_context(NULL),
+	audio_rate(0),
+	audio_origin(0),
+	audio_sample(0),
+	audio_listener(NULL),
+	audio_listener_context(NULL),
+	io_cycles(0),
+	busy_ns(0),
+	saves(0),
+	last_save_ns(0),
+	save_errors(0),
+	flash_errors(0) {
+	memset(&nc1020_states, 0, sizeof(nc1020_states));
+	memset(memmap, 0, sizeof(memmap));
+	memset(ahead_frame, 0, sizeof(ahead_frame));
+	memset(&latency_stats, 0, sizeof(latency_stats));
+#ifdef NC1020_COUNTERS
+	memset(&counters, 0, sizeof(counters));
+#endif
+#ifdef NC1020_PROFILER
+	profiler = NULL;
+#endif
+#ifdef NC1020_TRACE
+	tracer = NULL;
+#endif
+#ifdef NC1020_DEBUGGER
+	debugger = NULL;
+	break_pages = 0;
+	read_pages = 0;
+	write_pages = 0;
+	inst_pc = 0;
+#endif
+	if (owns_rom) {
+		rom_buff = (uint8_t*)malloc(ROM_SIZE);
+	}
+	// the loop below has always set volume 1 twice and left volume 2 to
+	// the zeroes it had as a static. kept so, but zeroed: a heap Machine
+	// would otherwise map garbage for it.
+	memset(rom_volume2, 0, sizeof(rom_volume2));
 	for (size_t i=0; i<0x100; i++) {
 		rom_volume0[i] = rom_buff + (0x8000 * i);
 		rom_volume1[i] = rom_buff + (0x8000 * (0x100 + i));
@@ -614,43 +920,45 @@ void Initialize(WqxRom rom) {
 		nor_banks[i] = nor_buff + (0x8000 * i);
 	}
 	for (size_t i=0; i<0x40; i++) {
-		io_read[i] = ReadXX;
-		io_write[i] = WriteXX;
-	}
-	io_read[0x06] = Read06;
-	io_read[0x3B] = Read3B;
-	io_read[0x3F] = Read3F;
-	io_write[0x00] = Write00;
-	io_write[0x05] = Write05;
-	io_write[0x06] = Write06;
-	io_write[0x08] = Write08;
-	io_write[0x09] = Write09;
-	io_write[0x0A] = Write0A;
-	io_write[0x0D] = Write0D;
-	io_write[0x0F] = Write0F;
-	io_write[0x20] = Write20;
-	io_write[0x23] = Write23;
-	io_write[0x3F] = Write3F;
-
-	LoadRom();
-//#ifdef DEBUG
-//	FILE* file = fopen((nc1020_dir + "/wqxsimlogs.bin").c_str(), "rb");
-//	fseek(file, 0L, SEEK_END);
-//	size_t file_size = ftell(file);
-//	size_t insts_count = (file_size - 8) / 8;
-//	debug_logs.insts_count = insts_count;
-//	debug_logs.logs = (log_rec_t*)malloc(insts_count * 8);
-//	fseek(file, 0L, SEEK_SET);
-//	fread(&debug_logs.insts_start, 4, 1, file);
-//	fseek(file, 4L, SEEK_SET);
-//	fread(&debug_logs.peek_addr, 4, 1, file);
-//	fseek(file, 8L, SEEK_SET);
-//	fread(debug_logs.logs, 8, insts_count, file);
-//	fclose(file);
-//#endif
-}
-
-void ResetStates(){
+		io_read[i] = &Machine::ReadXX;
+		io_write[i] = &Machine::WriteXX;
+	}
+	io_read[0x06] = &Machine::Read06;
+	io_read[0x3B] = &Machine::Read3B;
+	io_read[0x3F] = &Machine::Read3F;
+	io_write[0x00] = &Machine::Write00;
+	io_write[0x05] = &Machine::Write05;
+	io_write[0x06] = &Machine::Write06;
+	io_write[0x08] = &Machine::Write08;
+	io_write[0x09] = &Machine::Write09;
+	io_write[0x0A] = &Machine::Write0A;
+	io_write[0x0D] = &Machine::Write0D;
+	io_write[0x0F] = &Machine::Write0F;
+	io_write[0x20] = &Machine::Write20;
+	io_write[0x23] = &Machine::Write23;
+	io_write[0x3F] = &Machine::Write3F;
+
+	if (owns_rom) {
+		LoadRom();
+	}
+}
+
+Machine::~Machine() {
+	if (owns_rom) {
+		free(rom_buff);
+	}
+#ifdef NC1020_PROFILER
+	delete profiler;
+#endif
+#ifdef NC1020_TRACE
+	delete tracer;
+#endif
+#ifdef NC1020_DEBUGGER
+	delete debugger;
+#endif
+}
+
+void Machine::ResetStates(){
 	version = VERSION;
 
 	memset(ram_buff, 0, 0x8000);
@@ -677,6 +985,11 @@ void ResetStates(){
 
 	should_irq = false;
 
+	cycle_base = 0;
+	low_power_hold = 0;
+	latency_probes.clear();
+	probing = false;
+	MarkLcdDirty();
 	cycles = 0;
 	reg_a = 0;
 	reg_ps = 0x24;
@@ -686,20 +999,22 @@ void ResetStates(){
 	reg_pc = PeekW(RESET_VEC);
 	timer0_cycles = CYCLES_TIMER0;
 	timer1_cycles = CYCLES_TIMER1;
-
-//#ifdef DEBUG
-//	executed_insts = 0;
-//	debug_done = false;
-//#endif
+	ResetAudio();
+#ifdef NC1020_PROFILER
+	if (profiler) {
+		profiler->Unwind();
+	}
+#endif
 }
 
-void Reset() {
+void Machine::Reset() {
 	LoadNor();
 	ResetStates();
 }
 
-void LoadStates(){
+void Machine::LoadStates(){
 	ResetStates();
+	input_schedule.clear();
 	FILE* file = fopen(nc1020_rom.statesPath.c_str(), "rb");
 	if (file == NULL) {
 		return;
@@ -710,26 +1025,174 @@ void LoadStates(){
 		return;
 	}
 	SwitchVolume();
+	MarkLcdDirty();
+	struct stat saved;
+	time_t now = time(NULL);
+	if (clock_catch_up && stat(nc1020_rom.statesPath.c_str(), &saved) == 0 &&
+		now > saved.st_mtime) {
+		AdvanceClock((uint64_t)(now - saved.st_mtime));
+	}
+	ResetAudio();
 }
 
-void SaveStates(){
+bool Machine::SaveStates(){
+#ifdef NC1020_PHASES
+	Phase phase("SaveStates");
+#endif
 	FILE* file = fopen(nc1020_rom.statesPath.c_str(), "wb");
-	fwrite(&nc1020_states, 1, sizeof(nc1020_states), file);
-	fflush(file);
-	fclose(file);
+	if (file == NULL) {
+		return false;
+	}
+	bool ok = fwrite(&nc1020_states, 1, sizeof(nc1020_states), file) == sizeof(nc1020_states);
+	ok = fflush(file) == 0 && ok;
+	return fclose(file) == 0 && ok;
 }
 
-void LoadNC1020(){
+void Machine::LoadNC1020(){
 	LoadNor();
 	LoadStates();
 }
 
-void SaveNC1020(){
-	SaveNor();
-	SaveStates();
+void Machine::SaveNC1020(){
+	uint64_t start = HostNanos();
+	save_errors += !SaveNor();
+	save_errors += !SaveStates();
+	last_save_ns = HostNanos() - start;
+	saves++;
+}
+
+bool Machine::SetKey(uint8_t key_id, bool down_or_up){
+#ifdef NC1020_PHASES
+	Phase phase("SetKey");
+#endif
+	key_input_t input;
+	input.cycle = 0;
+	input.host_ns = HostNanos();
+	input.key_id = key_id;
+	input.down_or_up = down_or_up;
+	if (!input_queue.Push(input)) {
+		return false;
+	}
+	// pairs with the fence in WaitForInput: either the waiter sees the key
+	// or this sees the waiter.
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (input_waiting.load(std::memory_order_relaxed)) {
+		std::lock_guard<std::mutex> lock(input_wait_mutex);
+		input_wait.notify_one();
+	}
+	return true;
+}
+
+void Machine::WaitForInput(std::chrono::steady_clock::time_point deadline){
+#ifdef NC1020_PHASES
+	Phase phase("WaitForInput");
+#endif
+	std::unique_lock<std::mutex> lock(input_wait_mutex);
+	input_waiting.store(true, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	while (input_queue.Empty() &&
+		input_wait.wait_until(lock, deadline) == std::cv_status::no_timeout) {
+	}
+	input_waiting.store(false, std::memory_order_relaxed);
+}
+
+void Machine::DrainInput(){
+	key_input_t input;
+	while (input_queue.Pop(&input)) {
+		ApplyKey(input.key_id, input.down_or_up);
+		ProbeKey(input.down_or_up, input.host_ns);
+	}
+}
+
+void Machine::ScheduleKey(uint64_t cycle, uint8_t key_id, bool down_or_up){
+	key_input_t input;
+	input.cycle = cycle;
+	input.host_ns = 0;
+	input.key_id = key_id;
+	input.down_or_up = down_or_up;
+	std::deque<key_input_t>::iterator it = input_schedule.end();
+	while (it != input_schedule.begin() && (it - 1)->cycle > cycle) {
+		--it;
+	}
+	input_schedule.insert(it, input);
 }
 
-void SetKey(uint8_t key_id, bool down_or_up){
+bool Machine::HasPendingInput(){
+	return !input_queue.Empty();
+}
+
+bool Machine::IsParked(){
+	return low_power && slept && !should_wake_up && (input_held || input_queue.Empty()) &&
+		GetCycleCount() >= low_power_hold;
+}
+
+uint64_t Machine::ParkedCycles(uint64_t max_cycles){
+	if (!input_schedule.empty() &&
+		input_schedule.front().cycle < GetCycleCount() + max_cycles) {
+		max_cycles = input_schedule.front().cycle > GetCycleCount() ?
+			input_schedule.front().cycle - GetCycleCount() : 0;
+	}
+	// the rtc ticks on the timer0 events that clear the toggle.
+	uint64_t alarm = SecondsToAlarm();
+	if (alarm) {
+		uint64_t event = timer0_cycles +
+			((alarm - 1) * 2 + (timer0_toggle ? 0 : 1)) * CYCLES_TIMER0;
+		uint64_t parked = event > cycles ? event - cycles : 0;
+		if (parked < max_cycles) {
+			return parked;
+		}
+	}
+	return max_cycles;
+}
+
+void Machine::SkipSlept(size_t end_cycles){
+	size_t events = timer0_cycles < end_cycles ?
+		(end_cycles - 1 - timer0_cycles) / CYCLES_TIMER0 + 1 : 0;
+	// the rtc ticks on the timer0 events that clear the toggle.
+	size_t seconds = (events + (timer0_toggle ? 1 : 0)) / 2;
+	uint64_t alarm = SecondsToAlarm();
+	if (alarm && alarm <= seconds) {
+		// the event itself is left to ServiceTimers, the guest then runs
+		// for a timer0 period before it may be skipped again.
+		seconds = (size_t)alarm - 1;
+		events = seconds * 2 + (timer0_toggle ? 0 : 1);
+		end_cycles = timer0_cycles + events * CYCLES_TIMER0;
+		low_power_hold = cycle_base + end_cycles + CYCLES_TIMER0;
+	}
+#ifdef NC1020_COUNTERS
+	counters.timer0_events += events;
+	counters.idle_cycles += cycles < end_cycles ? end_cycles - cycles : 0;
+#endif
+	if (events) {
+		timer0_cycles += events * CYCLES_TIMER0;
+		timer0_toggle = timer0_toggle != (events % 2 == 1);
+		AdvanceClock(seconds);
+		ram_io[0x3D] = 0;
+		should_irq = true;
+	}
+	size_t timer1_period = speed_up ? CYCLES_TIMER1_SPEED_UP : CYCLES_TIMER1;
+	if (timer1_cycles < end_cycles) {
+		size_t ticks = (end_cycles - 1 - timer1_cycles) / timer1_period + 1;
+		timer1_cycles += ticks * timer1_period;
+#ifdef NC1020_COUNTERS
+		counters.timer1_events += ticks;
+#endif
+		clock_buff[4] += (uint8_t)ticks;
+		ram_io[0x01] |= 0x08;
+		should_irq = true;
+	}
+	if (cycles < end_cycles) {
+		cycles = end_cycles;
+	}
+}
+
+void Machine::ApplyKey(uint8_t key_id, bool down_or_up){
+#ifdef NC1020_PHASES
+	Phase phase("ApplyKey");
+#endif
+	if (input_listener && !speculating) {
+		input_listener(input_listener_context, GetCycleCount(), key_id, down_or_up);
+	}
 	uint8_t row = key_id % 8;
 	uint8_t col = key_id / 8;
 	uint8_t bits = 1 << col;
@@ -767,67 +1230,179 @@ void SetKey(uint8_t key_id, bool down_or_up){
 	}
 }
 
-bool CopyLcdBuffer(uint8_t* buffer){
+static const size_t SNAPSHOT_SIZE = sizeof(nc1020_states_t) + sizeof(uint64_t) + NOR_SIZE;
+
+void Machine::SaveSnapshot(uint8_t* snapshot){
+	// cycles counted from the instruction boundary itself, so the same
+	// point of the emulation gives the same snapshot however it was sliced.
+	size_t rebased[3] = {0, timer0_cycles - cycles, timer1_cycles - cycles};
+	memcpy(snapshot, &nc1020_states, sizeof(nc1020_states));
+	memcpy(snapshot + offsetof(nc1020_states_t, cycles), &rebased[0], sizeof(size_t));
+	memcpy(snapshot + offsetof(nc1020_states_t, timer0_cycles), &rebased[1], sizeof(size_t));
+	memcpy(snapshot + offsetof(nc1020_states_t, timer1_cycles), &rebased[2], sizeof(size_t));
+	snapshot += sizeof(nc1020_states);
+	uint64_t base = GetCycleCount();
+	memcpy(snapshot, &base, sizeof(base));
+	snapshot += sizeof(base);
+	memcpy(snapshot, nor_buff, NOR_SIZE);
+}
+
+void Machine::LoadSnapshot(const uint8_t* snapshot){
+	memcpy(&nc1020_states, snapshot, sizeof(nc1020_states));
+	snapshot += sizeof(nc1020_states);
+	memcpy(&cycle_base, snapshot, sizeof(cycle_base));
+	snapshot += sizeof(cycle_base);
+	memcpy(nor_buff, snapshot, NOR_SIZE);
+	input_schedule.clear();
+	low_power_hold = 0;
+	latency_probes.clear();
+	probing = false;
+	memmap[0] = ram_page0;
+	SwitchVolume();
+	MarkLcdDirty();
+	ResetAudio();
+}
+
+bool Machine::CopyLcdBuffer(uint8_t* buffer){
+#ifdef NC1020_PHASES
+	Phase phase("CopyLcdBuffer");
+#endif
 	if (lcd_addr == 0) return false;
 	memcpy(buffer, ram_buff + lcd_addr, 1600);
 	return true;
 }
 
-void RunTimeSlice(size_t time_slice, bool speed_up) {
-	size_t end_cycles = time_slice * CYCLES_MS;
-	register size_t cycles = wqx::cycles;
-	register uint16_t reg_pc = wqx::reg_pc;
-	register uint8_t reg_a = wqx::reg_a;
-	register uint8_t reg_ps = wqx::reg_ps;
-	register uint8_t reg_x = wqx::reg_x;
-	register uint8_t reg_y = wqx::reg_y;
-	register uint8_t reg_sp = wqx::reg_sp;
+void Machine::MarkLcdDirty(){
+	memset(lcd_dirty, 0xFF, sizeof(lcd_dirty));
+	lcd_changed = true;
+}
 
-	while (cycles < end_cycles) {
-//#ifdef DEBUG
-//		if (executed_insts == 2792170) {
-//			printf("debug start!\n");
-//		}
-//		if (executed_insts >= debug_logs.insts_start &&
-//			executed_insts < debug_logs.insts_start + debug_logs.insts_count) {
-//			log_rec_t& log = debug_logs.logs[executed_insts - debug_logs.insts_start];
-//			string debug_info;
-//			if (log.reg_pc != reg_pc) {
-//				debug_info += " pc ";
-//			}
-//			if (log.reg_a != reg_a) {
-//				debug_info += " a ";
-//			}
-//			if (log.reg_ps != reg_ps) {
-//				debug_info += " ps ";
-//			}
-//			if (log.reg_x != reg_x) {
-//				debug_info += " x ";
-//			}
-//			if (log.reg_y != reg_y) {
-//				debug_info += " y ";
-//			}
-//			if (log.reg_sp != reg_sp) {
-//				debug_info += " sp ";
-//			}
-//			if (debug_logs.peek_addr != -1) {
-//				if (log.peeked != Peek((uint16_t)debug_logs.peek_addr)) {
-//					debug_info += " mem ";
-//				}
-//			} else {
-//				if (log.peeked != Peek(reg_pc)) {
-//					debug_info += " op ";
-//				}
-//			}
-//			if (debug_info.length()) {
-//				printf("%d: %s\n", executed_insts, debug_info.c_str());
-//				exit(-1);
-//			}
-//		}
-//		if (executed_insts >= debug_logs.insts_start + debug_logs.insts_count) {
-//			printf("ok\n");
-//		}
-//#endif
+bool Machine::CopyLcdBufferIfChanged(uint8_t* buffer, uint8_t* dirty_rows){
+#ifdef NC1020_PHASES
+	Phase phase("CopyLcdBufferIfChanged");
+#endif
+	if (lcd_addr == 0) return false;
+	uint8_t any = 0;
+	for (size_t i=0; i<LCD_DIRTY_BYTES; i++) {
+		any |= lcd_dirty[i];
+	}
+	if (!any) return false;
+	const uint8_t* lcd = ram_buff + lcd_addr;
+	for (size_t row=0; row<LCD_HEIGHT; row++) {
+		if (lcd_dirty[row >> 3] & (1 << (row & 7))) {
+			memcpy(buffer + row * LCD_ROW_BYTES, lcd + row * LCD_ROW_BYTES, LCD_ROW_BYTES);
+		}
+	}
+	if (dirty_rows) {
+		memcpy(dirty_rows, lcd_dirty, LCD_DIRTY_BYTES);
+	}
+	memset(lcd_dirty, 0, LCD_DIRTY_BYTES);
+	return true;
+}
+
+void Machine::ServiceTimers() {
+	if (cycles >= timer0_cycles) {
+#ifdef NC1020_COUNTERS
+		counters.timer0_events++;
+#endif
+		timer0_cycles += CYCLES_TIMER0;
+		timer0_toggle = !timer0_toggle;
+		if (!timer0_toggle) {
+			AdjustTime();
+		}
+		if (!IsCountDown() || timer0_toggle) {
+			ram_io[0x3D] = 0;
+		} else {
+			ram_io[0x3D] = 0x20;
+			clock_flags &= 0xFD;
+		}
+		should_irq = true;
+	}
+	if (should_irq && !(reg_ps & 0x04)) {
+		should_irq = false;
+		stack[reg_sp --] = reg_pc >> 8;
+		stack[reg_sp --] = reg_pc & 0xFF;
+		reg_ps &= 0xEF;
+		stack[reg_sp --] = reg_ps;
+		reg_pc = PeekW(IRQ_VEC);
+		reg_ps |= 0x04;
+		cycles += 7;
+#ifdef NC1020_COUNTERS
+		counters.irqs++;
+#endif
+#ifdef NC1020_PROFILER
+		if (profiler) {
+			profiler->Interrupt(reg_pc, reg_sp + 3u, 7);
+		}
+#endif
+	}
+	if (cycles >= timer1_cycles) {
+#ifdef NC1020_COUNTERS
+		counters.timer1_events++;
+#endif
+		if (speed_up) {
+			timer1_cycles += CYCLES_TIMER1_SPEED_UP;
+		} else {
+			timer1_cycles += CYCLES_TIMER1;
+		}
+		clock_buff[4] ++;
+		if (should_wake_up) {
+			should_wake_up = false;
+			ram_io[0x01] |= 0x01;
+			ram_io[0x02] |= 0x01;
+			reg_pc = PeekW(RESET_VEC);
+#ifdef NC1020_PROFILER
+			if (profiler) {
+				profiler->Unwind();
+			}
+#endif
+		} else {
+			ram_io[0x01] |= 0x08;
+			should_irq = true;
+		}
+	}
+}
+
+size_t Machine::Execute(size_t end_cycles, size_t max_insts) {
+	size_t insts = 0;
+	register size_t cycles = this->cycles;
+	register uint16_t reg_pc = this->reg_pc;
+	register uint8_t reg_a = this->reg_a;
+	register uint8_t reg_ps = this->reg_ps;
+	register uint8_t reg_x = this->reg_x;
+	register uint8_t reg_y = this->reg_y;
+	register uint8_t reg_sp = this->reg_sp;
+#ifdef NC1020_DEBUGGER
+	if (debugger) {
+		debugger->Resume(this);
+	}
+#endif
+
+	while (cycles < end_cycles && insts < max_insts) {
+#ifdef NC1020_DEBUGGER
+		inst_pc = reg_pc;
+		if (break_pages & (1 << (reg_pc >> 13))) {
+			this->cycles = cycles;
+			this->reg_pc = reg_pc;
+			this->reg_a = reg_a;
+			this->reg_ps = reg_ps;
+			this->reg_x = reg_x;
+			this->reg_y = reg_y;
+			this->reg_sp = reg_sp;
+			if (debugger->Check(this)) {
+				break;
+			}
+		}
+#endif
+#ifdef NC1020_TRACE
+		if (tracer) {
+			tracer->Record(reg_pc, reg_a, reg_ps, reg_x, reg_y, reg_sp);
+		}
+#endif
+#ifdef NC1020_PROFILER
+		uint16_t profiled_pc = reg_pc;
+		size_t profiled_cycles = cycles;
+#endif
 		switch (Peek(reg_pc++)) {
 		case 0x00: {
 			reg_pc++;
@@ -872,7 +1447,7 @@ void RunTimeSlice(size_t time_slice, bool speed_up) {
 			reg_ps |= (tmp1 >> 7);
 			tmp1 <<= 1;
 			reg_ps |= (tmp1 & 0x80) | (!tmp1 << 1);
-			Store(addr, tmp1);
+			Store(addr, tmp1, cycles);
 			cycles += 5;
 		}
 			break;
@@ -923,7 +1498,7 @@ void RunTimeSlice(size_t time_slice, bool speed_up) {
 			reg_ps |= (tmp1 >> 7);
 			tmp1 <<= 1;
 			reg_ps |= (tmp1 & 0x80) | (!tmp1 << 1);
-			Store(addr, tmp1);
+			Store(addr, tmp1, cycles);
 			cycles += 6;
 		}
 			break;
@@ -975,7 +1550,7 @@ void RunTimeSlice(size_t time_slice, bool speed_up) {
 			reg_ps |= (tmp1 >> 7);
 			tmp1 <<= 1;
 			reg_ps |= (tmp1 & 0x80) | (!tmp1 << 1);
-			Store(addr, tmp1);
+			Store(addr, tmp1, cycles);
 			cycles += 6;
 		}
 			break;
@@ -1027,7 +1602,7 @@ void RunTimeSlice(size_t time_slice, bool speed_up) {
 			reg_ps |= (tmp1 >> 7);
 			tmp1 <<= 1;
 			reg_ps |= (tmp1 & 0x80) | (!tmp1 << 1);
-			Store(addr, tmp1);
+			Store(addr, tmp1, cycles);
 			cycles += 6;
 		}
 			break;
@@ -1080,7 +1655,7 @@ void RunTimeSlice(size_t time_slice, bool speed_up) {
 			uint8_t tmp2 = (tmp1 << 1) | (reg_ps & 0x01);
 			reg_ps &= 0x7C;
 			reg_ps |= (tmp2 & 0x80) | (!tmp2 << 1) | (tmp1 >> 7);
-			Store(addr, tmp2);
+			Store(addr, tmp2, cycles);
 			cycles += 5;
 		}
 			break;
@@ -1136,7 +1711,7 @@ void RunTimeSlice(size_t time_slice, bool speed_up) {
 			uint8_t tmp2 = (tmp1 << 1) | (reg_ps & 0x01);
 			reg_ps &= 0x7C;
 			reg_ps |= (tmp2 & 0x80) | (!tmp2 << 1) | (tmp1 >> 7);
-			Store(addr, tmp2);
+			Store(addr, tmp2, cycles);
 			cycles += 6;
 		}
 			break;
@@ -1187,7 +1762,7 @@ void RunTimeSlice(size_t time_slice, bool speed_up) {
 			uint8_t tmp2 = (tmp1 << 1) | (reg_ps & 0x01);
 			reg_ps &= 0x7C;
 			reg_ps |= (tmp2 & 0x80) | (!tmp2 << 1) | (tmp1 >> 7);
-			Store(addr, tmp2);
+			Store(addr, tmp2, cycles);
 			cycles += 6;
 		}
 			break;
@@ -1238,7 +1813,7 @@ void RunTimeSlice(size_t time_slice, bool speed_up) {
 			uint8_t tmp2 = (tmp1 << 1) | (reg_ps & 0x01);
 			reg_ps &= 0x7C;
 			reg_ps |= (tmp2 & 0x80) | (!tmp2 << 1) | (tmp1 >> 7);
-			Store(addr, tmp2);
+			Store(addr, tmp2, cycles);
 			cycles += 6;
 		}
 			break;
@@ -1284,7 +1859,7 @@ void RunTimeSlice(size_t time_slice, bool speed_up) {
 			reg_ps |= (tmp1 & 0x01);
 			tmp1 >>= 1;
 			reg_ps |= (!tmp1 << 1);
-			Store(addr, tmp1);
+			Store(addr, tmp1, cycles);
 			cycles += 5;
 		}
 			break;
@@ -1339,7 +1914,7 @@ void RunTimeSlice(size_t time_slice, bool speed_up) {
 			reg_ps |= (tmp1 & 0x01);
 			tmp1 >>= 1;
 			reg_ps |= (!tmp1 << 1);
-			Store(addr, tmp1);
+			Store(addr, tmp1, cycles);
 			cycles += 6;
 		}
 			break;
@@ -1391,7 +1966,7 @@ void RunTimeSlice(size_t time_slice, bool speed_up) {
 			reg_ps |= (tmp1 & 0x01);
 			tmp1 >>= 1;
 			reg_ps |= (!tmp1 << 1);
-			Store(addr, tmp1);
+			Store(addr, tmp1, cycles);
 			cycles += 6;
 		}
 			break;
@@ -1443,7 +2018,7 @@ void RunTimeSlice(size_t time_slice, bool speed_up) {
 			reg_ps |= (tmp1 & 0x01);
 			tmp1 >>= 1;
 			reg_ps |= (!tmp1 << 1);
-			Store(addr, tmp1);
+			Store(addr, tmp1, cycles);
 			cycles += 6;
 		}
 			break;
@@ -1496,7 +2071,7 @@ void RunTimeSlice(size_t time_slice, bool speed_up) {
 			uint8_t tmp2 = (tmp1 >> 1) | ((reg_ps & 0x01) << 7);
 			reg_ps &= 0x7C;
 			reg_ps |= (tmp2 & 0x80) | (!tmp2 << 1) | (tmp1 & 0x01);
-			Store(addr, tmp2);
+			Store(addr, tmp2, cycles);
 			cycles += 5;
 		}
 			break;
@@ -1560,7 +2135,7 @@ void RunTimeSlice(size_t time_slice, bool speed_up) {
 			uint8_t tmp2 = (tmp1 >> 1) | ((reg_ps & 0x01) << 7);
 			reg_ps &= 0x7C;
 			reg_ps |= (tmp2 & 0x80) | (!tmp2 << 1) | (tmp1 & 0x01);
-			Store(addr, tmp2);
+			Store(addr, tmp2, cycles);
 			cycles += 6;
 		}
 			break;
@@ -1619,7 +2194,7 @@ void RunTimeSlice(size_t time_slice, bool speed_up) {
 			uint8_t tmp2 = (tmp1 >> 1) | ((reg_ps & 0x01) << 7);
 			reg_ps &= 0x7C;
 			reg_ps |= (tmp2 & 0x80) | (!tmp2 << 1) | (tmp1 & 0x01);
-			Store(addr, tmp2);
+			Store(addr, tmp2, cycles);
 			cycles += 6;
 		}
 			break;
@@ -1678,7 +2253,7 @@ void RunTimeSlice(size_t time_slice, bool speed_up) {
 			uint8_t tmp2 = (tmp1 >> 1) | ((reg_ps & 0x01) << 7);
 			reg_ps &= 0x7C;
 			reg_ps |= (tmp2 & 0x80) | (!tmp2 << 1) | (tmp1 & 0x01);
-			Store(addr, tmp2);
+			Store(addr, tmp2, cycles);
 			cycles += 6;
 		}
 			break;
@@ -1690,7 +2265,7 @@ void RunTimeSlice(size_t time_slice, bool speed_up) {
 			break;
 		case 0x81: {
 			uint16_t addr = PeekW((Peek(reg_pc++) + reg_x) & 0xFF);
-			Store(addr, reg_a);
+			Store(addr, reg_a, cycles);
 			cycles += 6;
 		}
 			break;
@@ -1702,19 +2277,19 @@ void RunTimeSlice(size_t time_slice, bool speed_up) {
 			break;
 		case 0x84: {
 			uint16_t addr = Peek(reg_pc++);
-			Store(addr, reg_y);
+			Store(addr, reg_y, cycles);
 			cycles += 3;
 		}
 			break;
 		case 0x85: {
 			uint16_t addr = Peek(reg_pc++);
-			Store(addr, reg_a);
+			Store(addr, reg_a, cycles);
 			cycles += 3;
 		}
 			break;
 		case 0x86: {
 			uint16_t addr = Peek(reg_pc++);
-			Store(addr, reg_x);
+			Store(addr, reg_x, cycles);
 			cycles += 3;
 		}
 			break;
@@ -1744,21 +2319,21 @@ void RunTimeSlice(size_t time_slice, bool speed_up) {
 		case 0x8C: {
 			uint16_t addr = PeekW(reg_pc);
 			reg_pc += 2;
-			Store(addr, reg_y);
+			Store(addr, reg_y, cycles);
 			cycles += 4;
 		}
 			break;
 		case 0x8D: {
 			uint16_t addr = PeekW(reg_pc);
 			reg_pc += 2;
-			Store(addr, reg_a);
+			Store(addr, reg_a, cycles);
 			cycles += 4;
 		}
 			break;
 		case 0x8E: {
 			uint16_t addr = PeekW(reg_pc);
 			reg_pc += 2;
-			Store(addr, reg_x);
+			Store(addr, reg_x, cycles);
 			cycles += 4;
 		}
 			break;
@@ -1779,7 +2354,7 @@ void RunTimeSlice(size_t time_slice, bool speed_up) {
 			uint16_t addr = PeekW(Peek(reg_pc));
 			addr += reg_y;
 			reg_pc++;
-			Store(addr, reg_a);
+			Store(addr, reg_a, cycles);
 			cycles += 6;
 		}
 			break;
@@ -1791,19 +2366,19 @@ void RunTimeSlice(size_t time_slice, bool speed_up) {
 			break;
 		case 0x94: {
 			uint16_t addr = (Peek(reg_pc++) + reg_x) & 0xFF;
-			Store(addr, reg_y);
+			Store(addr, reg_y, cycles);
 			cycles += 4;
 		}
 			break;
 		case 0x95: {
 			uint16_t addr = (Peek(reg_pc++) + reg_x) & 0xFF;
-			Store(addr, reg_a);
+			Store(addr, reg_a, cycles);
 			cycles += 4;
 		}
 			break;
 		case 0x96: {
 			uint16_t addr = (Peek(reg_pc++) + reg_y) & 0xFF;
-			Store(addr, reg_x);
+			Store(addr, reg_x, cycles);
 			cycles += 4;
 		}
 			break;
@@ -1821,7 +2396,7 @@ void RunTimeSlice(size_t time_slice, bool speed_up) {
 			uint16_t addr = PeekW(reg_pc);
 			addr += reg_y;
 			reg_pc += 2;
-			Store(addr, reg_a);
+			Store(addr, reg_a, cycles);
 			cycles += 5;
 		}
 			break;
@@ -1840,7 +2415,7 @@ void RunTimeSlice(size_t time_slice, bool speed_up) {
 			uint16_t addr = PeekW(reg_pc);
 			addr += reg_x;
 			reg_pc += 2;
-			Store(addr, reg_a);
+			Store(addr, reg_a, cycles);
 			cycles += 5;
 		}
 			break;
@@ -2120,7 +2695,7 @@ void RunTimeSlice(size_t time_slice, bool speed_up) {
 		case 0xC6: {
 			uint16_t addr = Peek(reg_pc++);
 			uint8_t tmp1 = Load(addr) - 1;
-			Store(addr, tmp1);
+			Store(addr, tmp1, cycles);
 			reg_ps &= 0x7D;
 			reg_ps |= (tmp1 & 0x80) | (!tmp1 << 1);
 			cycles += 5;
@@ -2179,7 +2754,7 @@ void RunTimeSlice(size_t time_slice, bool speed_up) {
 			uint16_t addr = PeekW(reg_pc);
 			reg_pc += 2;
 			uint8_t tmp1 = Load(addr) - 1;
-			Store(addr, tmp1);
+			Store(addr, tmp1, cycles);
 			reg_ps &= 0x7D;
 			reg_ps |= (tmp1 & 0x80) | (!tmp1 << 1);
 			cycles += 6;
@@ -2231,7 +2806,7 @@ void RunTimeSlice(size_t time_slice, bool speed_up) {
 		case 0xD6: {
 			uint16_t addr = (Peek(reg_pc++) + reg_x) & 0xFF;
 			uint8_t tmp1 = Load(addr) - 1;
-			Store(addr, tmp1);
+			Store(addr, tmp1, cycles);
 			reg_ps &= 0x7D;
 			reg_ps |= (tmp1 & 0x80) | (!tmp1 << 1);
 			cycles += 6;
@@ -2283,7 +2858,7 @@ void RunTimeSlice(size_t time_slice, bool speed_up) {
 			addr += reg_x;
 			reg_pc += 2;
 			uint8_t tmp1 = Load(addr) - 1;
-			Store(addr, tmp1);
+			Store(addr, tmp1, cycles);
 			reg_ps &= 0x7D;
 			reg_ps |= (tmp1 & 0x80) | (!tmp1 << 1);
 			cycles += 6;
@@ -2343,7 +2918,7 @@ void RunTimeSlice(size_t time_slice, bool speed_up) {
 		case 0xE6: {
 			uint16_t addr = Peek(reg_pc++);
 			uint8_t tmp1 = Load(addr) + 1;
-			Store(addr, tmp1);
+			Store(addr, tmp1, cycles);
 			reg_ps &= 0x7D;
 			reg_ps |= (tmp1 & 0x80) | (!tmp1 << 1);
 			cycles += 5;
@@ -2405,7 +2980,7 @@ void RunTimeSlice(size_t time_slice, bool speed_up) {
 			uint16_t addr = PeekW(reg_pc);
 			reg_pc += 2;
 			uint8_t tmp1 = Load(addr) + 1;
-			Store(addr, tmp1);
+			Store(addr, tmp1, cycles);
 			reg_ps &= 0x7D;
 			reg_ps |= (tmp1 & 0x80) | (!tmp1 << 1);
 			cycles += 6;
@@ -2463,7 +3038,7 @@ void RunTimeSlice(size_t time_slice, bool speed_up) {
 		case 0xF6: {
 			uint16_t addr = (Peek(reg_pc++) + reg_x) & 0xFF;
 			uint8_t tmp1 = Load(addr) + 1;
-			Store(addr, tmp1);
+			Store(addr, tmp1, cycles);
 			reg_ps &= 0x7D;
 			reg_ps |= (tmp1 & 0x80) | (!tmp1 << 1);
 			cycles += 6;
@@ -2521,7 +3096,7 @@ void RunTimeSlice(size_t time_slice, bool speed_up) {
 			addr += reg_x;
 			reg_pc += 2;
 			uint8_t tmp1 = Load(addr) + 1;
-			Store(addr, tmp1);
+			Store(addr, tmp1, cycles);
 			reg_ps &= 0x7D;
 			reg_ps |= (tmp1 & 0x80) | (!tmp1 << 1);
 			cycles += 6;
@@ -2531,86 +3106,473 @@ void RunTimeSlice(size_t time_slice, bool speed_up) {
 		}
 			break;
 		}
-//#ifdef DEBUG
-//		if (should_irq && !(reg_ps & 0x04)) {
-//			should_irq = false;
-//			stack[reg_sp --] = reg_pc >> 8;
-//			stack[reg_sp --] = reg_pc & 0xFF;
-//			reg_ps &= 0xEF;
-//			stack[reg_sp --] = reg_ps;
-//			reg_pc = PeekW(IRQ_VEC);
-//			reg_ps |= 0x04;
-//			cycles += 7;
-//		}
-//		executed_insts ++;
-//		if (executed_insts % 6000 == 0) {
-//			timer1_cycles += CYCLES_TIMER1;
-//			clock_buff[4] ++;
-//			if (should_wake_up) {
-//				should_wake_up = false;
-//				ram_io[0x01] |= 0x01;
-//				ram_io[0x02] |= 0x01;
-//				reg_pc = PeekW(RESET_VEC);
-//			} else {
-//				ram_io[0x01] |= 0x08;
-//				should_irq = true;
-//			}
-//		}
-//#else
-		if (cycles >= timer0_cycles) {
-			timer0_cycles += CYCLES_TIMER0;
-			timer0_toggle = !timer0_toggle;
-			if (!timer0_toggle) {
-				AdjustTime();
+#ifdef NC1020_PROFILER
+		if (profiler) {
+			profiler->Retire(profiled_pc, cycles - profiled_cycles, reg_pc, reg_sp);
+		}
+#endif
+		if (cycles >= timer0_cycles || cycles >= timer1_cycles ||
+			(should_irq && !(reg_ps & 0x04))) {
+			this->cycles = cycles;
+			this->reg_pc = reg_pc;
+			this->reg_ps = reg_ps;
+			this->reg_sp = reg_sp;
+			ServiceTimers();
+			cycles = this->cycles;
+			reg_pc = this->reg_pc;
+			reg_ps = this->reg_ps;
+			reg_sp = this->reg_sp;
+		}
+		insts++;
+	}
+
+	this->cycles = cycles;
+	this->reg_pc = reg_pc;
+	this->reg_a = reg_a;
+	this->reg_ps = reg_ps;
+	this->reg_x = reg_x;
+	this->reg_y = reg_y;
+	this->reg_sp = reg_sp;
+#ifdef NC1020_DEBUGGER
+	// a watchpoint the last instruction hit.
+	if (debugger && debugger->Pending()) {
+		debugger->CheckAccesses(this);
+	}
+#endif
+#ifdef NC1020_COUNTERS
+	counters.insts += insts;
+#endif
+	return insts;
+}
+
+size_t Machine::Step() {
+	return Execute((size_t)-1, 1);
+}
+
+void Machine::EndSlice(size_t end_cycles) {
+	// the cycles run past end_cycles are carried into the next slice, so
+	// the emulation is the same however the host cuts it into slices.
+	cycles -= end_cycles;
+	timer0_cycles -= end_cycles;
+	timer1_cycles -= end_cycles;
+	cycle_base += end_cycles;
+#ifdef NC1020_COUNTERS
+	counters.cycles += end_cycles;
+#endif
+	if (speculating) {
+		return;
+	}
+	if (lcd_changed) {
+		lcd_changed = false;
+		// with run ahead the ui gets the frames of RunAhead instead.
+		if (!run_ahead_cycles) {
+			lcd_generation++;
+		}
+		if (lcd_addr) {
+			if (!run_ahead_cycles) {
+#ifdef NC1020_PHASES
+				Phase phase("PublishFrame");
+#endif
+				lcd_frames.Publish(ram_buff + lcd_addr, GetCycleCount());
 			}
-			if (!IsCountDown() || timer0_toggle) {
-				ram_io[0x3D] = 0;
-			} else {
-				ram_io[0x3D] = 0x20;
-				clock_flags &= 0xFD;
+			if (frame_listener) {
+				frame_listener(frame_listener_context, GetCycleCount(), ram_buff + lcd_addr);
 			}
-			should_irq = true;
-		}
-		if (should_irq && !(reg_ps & 0x04)) {
-			should_irq = false;
-			stack[reg_sp --] = reg_pc >> 8;
-			stack[reg_sp --] = reg_pc & 0xFF;
-			reg_ps &= 0xEF;
-			stack[reg_sp --] = reg_ps;
-			reg_pc = PeekW(IRQ_VEC);
-			reg_ps |= 0x04;
-			cycles += 7;
 		}
-		if (cycles >= timer1_cycles) {
-			if (speed_up) {
-				timer1_cycles += CYCLES_TIMER1_SPEED_UP;
-			} else {
-				timer1_cycles += CYCLES_TIMER1;
+	}
+	if (audio_rate) {
+		RenderAudio();
+	}
+	if (!latency_probes.empty() && !run_ahead_cycles) {
+		FinishProbes();
+	}
+}
+
+void Machine::PollInput() {
+	// keys queued meanwhile wait for the real run, keys held for the end
+	// of a park for its skip to end.
+	if (!speculating && !input_held) {
+		DrainInput();
+	}
+	while (!input_schedule.empty() &&
+		input_schedule.front().cycle <= GetCycleCount()) {
+		key_input_t input = input_schedule.front();
+		input_schedule.pop_front();
+		ApplyKey(input.key_id, input.down_or_up);
+		ProbeKey(input.down_or_up, HostNanos());
+	}
+}
+
+void Machine::RunCycles(size_t end_cycles, bool speed_up) {
+	this->speed_up = speed_up;
+	// the slice runs in chunks of at most CYCLES_INPUT_POLL, split further
+	// at scheduled keys. keys are applied between chunks, which are
+	// instruction boundaries, so a key waits at most one chunk and is
+	// stamped with the cycle it really took effect at. cutting Execute
+	// does not change what it runs, so chunks are shorter while a key
+	// press waits to be seen on the lcd.
+	PollInput();
+	while (cycles < end_cycles) {
+		// a parked guest skips up to the next scheduled key at once.
+		bool parked = IsParked();
+		size_t poll = probing ? CYCLES_LATENCY_POLL : CYCLES_INPUT_POLL;
+		size_t chunk_end = !parked && end_cycles - cycles > poll ?
+			cycles + poll : end_cycles;
+		if (!input_schedule.empty() &&
+			input_schedule.front().cycle < cycle_base + chunk_end) {
+			chunk_end = (size_t)(input_schedule.front().cycle - cycle_base);
+		}
+		if (parked) {
+			SkipSlept(chunk_end);
+		} else {
+			Execute(chunk_end, (size_t)-1);
+		}
+#ifdef NC1020_DEBUGGER
+		// the slice ends at a stop.
+		if (debugger && debugger->Stopped()) {
+			end_cycles = cycles < end_cycles ? cycles : end_cycles;
+		}
+#endif
+		if (lcd_written) {
+			lcd_written = false;
+			if (!latency_probes.empty()) {
+				LcdWritten();
 			}
-			clock_buff[4] ++;
-			if (should_wake_up) {
-				should_wake_up = false;
-				ram_io[0x01] |= 0x01;
-				ram_io[0x02] |= 0x01;
-				reg_pc = PeekW(RESET_VEC);
-			} else {
-				ram_io[0x01] |= 0x08;
-				should_irq = true;
+		}
+		PollInput();
+	}
+	EndSlice(end_cycles);
+}
+
+void Machine::RunTimeSlice(size_t time_slice, bool speed_up) {
+#ifdef NC1020_PHASES
+	Phase phase("RunTimeSlice");
+#endif
+	uint64_t start = HostNanos();
+	RunCycles(time_slice * CYCLES_MS, speed_up);
+	if (run_ahead_cycles) {
+		RunAhead();
+	}
+	busy_ns += HostNanos() - start;
+}
+
+void Machine::RunAhead() {
+#ifdef NC1020_PHASES
+	Phase phase("RunAhead");
+#endif
+	// only what the emulation changes is kept, nor banks once written to;
+	// a few tens of kB instead of a full snapshot.
+	memcpy(&ahead_states, &nc1020_states, sizeof(nc1020_states));
+	ahead_cycle_base = cycle_base;
+	ahead_low_power_hold = low_power_hold;
+	memcpy(ahead_memmap, memmap, sizeof(memmap));
+	memcpy(ahead_bbs_pages, bbs_pages, sizeof(bbs_pages));
+	ahead_schedule = input_schedule;
+	uint8_t dirty[LCD_DIRTY_BYTES];
+	memcpy(dirty, lcd_dirty, sizeof(dirty));
+	bool changed = lcd_changed;
+	nor_saved = 0;
+	speculating = true;
+#ifdef NC1020_PROFILER
+	// only the real run is profiled or traced.
+	Profiler* profiling = profiler;
+	profiler = NULL;
+#endif
+#ifdef NC1020_TRACE
+	TraceWriter* tracing = tracer;
+	tracer = NULL;
+#endif
+#ifdef NC1020_DEBUGGER
+	Debugger* debugging = debugger;
+	uint8_t watched[3] = {break_pages, read_pages, write_pages};
+	debugger = NULL;
+	break_pages = 0;
+	read_pages = 0;
+	write_pages = 0;
+#endif
+#ifdef NC1020_COUNTERS
+	perf_counters_t counted = counters;
+#endif
+
+	RunCycles(run_ahead_cycles, speed_up);
+#ifdef NC1020_PROFILER
+	profiler = profiling;
+#endif
+#ifdef NC1020_COUNTERS
+	counters = counted;
+#endif
+#ifdef NC1020_TRACE
+	tracer = tracing;
+#endif
+#ifdef NC1020_DEBUGGER
+	debugger = debugging;
+	break_pages = watched[0];
+	read_pages = watched[1];
+	write_pages = watched[2];
+#endif
+	if (lcd_addr && memcmp(ahead_frame, ram_buff + lcd_addr, LCD_SIZE) != 0) {
+		memcpy(ahead_frame, ram_buff + lcd_addr, LCD_SIZE);
+#ifdef NC1020_PHASES
+		Phase phase("PublishFrame");
+#endif
+		lcd_frames.Publish(ahead_frame, GetCycleCount());
+		lcd_generation++;
+	}
+
+	speculating = false;
+	for (size_t i=0; i<0x20; i++) {
+		if (nor_saved & (1u << i)) {
+			memcpy(nor_banks[i], &nor_backup[0x8000 * i], 0x8000);
+		}
+	}
+	memcpy(&nc1020_states, &ahead_states, sizeof(nc1020_states));
+	cycle_base = ahead_cycle_base;
+	low_power_hold = ahead_low_power_hold;
+	memcpy(memmap, ahead_memmap, sizeof(memmap));
+	memcpy(bbs_pages, ahead_bbs_pages, sizeof(bbs_pages));
+	input_schedule.swap(ahead_schedule);
+	memcpy(lcd_dirty, dirty, sizeof(dirty));
+	lcd_changed = changed;
+
+	if (ahead_written) {
+		ahead_written = false;
+		uint64_t now = HostNanos();
+		for (size_t i=0; i<latency_probes.size(); i++) {
+			if (!latency_probes[i].shown_ns) {
+				latency_probes[i].shown_ns = now;
 			}
 		}
-//#endif
 	}
+	if (!latency_probes.empty()) {
+		FinishProbes();
+	}
+}
 
-	cycles -= end_cycles;
-	timer0_cycles -= end_cycles;
-	timer1_cycles -= end_cycles;
+static Machine* nc1020_machine = NULL;
+
+Machine* CreateMachine(WqxRom rom, uint8_t* shared_rom){
+	return new Machine(rom, shared_rom);
+}
+
+void DestroyMachine(Machine* machine){
+	delete machine;
+}
+
+void Reset(Machine* machine){
+	machine->Reset();
+}
+
+bool SetKey(Machine* machine, uint8_t key_id, bool down_or_up){
+	return machine->SetKey(key_id, down_or_up);
+}
+
+void RunTimeSlice(Machine* machine, size_t time_slice, bool speed_up){
+	machine->RunTimeSlice(time_slice, speed_up);
+}
+
+bool CopyLcdBuffer(Machine* machine, uint8_t* buffer){
+	return machine->CopyLcdBuffer(buffer);
+}
+
+void LoadNC1020(Machine* machine){
+	machine->LoadNC1020();
+}
+
+void SaveNC1020(Machine* machine){
+	machine->SaveNC1020();
+}
+
+bool IsSlept(Machine* machine){
+	return machine->slept;
+}
+
+void SetLowPower(Machine* machine, bool low_power){
+	machine->low_power = low_power;
+}
 
-	wqx::reg_pc = reg_pc;
-	wqx::reg_a = reg_a;
-	wqx::reg_ps = reg_ps;
-	wqx::reg_x = reg_x;
-	wqx::reg_y = reg_y;
-	wqx::reg_sp = reg_sp;
+void SetClockCatchUp(Machine* machine, bool catch_up){
+	machine->clock_catch_up = catch_up;
+}
+
+void AdvanceClock(Machine* machine, uint64_t seconds){
+	machine->AdvanceClock(seconds);
+}
+
+void EnableAudio(Machine* machine, size_t sample_rate){
+	machine->audio_rate = sample_rate;
+	machine->ResetAudio();
+}
+
+size_t ReadAudio(Machine* machine, int16_t* samples, size_t count, uint64_t* cycle){
+	return machine->audio_ring.Read(samples, count, cycle);
+}
+
+void SetAudioListener(Machine* machine, audio_listener_t listener, void* context){
+	machine->audio_listener = listener;
+	machine->audio_listener_context = context;
+}
+
+void SetRunAhead(Machine* machine, size_t ahead_ms){
+	machine->run_ahead_cycles = ahead_ms * CYCLES_MS;
+	if (ahead_ms) {
+		machine->nor_backup.resize(NOR_SIZE);
+	}
+	// the ui gets the real frame again, or the first ahead one.
+	memset(machine->ahead_frame, 0, sizeof(machine->ahead_frame));
+	machine->MarkLcdDirty();
+}
+
+bool CopyLcdBufferIfChanged(Machine* machine, uint8_t* buffer, uint8_t* dirty_rows){
+	return machine->CopyLcdBufferIfChanged(buffer, dirty_rows);
+}
+
+uint64_t GetLcdGeneration(Machine* machine){
+	return machine->lcd_generation;
+}
+
+void SetFrameListener(Machine* machine, frame_listener_t listener, void* context){
+	machine->frame_listener = listener;
+	machine->frame_listener_context = context;
+}
+
+bool CopyLatestFrame(Machine* machine, uint8_t* frame, uint64_t* sequence){
+#ifdef NC1020_PHASES
+	Phase phase("CopyLatestFrame");
+#endif
+	return machine->lcd_frames.Latest(frame, sequence, NULL);
+}
+
+void SetInputListener(Machine* machine, input_listener_t listener, void* context){
+	machine->input_listener = listener;
+	machine->input_listener_context = context;
+}
+
+void ScheduleKey(Machine* machine, uint64_t cycle, uint8_t key_id, bool down_or_up){
+	machine->ScheduleKey(cycle, key_id, down_or_up);
+}
+
+void ClearSchedule(Machine* machine){
+	machine->input_schedule.clear();
+}
+
+bool HasPendingInput(Machine* machine){
+	return machine->HasPendingInput();
+}
+
+uint64_t GetCycleCount(Machine* machine){
+	return machine->GetCycleCount();
+}
+
+uint32_t Locate(Machine* machine, uint16_t addr){
+	uint8_t* page = machine->memmap[addr >> 13];
+	return page ? machine->Locate(page + (addr & 0x1FFF)) : 0;
+}
+
+void RunCycles(Machine* machine, size_t cycles, bool speed_up){
+	machine->RunCycles(cycles, speed_up);
+}
+
+size_t SnapshotSize(){
+	return SNAPSHOT_SIZE;
+}
+
+void SaveSnapshot(Machine* machine, uint8_t* snapshot){
+	machine->SaveSnapshot(snapshot);
+}
+
+void LoadSnapshot(Machine* machine, const uint8_t* snapshot){
+	machine->LoadSnapshot(snapshot);
+}
+
+#ifdef NC1020_COUNTERS
+void* Machine::operator new(size_t size){
+	// plain new aligns to 16 at most before c++17.
+	void* memory = NULL;
+	if (posix_memalign(&memory, alignof(Machine), size) != 0) {
+		throw std::bad_alloc();
+	}
+	return memory;
+}
+
+void Machine::operator delete(void* memory){
+	free(memory);
+}
+
+void GetPerfCounters(Machine* machine, perf_counters_t* counters){
+	*counters = machine->counters;
+}
+
+void ResetPerfCounters(Machine* machine){
+	memset(&machine->counters, 0, sizeof(machine->counters));
+}
+#endif
+
+void Initialize(WqxRom rom) {
+	delete nc1020_machine;
+	nc1020_machine = new Machine(rom, NULL);
+}
+
+void Reset() {
+	nc1020_machine->Reset();
+}
+
+bool SetKey(uint8_t key_id, bool down_or_up){
+	return nc1020_machine->SetKey(key_id, down_or_up);
+}
+
+void RunTimeSlice(size_t time_slice, bool speed_up){
+	nc1020_machine->RunTimeSlice(time_slice, speed_up);
+}
+
+void SetLowPower(bool low_power){
+	nc1020_machine->low_power = low_power;
+}
+
+void SetClockCatchUp(bool catch_up){
+	nc1020_machine->clock_catch_up = catch_up;
+}
+
+void EnableAudio(size_t sample_rate){
+	EnableAudio(nc1020_machine, sample_rate);
+}
+
+size_t ReadAudio(int16_t* samples, size_t count, uint64_t* cycle){
+	return nc1020_machine->audio_ring.Read(samples, count, cycle);
+}
+
+void SetRunAhead(size_t ahead_ms){
+	SetRunAhead(nc1020_machine, ahead_ms);
+}
+
+Machine* DefaultMachine(){
+	return nc1020_machine;
+}
+
+bool CopyLcdBuffer(uint8_t* buffer){
+	return nc1020_machine->CopyLcdBuffer(buffer);
+}
+
+bool CopyLcdBufferIfChanged(uint8_t* buffer, uint8_t* dirty_rows){
+	return nc1020_machine->CopyLcdBufferIfChanged(buffer, dirty_rows);
+}
+
+uint64_t GetLcdGeneration(){
+	return nc1020_machine->lcd_generation;
+}
+
+bool CopyLatestFrame(uint8_t* frame, uint64_t* sequence){
+#ifdef NC1020_PHASES
+	Phase phase("CopyLatestFrame");
+#endif
+	return nc1020_machine->lcd_frames.Latest(frame, sequence, NULL);
+}
+
+void LoadNC1020(){
+	nc1020_machine->LoadNC1020();
+}
+
+void SaveNC1020(){
+	nc1020_machine->SaveNC1020();
 }
 
 }
@@ -3,6 +3,7 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <string>
 namespace wqx {
 struct WqxRom {
@@ -13,12 +14,285 @@ struct WqxRom {
 typedef struct WqxRom WqxRom;
 extern void Initialize(WqxRom);
 extern void Reset();
-extern void SetKey(uint8_t, bool);
+extern bool SetKey(uint8_t, bool);
 extern void RunTimeSlice(size_t, bool);
+extern void SetLowPower(bool);
+extern void SetClockCatchUp(bool);
+extern void EnableAudio(size_t);
+extern size_t ReadAudio(int16_t*, size_t, uint64_t*);
+extern void SetRunAhead(size_t);
 extern bool CopyLcdBuffer(uint8_t*);
 extern void LoadNC1020();
 extern void SaveNC1020();
 
+// independent machines, for hosts running more than one nc1020.
+// a rom image from LoadRomImage can be shared by any number of machines,
+// pass NULL to let the machine load its own copy from romPath.
+struct Machine;
+typedef struct Machine Machine;
+extern uint8_t* LoadRomImage(const std::string&);
+extern void FreeRomImage(uint8_t*);
+extern Machine* CreateMachine(WqxRom, uint8_t*);
+extern void DestroyMachine(Machine*);
+extern void Reset(Machine*);
+extern bool SetKey(Machine*, uint8_t, bool);
+extern void RunTimeSlice(Machine*, size_t, bool);
+extern bool CopyLcdBuffer(Machine*, uint8_t*);
+extern void LoadNC1020(Machine*);
+extern void SaveNC1020(Machine*);
+extern bool IsSlept(Machine*);
+// low power mode. while the guest is asleep and no key woke it up, time
+// slices skip the cpu: the timers and the rtc move on, nothing runs until a
+// key wakes it or the rtc alarm goes off. the guest's own code no longer
+// runs meanwhile, so emulation differs from a full run and the mode is off
+// by default. Pacer blocks the host thread for as long as that lasts.
+extern void SetLowPower(Machine*, bool);
+// rtc catch up. with it on, LoadNC1020 moves the guest clock on by the host
+// time passed since the states file was written, without emulating the gap;
+// an alarm due in between goes off once the machine runs. AdvanceClock does
+// the same by any number of seconds, for hosts restoring snapshots.
+extern void SetClockCatchUp(Machine*, bool);
+extern void AdvanceClock(Machine*, uint64_t);
+
+// jg sound. EnableAudio has the machine render what its sound chip plays as
+// 16 bit mono pcm at the given rate (0 turns it off), in blocks at the end
+// of every slice on the emulation thread. ReadAudio drains them from one
+// other thread without blocking either side and gives the emulated cycle of
+// the first sample; the listener sees every block as it is made, also when
+// nobody reads.
+// this is a placeholder: the chip is not emulated and the audio is silent.
+// built with NC1020_JG_PLACEHOLDER, an experimental, made up model plays
+// every byte of a command as 1/32 s of square wave, so programs sound with
+// their rhythm but not their tune.
+typedef void (*audio_listener_t)(void* context, uint64_t cycle, const int16_t* samples, size_t count);
+extern void EnableAudio(Machine*, size_t);
+extern size_t ReadAudio(Machine*, int16_t*, size_t, uint64_t*);
+extern void SetAudioListener(Machine*, audio_listener_t, void*);
+
+// run ahead, in ms (0, the default, turns it off). after every RunTimeSlice
+// the machine runs that much further with the keys it has, hands the lcd it
+// ends with to CopyLatestFrame and GetLcdGeneration, and goes back to where
+// the slice ended. the screen then shows a key's effect that much earlier.
+// only the real run is seen by listeners, recordings and sound. costs the
+// emulation of the extra time per slice; call it on the emulation thread.
+extern void SetRunAhead(Machine*, size_t);
+
+// lcd change tracking. CopyLcdBufferIfChanged copies only the rows written
+// since its last call into buffer, which must still hold the frame of that
+// call, and returns false with buffer untouched when nothing changed.
+// dirty_rows (may be NULL) receives LCD_DIRTY_BYTES bytes, bit r % 8 of byte
+// r / 8 set for every copied row r. the generation goes up with every time
+// slice that changed the lcd.
+const size_t LCD_DIRTY_BYTES = 10;
+extern bool CopyLcdBufferIfChanged(uint8_t*, uint8_t*);
+extern bool CopyLcdBufferIfChanged(Machine*, uint8_t*, uint8_t*);
+extern uint64_t GetLcdGeneration();
+extern uint64_t GetLcdGeneration(Machine*);
+// called on the emulation thread at the end of every slice that changed the
+// lcd, with the 1600 byte frame and the emulated cycle the slice ended at.
+typedef void (*frame_listener_t)(void* context, uint64_t cycle, const uint8_t* frame);
+extern void SetFrameListener(Machine*, frame_listener_t, void*);
+// the newest frame a slice finished with, safe from any thread while the
+// machine runs and never blocking it. copies only when the frame is newer
+// than *sequence (start from 0) and updates it.
+extern bool CopyLatestFrame(uint8_t*, uint64_t*);
+extern bool CopyLatestFrame(Machine*, uint8_t*, uint64_t*);
+
+// deterministic input. SetKey only queues the key on a wait free queue (one
+// calling thread at a time) and returns false when it was full and the key
+// was dropped; releases have slots of their own, so a key once down is
+// never left held. the key reaches the machine at the next instruction
+// boundary the run loop polls, at most 1/256 s of emulated time later; the
+// listener sees every key as it is applied, stamped with the emulated cycle
+// (cycles since reset or load). ScheduleKey applies a key at the first
+// instruction boundary at or after the given cycle, which is how recorded
+// input is replayed.
+typedef void (*input_listener_t)(void* context, uint64_t cycle, uint8_t key_id, bool down_or_up);
+extern void SetInputListener(Machine*, input_listener_t, void*);
+extern void ScheduleKey(Machine*, uint64_t, uint8_t, bool);
+extern void ClearSchedule(Machine*);
+extern bool HasPendingInput(Machine*);
+extern uint64_t GetCycleCount(Machine*);
+// physical locations, for what depends on the banks: a byte of ram, nor or
+// rom by where it lives rather than where the cpu sees it. PHYS_RAM | offset
+// into the 32 KB of ram, PHYS_NOR | bank * 0x8000 + offset for nor banks 00
+// to 1F, PHYS_ROM | (volume * 0x100 + bank) * 0x8000 + offset for the rom.
+// Locate gives the location of a cpu address under the current banks, 0
+// where nothing is mapped.
+const uint32_t PHYS_RAM = 1u << 28;
+const uint32_t PHYS_ROM = 2u << 28;
+const uint32_t PHYS_NOR = 3u << 28;
+const uint32_t PHYS_OFFSET_MASK = PHYS_RAM - 1;
+extern uint32_t Locate(Machine*, uint16_t);
+// like RunTimeSlice with a slice length in cpu cycles. the emulation does not
+// depend on how it is cut into slices.
+extern void RunCycles(Machine*, size_t, bool);
+
+// key to pixel latency. with tracking on, every key press is followed to
+// the first write into the lcd after it: emulated is the time from the key
+// taking effect to that write (to within CYCLES_LATENCY_POLL, 0.1 ms), host
+// the wall time from SetKey to the ui being handed a frame with it (with run
+// ahead, the first ahead frame that had it). presses that write nothing
+// within LATENCY_TIMEOUT_MS are counted as unanswered; releases are not
+// followed. read the stats on the emulation thread or while it is stopped.
+const size_t LATENCY_BUCKETS = 256;
+const size_t LATENCY_TIMEOUT_MS = 1000;
+typedef struct {
+	// bucket i counts latencies of i to i + 1 ms, the last one all longer.
+	uint64_t buckets[LATENCY_BUCKETS];
+	uint64_t count;
+	double total_ms;
+	double max_ms;
+} latency_histogram_t;
+typedef struct {
+	uint64_t keys;
+	uint64_t unanswered;
+	latency_histogram_t emulated;
+	latency_histogram_t host;
+} latency_stats_t;
+extern void SetLatencyTracking(Machine*, bool);
+extern void GetLatencyStats(Machine*, latency_stats_t*);
+extern void ResetLatencyStats(Machine*);
+// adds the counts of one to the other, for hosts running many machines.
+extern void MergeLatencyStats(latency_stats_t*, const latency_stats_t*);
+// latency under which the given fraction (0 to 1) of the samples fall, to
+// the bucket.
+extern double LatencyPercentile(const latency_histogram_t*, double);
+// the report wqx-run and wqx-fleet print: counts, percentiles of both
+// histograms and the emulated one in 10 ms steps.
+extern void PrintLatencyStats(FILE*, const latency_stats_t*);
+
+#ifdef NC1020_COUNTERS
+// performance counters, only in builds with NC1020_COUNTERS: 1 counts the
+// totals, 2 also every io port on its own (io_port_reads and io_port_writes
+// stay 0 otherwise). counted on the emulation thread and never reset by
+// the machine; GetPerfCounters takes a copy, on the emulation thread or
+// while it is stopped. run ahead is not counted, lockstep groups count
+// what their cohorts run as instructions only.
+const int PERF_COUNTERS_LEVEL = NC1020_COUNTERS;
+typedef struct alignas(64) {
+	uint64_t insts;
+	// emulated cycles of the slices ended, idle_cycles those of them low
+	// power mode skipped.
+	uint64_t cycles;
+	uint64_t idle_cycles;
+	uint64_t irqs;
+	uint64_t timer0_events;
+	uint64_t timer1_events;
+	// writes that switched banks through $00, $0A, $0D and $0F.
+	uint64_t bank_switches[4];
+	uint64_t io_reads;
+	uint64_t io_writes;
+	// flash commands started, by fp_type (1 to 6).
+	uint64_t flash_commands[8];
+	// writes into the lcd buffer.
+	uint64_t lcd_writes;
+	uint64_t io_port_reads[0x40];
+	uint64_t io_port_writes[0x40];
+} perf_counters_t;
+extern void GetPerfCounters(Machine*, perf_counters_t*);
+extern void ResetPerfCounters(Machine*);
+#endif
+
+#ifdef NC1020_PHASES
+// host phase trace, only in builds with NC1020_PHASES (see phases.h). times
+// what the host spends on emulation (RunTimeSlice, RunAhead), the lcd
+// (CopyLcdBuffer, PublishFrame, CopyLatestFrame, RenderLcd), saving
+// (SaveNor, SaveStates), input (SetKey, ApplyKey) and pacing (Sleep,
+// WaitForInput), on every thread, from
+// StartPhaseTrace, which drops what was recorded before, to StopPhaseTrace.
+// WritePhaseTrace writes chrome trace event json for chrome://tracing or
+// Perfetto, threads named with SetPhaseThreadName show by name.
+extern void StartPhaseTrace();
+extern void StopPhaseTrace();
+extern bool WritePhaseTrace(const std::string&);
+extern void SetPhaseThreadName(const std::string&);
+#endif
+
+#ifdef NC1020_PROFILER
+// guest profiler, only in builds with NC1020_PROFILER (see profiler.h).
+// StartProfiler starts a new profile, sample_cycles 0 counts every
+// instruction, more samples once per that many cycles. WriteProfile writes
+// the folded stacks for a flamegraph, ProfileTop lists the pcs with the most
+// cycles, both by physical location or by the name symbols (may be NULL)
+// has for it. use them on the emulation thread or while it is stopped.
+class SymbolTable;
+extern void StartProfiler(Machine*, size_t);
+extern void StopProfiler(Machine*);
+extern bool WriteProfile(Machine*, const std::string&, const SymbolTable*);
+extern std::string ProfileTop(Machine*, size_t, const SymbolTable*);
+#endif
+
+#ifdef NC1020_TRACE
+// execution trace, only in builds with NC1020_TRACE (see trace.h). of the
+// instructions run after StartTrace, start_inst are skipped, then the trace
+// waits for one at start_pc (-1 for any) and records until max_insts are
+// in it (0 for no limit), stop_pc is about to run (-1 for none) or
+// StopTrace. StopTrace waits for the file and returns the instructions in
+// it, 0 when it could not be written. use them on the emulation thread or
+// while it is stopped.
+typedef struct {
+	std::string path;
+	uint64_t start_inst;
+	uint64_t max_insts;
+	int32_t start_pc;
+	int32_t stop_pc;
+	// address of the byte recorded with every instruction, -1 for the
+	// opcode.
+	int32_t peek_addr;
+} trace_options_t;
+extern bool StartTrace(Machine*, const trace_options_t&);
+extern uint64_t StopTrace(Machine*);
+#endif
+
+#ifdef NC1020_DEBUGGER
+// breakpoints and watchpoints, only in builds with NC1020_DEBUGGER (see
+// debugger.h). a breakpoint stops the machine in front of the instruction
+// at its address, a watchpoint behind the instruction that loaded or stored
+// its byte; instruction fetches, stack pushes and pulls and the vectors are
+// not watched. the address is a cpu address, or with physical set a
+// physical location (see Locate) that hits wherever the banks put it. the
+// condition, empty for none, must come out nonzero for a hit (see
+// debugger.h for the syntax); those of watchpoints see the registers after
+// the instruction. a stop ends the time slice there, GetBreak says why, the
+// next run goes on from it. AddBreakpoint returns an id, -1 for a
+// condition it cannot parse. use them on the emulation thread or while it
+// is stopped. lockstep groups and run ahead do not stop.
+typedef enum {
+	BREAK_EXEC = 1,
+	BREAK_READ = 2,
+	BREAK_WRITE = 4
+} break_kind_t;
+typedef struct {
+	// BREAK_ bits, BREAK_READ | BREAK_WRITE for an access watchpoint.
+	int kinds;
+	bool physical;
+	uint32_t address;
+	std::string condition;
+} breakpoint_t;
+typedef struct {
+	int id;
+	break_kind_t kind;
+	// the instruction that hit, at address and location for BREAK_EXEC.
+	uint16_t pc;
+	uint16_t address;
+	uint32_t location;
+	// the byte loaded or stored, the opcode for BREAK_EXEC.
+	uint8_t value;
+	uint64_t cycle;
+} break_hit_t;
+extern int AddBreakpoint(Machine*, const breakpoint_t&);
+extern void RemoveBreakpoint(Machine*, int);
+extern void ClearBreakpoints(Machine*);
+extern bool GetBreak(Machine*, break_hit_t*);
+#endif
+
+// in memory snapshot of everything the emulation depends on (states, nor,
+// cycle count), SnapshotSize bytes.
+extern size_t SnapshotSize();
+extern void SaveSnapshot(Machine*, uint8_t*);
+extern void LoadSnapshot(Machine*, const uint8_t*);
+
 }
 
 #endif /* NC1020_H_ */
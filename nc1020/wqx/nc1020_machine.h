@@ -0,0 +1,435 @@
+#ifndef NC1020_MACHINE_H_
+#define NC1020_MACHINE_H_
+
+#include "nc1020.h"
+#include "audio_ring.h"
+#include "debugger.h"
+#include "frame_buffer.h"
+#include "input_queue.h"
+#include "phases.h"
+#include "profiler.h"
+#include "trace.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+namespace wqx {
+    // cpu cycles per second (cpu freq).
+    const size_t CYCLES_SECOND = 5120000;
+    const size_t TIMER0_FREQ = 2;
+    const size_t TIMER1_FREQ = 0x100;
+    // cpu cycles per timer0 period (1/2 s).
+    const size_t CYCLES_TIMER0 = CYCLES_SECOND / TIMER0_FREQ;
+    // cpu cycles per timer1 period (1/256 s).
+    const size_t CYCLES_TIMER1 = CYCLES_SECOND / TIMER1_FREQ;
+    // speed up
+    const size_t CYCLES_TIMER1_SPEED_UP = CYCLES_SECOND / TIMER1_FREQ / 20;
+    // cpu cycles per ms (1/1000 s).
+    const size_t CYCLES_MS = CYCLES_SECOND / 1000;
+    // most cpu cycles run between two polls of the input queue (1/256 s).
+    const size_t CYCLES_INPUT_POLL = CYCLES_TIMER1;
+    // the same while a key press waits for its first lcd write (0.1 ms).
+    const size_t CYCLES_LATENCY_POLL = CYCLES_MS / 10;
+
+    static const size_t ROM_SIZE = 0x8000 * 0x300;
+    static const size_t NOR_SIZE = 0x8000 * 0x20;
+
+    static const uint16_t IO_LIMIT = 0x40;
+#define IO_API
+    struct Machine;
+    typedef uint8_t (IO_API Machine::*io_read_func_t)(uint8_t);
+    typedef void (IO_API Machine::*io_write_func_t)(uint8_t, uint8_t);
+
+    const uint16_t NMI_VEC = 0xFFFA;
+    const uint16_t RESET_VEC = 0xFFFC;
+    const uint16_t IRQ_VEC = 0xFFFE;
+
+    const size_t VERSION = 0x06;
+
+    // lcd: 160x80, 1 bit per pixel, rows of 20 bytes at lcd_addr in ram.
+    const size_t LCD_WIDTH = 160;
+    const size_t LCD_HEIGHT = 80;
+    const size_t LCD_ROW_BYTES = LCD_WIDTH / 8;
+    const size_t LCD_SIZE = LCD_ROW_BYTES * LCD_HEIGHT;
+
+typedef struct {
+	uint16_t reg_pc;
+	uint8_t reg_a;
+	uint8_t reg_ps;
+	uint8_t reg_x;
+	uint8_t reg_y;
+	uint8_t reg_sp;
+} cpu_states_t;
+
+typedef struct {
+	size_t version;
+	cpu_states_t cpu;
+	uint8_t ram[0x8000];
+
+	uint8_t bak_40[0x40];
+
+	uint8_t clock_data[80];
+	uint8_t clock_flags;
+
+	uint8_t jg_wav_data[0x20];
+	uint8_t jg_wav_flags;
+	uint8_t jg_wav_idx;
+	bool jg_wav_playing;
+
+	uint8_t fp_step;
+	uint8_t fp_type;
+	uint8_t fp_bank_idx;
+	uint8_t fp_bak1;
+	uint8_t fp_bak2;
+	uint8_t fp_buff[0x100];
+
+	bool slept;
+	bool should_wake_up;
+	bool pending_wake_up;
+	uint8_t wake_up_flags;
+
+	bool timer0_toggle;
+	size_t cycles;
+	size_t timer0_cycles;
+	size_t timer1_cycles;
+	bool should_irq;
+
+	size_t lcd_addr;
+	uint8_t keypad_matrix[8];
+} nc1020_states_t;
+
+// a square wave the jg chip plays, in samples since the audio origin.
+typedef struct {
+	uint64_t start;
+	uint64_t end;
+	uint32_t phase;
+	uint32_t step;
+} jg_tone_t;
+
+// a key press followed for SetLatencyTracking, in cycles since reset and
+// steady clock ns. lcd_cycle and shown_ns stay 0 until seen.
+typedef struct {
+	uint64_t cycle;
+	uint64_t host_ns;
+	uint64_t lcd_cycle;
+	uint64_t shown_ns;
+} latency_probe_t;
+
+
+/**
+ * Machine
+ * one emulated nc1020. the rom image may be shared between machines since
+ * nothing ever writes to it, everything else is owned by the instance.
+ */
+struct Machine {
+	Machine(const WqxRom& rom, uint8_t* shared_rom);
+	~Machine();
+
+	WqxRom nc1020_rom;
+
+	uint8_t* rom_buff;
+	bool owns_rom;
+	uint8_t nor_buff[NOR_SIZE];
+
+	uint8_t* rom_volume0[0x100];
+	uint8_t* rom_volume1[0x100];
+	uint8_t* rom_volume2[0x100];
+
+	uint8_t* nor_banks[0x20];
+	uint8_t* bbs_pages[0x10];
+
+	uint8_t* memmap[8];
+	nc1020_states_t nc1020_states;
+
+	size_t& version;
+
+	uint16_t& reg_pc;
+	uint8_t& reg_a;
+	uint8_t& reg_ps;
+	uint8_t& reg_x;
+	uint8_t& reg_y;
+	uint8_t& reg_sp;
+
+	uint8_t* ram_buff;
+	uint8_t* stack;
+	uint8_t* ram_io;
+	uint8_t* ram_40;
+	uint8_t* ram_page0;
+	uint8_t* ram_page1;
+	uint8_t* ram_page2;
+	uint8_t* ram_page3;
+
+	uint8_t* clock_buff;
+	uint8_t& clock_flags;
+
+	uint8_t* jg_wav_buff;
+	uint8_t& jg_wav_flags;
+	uint8_t& jg_wav_index;
+	bool& jg_wav_playing;
+
+	uint8_t* bak_40;
+	uint8_t& fp_step;
+	uint8_t& fp_type;
+	uint8_t& fp_bank_idx;
+	uint8_t& fp_bak1;
+	uint8_t& fp_bak2;
+	uint8_t* fp_buff;
+
+	bool& slept;
+	bool& should_wake_up;
+	bool& wake_up_pending;
+	uint8_t& wake_up_key;
+
+	bool& should_irq;
+	bool& timer0_toggle;
+	size_t& cycles;
+	size_t& timer0_cycles;
+	size_t& timer1_cycles;
+
+	uint8_t* keypad_matrix;
+	size_t& lcd_addr;
+
+	// timer1 rate of the slice being run, see RunTimeSlice.
+	bool speed_up;
+
+	// cycles of all slices run so far, cycle_base + cycles is the emulated
+	// time since reset or load.
+	uint64_t cycle_base;
+
+	// keys from SetKey, applied at the next poll inside RunCycles.
+	InputQueue input_queue;
+	// keys bound to a cycle, sorted by cycle.
+	std::deque<key_input_t> input_schedule;
+	input_listener_t input_listener;
+	void* input_listener_context;
+	// set while the host waits in WaitForInput, SetKey then wakes it.
+	std::atomic<bool> input_waiting;
+	std::mutex input_wait_mutex;
+	std::condition_variable input_wait;
+
+	// skip emulation while asleep, see SetLowPower. nothing is skipped
+	// before the cycle low_power_hold, which gives the guest time to deal
+	// with an rtc alarm.
+	bool low_power;
+	uint64_t low_power_hold;
+	// set while Pacer skips the time a park lasted: the key that ended the
+	// wait was pressed at its end, it stays queued and the skip goes on as
+	// if the queue were empty.
+	bool input_held;
+	// LoadStates moves the rtc on by the host time since the save.
+	bool clock_catch_up;
+
+	// see SetRunAhead. while speculating, RunAhead runs on from a state
+	// kept in the ahead_ members; nor banks flagged in nor_saved were copied
+	// to nor_backup before their first write. ahead_frame is the frame the
+	// ui was last given.
+	size_t run_ahead_cycles;
+	bool speculating;
+	nc1020_states_t ahead_states;
+	uint64_t ahead_cycle_base;
+	uint64_t ahead_low_power_hold;
+	uint8_t* ahead_memmap[8];
+	uint8_t* ahead_bbs_pages[0x10];
+	std::deque<key_input_t> ahead_schedule;
+	uint32_t nor_saved;
+	std::vector<uint8_t> nor_backup;
+	uint8_t ahead_frame[LCD_SIZE];
+
+	// see SetLatencyTracking. lcd_written is set by every lcd write and
+	// looked at between chunks of RunCycles; ahead_written when run ahead
+	// wrote the lcd after a followed press.
+	bool latency_tracking;
+	// a followed press has not seen its lcd write yet.
+	bool probing;
+	bool lcd_written;
+	bool ahead_written;
+	std::deque<latency_probe_t> latency_probes;
+	latency_stats_t latency_stats;
+
+	// lcd rows changed since the last CopyLcdBufferIfChanged, bit r % 8 of
+	// byte r / 8 for row r. lcd_generation counts the slices that changed
+	// the lcd.
+	uint8_t lcd_dirty[LCD_DIRTY_BYTES];
+	bool lcd_changed;
+	uint64_t lcd_generation;
+	frame_listener_t frame_listener;
+	void* frame_listener_context;
+	FrameBuffer lcd_frames;
+
+	// jg sound, see EnableAudio. sample n is played at cycle audio_origin +
+	// n * CYCLES_SECOND / audio_rate; everything before audio_sample has
+	// been rendered, audio_tones are still to come.
+	size_t audio_rate;
+	uint64_t audio_origin;
+	uint64_t audio_sample;
+	std::deque<jg_tone_t> audio_tones;
+	AudioRing audio_ring;
+	audio_listener_t audio_listener;
+	void* audio_listener_context;
+	// live cycle count, relative to cycle_base, of the instruction whose
+	// io write is being handled. the member cycles lags behind it in
+	// Execute.
+	size_t io_cycles;
+
+	// health, see StatsPage: host time spent in RunTimeSlice, SaveNC1020
+	// calls with the host time of the last one, files they failed to write
+	// and flash writes outside any known command.
+	uint64_t busy_ns;
+	uint64_t saves;
+	uint64_t last_save_ns;
+	uint64_t save_errors;
+	uint64_t flash_errors;
+
+#ifdef NC1020_COUNTERS
+	// see GetPerfCounters. cache line aligned, hence the operator new.
+	perf_counters_t counters;
+	static void* operator new(size_t size);
+	static void operator delete(void* memory);
+#endif
+#ifdef NC1020_PROFILER
+	// see StartProfiler, NULL when off.
+	Profiler* profiler;
+#endif
+#ifdef NC1020_TRACE
+	// see StartTrace, NULL when off.
+	TraceWriter* tracer;
+#endif
+#ifdef NC1020_DEBUGGER
+	// see AddBreakpoint, NULL with nothing set. bit s of break_pages is set
+	// while memmap[s] holds a breakpoint or a watchpoint hit waits to be
+	// checked, of read_pages and write_pages while it holds a watchpoint;
+	// only those pages leave the fast path. inst_pc is the instruction
+	// Execute is running.
+	Debugger* debugger;
+	uint8_t break_pages;
+	uint8_t read_pages;
+	uint8_t write_pages;
+	uint16_t inst_pc;
+#endif
+
+	io_read_func_t io_read[0x40];
+	io_write_func_t io_write[0x40];
+
+	uint8_t* GetBank(uint8_t bank_idx);
+	void SwitchBank();
+	uint8_t** GetVolumm(uint8_t volume_idx);
+	void SwitchVolume();
+	// cycle is when the command was given.
+	void GenerateAndPlayJGWav(uint64_t cycle);
+	uint64_t AudioSampleAt(uint64_t cycle);
+	uint64_t AudioSampleCycle(uint64_t sample);
+	void ResetAudio();
+	// renders the samples up to the current cycle, a block at a time.
+	void RenderAudio();
+	uint8_t* GetPtr40(uint8_t index);
+	// the physical location of a byte of ram, nor or rom, 0 for anything
+	// else.
+	uint32_t Locate(const uint8_t* cell) const;
+
+	uint8_t IO_API ReadXX(uint8_t addr);
+	uint8_t IO_API Read06(uint8_t addr);
+	uint8_t IO_API Read3B(uint8_t addr);
+	uint8_t IO_API Read3F(uint8_t addr);
+	void IO_API WriteXX(uint8_t addr, uint8_t value);
+	void IO_API Write00(uint8_t addr, uint8_t value);
+	void IO_API Write05(uint8_t addr, uint8_t value);
+	void IO_API Write06(uint8_t addr, uint8_t value);
+	void IO_API Write08(uint8_t addr, uint8_t value);
+	void IO_API Write09(uint8_t addr, uint8_t value);
+	void IO_API Write0A(uint8_t addr, uint8_t value);
+	void IO_API Write0D(uint8_t addr, uint8_t value);
+	void IO_API Write0F(uint8_t addr, uint8_t value);
+	void IO_API Write20(uint8_t addr, uint8_t value);
+	void IO_API Write23(uint8_t addr, uint8_t value);
+	void IO_API Write3F(uint8_t addr, uint8_t value);
+
+	void AdjustTime();
+	bool IsCountDown();
+	// seconds until the rtc alarm goes off, 0 when it is not set.
+	uint64_t SecondsToAlarm();
+	// AdjustTime run seconds times, in constant time.
+	void AdvanceClock(uint64_t seconds);
+
+	void LoadRom();
+	void LoadNor();
+	bool SaveNor();
+
+	inline uint8_t & Peek(uint8_t addr);
+	inline uint8_t & Peek(uint16_t addr);
+	inline uint16_t PeekW(uint16_t addr);
+	inline uint8_t Load(uint16_t addr);
+	// cycles is Execute's live cycle count, see io_cycles.
+	inline void Store(uint16_t addr, uint8_t value, size_t cycles);
+	inline void StoreRam(uint8_t* cell, uint8_t value);
+	// keeps a nor bank from before run ahead's first write to it.
+	inline void TouchNor(size_t bank_idx);
+	void BackupNor(size_t bank_idx);
+	void MarkLcdDirty();
+
+	void ResetStates();
+	void Reset();
+	void LoadStates();
+	bool SaveStates();
+	void LoadNC1020();
+	void SaveNC1020();
+	// false when the input queue was full and the key dropped.
+	bool SetKey(uint8_t key_id, bool down_or_up);
+	void ApplyKey(uint8_t key_id, bool down_or_up);
+	void DrainInput();
+	// applies queued keys and scheduled keys that are due.
+	void PollInput();
+	// steady clock ns, the host time of key presses.
+	static uint64_t HostNanos();
+	// starts following a key press applied now, pressed at host_ns.
+	void ProbeKey(bool down_or_up, uint64_t host_ns);
+	// the lcd was written since the last chunk.
+	void LcdWritten();
+	// records the followed presses the ui has been given a frame of, and
+	// the ones that timed out.
+	void FinishProbes();
+	void ScheduleKey(uint64_t cycle, uint8_t key_id, bool down_or_up);
+	bool HasPendingInput();
+	// blocks until a key is queued or the deadline passed.
+	void WaitForInput(std::chrono::steady_clock::time_point deadline);
+	// asleep in low power mode with nothing to wake it. queued keys count
+	// only when input is not held.
+	bool IsParked();
+	// cycles the parked guest can skip before its rtc alarm or a scheduled
+	// key, at most max_cycles.
+	uint64_t ParkedCycles(uint64_t max_cycles);
+	// moves the timers and the rtc on to end_cycles without running the
+	// cpu, stopping in front of a timer0 event that raises the alarm.
+	void SkipSlept(size_t end_cycles);
+	uint64_t GetCycleCount() const { return cycle_base + cycles; }
+	void SaveSnapshot(uint8_t* snapshot);
+	void LoadSnapshot(const uint8_t* snapshot);
+	bool CopyLcdBuffer(uint8_t* buffer);
+	bool CopyLcdBufferIfChanged(uint8_t* buffer, uint8_t* dirty_rows);
+
+	// the interpreter loop: runs instructions, each followed by the timer
+	// and irq checks of ServiceTimers, until cycles reaches end_cycles or
+	// max_insts retire. returns the number of instructions run.
+	size_t Execute(size_t end_cycles, size_t max_insts);
+	size_t Step();
+	void ServiceTimers();
+	void EndSlice(size_t end_cycles);
+	void RunCycles(size_t end_cycles, bool speed_up);
+	void RunTimeSlice(size_t time_slice, bool speed_up);
+	// runs run_ahead_cycles past the end of the slice, publishes the lcd it
+	// ends with and puts everything back.
+	void RunAhead();
+
+private:
+	Machine(const Machine&);
+	Machine& operator=(const Machine&);
+};
+
+// the machine of Initialize.
+extern Machine* DefaultMachine();
+
+}
+
+#endif /* NC1020_MACHINE_H_ */
@@ -0,0 +1,164 @@
+#include "pacer.h"
+#include "nc1020_machine.h"
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+namespace wqx {
+
+const size_t Pacer::PACER_SAMPLES;
+const size_t Pacer::MAX_PARK_MS;
+const size_t Pacer::MAX_SKIP_MS;
+
+static double Ms(std::chrono::steady_clock::duration duration){
+	return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+static pacer_percentiles_t Percentiles(const double* samples, size_t count){
+	pacer_percentiles_t result = { 0, 0, 0, 0 };
+	if (count == 0) {
+		return result;
+	}
+	std::vector<double> sorted(samples, samples + count);
+	std::sort(sorted.begin(), sorted.end());
+	result.p50 = sorted[(count - 1) * 50 / 100];
+	result.p90 = sorted[(count - 1) * 90 / 100];
+	result.p99 = sorted[(count - 1) * 99 / 100];
+	result.max = sorted[count - 1];
+	return result;
+}
+
+Pacer::Pacer(Machine* machine, const pacer_options_t& options) :
+	machine(machine),
+	options(options),
+	started(false),
+	scheduled_ms(0),
+	emulated_ms(0),
+	slices(0),
+	dropped_ms(0),
+	stalls(0),
+	parked_ms(0),
+	parks(0),
+	last_slice_ms(0),
+	previous_wall_ms(0),
+	samples(0) {
+	if (this->options.slice_ms == 0) {
+		this->options.slice_ms = 1;
+	}
+	if (this->options.max_slice_ms < this->options.slice_ms) {
+		this->options.max_slice_ms = this->options.slice_ms;
+	}
+}
+
+void Pacer::Restart() {
+	if (started) {
+		previous_wall_ms += Ms(Clock::now() - first_start);
+	}
+	started = false;
+}
+
+size_t Pacer::Tick() {
+	Machine* machine = this->machine ? this->machine : DefaultMachine();
+	Clock::time_point now = Clock::now();
+	if (!started) {
+		started = true;
+		origin = now;
+		first_start = now;
+		scheduled_ms = 0;
+		last_slice_ms = 0;
+	} else if (machine->IsParked()) {
+		uint64_t parked_cycles = machine->ParkedCycles((uint64_t)MAX_PARK_MS * CYCLES_MS);
+		if (parked_cycles >= options.slice_ms * CYCLES_MS) {
+			return Park(machine, parked_cycles);
+		}
+	}
+	Clock::time_point due = origin +
+		std::chrono::milliseconds(scheduled_ms + options.slice_ms);
+	if (now < due) {
+#ifdef NC1020_PHASES
+		Phase phase("Sleep");
+#endif
+		std::this_thread::sleep_until(due);
+		now = Clock::now();
+	}
+	double owed_ms = Ms(now - origin) - scheduled_ms;
+	double lag_ms = owed_ms - options.slice_ms;
+	if (lag_ms > options.max_catch_up_ms) {
+		uint64_t dropped = (uint64_t)(lag_ms - options.max_catch_up_ms);
+		origin += std::chrono::milliseconds(dropped);
+		owed_ms -= dropped;
+		dropped_ms += dropped;
+		stalls++;
+	}
+	size_t slice_ms = owed_ms < options.max_slice_ms ?
+		std::max((size_t)owed_ms, options.slice_ms) : options.max_slice_ms;
+
+	RunTimeSlice(machine, slice_ms, options.speed_up);
+	Clock::time_point end = Clock::now();
+
+	if (last_slice_ms) {
+		double wall_ms = Ms(now - last_start);
+		Sample(Ms(end - now), lag_ms > 0 ? lag_ms : 0,
+			wall_ms > 0 ? last_slice_ms / wall_ms : 0);
+	}
+	last_start = now;
+	last_slice_ms = slice_ms;
+	scheduled_ms += slice_ms;
+	emulated_ms += slice_ms;
+	slices++;
+	return slice_ms;
+}
+
+size_t Pacer::Park(Machine* machine, uint64_t parked_cycles) {
+	machine->WaitForInput(origin +
+		std::chrono::milliseconds(scheduled_ms + parked_cycles / CYCLES_MS));
+	Clock::time_point now = Clock::now();
+	double owed_ms = Ms(now - origin) - scheduled_ms;
+	size_t skipped_ms = owed_ms > 0 ? (size_t)owed_ms : 0;
+	// a key that ended the wait was pressed now, not where the park began:
+	// held, it would otherwise wake the guest and have the whole gap run
+	// instruction by instruction.
+	machine->input_held = true;
+	for (size_t left = skipped_ms; left; ) {
+		size_t slice_ms = std::min(left, MAX_SKIP_MS);
+		RunTimeSlice(machine, slice_ms, options.speed_up);
+		left -= slice_ms;
+	}
+	machine->input_held = false;
+	scheduled_ms += skipped_ms;
+	emulated_ms += skipped_ms;
+	parked_ms += skipped_ms;
+	parks++;
+	// the next slice starts a new ratio sample.
+	last_slice_ms = 0;
+	return skipped_ms;
+}
+
+void Pacer::Sample(double slice_ms, double lag_ms, double ratio) {
+	size_t index = samples % PACER_SAMPLES;
+	slice_samples[index] = slice_ms;
+	lag_samples[index] = lag_ms;
+	ratio_samples[index] = ratio;
+	samples++;
+}
+
+pacer_stats_t Pacer::Stats() const {
+	pacer_stats_t stats;
+	stats.slices = slices;
+	stats.emulated_ms = emulated_ms;
+	stats.dropped_ms = dropped_ms;
+	stats.stalls = stalls;
+	stats.parked_ms = parked_ms;
+	stats.parks = parks;
+	stats.wall_seconds = (previous_wall_ms +
+		(started ? Ms(Clock::now() - first_start) : 0)) / 1000;
+	stats.realtime_ratio = stats.wall_seconds > 0 ?
+		emulated_ms / 1000.0 / stats.wall_seconds : 0;
+	size_t count = std::min(samples, PACER_SAMPLES);
+	stats.slice_ms = Percentiles(slice_samples, count);
+	stats.lag_ms = Percentiles(lag_samples, count);
+	stats.ratio = Percentiles(ratio_samples, count);
+	return stats;
+}
+
+}
@@ -0,0 +1,116 @@
+#ifndef PACER_H_
+#define PACER_H_
+
+#include "nc1020.h"
+#include <chrono>
+
+namespace wqx {
+
+typedef struct {
+	// emulated length of a slice while the host keeps up.
+	size_t slice_ms;
+	// longest slice run when the host is behind.
+	size_t max_slice_ms;
+	// the most emulated time made up after a stall, anything beyond is
+	// dropped instead of fast forwarded.
+	size_t max_catch_up_ms;
+	bool speed_up;
+} pacer_options_t;
+
+typedef struct {
+	double p50;
+	double p90;
+	double p99;
+	double max;
+} pacer_percentiles_t;
+
+typedef struct {
+	uint64_t slices;
+	uint64_t emulated_ms;
+	// emulated time given up after stalls, and how many stalls.
+	uint64_t dropped_ms;
+	uint64_t stalls;
+	// emulated time the host slept through while the guest was parked in
+	// low power mode, and how often it parked.
+	uint64_t parked_ms;
+	uint64_t parks;
+	// time spent ticking, without the gaps before a Restart.
+	double wall_seconds;
+	// emulated over wall time, 1 when on time.
+	double realtime_ratio;
+	// over the last PACER_SAMPLES slices: host time running a slice, how
+	// late a slice started against the schedule, and emulated over wall
+	// time from one slice start to the next.
+	pacer_percentiles_t slice_ms;
+	pacer_percentiles_t lag_ms;
+	pacer_percentiles_t ratio;
+} pacer_stats_t;
+
+/**
+ * Pacer
+ * keeps a machine on real time. slice n is due when the monotonic clock
+ * reaches n slices after the first tick, so the cost of running a slice,
+ * of the host's own work and of oversleeping is absorbed by the next sleep
+ * instead of adding up. a host that falls behind gets longer slices (up to
+ * max_slice_ms) back to back until it caught up; after a stall longer than
+ * max_catch_up_ms the schedule moves forward and the rest is dropped.
+ *
+ * a guest parked in low power mode (see SetLowPower) needs no slices: the
+ * host thread blocks until a key is queued or the rtc alarm is due, at most
+ * MAX_PARK_MS, then the time in between is skipped in one go and a key
+ * that ended the wait applies after it.
+ */
+class Pacer {
+public:
+	static const size_t PACER_SAMPLES = 1024;
+	static const size_t MAX_PARK_MS = 3600 * 1000;
+	// a park's time is skipped in slices of at most this, whose cycles fit
+	// a 32 bit size_t.
+	static const size_t MAX_SKIP_MS = 60 * 1000;
+
+	// machine NULL runs the machine of Initialize.
+	Pacer(Machine* machine, const pacer_options_t& options);
+
+	// sleeps until the next slice is due, runs it and returns its emulated
+	// length in ms, or blocks while the guest is parked and returns the
+	// time skipped.
+	size_t Tick();
+	// forgets the schedule, the next tick starts a new one. for hosts that
+	// stopped ticking on purpose (paused, in background).
+	void Restart();
+
+	// from the thread calling Tick.
+	pacer_stats_t Stats() const;
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	void Sample(double slice_ms, double lag_ms, double ratio);
+	size_t Park(Machine* machine, uint64_t parked_cycles);
+
+	Machine* machine;
+	pacer_options_t options;
+	bool started;
+	Clock::time_point origin;
+	Clock::time_point first_start;
+	Clock::time_point last_start;
+	// emulated ms scheduled since origin, and in total.
+	uint64_t scheduled_ms;
+	uint64_t emulated_ms;
+	uint64_t slices;
+	uint64_t dropped_ms;
+	uint64_t stalls;
+	uint64_t parked_ms;
+	uint64_t parks;
+	size_t last_slice_ms;
+	// wall time of the schedules before the last Restart.
+	double previous_wall_ms;
+	size_t samples;
+	double slice_samples[PACER_SAMPLES];
+	double lag_samples[PACER_SAMPLES];
+	double ratio_samples[PACER_SAMPLES];
+};
+
+}
+
+#endif /* PACER_H_ */
@@ -0,0 +1,125 @@
+#include "phases.h"
+
+#ifdef NC1020_PHASES
+
+#include "nc1020.h"
+#include <stdio.h>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+namespace wqx {
+
+// per thread, about 24 MB.
+static const size_t MAX_PHASES = 1 << 20;
+
+typedef struct {
+	const char* name;
+	uint64_t begin;
+	uint64_t end;
+} phase_t;
+
+struct PhaseBuffer {
+	std::mutex mutex;
+	uint32_t tid;
+	std::string name;
+	std::vector<phase_t> phases;
+	uint64_t dropped;
+};
+
+std::atomic<bool> phases_on(false);
+
+// buffers live as long as the process, threads that ended keep theirs
+// until the trace is written.
+static std::mutex buffers_mutex;
+static std::vector<PhaseBuffer*> buffers;
+static uint64_t trace_origin;
+static thread_local PhaseBuffer* thread_buffer = NULL;
+
+uint64_t PhaseNanos(){
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static PhaseBuffer* ThreadBuffer(){
+	if (thread_buffer == NULL) {
+		std::lock_guard<std::mutex> lock(buffers_mutex);
+		thread_buffer = new PhaseBuffer();
+		thread_buffer->tid = (uint32_t)buffers.size() + 1;
+		thread_buffer->dropped = 0;
+		buffers.push_back(thread_buffer);
+	}
+	return thread_buffer;
+}
+
+void RecordPhase(const char* name, uint64_t begin, uint64_t end){
+	PhaseBuffer* buffer = ThreadBuffer();
+	std::lock_guard<std::mutex> lock(buffer->mutex);
+	if (buffer->phases.size() == MAX_PHASES) {
+		buffer->dropped++;
+		return;
+	}
+	phase_t phase = {name, begin, end};
+	buffer->phases.push_back(phase);
+}
+
+void StartPhaseTrace(){
+	std::lock_guard<std::mutex> lock(buffers_mutex);
+	for (size_t i=0; i<buffers.size(); i++) {
+		std::lock_guard<std::mutex> buffer_lock(buffers[i]->mutex);
+		buffers[i]->phases.clear();
+		buffers[i]->dropped = 0;
+	}
+	trace_origin = PhaseNanos();
+	phases_on.store(true, std::memory_order_relaxed);
+}
+
+void StopPhaseTrace(){
+	phases_on.store(false, std::memory_order_relaxed);
+}
+
+void SetPhaseThreadName(const std::string& name){
+	PhaseBuffer* buffer = ThreadBuffer();
+	std::lock_guard<std::mutex> lock(buffer->mutex);
+	buffer->name = name;
+}
+
+// names are literals from the source, nothing to escape.
+bool WritePhaseTrace(const std::string& path){
+	FILE* file = fopen(path.c_str(), "w");
+	if (file == NULL) {
+		return false;
+	}
+	fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"wqx\"}}");
+	std::lock_guard<std::mutex> lock(buffers_mutex);
+	for (size_t i=0; i<buffers.size(); i++) {
+		PhaseBuffer* buffer = buffers[i];
+		std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+		if (!buffer->name.empty()) {
+			fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,"
+				"\"args\":{\"name\":\"%s\"}}", buffer->tid, buffer->name.c_str());
+		}
+		for (size_t j=0; j<buffer->phases.size(); j++) {
+			const phase_t& phase = buffer->phases[j];
+			if (phase.begin < trace_origin) {
+				continue;
+			}
+			fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"wqx\",\"ph\":\"X\",\"pid\":1,"
+				"\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}", phase.name, buffer->tid,
+				(phase.begin - trace_origin) / 1000.0, (phase.end - phase.begin) / 1000.0);
+		}
+		if (buffer->dropped) {
+			fprintf(file, ",\n{\"name\":\"dropped %llu phases\",\"ph\":\"i\",\"s\":\"t\","
+				"\"pid\":1,\"tid\":%u,\"ts\":%.3f}", (unsigned long long)buffer->dropped,
+				buffer->tid, (PhaseNanos() - trace_origin) / 1000.0);
+		}
+	}
+	fprintf(file, "\n]}\n");
+	bool ok = ferror(file) == 0;
+	return fclose(file) == 0 && ok;
+}
+
+}
+
+#endif /* NC1020_PHASES */
@@ -0,0 +1,50 @@
+#ifndef PHASES_H_
+#define PHASES_H_
+
+#ifdef NC1020_PHASES
+
+#include <stdint.h>
+#include <atomic>
+
+namespace wqx {
+
+// set between StartPhaseTrace and StopPhaseTrace.
+extern std::atomic<bool> phases_on;
+// steady clock ns.
+extern uint64_t PhaseNanos();
+// adds the phase to the calling thread's buffer.
+extern void RecordPhase(const char* name, uint64_t begin, uint64_t end);
+
+/**
+ * Phase
+ * a span of host time, built only with NC1020_PHASES. one at the top of a
+ * scope, named with a string literal, times the scope while a phase trace
+ * is on and costs a relaxed load otherwise. every thread records into a
+ * buffer of its own, the only lock is that buffer's, which the thread
+ * writing the trace out takes too.
+ */
+class Phase {
+public:
+	explicit Phase(const char* name) :
+		name(name),
+		begin(phases_on.load(std::memory_order_relaxed) ? PhaseNanos() : 0) {
+	}
+	~Phase(){
+		if (begin) {
+			RecordPhase(name, begin, PhaseNanos());
+		}
+	}
+
+private:
+	const char* name;
+	uint64_t begin;
+
+	Phase(const Phase&);
+	Phase& operator=(const Phase&);
+};
+
+}
+
+#endif /* NC1020_PHASES */
+
+#endif /* PHASES_H_ */
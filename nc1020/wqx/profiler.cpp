@@ -0,0 +1,177 @@
+#include "profiler.h"
+
+#ifdef NC1020_PROFILER
+
+#include "disasm.h"
+#include "nc1020.h"
+#include "nc1020_machine.h"
+#include <stdio.h>
+#include <algorithm>
+
+namespace wqx {
+
+const uint32_t Profiler::INTERRUPT;
+const size_t Profiler::MAX_DEPTH;
+
+Profiler::Profiler(uint8_t* const* memmap, const uint8_t* ram, const uint8_t* rom,
+	const uint8_t* nor, size_t sample_cycles) :
+	memmap(memmap),
+	ram(ram),
+	rom(rom),
+	nor(nor),
+	sample_cycles(sample_cycles),
+	countdown(sample_cycles),
+	total_cycles(0),
+	current(0) {
+	Node root;
+	root.location = 0;
+	root.parent = 0;
+	root.cycles = 0;
+	nodes.push_back(root);
+}
+
+// as Machine::Locate, without a call per instruction.
+uint32_t Profiler::Locate(uint16_t pc) const {
+	uintptr_t cell = (uintptr_t)(memmap[pc >> 13] + (pc & 0x1FFF));
+	if (cell - (uintptr_t)ram < 0x8000) {
+		return PHYS_RAM | (uint32_t)(cell - (uintptr_t)ram);
+	}
+	if (cell - (uintptr_t)rom < ROM_SIZE) {
+		return PHYS_ROM | (uint32_t)(cell - (uintptr_t)rom);
+	}
+	if (cell - (uintptr_t)nor < NOR_SIZE) {
+		return PHYS_NOR | (uint32_t)(cell - (uintptr_t)nor);
+	}
+	return 0;
+}
+
+// the symbol of the location, its LocationName when there is none.
+std::string Profiler::Name(uint32_t location, const SymbolTable* symbols) const {
+	const char* kind = location & INTERRUPT ? "irq:" : "";
+	location &= ~INTERRUPT;
+	const char* symbol = symbols ? symbols->FindLocation(location) : NULL;
+	return kind + (symbol ? std::string(symbol) : LocationName(location));
+}
+
+void Profiler::Charge(uint16_t pc, size_t cycles){
+	nodes[current].cycles += cycles;
+	locations[Locate(pc)] += cycles;
+	total_cycles += cycles;
+}
+
+void Profiler::Call(uint32_t location, uint32_t sp){
+	uint32_t node = current;
+	if (frames.size() < MAX_DEPTH) {
+		uint64_t key = (uint64_t)current << 32 | location;
+		std::unordered_map<uint64_t, uint32_t>::iterator child = children.find(key);
+		if (child != children.end()) {
+			node = child->second;
+		} else {
+			Node callee;
+			callee.location = location;
+			callee.parent = current;
+			callee.cycles = 0;
+			node = (uint32_t)nodes.size();
+			nodes.push_back(callee);
+			children[key] = node;
+		}
+	}
+	Frame frame;
+	frame.node = node;
+	frame.sp = sp;
+	frames.push_back(frame);
+	current = node;
+}
+
+void Profiler::Return(uint8_t sp){
+	while (!frames.empty() && frames.back().sp <= sp) {
+		frames.pop_back();
+	}
+	current = frames.empty() ? 0 : frames.back().node;
+}
+
+void Profiler::Flow(uint8_t opcode, uint16_t next_pc, uint8_t sp){
+	switch (opcode) {
+	// jsr pushed two bytes, brk three.
+	case 0x20: Call(Locate(next_pc), sp + 2u); break;
+	case 0x00: Call(Locate(next_pc) | INTERRUPT, sp + 3u); break;
+	default: Return(sp); break;
+	}
+}
+
+void Profiler::Interrupt(uint16_t pc, uint32_t sp, size_t cycles){
+	Call(Locate(pc) | INTERRUPT, sp);
+	if (!sample_cycles) {
+		Charge(pc, cycles);
+	} else {
+		countdown -= cycles;
+	}
+}
+
+void Profiler::Unwind(){
+	frames.clear();
+	current = 0;
+}
+
+bool Profiler::WriteFolded(const std::string& path, const SymbolTable* symbols) const {
+	FILE* file = fopen(path.c_str(), "w");
+	if (file == NULL) {
+		return false;
+	}
+	std::vector<std::string> names(nodes.size());
+	names[0] = "wqx";
+	// parents come before their children.
+	for (size_t i=1; i<nodes.size(); i++) {
+		names[i] = names[nodes[i].parent] + ";" + Name(nodes[i].location, symbols);
+	}
+	for (size_t i=0; i<nodes.size(); i++) {
+		if (nodes[i].cycles) {
+			fprintf(file, "%s %llu\n", names[i].c_str(), (unsigned long long)nodes[i].cycles);
+		}
+	}
+	bool ok = ferror(file) == 0;
+	fclose(file);
+	return ok;
+}
+
+static bool MoreCycles(const std::pair<uint32_t, uint64_t>& a, const std::pair<uint32_t, uint64_t>& b){
+	return a.second > b.second || (a.second == b.second && a.first < b.first);
+}
+
+std::string Profiler::Top(size_t count, const SymbolTable* symbols) const {
+	std::vector<std::pair<uint32_t, uint64_t> > sorted(locations.begin(), locations.end());
+	std::sort(sorted.begin(), sorted.end(), MoreCycles);
+	std::string text;
+	for (size_t i=0; i<sorted.size() && i<count; i++) {
+		char line[160];
+		snprintf(line, sizeof(line), "%14llu %6.2f%%  %s\n",
+			(unsigned long long)sorted[i].second,
+			total_cycles ? sorted[i].second * 100.0 / total_cycles : 0,
+			Name(sorted[i].first, symbols).c_str());
+		text += line;
+	}
+	return text;
+}
+
+void StartProfiler(Machine* machine, size_t sample_cycles){
+	delete machine->profiler;
+	machine->profiler = new Profiler(machine->memmap, machine->ram_buff,
+		machine->rom_buff, machine->nor_buff, sample_cycles);
+}
+
+void StopProfiler(Machine* machine){
+	delete machine->profiler;
+	machine->profiler = NULL;
+}
+
+bool WriteProfile(Machine* machine, const std::string& path, const SymbolTable* symbols){
+	return machine->profiler && machine->profiler->WriteFolded(path, symbols);
+}
+
+std::string ProfileTop(Machine* machine, size_t count, const SymbolTable* symbols){
+	return machine->profiler ? machine->profiler->Top(count, symbols) : std::string();
+}
+
+}
+
+#endif /* NC1020_PROFILER */
@@ -0,0 +1,111 @@
+#ifndef PROFILER_H_
+#define PROFILER_H_
+
+#ifdef NC1020_PROFILER
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace wqx {
+
+/**
+ * Profiler
+ * where the guest spends its cycles, built only with NC1020_PROFILER. Execute
+ * reports every instruction it retires; a location is the physical location
+ * of the pc (see Locate), so the same pc in two banks counts apart and a
+ * SymbolTable can name it. JSR, BRK and interrupts open a
+ * frame of the call graph, RTS and RTI close every frame whose stack
+ * pointer they went back above, which keeps the graph right through RTS
+ * used as a jump and stacks dropped with TXS.
+ *
+ * sample_cycles 0 counts the cycles of every instruction. otherwise only
+ * every sample_cycles the location and stack are charged sample_cycles, and
+ * between samples only calls and returns are looked at.
+ * lockstep groups run their own interpreter and are not profiled.
+ */
+class SymbolTable;
+
+class Profiler {
+public:
+	Profiler(uint8_t* const* memmap, const uint8_t* ram, const uint8_t* rom,
+		const uint8_t* nor, size_t sample_cycles);
+
+	// the instruction at pc took cycles, after it the cpu is at next_pc with
+	// stack pointer sp.
+	inline void Retire(uint16_t pc, size_t cycles, uint16_t next_pc, uint8_t sp);
+	// an interrupt went to pc, its pushes started at stack pointer sp.
+	void Interrupt(uint16_t pc, uint32_t sp, size_t cycles);
+	// the stack is gone, as after a reset.
+	void Unwind();
+
+	uint64_t TotalCycles() const { return total_cycles; }
+	// one "frame;frame;... cycles" line per stack, for flamegraph.pl and
+	// the like. frames are named by symbols where it has them (may be NULL).
+	bool WriteFolded(const std::string& path, const SymbolTable* symbols) const;
+	// the count locations with the most cycles, one per line.
+	std::string Top(size_t count, const SymbolTable* symbols) const;
+
+private:
+	// a frame opened by an interrupt or BRK.
+	static const uint32_t INTERRUPT = 0x80000000;
+	static const size_t MAX_DEPTH = 128;
+
+	struct Node {
+		uint32_t location;
+		uint32_t parent;
+		uint64_t cycles;
+	};
+	struct Frame {
+		uint32_t node;
+		// the stack pointer before the call pushed anything.
+		uint32_t sp;
+	};
+
+	uint8_t* const* memmap;
+	const uint8_t* ram;
+	const uint8_t* rom;
+	const uint8_t* nor;
+	size_t sample_cycles;
+	int64_t countdown;
+	uint64_t total_cycles;
+
+	std::vector<Node> nodes;
+	// node of (parent << 32 | location).
+	std::unordered_map<uint64_t, uint32_t> children;
+	std::vector<Frame> frames;
+	uint32_t current;
+	std::unordered_map<uint32_t, uint64_t> locations;
+
+	// the physical location, INTERRUPT stays clear.
+	uint32_t Locate(uint16_t pc) const;
+	std::string Name(uint32_t location, const SymbolTable* symbols) const;
+	void Charge(uint16_t pc, size_t cycles);
+	void Call(uint32_t location, uint32_t sp);
+	void Return(uint8_t sp);
+	void Flow(uint8_t opcode, uint16_t next_pc, uint8_t sp);
+
+	Profiler(const Profiler&);
+	Profiler& operator=(const Profiler&);
+};
+
+inline void Profiler::Retire(uint16_t pc, size_t cycles, uint16_t next_pc, uint8_t sp){
+	if (!sample_cycles) {
+		Charge(pc, cycles);
+	} else if ((countdown -= cycles) <= 0) {
+		countdown += sample_cycles;
+		Charge(pc, sample_cycles);
+	}
+	uint8_t opcode = memmap[pc >> 13][pc & 0x1FFF];
+	if (opcode == 0x20 || opcode == 0x60 || opcode == 0x40 || opcode == 0x00) {
+		Flow(opcode, next_pc, sp);
+	}
+}
+
+}
+
+#endif /* NC1020_PROFILER */
+
+#endif /* PROFILER_H_ */
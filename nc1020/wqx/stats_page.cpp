@@ -0,0 +1,185 @@
+#include "stats_page.h"
+#include "nc1020_machine.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <chrono>
+#include <thread>
+
+namespace wqx {
+
+static const char STATS_MAGIC[8] = {'W', 'Q', 'X', 'S', 'T', 'A', 'T', 'S'};
+
+const uint64_t StatsPage::STATS_WINDOW_MS;
+
+static uint64_t UnixMs(){
+	return std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+StatsPage::StatsPage() :
+	page(NULL) {
+}
+
+StatsPage::~StatsPage(){
+	if (page) {
+		munmap(page, sizeof(stats_page_t));
+		shm_unlink(name.c_str());
+	}
+}
+
+bool StatsPage::Open(const std::string& name){
+	if (page) {
+		return false;
+	}
+	this->name = name;
+	if (this->name.empty()) {
+		char text[32];
+		snprintf(text, sizeof(text), "/wqx-%ld", (long)getpid());
+		this->name = text;
+	}
+	int fd = shm_open(this->name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		return false;
+	}
+	void* memory = MAP_FAILED;
+	if (ftruncate(fd, sizeof(stats_page_t)) == 0) {
+		memory = mmap(NULL, sizeof(stats_page_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+	close(fd);
+	if (memory == MAP_FAILED) {
+		shm_unlink(this->name.c_str());
+		return false;
+	}
+	// zero filled, which is every sequence at 0. the magic goes last so a
+	// reader never takes a page still being set up.
+	page = (stats_page_t*)memory;
+	page->version = STATS_PAGE_VERSION;
+	page->slots = STATS_PAGE_SLOTS;
+	page->pid = getpid();
+	std::atomic_thread_fence(std::memory_order_release);
+	memcpy(page->magic, STATS_MAGIC, sizeof(STATS_MAGIC));
+	sources.reserve(STATS_PAGE_SLOTS);
+	return true;
+}
+
+int StatsPage::Add(Machine* machine, const std::string& label){
+	if (page == NULL || sources.size() == STATS_PAGE_SLOTS) {
+		return -1;
+	}
+	Source source;
+	source.machine = machine;
+	source.label = label;
+	source.window_ns = Machine::HostNanos();
+	source.window_cycles = machine->GetCycleCount();
+	source.window_busy_ns = machine->busy_ns;
+	source.mhz = 0;
+	source.realtime_ratio = 0;
+	sources.push_back(source);
+	return (int)sources.size() - 1;
+}
+
+void StatsPage::Publish(int slot){
+	if (page == NULL || slot < 0 || (size_t)slot >= sources.size()) {
+		return;
+	}
+	Source& source = sources[slot];
+	Machine* machine = source.machine;
+	uint64_t now = Machine::HostNanos();
+	uint64_t cycles = machine->GetCycleCount();
+	if (now - source.window_ns >= STATS_WINDOW_MS * 1000000) {
+		uint64_t busy_ns = machine->busy_ns - source.window_busy_ns;
+		double emulated = (double)(cycles - source.window_cycles);
+		source.mhz = busy_ns ? emulated * 1000 / busy_ns : 0;
+		source.realtime_ratio = emulated / CYCLES_SECOND * 1e9 / (now - source.window_ns);
+		source.window_ns = now;
+		source.window_cycles = cycles;
+		source.window_busy_ns = machine->busy_ns;
+	}
+
+	live_stats_t stats;
+	memset(&stats, 0, sizeof(stats));
+	strncpy(stats.name, source.label.c_str(), sizeof(stats.name) - 1);
+	stats.updated_ms = UnixMs();
+	stats.cycles = cycles;
+	stats.mhz = source.mhz;
+	stats.realtime_ratio = source.realtime_ratio;
+	stats.lcd_generation = machine->lcd_generation;
+	stats.saves = machine->saves;
+	stats.last_save_ms = machine->last_save_ns / 1e6;
+	stats.save_errors = machine->save_errors;
+	stats.flash_errors = machine->flash_errors;
+	stats.sleeping = machine->slept;
+
+	stats_slot_t& target = page->slot[slot];
+	uint32_t sequence = target.sequence.load(std::memory_order_relaxed);
+	target.sequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	memcpy(&target.stats, &stats, sizeof(stats));
+	target.sequence.store(sequence + 2, std::memory_order_release);
+}
+
+StatsReader::StatsReader() :
+	page(NULL) {
+}
+
+StatsReader::~StatsReader(){
+	if (page) {
+		munmap((void*)page, sizeof(stats_page_t));
+	}
+}
+
+bool StatsReader::Open(const std::string& name){
+	int fd = shm_open(name.c_str(), O_RDONLY, 0);
+	if (fd < 0) {
+		return false;
+	}
+	void* memory = mmap(NULL, sizeof(stats_page_t), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (memory == MAP_FAILED) {
+		return false;
+	}
+	const stats_page_t* mapped = (const stats_page_t*)memory;
+	if (memcmp(mapped->magic, STATS_MAGIC, sizeof(STATS_MAGIC)) != 0 ||
+		mapped->version != STATS_PAGE_VERSION || mapped->slots != STATS_PAGE_SLOTS) {
+		munmap(memory, sizeof(stats_page_t));
+		return false;
+	}
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if (page) {
+		munmap((void*)page, sizeof(stats_page_t));
+	}
+	page = mapped;
+	return true;
+}
+
+int64_t StatsReader::Pid() const {
+	return page ? page->pid : 0;
+}
+
+bool StatsReader::Read(size_t slot, live_stats_t* stats) const {
+	if (page == NULL || slot >= STATS_PAGE_SLOTS) {
+		return false;
+	}
+	const stats_slot_t& source = page->slot[slot];
+	for (size_t tries=0; tries<1000; tries++) {
+		uint32_t before = source.sequence.load(std::memory_order_acquire);
+		if (before == 0) {
+			return false;
+		}
+		if (before & 1) {
+			std::this_thread::yield();
+			continue;
+		}
+		memcpy(stats, &source.stats, sizeof(*stats));
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (source.sequence.load(std::memory_order_relaxed) == before) {
+			return true;
+		}
+	}
+	return false;
+}
+
+}
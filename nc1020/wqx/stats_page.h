@@ -0,0 +1,116 @@
+#ifndef STATS_PAGE_H_
+#define STATS_PAGE_H_
+
+#include "nc1020.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+namespace wqx {
+
+const uint32_t STATS_PAGE_VERSION = 1;
+const size_t STATS_PAGE_SLOTS = 64;
+
+// what a slot of the page says about one machine. rates are over the last
+// STATS_WINDOW_MS or more.
+typedef struct {
+	char name[48];
+	// unix ms of the last Publish.
+	uint64_t updated_ms;
+	uint64_t cycles;
+	// emulated MHz while emulating, the most the host could run it at.
+	double mhz;
+	// emulated time over wall time.
+	double realtime_ratio;
+	uint64_t lcd_generation;
+	uint64_t saves;
+	double last_save_ms;
+	uint64_t save_errors;
+	uint64_t flash_errors;
+	uint8_t sleeping;
+} live_stats_t;
+
+// sequence is odd while the slot is written, 0 until the first Publish.
+typedef struct {
+	std::atomic<uint32_t> sequence;
+	live_stats_t stats;
+} stats_slot_t;
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t slots;
+	int64_t pid;
+	stats_slot_t slot[STATS_PAGE_SLOTS];
+} stats_page_t;
+
+/**
+ * StatsPage
+ * publishes the stats of a process's machines in a posix shared memory
+ * object (/dev/shm on linux), for monitoring from outside without touching
+ * the emulation. every slot is a seqlock: the one thread running its
+ * machine writes it without waiting, readers retry when they overlap a
+ * write. the object goes away with the StatsPage.
+ */
+class StatsPage {
+public:
+	static const uint64_t STATS_WINDOW_MS = 500;
+
+	StatsPage();
+	~StatsPage();
+
+	// creates the page, named "/wqx-<pid>" when name is empty.
+	bool Open(const std::string& name);
+	const std::string& Name() const { return name; }
+	// a slot for the machine, -1 once all are taken. before the machine runs.
+	int Add(Machine* machine, const std::string& label);
+	// the machine's stats into its slot, on the thread that runs it,
+	// between slices. cheap enough for every slice.
+	void Publish(int slot);
+
+private:
+	struct Source {
+		Machine* machine;
+		std::string label;
+		uint64_t window_ns;
+		uint64_t window_cycles;
+		uint64_t window_busy_ns;
+		double mhz;
+		double realtime_ratio;
+	};
+
+	std::string name;
+	stats_page_t* page;
+	std::vector<Source> sources;
+
+	StatsPage(const StatsPage&);
+	StatsPage& operator=(const StatsPage&);
+};
+
+/**
+ * StatsReader
+ * maps a page read only, from any process.
+ */
+class StatsReader {
+public:
+	StatsReader();
+	~StatsReader();
+
+	bool Open(const std::string& name);
+	int64_t Pid() const;
+	// false for a slot never published, or one written too often to get a
+	// consistent copy.
+	bool Read(size_t slot, live_stats_t* stats) const;
+
+private:
+	const stats_page_t* page;
+
+	StatsReader(const StatsReader&);
+	StatsReader& operator=(const StatsReader&);
+};
+
+}
+
+#endif /* STATS_PAGE_H_ */
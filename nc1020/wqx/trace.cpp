@@ -0,0 +1,229 @@
+#include "trace.h"
+#include <string.h>
+
+#ifdef NC1020_TRACE
+#include "nc1020_machine.h"
+#include <chrono>
+#endif
+
+namespace wqx {
+
+static const char TRACE_MAGIC[8] = {'W', 'Q', 'X', 'T', 'R', 'A', 'C', 'E'};
+
+TraceReader::TraceReader() :
+	file(NULL) {
+	memset(&header, 0, sizeof(header));
+	memset(last, 0, sizeof(last));
+}
+
+TraceReader::~TraceReader(){
+	if (file) {
+		fclose(file);
+	}
+}
+
+bool TraceReader::Open(const std::string& path){
+	if (file) {
+		fclose(file);
+	}
+	memset(last, 0, sizeof(last));
+	file = fopen(path.c_str(), "rb");
+	if (file == NULL) {
+		return false;
+	}
+	if (fread(&header, sizeof(header), 1, file) != 1 ||
+		memcmp(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0 ||
+		header.version != TRACE_VERSION) {
+		fclose(file);
+		file = NULL;
+		return false;
+	}
+	return true;
+}
+
+bool TraceReader::Next(trace_record_t* record){
+	if (file == NULL) {
+		return false;
+	}
+	int mask = getc(file);
+	if (mask == EOF) {
+		return false;
+	}
+	for (size_t i=0; i<8; i++) {
+		if (mask & (1 << i)) {
+			int value = getc(file);
+			if (value == EOF) {
+				return false;
+			}
+			last[i] = (uint8_t)value;
+		}
+	}
+	memcpy(record, last, sizeof(*record));
+	return true;
+}
+
+#ifdef NC1020_TRACE
+
+const size_t TraceWriter::CHUNK_RECORDS;
+const size_t TraceWriter::CHUNKS;
+
+TraceWriter::TraceWriter(uint8_t* const* memmap, const trace_options_t& options) :
+	memmap(memmap),
+	options(options),
+	file(NULL),
+	recording(false),
+	done(false),
+	seen(0),
+	remaining(options.max_insts ? options.max_insts : (uint64_t)-1),
+	recorded(0),
+	chunk(NULL),
+	fill(0),
+	chunks(CHUNKS),
+	head(0),
+	tail(0),
+	closing(false),
+	failed(false) {
+	chunk = chunks[0].records;
+}
+
+TraceWriter::~TraceWriter(){
+	Close();
+}
+
+static bool WriteHeader(FILE* file, const trace_options_t& options, uint64_t start_inst){
+	trace_header_t header;
+	memcpy(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+	header.version = TRACE_VERSION;
+	header.peek_addr = options.peek_addr;
+	header.start_inst = start_inst;
+	return fwrite(&header, sizeof(header), 1, file) == 1;
+}
+
+bool TraceWriter::Open(){
+	file = fopen(options.path.c_str(), "wb");
+	if (file == NULL || !WriteHeader(file, options, 0)) {
+		done = true;
+		return false;
+	}
+	writer = std::thread(&TraceWriter::Drain, this);
+	return true;
+}
+
+bool TraceWriter::Arm(uint16_t pc){
+	if (seen < options.start_inst || (options.start_pc >= 0 && pc != options.start_pc)) {
+		seen++;
+		return false;
+	}
+	recording = true;
+	return true;
+}
+
+void TraceWriter::Push(){
+	size_t pushed = tail.load(std::memory_order_relaxed);
+	chunks[pushed % CHUNKS].count = fill;
+	tail.store(pushed + 1, std::memory_order_release);
+	while (pushed + 1 - head.load(std::memory_order_acquire) == CHUNKS) {
+		std::this_thread::yield();
+	}
+	chunk = chunks[(pushed + 1) % CHUNKS].records;
+	fill = 0;
+}
+
+void TraceWriter::Finish(){
+	if (fill) {
+		Push();
+	}
+	recording = false;
+	done = true;
+	closing.store(true, std::memory_order_release);
+}
+
+// branch free, every byte is stored and the cursor moves past the changed
+// ones only. out needs 9 bytes per record.
+static size_t Encode(const trace_record_t* records, size_t count, uint8_t* last, uint8_t* out){
+	uint8_t* start = out;
+	uint8_t previous[8];
+	memcpy(previous, last, 8);
+	for (size_t i=0; i<count; i++) {
+		const uint8_t* bytes = (const uint8_t*)&records[i];
+		uint8_t* mask = out++;
+		uint8_t changed = 0;
+		for (size_t j=0; j<8; j++) {
+			uint8_t differs = bytes[j] != previous[j];
+			*out = bytes[j];
+			out += differs;
+			changed |= differs << j;
+		}
+		*mask = changed;
+		memcpy(previous, bytes, 8);
+	}
+	memcpy(last, previous, 8);
+	return out - start;
+}
+
+void TraceWriter::Drain(){
+	std::vector<uint8_t> encoded(CHUNK_RECORDS * 9);
+	uint8_t last[8] = {0};
+	for (;;) {
+		size_t popped = head.load(std::memory_order_relaxed);
+		if (popped == tail.load(std::memory_order_acquire)) {
+			if (closing.load(std::memory_order_acquire)) {
+				if (popped == tail.load(std::memory_order_acquire)) {
+					return;
+				}
+				continue;
+			}
+			std::this_thread::sleep_for(std::chrono::microseconds(500));
+			continue;
+		}
+		const Chunk& full = chunks[popped % CHUNKS];
+		size_t size = Encode(full.records, full.count, last, &encoded[0]);
+		if (fwrite(&encoded[0], 1, size, file) != size) {
+			failed.store(true, std::memory_order_relaxed);
+		}
+		head.store(popped + 1, std::memory_order_release);
+	}
+}
+
+uint64_t TraceWriter::Close(){
+	if (file == NULL) {
+		return recorded;
+	}
+	if (!done) {
+		Finish();
+	}
+	writer.join();
+	// the window is known only now.
+	if (fseek(file, 0, SEEK_SET) != 0 || !WriteHeader(file, options, seen) ||
+		fclose(file) != 0) {
+		failed.store(true, std::memory_order_relaxed);
+	}
+	file = NULL;
+	return recorded;
+}
+
+bool StartTrace(Machine* machine, const trace_options_t& options){
+	StopTrace(machine);
+	TraceWriter* tracer = new TraceWriter(machine->memmap, options);
+	if (!tracer->Open()) {
+		delete tracer;
+		return false;
+	}
+	machine->tracer = tracer;
+	return true;
+}
+
+uint64_t StopTrace(Machine* machine){
+	if (machine->tracer == NULL) {
+		return 0;
+	}
+	uint64_t recorded = machine->tracer->Close();
+	bool failed = machine->tracer->Failed();
+	delete machine->tracer;
+	machine->tracer = NULL;
+	return failed ? 0 : recorded;
+}
+
+#endif /* NC1020_TRACE */
+
+}
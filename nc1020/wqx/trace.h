@@ -0,0 +1,157 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include "nc1020.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace wqx {
+
+// one instruction of an execution trace: the cpu before it ran and one
+// byte of memory, its opcode unless a peek address was asked for. the
+// records of the old wqxsimlogs.bin.
+typedef struct {
+	uint16_t reg_pc;
+	uint8_t reg_a;
+	uint8_t reg_ps;
+	uint8_t reg_x;
+	uint8_t reg_y;
+	uint8_t reg_sp;
+	uint8_t peeked;
+} trace_record_t;
+
+// a trace file is this header, start_inst counting the instructions run
+// from StartTrace to the first one recorded, then the records, each a byte
+// with bit i set for every byte i that differs from the record before
+// followed by those bytes. most instructions change only the pc and one or
+// two registers, so this halves the file for next to no work.
+const uint32_t TRACE_VERSION = 1;
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	int32_t peek_addr;
+	uint64_t start_inst;
+} trace_header_t;
+
+/**
+ * TraceReader
+ * reads trace files back, one record at a time.
+ */
+class TraceReader {
+public:
+	TraceReader();
+	~TraceReader();
+
+	bool Open(const std::string& path);
+	const trace_header_t& Header() const { return header; }
+	// false at the end of the file.
+	bool Next(trace_record_t* record);
+
+private:
+	FILE* file;
+	trace_header_t header;
+	uint8_t last[8];
+
+	TraceReader(const TraceReader&);
+	TraceReader& operator=(const TraceReader&);
+};
+
+#ifdef NC1020_TRACE
+
+/**
+ * TraceWriter
+ * records the instructions Execute runs, built only with NC1020_TRACE. the
+ * emulation thread fills chunks of raw records in place and hands them over
+ * through a single producer single consumer ring; a thread of the writer's
+ * own encodes and writes them. when it falls behind by all CHUNKS chunks
+ * the emulation waits for it, a trace never has holes.
+ */
+class TraceWriter {
+public:
+	static const size_t CHUNK_RECORDS = 16384;
+	static const size_t CHUNKS = 64;
+
+	TraceWriter(uint8_t* const* memmap, const trace_options_t& options);
+	~TraceWriter();
+
+	// opens the file and starts the writer thread.
+	bool Open();
+	// the instruction about to run at pc.
+	inline void Record(uint16_t pc, uint8_t a, uint8_t ps, uint8_t x, uint8_t y, uint8_t sp);
+	// ends the trace and waits for the file to be written. returns the
+	// records in it.
+	uint64_t Close();
+	bool Failed() const { return failed.load(std::memory_order_relaxed); }
+
+private:
+	struct Chunk {
+		size_t count;
+		trace_record_t records[CHUNK_RECORDS];
+	};
+
+	uint8_t* const* memmap;
+	trace_options_t options;
+	FILE* file;
+	std::thread writer;
+
+	// emulation thread. seen counts the instructions before the window.
+	bool recording;
+	bool done;
+	uint64_t seen;
+	uint64_t remaining;
+	uint64_t recorded;
+	trace_record_t* chunk;
+	size_t fill;
+
+	std::vector<Chunk> chunks;
+	std::atomic<size_t> head;
+	std::atomic<size_t> tail;
+	std::atomic<bool> closing;
+	std::atomic<bool> failed;
+
+	// true when the window opens at this instruction.
+	bool Arm(uint16_t pc);
+	void Push();
+	void Finish();
+	void Drain();
+
+	TraceWriter(const TraceWriter&);
+	TraceWriter& operator=(const TraceWriter&);
+};
+
+inline void TraceWriter::Record(uint16_t pc, uint8_t a, uint8_t ps, uint8_t x, uint8_t y, uint8_t sp){
+	if (!recording && (done || !Arm(pc))) {
+		return;
+	}
+	if (pc == options.stop_pc) {
+		Finish();
+		return;
+	}
+	uint16_t peek = options.peek_addr < 0 ? pc : (uint16_t)options.peek_addr;
+	trace_record_t& record = chunk[fill];
+	record.reg_pc = pc;
+	record.reg_a = a;
+	record.reg_ps = ps;
+	record.reg_x = x;
+	record.reg_y = y;
+	record.reg_sp = sp;
+	record.peeked = memmap[peek >> 13][peek & 0x1FFF];
+	recorded++;
+	if (++fill == CHUNK_RECORDS) {
+		Push();
+	}
+	if (--remaining == 0) {
+		Finish();
+	}
+}
+
+#endif /* NC1020_TRACE */
+
+}
+
+#endif /* TRACE_H_ */
@@ -0,0 +1,105 @@
+#include "wav_recorder.h"
+#include "nc1020_machine.h"
+#include <string.h>
+
+namespace wqx {
+    using std::string;
+
+static const size_t HEADER_SIZE = 44;
+
+const size_t WavRecorder::DEFAULT_RATE;
+
+static void PutU16(uint8_t* out, uint16_t value){
+	out[0] = (uint8_t)value;
+	out[1] = (uint8_t)(value >> 8);
+}
+
+static void PutU32(uint8_t* out, uint32_t value){
+	for (size_t i=0; i<4; i++) {
+		out[i] = (uint8_t)(value >> (i * 8));
+	}
+}
+
+// canonical riff header of a mono 16 bit pcm stream of data_size bytes.
+static void MakeHeader(uint8_t* header, uint32_t rate, uint32_t data_size){
+	memcpy(header, "RIFF", 4);
+	PutU32(header + 4, 36 + data_size);
+	memcpy(header + 8, "WAVEfmt ", 8);
+	PutU32(header + 16, 16);
+	PutU16(header + 20, 1);
+	PutU16(header + 22, 1);
+	PutU32(header + 24, rate);
+	PutU32(header + 28, rate * 2);
+	PutU16(header + 32, 2);
+	PutU16(header + 34, 16);
+	memcpy(header + 36, "data", 4);
+	PutU32(header + 40, data_size);
+}
+
+WavRecorder::WavRecorder() :
+	machine(NULL),
+	file(NULL),
+	samples(0) {
+}
+
+WavRecorder::~WavRecorder() {
+	Stop();
+}
+
+bool WavRecorder::Start(Machine* machine, const string& path){
+	Stop();
+	file = fopen(path.c_str(), "wb");
+	if (file == NULL) {
+		return false;
+	}
+	if (!machine->audio_rate) {
+		EnableAudio(machine, DEFAULT_RATE);
+	}
+	uint8_t header[HEADER_SIZE];
+	MakeHeader(header, (uint32_t)machine->audio_rate, 0);
+	fwrite(header, 1, sizeof(header), file);
+
+	this->machine = machine;
+	samples = 0;
+	SetAudioListener(machine, &WavRecorder::OnAudio, this);
+	return true;
+}
+
+void WavRecorder::OnAudio(void* context, uint64_t cycle, const int16_t* samples, size_t count){
+	((WavRecorder*)context)->WriteSamples(samples, count);
+}
+
+void WavRecorder::WriteSamples(const int16_t* samples, size_t count){
+	uint8_t data[2 * 256];
+	while (count) {
+		size_t chunk = count < 256 ? count : 256;
+		for (size_t i=0; i<chunk; i++) {
+			PutU16(data + i * 2, (uint16_t)samples[i]);
+		}
+		fwrite(data, 2, chunk, file);
+		samples += chunk;
+		count -= chunk;
+		this->samples += chunk;
+	}
+}
+
+void WavRecorder::Stop(){
+	if (file == NULL) {
+		return;
+	}
+	SetAudioListener(machine, NULL, NULL);
+	// a wav file holds at most 4 GB, later samples are left unaccounted.
+	uint64_t data_size = samples * 2;
+	if (data_size > 0xFFFFFFFFull - 36) {
+		data_size = 0xFFFFFFFFull - 36;
+	}
+	uint8_t header[HEADER_SIZE];
+	MakeHeader(header, (uint32_t)machine->audio_rate, (uint32_t)data_size);
+	fseek(file, 0, SEEK_SET);
+	fwrite(header, 1, sizeof(header), file);
+	fclose(file);
+	file = NULL;
+	machine = NULL;
+}
+
+}
@@ -0,0 +1,40 @@
+#ifndef WAV_RECORDER_H_
+#define WAV_RECORDER_H_
+
+#include "nc1020.h"
+#include <stdio.h>
+#include <string>
+
+namespace wqx {
+
+/**
+ * sound captures
+ * WavRecorder listens to the audio a machine renders and writes it to a
+ * 16 bit mono pcm wav file, at the machine's rate or 22050 when it had
+ * audio off. the sizes in the header are filled in by Stop.
+ */
+class WavRecorder {
+public:
+	static const size_t DEFAULT_RATE = 22050;
+
+	WavRecorder();
+	~WavRecorder();
+
+	bool Start(Machine* machine, const std::string& path);
+	void Stop();
+	bool IsRecording() const { return file != NULL; }
+
+	uint64_t Samples() const { return samples; }
+
+private:
+	static void OnAudio(void* context, uint64_t cycle, const int16_t* samples, size_t count);
+	void WriteSamples(const int16_t* samples, size_t count);
+
+	Machine* machine;
+	FILE* file;
+	uint64_t samples;
+};
+
+}
+
+#endif /* WAV_RECORDER_H_ */
@@ -0,0 +1,148 @@
+#include "work_pool.h"
+
+namespace wqx {
+
+WorkPool::WorkPool(size_t threads) :
+	generation(0),
+	stopping(false),
+	func(NULL),
+	context(NULL),
+	remaining(0) {
+	if (threads == 0) {
+		threads = std::thread::hardware_concurrency();
+		if (threads == 0) {
+			threads = 1;
+		}
+	}
+	for (size_t i=0; i<threads; i++) {
+		queues.push_back(new Queue());
+	}
+	for (size_t i=1; i<threads; i++) {
+		workers.push_back(std::thread(&WorkPool::WorkerLoop, this, i));
+	}
+}
+
+WorkPool::~WorkPool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake_cv.notify_all();
+	for (size_t i=0; i<workers.size(); i++) {
+		workers[i].join();
+	}
+	for (size_t i=0; i<queues.size(); i++) {
+		delete queues[i];
+	}
+}
+
+void WorkPool::Queue::PushBack(size_t index) {
+	size_t capacity = items.size();
+	if (count == capacity) {
+		std::vector<size_t> grown(capacity ? capacity * 2 : 64);
+		for (size_t i=0; i<count; i++) {
+			grown[i] = items[(head + i) % capacity];
+		}
+		items.swap(grown);
+		head = 0;
+		capacity = items.size();
+	}
+	items[(head + count) % capacity] = index;
+	count++;
+}
+
+bool WorkPool::Queue::PopFront(size_t& index) {
+	if (count == 0) {
+		return false;
+	}
+	index = items[head];
+	head = (head + 1) % items.size();
+	count--;
+	return true;
+}
+
+bool WorkPool::Queue::PopBack(size_t& index) {
+	if (count == 0) {
+		return false;
+	}
+	count--;
+	index = items[(head + count) % items.size()];
+	return true;
+}
+
+bool WorkPool::Pop(size_t self, size_t& index) {
+	Queue* own = queues[self];
+	{
+		std::lock_guard<std::mutex> lock(own->mutex);
+		if (own->PopFront(index)) {
+			return true;
+		}
+	}
+	size_t count = queues.size();
+	for (size_t i=1; i<count; i++) {
+		Queue* victim = queues[(self + i) % count];
+		std::lock_guard<std::mutex> lock(victim->mutex);
+		if (victim->PopBack(index)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void WorkPool::Work(size_t self) {
+	size_t index;
+	while (Pop(self, index)) {
+		// func and context are published before any index of the batch is
+		// queued, so a worker still draining the previous batch runs new
+		// items with the right task.
+		func.load()(context.load(), index);
+		if (remaining.fetch_sub(1) == 1) {
+			std::lock_guard<std::mutex> lock(mutex);
+			done_cv.notify_all();
+		}
+	}
+}
+
+void WorkPool::WorkerLoop(size_t self) {
+	size_t seen = 0;
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			while (!stopping && generation == seen) {
+				wake_cv.wait(lock);
+			}
+			if (stopping) {
+				return;
+			}
+			seen = generation;
+		}
+		Work(self);
+	}
+}
+
+void WorkPool::Run(const size_t* order, size_t count, task_func_t func, void* context) {
+	if (count == 0) {
+		return;
+	}
+	this->func = func;
+	this->context = context;
+	remaining = count;
+	size_t threads = queues.size();
+	for (size_t i=0; i<count; i++) {
+		Queue* queue = queues[i % threads];
+		std::lock_guard<std::mutex> lock(queue->mutex);
+		queue->PushBack(order ? order[i] : i);
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		generation++;
+	}
+	wake_cv.notify_all();
+	Work(0);
+	std::unique_lock<std::mutex> lock(mutex);
+	while (remaining.load() != 0) {
+		done_cv.wait(lock);
+	}
+}
+
+}
@@ -0,0 +1,72 @@
+#ifndef WORK_POOL_H_
+#define WORK_POOL_H_
+
+#include <stddef.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace wqx {
+
+/**
+ * WorkPool
+ * runs batches of independent tasks on a fixed set of threads. every thread
+ * owns a deque, takes work from its front and steals from the back of the
+ * others once its own deque runs dry. the calling thread takes part in the
+ * batch as worker 0.
+ */
+class WorkPool {
+public:
+	typedef void (*task_func_t)(void* context, size_t index);
+
+	explicit WorkPool(size_t threads);
+	~WorkPool();
+
+	size_t Threads() const { return queues.size(); }
+
+	// run func(context, order[i]) for every i < count, dealt round robin so
+	// the first entries of order land on different threads. blocks until
+	// the whole batch is done.
+	void Run(const size_t* order, size_t count, task_func_t func, void* context);
+
+private:
+	// ring of task indices. it only grows, so once warmed up a batch runs
+	// without touching the allocator.
+	struct Queue {
+		std::mutex mutex;
+		std::vector<size_t> items;
+		size_t head;
+		size_t count;
+
+		Queue() : head(0), count(0) {}
+		void PushBack(size_t index);
+		bool PopFront(size_t& index);
+		bool PopBack(size_t& index);
+	};
+
+	bool Pop(size_t self, size_t& index);
+	void Work(size_t self);
+	void WorkerLoop(size_t self);
+
+	std::vector<Queue*> queues;
+	std::vector<std::thread> workers;
+
+	std::mutex mutex;
+	std::condition_variable wake_cv;
+	std::condition_variable done_cv;
+	size_t generation;
+	bool stopping;
+
+	std::atomic<task_func_t> func;
+	std::atomic<void*> context;
+	std::atomic<size_t> remaining;
+
+	WorkPool(const WorkPool&);
+	WorkPool& operator=(const WorkPool&);
+};
+
+}
+
+#endif /* WORK_POOL_H_ */
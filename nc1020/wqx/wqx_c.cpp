@@ -0,0 +1,139 @@
+#include "wqx_c.h"
+#include "nc1020.h"
+#include "work_pool.h"
+#include <string.h>
+
+struct wqx_rom_image {
+	uint8_t* rom_buff;
+};
+
+struct wqx_machine {
+	wqx::Machine* machine;
+	// key pressed by the last batch step, WQX_ACTION_NONE if none.
+	int held_key;
+};
+
+struct wqx_batch {
+	wqx::WorkPool* pool;
+	wqx_machine* const* machines;
+	const int* actions;
+	size_t ms;
+	uint8_t* frames;
+};
+
+wqx_rom_image* wqx_rom_image_load(const char* rom_path) {
+	uint8_t* rom_buff = wqx::LoadRomImage(rom_path);
+	if (rom_buff == NULL) {
+		return NULL;
+	}
+	wqx_rom_image* image = new wqx_rom_image();
+	image->rom_buff = rom_buff;
+	return image;
+}
+
+void wqx_rom_image_free(wqx_rom_image* image) {
+	if (image) {
+		wqx::FreeRomImage(image->rom_buff);
+		delete image;
+	}
+}
+
+wqx_machine* wqx_machine_create(wqx_rom_image* image,
+	const char* nor_path, const char* states_path) {
+	wqx::WqxRom rom;
+	rom.norFlashPath = nor_path ? nor_path : "";
+	rom.statesPath = states_path ? states_path : "";
+	wqx_machine* machine = new wqx_machine();
+	machine->machine = wqx::CreateMachine(rom, image->rom_buff);
+	machine->held_key = WQX_ACTION_NONE;
+	if (rom.statesPath.empty()) {
+		wqx::Reset(machine->machine);
+	} else {
+		wqx::LoadNC1020(machine->machine);
+	}
+	return machine;
+}
+
+void wqx_machine_destroy(wqx_machine* machine) {
+	if (machine) {
+		wqx::DestroyMachine(machine->machine);
+		delete machine;
+	}
+}
+
+void wqx_machine_reset(wqx_machine* machine) {
+	wqx::Reset(machine->machine);
+	machine->held_key = WQX_ACTION_NONE;
+}
+
+void wqx_machine_load(wqx_machine* machine) {
+	wqx::LoadNC1020(machine->machine);
+	machine->held_key = WQX_ACTION_NONE;
+}
+
+void wqx_machine_save(wqx_machine* machine) {
+	wqx::SaveNC1020(machine->machine);
+}
+
+int wqx_machine_set_key(wqx_machine* machine, uint8_t key_id, int down) {
+	return wqx::SetKey(machine->machine, key_id, down != 0) ? 1 : 0;
+}
+
+void wqx_machine_run(wqx_machine* machine, size_t ms) {
+	wqx::RunTimeSlice(machine->machine, ms, false);
+}
+
+int wqx_machine_copy_frame(wqx_machine* machine, uint8_t* frame) {
+	if (wqx::CopyLcdBuffer(machine->machine, frame)) {
+		return 1;
+	}
+	memset(frame, 0, WQX_LCD_FRAME_SIZE);
+	return 0;
+}
+
+wqx_batch* wqx_batch_create(size_t threads) {
+	wqx_batch* batch = new wqx_batch();
+	batch->pool = new wqx::WorkPool(threads);
+	batch->machines = NULL;
+	batch->actions = NULL;
+	batch->ms = 0;
+	batch->frames = NULL;
+	return batch;
+}
+
+void wqx_batch_destroy(wqx_batch* batch) {
+	if (batch) {
+		delete batch->pool;
+		delete batch;
+	}
+}
+
+static void StepMachine(void* context, size_t index) {
+	wqx_batch* batch = (wqx_batch*)context;
+	wqx_machine* machine = batch->machines[index];
+	if (batch->actions) {
+		int action = batch->actions[index];
+		if (action != machine->held_key) {
+			if (machine->held_key != WQX_ACTION_NONE) {
+				wqx::SetKey(machine->machine, (uint8_t)machine->held_key, false);
+			}
+			if (action != WQX_ACTION_NONE) {
+				wqx::SetKey(machine->machine, (uint8_t)action, true);
+			}
+			machine->held_key = action;
+		}
+	}
+	wqx::RunTimeSlice(machine->machine, batch->ms, false);
+	if (batch->frames) {
+		wqx_machine_copy_frame(machine, batch->frames + index * WQX_LCD_FRAME_SIZE);
+	}
+}
+
+void wqx_batch_step(wqx_batch* batch, wqx_machine* const* machines,
+	const int* actions, size_t count, size_t ms, uint8_t* frames) {
+	batch->machines = machines;
+	batch->actions = actions;
+	batch->ms = ms;
+	batch->frames = frames;
+	batch->pool->Run(NULL, count, &StepMachine, batch);
+}
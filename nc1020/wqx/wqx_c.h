@@ -0,0 +1,70 @@
+#ifndef WQX_C_H_
+#define WQX_C_H_
+
+/**
+ * plain c interface to the nc1020 core, for harnesses driving many
+ * machines through ffi.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(_WIN32)
+#define WQX_C_API __declspec(dllexport)
+#else
+#define WQX_C_API __attribute__((visibility("default")))
+#endif
+
+#define WQX_LCD_WIDTH 160
+#define WQX_LCD_HEIGHT 80
+#define WQX_LCD_FRAME_SIZE 1600
+
+/* no key held during the step. */
+#define WQX_ACTION_NONE (-1)
+
+typedef struct wqx_rom_image wqx_rom_image;
+typedef struct wqx_machine wqx_machine;
+typedef struct wqx_batch wqx_batch;
+
+/* decrypted rom shared by machines, NULL if the file can't be read. */
+WQX_C_API wqx_rom_image* wqx_rom_image_load(const char* rom_path);
+WQX_C_API void wqx_rom_image_free(wqx_rom_image* image);
+
+/* image is required. states_path may be NULL or empty for a machine that
+ * starts from reset. */
+WQX_C_API wqx_machine* wqx_machine_create(wqx_rom_image* image,
+	const char* nor_path, const char* states_path);
+WQX_C_API void wqx_machine_destroy(wqx_machine* machine);
+WQX_C_API void wqx_machine_reset(wqx_machine* machine);
+WQX_C_API void wqx_machine_load(wqx_machine* machine);
+WQX_C_API void wqx_machine_save(wqx_machine* machine);
+/* returns 0 when the machine's input queue is full and the key dropped. */
+WQX_C_API int wqx_machine_set_key(wqx_machine* machine, uint8_t key_id, int down);
+WQX_C_API void wqx_machine_run(wqx_machine* machine, size_t ms);
+/* returns 0 while the lcd has no frame yet, frame is zero filled then. */
+WQX_C_API int wqx_machine_copy_frame(wqx_machine* machine, uint8_t* frame);
+
+/* threads == 0 means one per core. */
+WQX_C_API wqx_batch* wqx_batch_create(size_t threads);
+WQX_C_API void wqx_batch_destroy(wqx_batch* batch);
+
+/*
+ * advance count machines by ms each, spread over the batch threads.
+ * actions[i] is the key machine i holds for this step (WQX_ACTION_NONE for
+ * none); a key held in the previous step and not repeated is released.
+ * actions may be NULL to keep every machine's input as it is. when frames
+ * is not NULL it receives count * WQX_LCD_FRAME_SIZE bytes, frame i at
+ * frames + i * WQX_LCD_FRAME_SIZE. nothing is allocated per call.
+ */
+WQX_C_API void wqx_batch_step(wqx_batch* batch, wqx_machine* const* machines,
+	const int* actions, size_t count, size_t ms, uint8_t* frames);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* WQX_C_H_ */
@@ -0,0 +1,82 @@
+/**
+ * audio_ring_test
+ * AudioRing gives back the samples in order with the cycle of the first,
+ * drops what is pushed when full, and hands every sample over between two
+ * threads.
+ */
+#include "test.h"
+#include "audio_ring.h"
+#include <thread>
+
+static const size_t BLOCK = wqx::AudioRing::BLOCK_SAMPLES;
+
+// block n holds samples n * BLOCK on, at a cycle per sample.
+static bool PushBlock(wqx::AudioRing& ring, uint64_t n){
+	int16_t samples[BLOCK];
+	for (size_t i=0; i<BLOCK; i++) {
+		samples[i] = (int16_t)(n * BLOCK + i);
+	}
+	return ring.Push(n * BLOCK, (n + 1) * BLOCK, samples, BLOCK);
+}
+
+static void TestRing(){
+	wqx::AudioRing ring;
+	int16_t samples[3 * BLOCK];
+	uint64_t cycle = 0;
+	TEST_EXPECT(ring.Read(samples, 10, &cycle) == 0);
+	for (uint64_t n=0; n<wqx::AudioRing::BLOCKS; n++) {
+		TEST_EXPECT(PushBlock(ring, n));
+	}
+	TEST_EXPECT(!PushBlock(ring, wqx::AudioRing::BLOCKS));
+	TEST_EXPECT(ring.Dropped() == 1);
+	// reads across blocks, the cycle of a first sample inside one.
+	TEST_EXPECT(ring.Read(samples, 100, &cycle) == 100 && cycle == 0);
+	TEST_EXPECT(ring.Read(samples, 2 * BLOCK, &cycle) == 2 * BLOCK && cycle == 100);
+	TEST_EXPECT(samples[0] == 100 && samples[2 * BLOCK - 1] == (int16_t)(2 * BLOCK + 99));
+	TEST_EXPECT(PushBlock(ring, wqx::AudioRing::BLOCKS));
+	ring.Clear();
+	TEST_EXPECT(ring.Read(samples, 10, NULL) == 0);
+	TEST_EXPECT(PushBlock(ring, 7));
+	TEST_EXPECT(ring.Read(samples, 3 * BLOCK, &cycle) == BLOCK && cycle == 7 * BLOCK);
+}
+
+static void TestThreads(){
+	const uint64_t BLOCKS = 20000;
+	wqx::AudioRing ring;
+	std::thread producer([&ring, BLOCKS]() {
+		for (uint64_t n=0; n<BLOCKS; n++) {
+			while (!PushBlock(ring, n)) {
+				std::this_thread::yield();
+			}
+		}
+	});
+	test::Random random(0x1020);
+	int16_t samples[3 * BLOCK];
+	uint64_t next = 0;
+	while (next < BLOCKS * BLOCK) {
+		uint64_t cycle;
+		size_t read = ring.Read(samples, 1 + random.Below(3 * BLOCK), &cycle);
+		if (read == 0) {
+			std::this_thread::yield();
+			continue;
+		}
+		if (!TEST_EXPECT(cycle == next)) {
+			break;
+		}
+		bool ordered = true;
+		for (size_t i=0; i<read; i++) {
+			ordered = ordered && samples[i] == (int16_t)(next + i);
+		}
+		if (!TEST_EXPECT(ordered)) {
+			break;
+		}
+		next += read;
+	}
+	producer.join();
+}
+
+int main(){
+	TestRing();
+	TestThreads();
+	return test::Result();
+}
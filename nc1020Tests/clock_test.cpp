@@ -0,0 +1,85 @@
+/**
+ * clock_test
+ * AdvanceClock against AdjustTime called once a second, and SecondsToAlarm
+ * against IsCountDown checked after each of those calls, the per event loop
+ * SkipSlept and the rtc catch up stand in for. every value of the hours
+ * byte, flag bits included, with random seconds, minutes, alarms and
+ * lengths.
+ */
+#include "test.h"
+#include <string.h>
+
+// far enough for any alarm: a day, and the hour and minute it may take for
+// fields out of range to settle.
+static const uint64_t HORIZON = 86400 + 3600 + 120;
+
+static void RandomClock(wqx::Machine* machine, test::Random& random, uint8_t hours){
+	memset(machine->clock_buff, 0, sizeof(machine->nc1020_states.clock_data));
+	// out of range values now and then, as a guest may write them.
+	machine->clock_buff[0] = random.Below(8) ? (uint8_t)random.Below(60) : (uint8_t)random.Next();
+	machine->clock_buff[1] = random.Below(8) ? (uint8_t)random.Below(60) : (uint8_t)random.Next();
+	machine->clock_buff[2] = hours;
+	machine->clock_buff[3] = (uint8_t)random.Next();
+	for (size_t i=5; i<8; i++) {
+		machine->clock_buff[i] = random.Below(2) ? (uint8_t)random.Next() : 0;
+	}
+	machine->clock_buff[10] = random.Below(4) ? 0x02 : 0;
+	machine->clock_flags = random.Below(4) ? 0x02 : 0;
+}
+
+int main(){
+	wqx::WqxRom rom;
+	wqx::Machine* fast = wqx::CreateMachine(rom, NULL);
+	wqx::Machine* slow = wqx::CreateMachine(rom, NULL);
+	test::Random random(0x1020);
+	for (size_t hours=0; hours<0x100; hours++) {
+		for (size_t round=0; round<16; round++) {
+			RandomClock(fast, random, (uint8_t)hours);
+			memcpy(slow->clock_buff, fast->clock_buff, sizeof(slow->nc1020_states.clock_data));
+			slow->clock_flags = fast->clock_flags;
+
+			uint64_t alarm = fast->SecondsToAlarm();
+			uint64_t expected = 0;
+			uint8_t clock[8];
+			memcpy(clock, slow->clock_buff, sizeof(clock));
+			for (uint64_t second=1; second<=HORIZON && !expected; second++) {
+				slow->AdjustTime();
+				if (slow->IsCountDown()) {
+					expected = second;
+				}
+			}
+			if (!TEST_EXPECT(alarm == expected)) {
+				fprintf(stderr, "  clock %02X %02X %02X alarm %02X %02X %02X: %llu, expected %llu\n",
+					clock[0], clock[1], clock[2], clock[5], clock[6], clock[7],
+					(unsigned long long)alarm, (unsigned long long)expected);
+				return 1;
+			}
+
+			uint64_t seconds = round % 4 == 0 ? random.Below(120) : random.Below(3 * 86400);
+			memcpy(slow->clock_buff, clock, sizeof(clock));
+			memcpy(fast->clock_buff, clock, sizeof(clock));
+			fast->ram_io[0x3D] = 0;
+			fast->AdvanceClock(seconds);
+			for (uint64_t second=0; second<seconds; second++) {
+				slow->AdjustTime();
+			}
+			if (!TEST_EXPECT(memcmp(fast->clock_buff, slow->clock_buff, 4) == 0)) {
+				fprintf(stderr, "  clock %02X %02X %02X %02X + %llu s: %02X %02X %02X %02X, "
+					"expected %02X %02X %02X %02X\n",
+					clock[0], clock[1], clock[2], clock[3], (unsigned long long)seconds,
+					fast->clock_buff[0], fast->clock_buff[1], fast->clock_buff[2],
+					fast->clock_buff[3], slow->clock_buff[0], slow->clock_buff[1],
+					slow->clock_buff[2], slow->clock_buff[3]);
+				return 1;
+			}
+			// AdvanceClock raises the alarm it passes.
+			bool raised = (fast->ram_io[0x3D] & 0x20) != 0;
+			if (!TEST_EXPECT(raised == (alarm && alarm <= seconds))) {
+				return 1;
+			}
+		}
+	}
+	wqx::DestroyMachine(fast);
+	wqx::DestroyMachine(slow);
+	return test::Result();
+}
@@ -0,0 +1,87 @@
+/**
+ * disasm_test
+ * the Disassembler's cached decode of a ram or nor bank follows the bytes,
+ * decoded again once any of them changed, and symbols name what Format
+ * prints.
+ */
+#include "guest.h"
+#include "disasm.h"
+#include <string.h>
+#include <string>
+#include <vector>
+
+static std::string Text(const wqx::Disassembler& disassembler,
+	const wqx::instruction_t& instruction, uint32_t location){
+	char text[64];
+	disassembler.Format(instruction, location, text, sizeof(text));
+	return text;
+}
+
+static bool Same(const std::vector<wqx::instruction_t>& a,
+	const std::vector<wqx::instruction_t>& b){
+	if (a.size() != b.size()) {
+		return false;
+	}
+	for (size_t i=0; i<a.size(); i++) {
+		if (a[i].pc != b[i].pc || a[i].length != b[i].length ||
+			memcmp(a[i].bytes, b[i].bytes, 3) != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void TestBank(wqx::Machine* machine, wqx::Disassembler& disassembler, uint8_t* bytes,
+	uint32_t location, uint16_t pc){
+	// LDA #$01, STA $0300.
+	static const uint8_t before[5] = {0xA9, 0x01, 0x8D, 0x00, 0x03};
+	memcpy(bytes, before, sizeof(before));
+	const std::vector<wqx::instruction_t>* decoded = &disassembler.DecodeBank(location, pc);
+	if (!TEST_EXPECT(decoded->size() >= 2)) {
+		return;
+	}
+	TEST_EXPECT((*decoded)[0].pc == pc && (*decoded)[0].length == 2);
+	TEST_EXPECT((*decoded)[1].pc == pc + 2 && (*decoded)[1].length == 3);
+	TEST_EXPECT(Text(disassembler, (*decoded)[1], location + 2) == "STA $0300");
+
+	// STA $1234 in place of the LDA, the STA after it now reads as data.
+	bytes[0] = 0x8D;
+	bytes[1] = 0x34;
+	bytes[2] = 0x12;
+	decoded = &disassembler.DecodeBank(location, pc);
+	TEST_EXPECT((*decoded)[0].length == 3);
+	TEST_EXPECT(Text(disassembler, (*decoded)[0], location) == "STA $1234");
+	TEST_EXPECT((*decoded)[1].pc == pc + 3);
+
+	// a change at the far end of the bank counts as well.
+	size_t size = 0x8000 - (location & 0x7FFF);
+	bytes[size - 3] = 0x20;
+	decoded = &disassembler.DecodeBank(location, pc);
+	wqx::Disassembler fresh(machine);
+	TEST_EXPECT(Same(*decoded, fresh.DecodeBank(location, pc)));
+}
+
+int main(){
+	uint8_t* image = test::CreateGuestImage();
+	wqx::Machine* machine = test::CreateGuest(image);
+	wqx::Disassembler disassembler(machine);
+	wqx::SymbolTable symbols;
+
+	TestBank(machine, disassembler, machine->ram_buff + 0x1000, wqx::PHYS_RAM | 0x1000, 0x1000);
+	TestBank(machine, disassembler, machine->nor_buff + 0x8000 * 3 + 0x2000,
+		wqx::PHYS_NOR | (0x8000 * 3 + 0x2000), 0x6000);
+
+	// names for the operand, by cpu address, once symbols are set.
+	uint32_t location = wqx::PHYS_RAM | 0x1000;
+	symbols.AddAddress(0x1234, "key_buffer");
+	disassembler.SetSymbols(&symbols);
+	const std::vector<wqx::instruction_t>& decoded = disassembler.DecodeBank(location, 0x1000);
+	TEST_EXPECT(Text(disassembler, decoded[0], location) == "STA key_buffer");
+	symbols.AddLocation(location, "entry");
+	const char* label = disassembler.Label(decoded[0], location);
+	TEST_EXPECT(label && strcmp(label, "entry") == 0);
+
+	wqx::DestroyMachine(machine);
+	free(image);
+	return test::Result();
+}
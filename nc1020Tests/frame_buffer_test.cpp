@@ -0,0 +1,85 @@
+/**
+ * frame_buffer_test
+ * FrameBuffer hands readers the newest frame once, and never a torn one
+ * while the writer keeps publishing.
+ */
+#include "test.h"
+#include "frame_buffer.h"
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+static const size_t FRAME_SIZE = wqx::FrameBuffer::FRAME_SIZE;
+
+static void TestLatest(){
+	wqx::FrameBuffer frames;
+	uint8_t frame[FRAME_SIZE];
+	uint8_t copy[FRAME_SIZE];
+	uint64_t sequence = 0;
+	uint64_t cycle = 0;
+	TEST_EXPECT(!frames.Latest(copy, &sequence, &cycle));
+	TEST_EXPECT(frames.Sequence() == 0);
+	for (uint64_t i=1; i<=5; i++) {
+		for (size_t j=0; j<FRAME_SIZE; j++) {
+			frame[j] = (uint8_t)(i * 31 + j);
+		}
+		frames.Publish(frame, i * 1000);
+	}
+	TEST_EXPECT(frames.Latest(copy, &sequence, &cycle));
+	TEST_EXPECT(sequence == 5 && cycle == 5000);
+	TEST_EXPECT(memcmp(copy, frame, FRAME_SIZE) == 0);
+	TEST_EXPECT(!frames.Latest(copy, &sequence, NULL));
+	frames.Publish(frame, 6000);
+	TEST_EXPECT(frames.Latest(copy, &sequence, NULL) && sequence == 6);
+}
+
+static void TestThreads(){
+	const uint64_t COUNT = 200000;
+	wqx::FrameBuffer frames;
+	std::atomic<bool> done(false);
+	std::vector<std::thread> readers;
+	std::atomic<size_t> torn(0);
+	std::atomic<size_t> backwards(0);
+	for (size_t i=0; i<3; i++) {
+		readers.push_back(std::thread([&]() {
+			uint8_t copy[FRAME_SIZE];
+			uint64_t sequence = 0;
+			uint64_t cycle;
+			while (!done.load()) {
+				uint64_t last = sequence;
+				if (!frames.Latest(copy, &sequence, &cycle)) {
+					continue;
+				}
+				if (sequence <= last || cycle != sequence) {
+					backwards++;
+				}
+				// every frame is one byte throughout, the one of its cycle.
+				for (size_t j=0; j<FRAME_SIZE; j++) {
+					if (copy[j] != (uint8_t)cycle) {
+						torn++;
+						break;
+					}
+				}
+			}
+		}));
+	}
+	uint8_t frame[FRAME_SIZE];
+	for (uint64_t i=1; i<=COUNT; i++) {
+		memset(frame, (uint8_t)i, FRAME_SIZE);
+		frames.Publish(frame, i);
+	}
+	done.store(true);
+	for (size_t i=0; i<readers.size(); i++) {
+		readers[i].join();
+	}
+	TEST_EXPECT(torn.load() == 0);
+	TEST_EXPECT(backwards.load() == 0);
+	TEST_EXPECT(frames.Sequence() == COUNT);
+}
+
+int main(){
+	TestLatest();
+	TestThreads();
+	return test::Result();
+}
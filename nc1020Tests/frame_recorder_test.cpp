@@ -0,0 +1,110 @@
+/**
+ * frame_recorder_test
+ * a capture read back with FrameReader gives every frame the machine showed,
+ * at the cycle it showed it, across deltas and keyframes, and a capture or
+ * export that cannot be written says so.
+ */
+#include "guest.h"
+#include "frame_recorder.h"
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+static const char* PATH = "frame_recorder_test.wqxframes";
+static const char* APNG_PATH = "frame_recorder_test.png";
+static const size_t SLICE_MS = 10;
+static const size_t SLICES = 100;
+
+typedef struct {
+	uint64_t cycle;
+	std::vector<uint8_t> frame;
+} shown_t;
+
+static shown_t Shown(wqx::Machine* machine){
+	shown_t shown = {wqx::GetCycleCount(machine), std::vector<uint8_t>(wqx::LCD_SIZE)};
+	wqx::CopyLcdBuffer(machine, &shown.frame[0]);
+	return shown;
+}
+
+static void TestRoundTrip(uint8_t* image){
+	test::Random random(0x32);
+	wqx::Machine* machine = test::CreateShowingGuest(image);
+	wqx::RunTimeSlice(machine, 7, false);
+	wqx::FrameRecorder recorder;
+	if (!TEST_EXPECT(recorder.Start(machine, PATH, 35))) {
+		wqx::DestroyMachine(machine);
+		return;
+	}
+	// the frames are handed over at slice ends.
+	std::vector<shown_t> shown(1, Shown(machine));
+	for (size_t slice=0; slice<SLICES; slice++) {
+		for (size_t i=random.Below(3); i>0; i--) {
+			wqx::SetKey(machine, test::RandomKey(random), random.Below(2) != 0);
+		}
+		wqx::RunTimeSlice(machine, SLICE_MS, false);
+		shown_t now = Shown(machine);
+		if (now.frame != shown.back().frame) {
+			shown.push_back(now);
+		}
+	}
+	TEST_EXPECT(recorder.Stop());
+	TEST_EXPECT(!recorder.Failed());
+	TEST_EXPECT(shown.size() > SLICES / 2);
+
+	// every change read back in order; frames in between are keyframes of
+	// an unchanged screen.
+	wqx::FrameReader reader;
+	if (!TEST_EXPECT(reader.Open(PATH))) {
+		wqx::DestroyMachine(machine);
+		return;
+	}
+	uint8_t frame[wqx::LCD_SIZE];
+	uint64_t cycle = 0;
+	uint64_t read = 0;
+	size_t next = 0;
+	size_t wrong = 0;
+	while (reader.Next(frame, &cycle)) {
+		read++;
+		if (next < shown.size() && cycle == shown[next].cycle) {
+			wrong += memcmp(frame, &shown[next].frame[0], wqx::LCD_SIZE) != 0;
+			next++;
+		} else {
+			wrong += next == 0 || memcmp(frame, &shown[next - 1].frame[0], wqx::LCD_SIZE) != 0;
+		}
+	}
+	TEST_EXPECT(wrong == 0);
+	TEST_EXPECT(next == shown.size());
+	TEST_EXPECT(read == recorder.Frames());
+	TEST_EXPECT(wqx::ExportApng(PATH, APNG_PATH));
+	wqx::DestroyMachine(machine);
+	remove(APNG_PATH);
+}
+
+static void TestWriteFailures(uint8_t* image){
+#ifdef __linux__
+	// /dev/full takes the buffered writes and fails the flush.
+	wqx::Machine* machine = test::CreateShowingGuest(image);
+	wqx::FrameRecorder recorder;
+	if (recorder.Start(machine, "/dev/full", 35)) {
+		for (size_t slice=0; slice<SLICES; slice++) {
+			wqx::RunTimeSlice(machine, SLICE_MS, false);
+		}
+		TEST_EXPECT(!recorder.Stop());
+		TEST_EXPECT(recorder.Failed());
+	}
+	TEST_EXPECT(!wqx::ExportY4m(PATH, "/dev/full", 30, 2));
+	TEST_EXPECT(!wqx::ExportApng(PATH, "/dev/full"));
+	wqx::DestroyMachine(machine);
+#else
+	(void)image;
+#endif
+}
+
+int main(){
+	uint8_t* image = test::CreateGuestImage();
+	TestRoundTrip(image);
+	TestWriteFailures(image);
+	remove(PATH);
+	free(image);
+	return test::Result();
+}
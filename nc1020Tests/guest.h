@@ -0,0 +1,146 @@
+#ifndef GUEST_H_
+#define GUEST_H_
+
+/**
+ * guest
+ * a synthetic guest for the tests that run a machine, there is no rom in the
+ * repository. it scans the keypad, reads the timers, counts its irqs and
+ * programs the flash now and then, so its state depends on when keys,
+ * interrupts and slice ends happen.
+ */
+#include "test.h"
+#include "nc1020.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+namespace test {
+
+// just enough of an assembler for the guest, code from 0xE000 on.
+class Assembler {
+public:
+	enum {
+		RTI = 0x40, CLI = 0x58, ADC_ZP = 0x65, STA_ZP = 0x85, STA_ABS = 0x8D,
+		STA_ABSY = 0x99, STA_ABSX = 0x9D, LDY_ZP = 0xA4, LDA_ZP = 0xA5,
+		LDA_IMM = 0xA9, LDA_ABSY = 0xB9, LDX_IMM = 0xA2, JMP_ABS = 0x4C, BNE = 0xD0,
+		INC_ZP = 0xE6, INX = 0xE8
+	};
+	static const uint16_t ORIGIN = 0xE000;
+
+	uint16_t Here() const { return (uint16_t)(ORIGIN + code.size()); }
+	const std::vector<uint8_t>& Code() const { return code; }
+
+	void Op(uint8_t opcode){
+		code.push_back(opcode);
+	}
+	void Op(uint8_t opcode, uint8_t operand){
+		code.push_back(opcode);
+		code.push_back(operand);
+	}
+	void OpW(uint8_t opcode, uint16_t operand){
+		code.push_back(opcode);
+		code.push_back(operand & 0xFF);
+		code.push_back(operand >> 8);
+	}
+	size_t BranchForward(uint8_t opcode){
+		code.push_back(opcode);
+		code.push_back(0);
+		return code.size() - 1;
+	}
+	void Bind(size_t operand){
+		code[operand] = (uint8_t)(code.size() - operand - 1);
+	}
+	void Poke(uint16_t addr, uint8_t value){
+		Op(LDA_IMM, value);
+		OpW(STA_ABS, addr);
+	}
+
+private:
+	std::vector<uint8_t> code;
+};
+
+// a decrypted rom image with the guest at 0xE000 of every volume. free it
+// with free.
+static inline uint8_t* CreateGuestImage(){
+	typedef Assembler A;
+	A a;
+	a.Op(A::CLI);
+	a.Op(A::LDX_IMM, 0);
+	uint16_t loop = a.Here();
+	for (uint8_t row=0x01; row; row<<=1) {
+		a.Op(A::LDA_IMM, row);
+		a.Op(A::STA_ZP, 0x09);
+		a.Op(A::LDA_ZP, 0x08);
+		a.Op(A::ADC_ZP, 0x60);
+		a.Op(A::STA_ZP, 0x60);
+	}
+	a.OpW(A::STA_ABSX, 0x0200);
+	a.Op(A::LDA_ZP, 0x3B);
+	a.OpW(A::STA_ABSX, 0x0300);
+	a.Op(A::LDA_ZP, 0x62);
+	a.OpW(A::STA_ABSX, 0x0400);
+	a.Op(A::INX);
+	size_t skip = a.BranchForward(A::BNE);
+	// every 256 rounds a byte of nor bank 0, at 0x4000 + the count in 0x63.
+	a.Poke(0x0000, 0x00);
+	a.Poke(0x5555, 0xAA);
+	a.Poke(0xAAAA, 0x55);
+	a.Poke(0x5555, 0xA0);
+	a.Op(A::LDY_ZP, 0x63);
+	a.Op(A::LDA_ZP, 0x60);
+	a.OpW(A::STA_ABSY, 0x4000);
+	// the status read ends the command.
+	a.OpW(A::LDA_ABSY, 0x4000);
+	a.Op(A::INC_ZP, 0x63);
+	a.Bind(skip);
+	a.OpW(A::JMP_ABS, loop);
+	uint16_t irq = a.Here();
+	a.Op(A::INC_ZP, 0x62);
+	a.Op(A::RTI);
+	const std::vector<uint8_t>& code = a.Code();
+	const uint16_t vectors[3] = {irq, Assembler::ORIGIN, irq};
+
+	uint8_t* image = (uint8_t*)calloc(wqx::ROM_SIZE, 1);
+	for (size_t i=0; i<3; i++) {
+		uint8_t* bank = image + 0x8000 * 0x100 * i;
+		memcpy(bank + 0x2000, &code[0], code.size());
+		for (size_t j=0; j<3; j++) {
+			bank[0x3FFA + j * 2] = vectors[j] & 0xFF;
+			bank[0x3FFB + j * 2] = vectors[j] >> 8;
+		}
+	}
+	return image;
+}
+
+// a machine reset into the guest, with erased flash.
+static inline wqx::Machine* CreateGuest(uint8_t* image){
+	wqx::WqxRom rom;
+	wqx::Machine* machine = wqx::CreateMachine(rom, image);
+	memset(machine->nor_buff, 0xFF, wqx::NOR_SIZE);
+	wqx::Reset(machine);
+	return machine;
+}
+
+// the same with an lcd: the guest sets up none, it shows the page its keypad,
+// timer and irq logs go to, which changes all the time.
+static inline wqx::Machine* CreateShowingGuest(uint8_t* image){
+	wqx::Machine* machine = CreateGuest(image);
+	machine->lcd_addr = 0x0200;
+	return machine;
+}
+
+// keys of the matrix away from the power and wake up keys.
+static inline uint8_t RandomKey(Random& random){
+	return (uint8_t)(0x10 + random.Below(0x28));
+}
+
+static inline std::vector<uint8_t> Snapshot(wqx::Machine* machine){
+	std::vector<uint8_t> snapshot(wqx::SnapshotSize());
+	wqx::SaveSnapshot(machine, &snapshot[0]);
+	return snapshot;
+}
+
+}
+
+#endif /* GUEST_H_ */
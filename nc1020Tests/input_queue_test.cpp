@@ -0,0 +1,80 @@
+/**
+ * input_queue_test
+ * InputQueue keeps order, holds back the release slots from presses, and
+ * hands every key over between two threads.
+ */
+#include "test.h"
+#include "input_queue.h"
+#include <thread>
+
+static wqx::key_input_t Key(uint64_t cycle, bool down_or_up){
+	wqx::key_input_t input;
+	input.cycle = cycle;
+	input.host_ns = 0;
+	input.key_id = (uint8_t)(cycle % 0x40);
+	input.down_or_up = down_or_up;
+	return input;
+}
+
+static void TestReleaseSlots(){
+	wqx::InputQueue queue;
+	wqx::key_input_t input;
+	TEST_EXPECT(queue.Empty());
+	TEST_EXPECT(!queue.Pop(&input));
+	const size_t presses = wqx::InputQueue::CAPACITY - wqx::InputQueue::RELEASE_SLOTS;
+	size_t pushed = 0;
+	for (size_t i=0; i<presses; i++) {
+		TEST_EXPECT(queue.Push(Key(pushed++, true)));
+	}
+	TEST_EXPECT(!queue.Push(Key(pushed, true)));
+	for (size_t i=0; i<wqx::InputQueue::RELEASE_SLOTS; i++) {
+		TEST_EXPECT(queue.Push(Key(pushed++, false)));
+	}
+	TEST_EXPECT(!queue.Push(Key(pushed, false)));
+	for (size_t i=0; i<pushed; i++) {
+		if (!TEST_EXPECT(queue.Pop(&input))) {
+			return;
+		}
+		TEST_EXPECT(input.cycle == i);
+		TEST_EXPECT(input.down_or_up == (i < presses));
+	}
+	TEST_EXPECT(queue.Empty());
+	// around the end of the ring.
+	for (size_t i=0; i<3 * wqx::InputQueue::CAPACITY; i++) {
+		TEST_EXPECT(queue.Push(Key(i, true)));
+		TEST_EXPECT(queue.Pop(&input) && input.cycle == i);
+	}
+}
+
+static void TestThreads(){
+	const uint64_t COUNT = 100000;
+	wqx::InputQueue queue;
+	std::thread producer([&queue, COUNT]() {
+		for (uint64_t i=0; i<COUNT; i++) {
+			while (!queue.Push(Key(i, (i & 1) != 0))) {
+				std::this_thread::yield();
+			}
+		}
+	});
+	uint64_t next = 0;
+	wqx::key_input_t input;
+	while (next < COUNT) {
+		if (!queue.Pop(&input)) {
+			std::this_thread::yield();
+			continue;
+		}
+		if (!TEST_EXPECT(input.cycle == next && input.key_id == next % 0x40 &&
+			input.down_or_up == ((next & 1) != 0))) {
+			break;
+		}
+		next++;
+	}
+	producer.join();
+	TEST_EXPECT(queue.Empty());
+}
+
+int main(){
+	TestReleaseSlots();
+	TestThreads();
+	return test::Result();
+}
@@ -0,0 +1,74 @@
+/**
+ * lcd_render_test
+ * RenderLcd gives the same pixels as the plain c kernels, whichever simd
+ * ones the build picked, for every scale and format and with dirty rows.
+ */
+#include "test.h"
+#include "lcd_render.h"
+#include <string.h>
+#include <vector>
+
+static const size_t FRAME_SIZE = wqx::LCD_HEIGHT * wqx::LCD_ROW_BYTES;
+
+static void Fill(test::Random& random, uint8_t* bytes, size_t size){
+	for (size_t i=0; i<size; i++) {
+		bytes[i] = (uint8_t)random.Next();
+	}
+}
+
+static void TestScale(test::Random& random, wqx::lcd_format_t format, size_t scale){
+	wqx::lcd_render_options_t options;
+	options.format = format;
+	options.scale = scale;
+	options.off_color = (uint32_t)random.Next();
+	options.on_color = (uint32_t)random.Next();
+	size_t row_size = wqx::LcdRenderWidth(options) * wqx::LcdRenderPixelBytes(options);
+	// padded rows, the padding is compared too.
+	size_t stride = row_size + 12;
+	size_t size = stride * wqx::LcdRenderHeight(options);
+	std::vector<uint8_t> simd(size);
+	Fill(random, &simd[0], size);
+	std::vector<uint8_t> plain(simd);
+	uint8_t frame[FRAME_SIZE];
+	uint8_t dirty_rows[wqx::LCD_HEIGHT / 8];
+	for (size_t i=0; i<4; i++) {
+		Fill(random, frame, FRAME_SIZE);
+		Fill(random, dirty_rows, sizeof(dirty_rows));
+		const uint8_t* dirty = i == 0 ? NULL : dirty_rows;
+		wqx::RenderLcd(frame, dirty, options, &simd[0], stride);
+		wqx::RenderLcdPlain(frame, dirty, options, &plain[0], stride);
+		if (!TEST_EXPECT(simd == plain)) {
+			fprintf(stderr, "  format %d scale %zu round %zu\n", (int)format, scale, i);
+			return;
+		}
+	}
+	// the plain kernels themselves: every pixel off or on as its bit says,
+	// the first column always off.
+	memset(dirty_rows, 0xFF, sizeof(dirty_rows));
+	wqx::RenderLcdPlain(frame, dirty_rows, options, &plain[0], stride);
+	size_t pixel_bytes = wqx::LcdRenderPixelBytes(options);
+	size_t wrong = 0;
+	for (size_t y=0; y<wqx::LcdRenderHeight(options); y++) {
+		for (size_t x=0; x<wqx::LcdRenderWidth(options); x++) {
+			size_t row = y / scale;
+			size_t column = x / scale;
+			bool on = column && (frame[row * wqx::LCD_ROW_BYTES + column / 8] & (0x80 >> (column & 7)));
+			uint32_t color = on ? options.on_color : options.off_color;
+			for (size_t j=0; j<pixel_bytes; j++) {
+				wrong += plain[y * stride + x * pixel_bytes + j] != (uint8_t)(color >> (j * 8));
+			}
+		}
+	}
+	TEST_EXPECT(wrong == 0);
+}
+
+int main(){
+	test::Random random(31);
+	const wqx::lcd_format_t formats[2] = {wqx::LCD_FORMAT_GRAY8, wqx::LCD_FORMAT_RGBA8888};
+	for (size_t i=0; i<2; i++) {
+		for (size_t scale=1; scale<=8; scale++) {
+			TestScale(random, formats[i], scale);
+		}
+	}
+	return test::Result();
+}
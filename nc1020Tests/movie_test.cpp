@@ -0,0 +1,101 @@
+/**
+ * movie_test
+ * a movie recorded with live keys replays bit for bit, with other slices
+ * than it was recorded with, and seeking to any point of it gives the
+ * machine the recording had there.
+ */
+#include "guest.h"
+#include "movie.h"
+#include <stdio.h>
+#include <vector>
+
+static const char* PATH = "movie_test.wqxmovie";
+static const size_t SLICE_MS = 20;
+static const size_t SLICES = 60;
+
+typedef struct {
+	uint64_t cycle;
+	std::vector<uint8_t> snapshot;
+} checkpoint_t;
+
+// runs the machine to the instruction boundary at cycle in random cuts.
+static void RunTo(wqx::Machine* machine, uint64_t cycle, test::Random& random){
+	uint64_t now;
+	while ((now = wqx::GetCycleCount(machine)) < cycle) {
+		size_t left = (size_t)(cycle - now);
+		wqx::RunCycles(machine, 1 + (size_t)random.Below(left), false);
+	}
+}
+
+int main(){
+	uint8_t* image = test::CreateGuestImage();
+	test::Random random(0x1020);
+
+	wqx::Machine* recorded = test::CreateGuest(image);
+	wqx::RunTimeSlice(recorded, 7, false);
+	wqx::MovieRecorder recorder;
+	if (!TEST_EXPECT(recorder.Start(recorded, PATH, 50))) {
+		return test::Result();
+	}
+	std::vector<checkpoint_t> checkpoints;
+	checkpoint_t start = {wqx::GetCycleCount(recorded), test::Snapshot(recorded)};
+	checkpoints.push_back(start);
+	size_t keys = 0;
+	for (size_t slice=0; slice<SLICES; slice++) {
+		// keys reach the machine when the next slice starts, stamped with
+		// the cycle it starts at; queued mid way, so that no key is stamped
+		// with the cycle of a checkpoint, which the recording takes before
+		// applying it and a replay ending there after.
+		wqx::RunTimeSlice(recorded, SLICE_MS / 2, false);
+		for (size_t i=random.Below(3); i>0; i--) {
+			keys += wqx::SetKey(recorded, test::RandomKey(random), random.Below(2) != 0);
+		}
+		wqx::RunTimeSlice(recorded, SLICE_MS / 2, false);
+		TEST_EXPECT(recorder.Update());
+		checkpoint_t checkpoint = {wqx::GetCycleCount(recorded), test::Snapshot(recorded)};
+		checkpoints.push_back(checkpoint);
+	}
+	TEST_EXPECT(recorder.Stop());
+
+	wqx::MoviePlayer player;
+	if (!TEST_EXPECT(player.Open(PATH))) {
+		return test::Result();
+	}
+	TEST_EXPECT(player.StartCycle() == checkpoints.front().cycle);
+	TEST_EXPECT(player.EndCycle() == checkpoints.back().cycle);
+	TEST_EXPECT(player.Keys().size() == keys);
+	TEST_EXPECT(player.Keyframes().size() > 10);
+
+	// replay from the start.
+	wqx::Machine* replayed = test::CreateGuest(image);
+	TEST_EXPECT(player.Seek(replayed, player.StartCycle()));
+	for (size_t i=0; i<checkpoints.size(); i++) {
+		RunTo(replayed, checkpoints[i].cycle, random);
+		if (!TEST_EXPECT(wqx::GetCycleCount(replayed) == checkpoints[i].cycle) ||
+			!TEST_EXPECT(test::Snapshot(replayed) == checkpoints[i].snapshot)) {
+			fprintf(stderr, "  replay, checkpoint %zu\n", i);
+			break;
+		}
+	}
+
+	// seek anywhere, backwards too, and play on.
+	wqx::Machine* sought = test::CreateGuest(image);
+	for (size_t round=0; round<20; round++) {
+		size_t i = (size_t)random.Below(checkpoints.size());
+		size_t j = i + (size_t)random.Below(checkpoints.size() - i);
+		TEST_EXPECT(player.Seek(sought, checkpoints[i].cycle));
+		RunTo(sought, checkpoints[j].cycle, random);
+		if (!TEST_EXPECT(test::Snapshot(sought) == checkpoints[j].snapshot)) {
+			fprintf(stderr, "  seek to checkpoint %zu, on to %zu\n", i, j);
+			break;
+		}
+	}
+
+	player.Close();
+	remove(PATH);
+	wqx::DestroyMachine(recorded);
+	wqx::DestroyMachine(replayed);
+	wqx::DestroyMachine(sought);
+	free(image);
+	return test::Result();
+}
@@ -0,0 +1,72 @@
+/**
+ * park_test
+ * a key ending a Pacer park applies where the park ended: the parked time
+ * is skipped with the timers and the rtc, not run instruction by
+ * instruction from where the park began.
+ */
+#include "guest.h"
+#include "pacer.h"
+#include <chrono>
+#include <thread>
+#include <vector>
+
+static const uint8_t POWER_KEY = 0x0F;
+static const uint8_t WAKE_KEY = 0x08;
+static const size_t PARK_MS = 300;
+
+static void OnInput(void* context, uint64_t cycle, uint8_t key_id, bool down_or_up){
+	if (down_or_up && key_id == WAKE_KEY) {
+		((std::vector<uint64_t>*)context)->push_back(cycle);
+	}
+}
+
+int main(){
+	uint8_t* image = test::CreateGuestImage();
+	wqx::Machine* machine = test::CreateGuest(image);
+	wqx::SetLowPower(machine, true);
+	wqx::RunTimeSlice(machine, 20, false);
+	wqx::SetKey(machine, POWER_KEY, true);
+	wqx::RunTimeSlice(machine, 20, false);
+	wqx::SetKey(machine, POWER_KEY, false);
+	wqx::RunTimeSlice(machine, 20, false);
+	if (!TEST_EXPECT(machine->slept && machine->IsParked())) {
+		return test::Result();
+	}
+	std::vector<uint64_t> wakes;
+	wqx::SetInputListener(machine, &OnInput, &wakes);
+
+	wqx::pacer_options_t options;
+	options.slice_ms = 20;
+	options.max_slice_ms = 100;
+	options.max_catch_up_ms = 250;
+	options.speed_up = false;
+	wqx::Pacer pacer(machine, options);
+	pacer.Tick();
+	uint64_t parked_at = wqx::GetCycleCount(machine);
+	uint8_t irqs = machine->ram_io[0x62];
+	std::thread presser([machine]() {
+		std::this_thread::sleep_for(std::chrono::milliseconds(PARK_MS));
+		wqx::SetKey(machine, WAKE_KEY, true);
+	});
+	size_t skipped_ms = pacer.Tick();
+	presser.join();
+	TEST_EXPECT(skipped_ms >= PARK_MS - 50);
+	TEST_EXPECT(pacer.Stats().parks == 1);
+	// skipped: the cpu did not run, the key is still queued.
+	TEST_EXPECT(machine->ram_io[0x62] == irqs);
+	TEST_EXPECT(machine->slept);
+	TEST_EXPECT(wakes.empty());
+	TEST_EXPECT(wqx::GetCycleCount(machine) >= parked_at + skipped_ms * wqx::CYCLES_MS);
+
+	// the next slice applies it where the park ended and the guest runs.
+	uint64_t woken_at = wqx::GetCycleCount(machine);
+	pacer.Tick();
+	TEST_EXPECT(wakes.size() == 1 && wakes[0] == woken_at);
+	TEST_EXPECT(!machine->slept);
+	TEST_EXPECT(machine->ram_io[0x62] != irqs);
+
+	wqx::SetInputListener(machine, NULL, NULL);
+	wqx::DestroyMachine(machine);
+	free(image);
+	return test::Result();
+}
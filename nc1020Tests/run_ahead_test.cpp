@@ -0,0 +1,77 @@
+/**
+ * run_ahead_test
+ * a machine running ahead after every slice goes on exactly as one that does
+ * not, nor included, and the frame it runs ahead to is the one the other
+ * shows a slice later.
+ */
+#include "guest.h"
+#include <string.h>
+#include <vector>
+
+static const size_t SLICE_MS = 20;
+static const size_t SLICES = 150;
+
+int main(){
+	uint8_t* image = test::CreateGuestImage();
+	test::Random random(0x39);
+	wqx::Machine* plain = test::CreateShowingGuest(image);
+	wqx::Machine* ahead = test::CreateShowingGuest(image);
+	wqx::SetRunAhead(ahead, SLICE_MS);
+
+	uint8_t predicted[wqx::LCD_SIZE];
+	uint8_t shown[wqx::LCD_SIZE];
+	uint64_t sequence = 0;
+	bool has_prediction = false;
+	size_t predictions = 0;
+	for (size_t slice=0; slice<SLICES; slice++) {
+		// keys bound to a cycle of the slice after this one, which the run
+		// ahead at the end of this one sees coming; in the second half also
+		// keys queued now, which it does not.
+		const uint64_t slice_cycles = SLICE_MS * wqx::CYCLES_MS;
+		uint64_t now = wqx::GetCycleCount(plain);
+		for (size_t i=random.Below(3); i>0; i--) {
+			uint64_t cycle = now + slice_cycles + random.Below(slice_cycles);
+			uint8_t key = test::RandomKey(random);
+			bool down = random.Below(2) != 0;
+			wqx::ScheduleKey(plain, cycle, key, down);
+			wqx::ScheduleKey(ahead, cycle, key, down);
+		}
+		bool queued = false;
+		if (slice >= SLICES / 2) {
+			for (size_t i=random.Below(3); i>0; i--) {
+				uint8_t key = test::RandomKey(random);
+				bool down = random.Below(2) != 0;
+				wqx::SetKey(plain, key, down);
+				wqx::SetKey(ahead, key, down);
+				queued = true;
+			}
+		}
+		wqx::RunTimeSlice(plain, SLICE_MS, false);
+		wqx::RunTimeSlice(ahead, SLICE_MS, false);
+		if (!TEST_EXPECT(wqx::GetCycleCount(ahead) == wqx::GetCycleCount(plain)) ||
+			!TEST_EXPECT(test::Snapshot(ahead) == test::Snapshot(plain)) ||
+			!TEST_EXPECT(memcmp(ahead->nor_buff, plain->nor_buff, wqx::NOR_SIZE) == 0)) {
+			fprintf(stderr, "  slice %zu\n", slice);
+			break;
+		}
+		if (has_prediction && !queued) {
+			wqx::CopyLcdBuffer(plain, shown);
+			TEST_EXPECT(memcmp(predicted, shown, wqx::LCD_SIZE) == 0);
+			predictions++;
+		}
+		if (wqx::CopyLatestFrame(ahead, predicted, &sequence)) {
+			has_prediction = true;
+		}
+	}
+	TEST_EXPECT(predictions > SLICES / 2);
+	// the guest did program the nor, ahead runs included.
+	size_t programmed = 0;
+	for (size_t i=0; i<0x100; i++) {
+		programmed += plain->nor_buff[i] != 0xFF;
+	}
+	TEST_EXPECT(programmed > 0);
+	wqx::DestroyMachine(plain);
+	wqx::DestroyMachine(ahead);
+	free(image);
+	return test::Result();
+}
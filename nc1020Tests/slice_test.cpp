@@ -0,0 +1,51 @@
+/**
+ * slice_test
+ * RunCycles does not depend on how the emulation is cut into slices: two
+ * machines get the same scheduled keys, one runs 20 ms slices, the other
+ * random ones down to a cycle, and their snapshots must match wherever
+ * both end a slice. EndSlice rebases the cycle counts in between.
+ */
+#include "guest.h"
+
+static const size_t SLICE = 20 * wqx::CYCLES_MS;
+static const size_t SLICES = 100;
+
+int main(){
+	uint8_t* image = test::CreateGuestImage();
+	test::Random random(0x1020);
+	for (size_t round=0; round<4; round++) {
+		wqx::Machine* whole = test::CreateGuest(image);
+		wqx::Machine* cut = test::CreateGuest(image);
+		for (size_t i=0; i<40; i++) {
+			uint64_t cycle = random.Below(SLICES * SLICE);
+			uint8_t key = test::RandomKey(random);
+			bool down = random.Below(2) != 0;
+			wqx::ScheduleKey(whole, cycle, key, down);
+			wqx::ScheduleKey(cut, cycle, key, down);
+		}
+		for (size_t slice=0; slice<SLICES; slice++) {
+			wqx::RunCycles(whole, SLICE, false);
+			// slices end at the first instruction boundary at or after
+			// their end, whatever came before.
+			size_t left = SLICE;
+			while (left) {
+				size_t length = random.Below(4) ? 1 + random.Below(left) :
+					1 + random.Below(left < 64 ? left : 64);
+				wqx::RunCycles(cut, length, false);
+				left -= length;
+			}
+			if (!TEST_EXPECT(wqx::GetCycleCount(whole) == wqx::GetCycleCount(cut)) ||
+				!TEST_EXPECT(test::Snapshot(whole) == test::Snapshot(cut))) {
+				fprintf(stderr, "  round %zu, slice %zu\n", round, slice);
+				return 1;
+			}
+		}
+		// the guest ran: irqs, keypad scans and flash writes.
+		TEST_EXPECT(whole->ram_io[0x62] != 0);
+		TEST_EXPECT(whole->ram_io[0x63] != 0);
+		wqx::DestroyMachine(whole);
+		wqx::DestroyMachine(cut);
+	}
+	free(image);
+	return test::Result();
+}
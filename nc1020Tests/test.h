@@ -0,0 +1,57 @@
+#ifndef TEST_H_
+#define TEST_H_
+
+/**
+ * test
+ * what the tests share: a check that reports where it failed and goes on,
+ * and a random generator seeded the same on every run.
+ */
+#include "nc1020_machine.h"
+#include <stdint.h>
+#include <stdio.h>
+
+namespace test {
+
+static size_t failures = 0;
+
+static inline bool Expect(bool passed, const char* condition, const char* file, int line){
+	if (!passed) {
+		fprintf(stderr, "%s:%d: failed: %s\n", file, line, condition);
+		failures++;
+	}
+	return passed;
+}
+
+// what main returns.
+static inline int Result(){
+	if (failures) {
+		fprintf(stderr, "%zu checks failed\n", failures);
+		return 1;
+	}
+	return 0;
+}
+
+// xorshift64*, the same sequence everywhere.
+class Random {
+public:
+	explicit Random(uint64_t seed) : state(seed ? seed : 1) {}
+
+	uint64_t Next(){
+		state ^= state >> 12;
+		state ^= state << 25;
+		state ^= state >> 27;
+		return state * 0x2545F4914F6CDD1DULL;
+	}
+	uint64_t Below(uint64_t bound){
+		return Next() % bound;
+	}
+
+private:
+	uint64_t state;
+};
+
+}
+
+#define TEST_EXPECT(condition) test::Expect((condition), #condition, __FILE__, __LINE__)
+
+#endif /* TEST_H_ */
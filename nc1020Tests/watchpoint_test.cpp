@@ -0,0 +1,96 @@
+/**
+ * watchpoint_test
+ * a write watchpoint on a byte of nor stops the guest behind the store that
+ * programs it, only the page the banks map it to leaves the fast path, and
+ * once removed the machine runs on as one that was never watched.
+ */
+#include "guest.h"
+#include "debugger.h"
+#include <vector>
+
+static const size_t SLICE_MS = 20;
+
+// the pages a watchpoint on location should mark under the current banks.
+static uint8_t MappedPages(wqx::Machine* machine, uint32_t location){
+	uint8_t pages = 0;
+	for (size_t i=0; i<8; i++) {
+		uint32_t base = machine->memmap[i] ? machine->Locate(machine->memmap[i]) : 0;
+		if (base && location - base < 0x2000) {
+			pages |= 1 << i;
+		}
+	}
+	return pages;
+}
+
+// runs watched until it stops, plain along to the same cycle.
+static bool RunToBreak(wqx::Machine* watched, wqx::Machine* plain, size_t slices,
+	wqx::break_hit_t* hit){
+	for (size_t i=0; i<slices; i++) {
+		wqx::RunTimeSlice(watched, SLICE_MS, false);
+		wqx::RunCycles(plain, (size_t)(wqx::GetCycleCount(watched) - wqx::GetCycleCount(plain)), false);
+		if (wqx::GetBreak(watched, hit)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+int main(){
+	uint8_t* image = test::CreateGuestImage();
+	wqx::Machine* watched = test::CreateGuest(image);
+	wqx::Machine* plain = test::CreateGuest(image);
+	// nor bank 1 at 0x4000 to start with, the guest maps bank 0 itself
+	// before it programs.
+	wqx::Machine* machines[2] = {watched, plain};
+	for (size_t i=0; i<2; i++) {
+		machines[i]->ram_io[0x00] = 0x01;
+		machines[i]->SwitchBank();
+	}
+
+	// the first byte the guest programs, at 0x4000.
+	wqx::breakpoint_t watch;
+	TEST_EXPECT(wqx::ParseBreakpoint("nor00+0000", wqx::BREAK_WRITE, &watch));
+	TEST_EXPECT(watch.physical && watch.address == wqx::PHYS_NOR);
+	int id = wqx::AddBreakpoint(watched, watch);
+	TEST_EXPECT(id >= 0);
+	TEST_EXPECT(watched->write_pages == 0);
+	TEST_EXPECT(watched->read_pages == 0);
+
+	wqx::break_hit_t hit;
+	if (!TEST_EXPECT(RunToBreak(watched, plain, 50, &hit))) {
+		return test::Result();
+	}
+	TEST_EXPECT(hit.id == id);
+	TEST_EXPECT(hit.kind == wqx::BREAK_WRITE);
+	TEST_EXPECT(hit.address == 0x4000);
+	TEST_EXPECT(hit.location == wqx::PHYS_NOR);
+	// stopped behind the store, the byte is programmed.
+	TEST_EXPECT(watched->nor_buff[0] == hit.value);
+	TEST_EXPECT(wqx::GetCycleCount(watched) == hit.cycle);
+	TEST_EXPECT(watched->write_pages == 0x04);
+	TEST_EXPECT(test::Snapshot(watched) == test::Snapshot(plain));
+
+	// the guest programs the next byte 256 rounds on, the watched one only
+	// after 0x63 wraps; the pages follow the banks meanwhile.
+	bool again = RunToBreak(watched, plain, 10, &hit);
+	TEST_EXPECT(!again);
+	TEST_EXPECT(watched->nor_buff[1] != 0xFF);
+	TEST_EXPECT(watched->write_pages == MappedPages(watched, watch.address));
+
+	wqx::RemoveBreakpoint(watched, id);
+	TEST_EXPECT(watched->debugger == NULL);
+	TEST_EXPECT(watched->break_pages == 0);
+	TEST_EXPECT(watched->read_pages == 0);
+	TEST_EXPECT(watched->write_pages == 0);
+	for (size_t i=0; i<10; i++) {
+		wqx::RunTimeSlice(watched, SLICE_MS, false);
+		wqx::RunTimeSlice(plain, SLICE_MS, false);
+	}
+	TEST_EXPECT(wqx::GetCycleCount(watched) == wqx::GetCycleCount(plain));
+	TEST_EXPECT(test::Snapshot(watched) == test::Snapshot(plain));
+
+	wqx::DestroyMachine(watched);
+	wqx::DestroyMachine(plain);
+	free(image);
+	return test::Result();
+}
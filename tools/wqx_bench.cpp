@@ -0,0 +1,583 @@
+/**
+ * wqx-bench
+ * measures the core on small synthetic 6502 images, each stressing one part
+ * of it, and on a real boot of obj_lu.bin when there is one. reports
+ * emulated MHz, ns per instruction and heap allocations per workload, and
+ * writes them as json that a later run can be compared against.
+ *
+ * the timed runs go through RunCycles in 20 ms slices, as hosts run the
+ * machine. it does not count instructions, so they are counted once per
+ * workload on an untimed machine running Execute; the emulation does not
+ * depend on the slicing, so both run the same instructions.
+ */
+#include "nc1020.h"
+#include "nc1020_machine.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+// every operator new of the process, the core's included.
+static std::atomic<uint64_t> allocations(0);
+
+void* operator new(size_t size){
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	void* block = malloc(size ? size : 1);
+	if (block == NULL) {
+		throw std::bad_alloc();
+	}
+	return block;
+}
+
+void* operator new[](size_t size){
+	return operator new(size);
+}
+
+void operator delete(void* block) noexcept {
+	free(block);
+}
+
+void operator delete[](void* block) noexcept {
+	free(block);
+}
+
+static double Now(){
+	return std::chrono::duration<double>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void Usage(const char* name){
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  --duration <ms>    emulated time of each synthetic workload (default 20000)\n"
+		"  --repeat <n>       runs per workload, the fastest counts (default 3)\n"
+		"  --workload <name>  run only this workload, may be repeated\n"
+		"  --rom <file>       rom of the boot workload (default obj_lu.bin,\n"
+		"                     skipped when it does not exist)\n"
+		"  --nor <file>       nor of the boot workload (default nc1020.fls)\n"
+		"  --boot <ms>        emulated time of the boot workload (default 10000)\n"
+		"  --json <file>      write the results as json\n"
+		"  --baseline <file>  compare with the json of an earlier run, exit 1\n"
+		"                     on a regression\n"
+		"  --tolerance <pct>  slow down that is not a regression (default 5)\n"
+		"workloads: alu, zeropage, bankswitch, flash, io, boot\n",
+		name);
+}
+
+/**
+ * Assembler
+ * just enough of one to write the workloads: code from 0xE000 on, backward
+ * branches to an address, forward ones patched by Bind.
+ */
+class Assembler {
+public:
+	enum {
+		ORA_IMM = 0x09, ASL_A = 0x0A, CLC = 0x18, AND_IMM = 0x29, ROL_A = 0x2A,
+		SEC = 0x38, RTI = 0x40, EOR_INDX = 0x41, EOR_IMM = 0x49, LSR_A = 0x4A,
+		JMP_ABS = 0x4C, CLI = 0x58, ADC_ZP = 0x65, ADC_IMM = 0x69,
+		ADC_ABS = 0x6D, ADC_ABSX = 0x7D, STA_ZP = 0x85, STX_ZP = 0x86,
+		DEY = 0x88, TXA = 0x8A, STA_ABS = 0x8D, BCC = 0x90, STA_INDY = 0x91,
+		STA_ZPX = 0x95, TYA = 0x98, STA_ABSY = 0x99, LDY_IMM = 0xA0,
+		LDX_IMM = 0xA2, LDA_ZP = 0xA5, TAY = 0xA8, LDA_IMM = 0xA9, TAX = 0xAA,
+		LDA_ABS = 0xAD, LDA_INDY = 0xB1, LDA_ZPX = 0xB5, LDA_ABSY = 0xB9,
+		LDA_ABSX = 0xBD, INY = 0xC8, CMP_IMM = 0xC9, BNE = 0xD0,
+		CPX_IMM = 0xE0, INC_ZP = 0xE6, INX = 0xE8, SBC_IMM = 0xE9
+	};
+	static const uint16_t ORIGIN = 0xE000;
+
+	uint16_t Here() const { return (uint16_t)(ORIGIN + code.size()); }
+	const vector<uint8_t>& Code() const { return code; }
+
+	void Op(uint8_t opcode){
+		code.push_back(opcode);
+	}
+	void Op(uint8_t opcode, uint8_t operand){
+		code.push_back(opcode);
+		code.push_back(operand);
+	}
+	void OpW(uint8_t opcode, uint16_t operand){
+		code.push_back(opcode);
+		code.push_back(operand & 0xFF);
+		code.push_back(operand >> 8);
+	}
+	void Branch(uint8_t opcode, uint16_t target){
+		code.push_back(opcode);
+		code.push_back((uint8_t)(target - (Here() + 1)));
+	}
+	// a branch to the place of the matching Bind.
+	size_t BranchForward(uint8_t opcode){
+		code.push_back(opcode);
+		code.push_back(0);
+		return code.size() - 1;
+	}
+	void Bind(size_t operand){
+		code[operand] = (uint8_t)(code.size() - operand - 1);
+	}
+	void Poke(uint16_t addr, uint8_t value){
+		Op(LDA_IMM, value);
+		OpW(STA_ABS, addr);
+	}
+
+private:
+	vector<uint8_t> code;
+};
+
+typedef Assembler A;
+
+// register arithmetic, shifts and a data dependent branch.
+static void BuildAlu(Assembler& a){
+	a.Op(A::LDX_IMM, 0);
+	a.Op(A::LDA_IMM, 1);
+	uint16_t loop = a.Here();
+	a.Op(A::CLC);
+	a.Op(A::ADC_IMM, 0x37);
+	a.Op(A::EOR_IMM, 0x5A);
+	a.Op(A::ROL_A);
+	a.Op(A::AND_IMM, 0xF3);
+	a.Op(A::ORA_IMM, 0x10);
+	a.Op(A::SEC);
+	a.Op(A::SBC_IMM, 0x11);
+	a.Op(A::LSR_A);
+	a.Op(A::ASL_A);
+	a.Op(A::CMP_IMM, 0x40);
+	size_t low = a.BranchForward(A::BCC);
+	a.Op(A::EOR_IMM, 0xFF);
+	a.Bind(low);
+	a.Op(A::TAY);
+	a.Op(A::INY);
+	a.Op(A::DEY);
+	a.Op(A::TYA);
+	a.Op(A::INX);
+	a.Branch(A::BNE, loop);
+	a.OpW(A::JMP_ABS, loop);
+}
+
+// zero page, zero page indexed, (zp),y and (zp,x) over ram pages 2 to 5.
+static void BuildZeroPage(Assembler& a){
+	a.Poke(0x50, 0x00);
+	a.Poke(0x51, 0x02);
+	a.Poke(0x52, 0x00);
+	a.Poke(0x53, 0x03);
+	// eight pointers into page 4 for (zp,x) with even x up to 14.
+	for (uint8_t i=0; i<8; i++) {
+		a.Poke(0x54 + i * 2, i * 0x20);
+		a.Poke(0x55 + i * 2, 0x04);
+	}
+	a.Op(A::LDX_IMM, 0);
+	uint16_t loop = a.Here();
+	a.Op(A::LDY_IMM, 0);
+	uint16_t inner = a.Here();
+	a.Op(A::LDA_INDY, 0x50);
+	a.Op(A::CLC);
+	a.Op(A::ADC_ZP, 0x80);
+	a.Op(A::STA_INDY, 0x52);
+	a.Op(A::STA_ZP, 0x81);
+	a.Op(A::INC_ZP, 0x82);
+	a.Op(A::LDA_ZPX, 0x90);
+	a.Op(A::EOR_INDX, 0x54);
+	a.Op(A::STA_ZPX, 0xA0);
+	a.OpW(A::LDA_ABSY, 0x0300);
+	a.OpW(A::STA_ABSY, 0x0500);
+	a.Op(A::INY);
+	a.Branch(A::BNE, inner);
+	a.Op(A::INX);
+	a.Op(A::INX);
+	a.Op(A::TXA);
+	a.Op(A::AND_IMM, 0x0E);
+	a.Op(A::TAX);
+	a.OpW(A::JMP_ABS, loop);
+}
+
+// Write00 over nor and rom banks, Write0D between volumes 0 and 1 and
+// Write0A over the bbs pages, with a read through each new mapping.
+static void BuildBankSwitch(Assembler& a){
+	a.Op(A::LDX_IMM, 0);
+	uint16_t loop = a.Here();
+	a.Op(A::TXA);
+	a.Op(A::AND_IMM, 0x1F);
+	a.Op(A::STA_ZP, 0x00);
+	a.OpW(A::LDA_ABSX, 0x4000);
+	a.OpW(A::ADC_ABSX, 0x6000);
+	a.OpW(A::ADC_ABS, 0x8000);
+	a.OpW(A::ADC_ABS, 0xA000);
+	a.Op(A::TXA);
+	a.Op(A::ORA_IMM, 0x80);
+	a.Op(A::STA_ZP, 0x00);
+	a.OpW(A::LDA_ABSX, 0x5000);
+	a.OpW(A::ADC_ABSX, 0xB000);
+	a.Op(A::TXA);
+	a.Op(A::AND_IMM, 0x01);
+	a.Op(A::STA_ZP, 0x0D);
+	a.Op(A::TXA);
+	a.Op(A::AND_IMM, 0x0F);
+	a.Op(A::STA_ZP, 0x0A);
+	a.OpW(A::LDA_ABSX, 0xC000);
+	a.Op(A::INX);
+	a.OpW(A::JMP_ABS, loop);
+}
+
+static void FlashCommand(Assembler& a, uint8_t command){
+	a.Poke(0x5555, 0xAA);
+	a.Poke(0xAAAA, 0x55);
+	a.Poke(0x5555, command);
+}
+
+// per nor bank: erase the sector at 0x4000, then program its first 256
+// bytes one at a time, polling the status after each command.
+static void BuildFlash(Assembler& a){
+	a.Op(A::LDX_IMM, 0);
+	uint16_t loop = a.Here();
+	a.Op(A::STX_ZP, 0x00);
+	FlashCommand(a, 0x80);
+	a.Poke(0x5555, 0xAA);
+	a.Poke(0xAAAA, 0x55);
+	a.Poke(0x4000, 0x30);
+	a.OpW(A::LDA_ABS, 0x4000);
+	a.Op(A::LDY_IMM, 0);
+	uint16_t program = a.Here();
+	FlashCommand(a, 0xA0);
+	a.Op(A::TYA);
+	a.OpW(A::STA_ABSY, 0x4000);
+	a.OpW(A::LDA_ABSY, 0x4000);
+	a.Op(A::INY);
+	a.Branch(A::BNE, program);
+	a.Op(A::INX);
+	a.Op(A::TXA);
+	a.Op(A::AND_IMM, 0x1F);
+	a.Op(A::TAX);
+	a.OpW(A::JMP_ABS, loop);
+}
+
+// the polls of an idle guest: interrupt flags, the rtc, the keypad
+// matrix row by row.
+static void BuildIo(Assembler& a){
+	uint16_t start = a.Here();
+	a.Op(A::LDX_IMM, 0);
+	uint16_t loop = a.Here();
+	a.Op(A::LDA_ZP, 0x01);
+	a.Op(A::AND_IMM, 0x08);
+	a.Op(A::LDA_ZP, 0x3B);
+	a.Op(A::STX_ZP, 0x3E);
+	a.Op(A::LDA_ZP, 0x3F);
+	a.Op(A::LDA_ZP, 0x06);
+	for (uint8_t row=0x01; row; row<<=1) {
+		a.Op(A::LDA_IMM, row);
+		a.Op(A::STA_ZP, 0x09);
+		a.Op(A::LDA_ZP, 0x08);
+	}
+	a.Op(A::LDA_IMM, 0);
+	a.Op(A::STA_ZP, 0x09);
+	a.Op(A::LDA_ZP, 0x0B);
+	a.Op(A::LDA_ZP, 0x3D);
+	a.Op(A::INX);
+	a.Op(A::CPX_IMM, 80);
+	a.Branch(A::BNE, loop);
+	a.OpW(A::JMP_ABS, start);
+}
+
+typedef struct {
+	const char* name;
+	void (*build)(Assembler&);
+} synthetic_t;
+
+static const synthetic_t SYNTHETICS[] = {
+	{"alu", &BuildAlu},
+	{"zeropage", &BuildZeroPage},
+	{"bankswitch", &BuildBankSwitch},
+	{"flash", &BuildFlash},
+	{"io", &BuildIo},
+};
+
+// a decrypted rom image with the workload at 0xE000 of every volume, after
+// a cli, and irqs that return at once.
+static uint8_t* CreateImage(const synthetic_t& synthetic){
+	Assembler a;
+	a.Op(A::CLI);
+	synthetic.build(a);
+	uint16_t irq = a.Here();
+	a.Op(A::RTI);
+	const vector<uint8_t>& code = a.Code();
+	const uint16_t vectors[3] = {irq, Assembler::ORIGIN, irq};
+
+	uint8_t* image = (uint8_t*)calloc(wqx::ROM_SIZE, 1);
+	for (size_t i=0; i<3; i++) {
+		uint8_t* bank = image + 0x8000 * 0x100 * i;
+		memcpy(bank + 0x2000, &code[0], code.size());
+		for (size_t j=0; j<3; j++) {
+			bank[0x3FFA + j * 2] = vectors[j] & 0xFF;
+			bank[0x3FFB + j * 2] = vectors[j] >> 8;
+		}
+	}
+	return image;
+}
+
+typedef struct {
+	string name;
+	uint64_t cycles;
+	uint64_t insts;
+	double seconds;
+	uint64_t allocs;
+} result_t;
+
+static double Mhz(const result_t& result){
+	return result.seconds > 0 ? result.cycles / result.seconds / 1e6 : 0;
+}
+
+static double NsPerInst(const result_t& result){
+	return result.insts ? result.seconds * 1e9 / result.insts : 0;
+}
+
+static const size_t SLICE = 20 * wqx::CYCLES_MS;
+
+static wqx::Machine* CreateWorkload(const wqx::WqxRom& rom, uint8_t* image){
+	wqx::Machine* machine = wqx::CreateMachine(rom, image);
+	// erased flash, there is no nor file.
+	memset(machine->nor_buff, 0xFF, wqx::NOR_SIZE);
+	wqx::Reset(machine);
+	return machine;
+}
+
+static result_t Measure(wqx::Machine* machine, uint64_t duration_ms){
+	result_t result;
+	result.cycles = 0;
+	result.insts = 0;
+	uint64_t allocs = allocations.load();
+	double begin = Now();
+	while (result.cycles < duration_ms * wqx::CYCLES_MS) {
+		wqx::RunCycles(machine, SLICE, false);
+		result.cycles += SLICE;
+	}
+	result.seconds = Now() - begin;
+	result.allocs = allocations.load() - allocs;
+	return result;
+}
+
+// the instructions Measure runs, counted without timing. no input and no
+// low power, so a slice is one Execute.
+static uint64_t CountInsts(wqx::Machine* machine, uint64_t duration_ms){
+	uint64_t insts = 0;
+	for (uint64_t cycles=0; cycles<duration_ms * wqx::CYCLES_MS; cycles+=SLICE) {
+		while (machine->cycles < SLICE) {
+			insts += machine->Execute(SLICE, (size_t)-1);
+		}
+		machine->EndSlice(SLICE);
+	}
+	return insts;
+}
+
+static result_t Best(const result_t& a, const result_t& b){
+	return b.seconds < a.seconds ? b : a;
+}
+
+static result_t Run(const wqx::WqxRom& rom, uint8_t* image, uint64_t duration_ms, size_t repeat){
+	result_t best;
+	for (size_t i=0; i<repeat; i++) {
+		wqx::Machine* machine = CreateWorkload(rom, image);
+		result_t result = Measure(machine, duration_ms);
+		best = i ? Best(best, result) : result;
+		wqx::DestroyMachine(machine);
+	}
+	wqx::Machine* machine = CreateWorkload(rom, image);
+	best.insts = CountInsts(machine, duration_ms);
+	wqx::DestroyMachine(machine);
+	return best;
+}
+
+static result_t RunSynthetic(const synthetic_t& synthetic, uint64_t duration_ms, size_t repeat){
+	uint8_t* image = CreateImage(synthetic);
+	result_t best = Run(wqx::WqxRom(), image, duration_ms, repeat);
+	free(image);
+	best.name = synthetic.name;
+	return best;
+}
+
+static result_t RunBoot(const wqx::WqxRom& rom, uint8_t* image, uint64_t duration_ms, size_t repeat){
+	result_t best = Run(rom, image, duration_ms, repeat);
+	best.name = "boot";
+	return best;
+}
+
+static bool WriteJson(const string& path, const vector<result_t>& results){
+	FILE* file = fopen(path.c_str(), "w");
+	if (file == NULL) {
+		return false;
+	}
+	// one workload per line, which is all ReadJson needs.
+	fprintf(file, "{\n  \"version\": 1,\n  \"workloads\": [\n");
+	for (size_t i=0; i<results.size(); i++) {
+		const result_t& result = results[i];
+		fprintf(file,
+			"    {\"name\": \"%s\", \"cycles\": %llu, \"insts\": %llu, "
+			"\"seconds\": %.6f, \"mhz\": %.3f, \"ns_per_inst\": %.3f, \"allocs\": %llu}%s\n",
+			result.name.c_str(), (unsigned long long)result.cycles,
+			(unsigned long long)result.insts, result.seconds, Mhz(result),
+			NsPerInst(result), (unsigned long long)result.allocs,
+			i + 1 < results.size() ? "," : "");
+	}
+	fprintf(file, "  ]\n}\n");
+	bool ok = ferror(file) == 0;
+	fclose(file);
+	return ok;
+}
+
+typedef struct {
+	string name;
+	double mhz;
+	uint64_t allocs;
+} baseline_t;
+
+// reads the lines WriteJson writes, not json in general.
+static bool ReadJson(const string& path, vector<baseline_t>& baselines){
+	FILE* file = fopen(path.c_str(), "r");
+	if (file == NULL) {
+		return false;
+	}
+	char line[512];
+	while (fgets(line, sizeof(line), file)) {
+		const char* name = strstr(line, "\"name\": \"");
+		const char* mhz = strstr(line, "\"mhz\": ");
+		const char* allocs = strstr(line, "\"allocs\": ");
+		if (name == NULL || mhz == NULL || allocs == NULL) {
+			continue;
+		}
+		name += strlen("\"name\": \"");
+		const char* end = strchr(name, '"');
+		if (end == NULL) {
+			continue;
+		}
+		baseline_t baseline;
+		baseline.name.assign(name, end - name);
+		baseline.mhz = strtod(mhz + strlen("\"mhz\": "), NULL);
+		baseline.allocs = strtoull(allocs + strlen("\"allocs\": "), NULL, 10);
+		baselines.push_back(baseline);
+	}
+	fclose(file);
+	return true;
+}
+
+static bool Selected(const vector<string>& selection, const string& name){
+	if (selection.empty()) {
+		return true;
+	}
+	for (size_t i=0; i<selection.size(); i++) {
+		if (selection[i] == name) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool FileExists(const string& path){
+	FILE* file = fopen(path.c_str(), "rb");
+	if (file == NULL) {
+		return false;
+	}
+	fclose(file);
+	return true;
+}
+
+int main(int argc, char** argv){
+	uint64_t duration_ms = 20000;
+	uint64_t boot_ms = 10000;
+	size_t repeat = 3;
+	double tolerance = 5;
+	vector<string> selection;
+	string json_path;
+	string baseline_path;
+	wqx::WqxRom rom;
+	rom.romPath = "obj_lu.bin";
+	rom.norFlashPath = "nc1020.fls";
+
+	for (int i=1; i<argc; i++) {
+		string arg = argv[i];
+		bool has_value = i + 1 < argc;
+		if (arg == "--duration" && has_value) {
+			duration_ms = strtoull(argv[++i], NULL, 10);
+		} else if (arg == "--repeat" && has_value) {
+			repeat = strtoul(argv[++i], NULL, 10);
+		} else if (arg == "--workload" && has_value) {
+			selection.push_back(argv[++i]);
+		} else if (arg == "--rom" && has_value) {
+			rom.romPath = argv[++i];
+		} else if (arg == "--nor" && has_value) {
+			rom.norFlashPath = argv[++i];
+		} else if (arg == "--boot" && has_value) {
+			boot_ms = strtoull(argv[++i], NULL, 10);
+		} else if (arg == "--json" && has_value) {
+			json_path = argv[++i];
+		} else if (arg == "--baseline" && has_value) {
+			baseline_path = argv[++i];
+		} else if (arg == "--tolerance" && has_value) {
+			tolerance = strtod(argv[++i], NULL);
+		} else {
+			Usage(argv[0]);
+			return 2;
+		}
+	}
+	if (duration_ms == 0 || boot_ms == 0 || repeat == 0) {
+		Usage(argv[0]);
+		return 2;
+	}
+
+	vector<baseline_t> baselines;
+	if (!baseline_path.empty() && !ReadJson(baseline_path, baselines)) {
+		fprintf(stderr, "cannot read baseline %s\n", baseline_path.c_str());
+		return 1;
+	}
+
+	vector<result_t> results;
+	for (size_t i=0; i<sizeof(SYNTHETICS) / sizeof(SYNTHETICS[0]); i++) {
+		if (Selected(selection, SYNTHETICS[i].name)) {
+			results.push_back(RunSynthetic(SYNTHETICS[i], duration_ms, repeat));
+		}
+	}
+	if (Selected(selection, "boot")) {
+		if (!FileExists(rom.romPath)) {
+			printf("boot skipped, no %s\n", rom.romPath.c_str());
+		} else {
+			uint8_t* image = wqx::LoadRomImage(rom.romPath);
+			if (image == NULL) {
+				fprintf(stderr, "cannot load rom %s\n", rom.romPath.c_str());
+				return 1;
+			}
+			results.push_back(RunBoot(rom, image, boot_ms, repeat));
+			wqx::FreeRomImage(image);
+		}
+	}
+
+	int status = 0;
+	printf("%-12s %10s %10s %14s %8s %s\n", "workload", "MHz", "ns/inst", "insts",
+		"allocs", baselines.empty() ? "" : "vs baseline");
+	for (size_t i=0; i<results.size(); i++) {
+		const result_t& result = results[i];
+		string comparison;
+		for (size_t j=0; j<baselines.size(); j++) {
+			if (baselines[j].name != result.name || baselines[j].mhz <= 0) {
+				continue;
+			}
+			double change = (Mhz(result) / baselines[j].mhz - 1) * 100;
+			char text[64];
+			snprintf(text, sizeof(text), "%+.1f%%", change);
+			comparison = text;
+			if (change < -tolerance || result.allocs > baselines[j].allocs) {
+				comparison += " REGRESSION";
+				status = 1;
+			}
+		}
+		printf("%-12s %10.1f %10.2f %14llu %8llu %s\n", result.name.c_str(),
+			Mhz(result), NsPerInst(result), (unsigned long long)result.insts,
+			(unsigned long long)result.allocs, comparison.c_str());
+	}
+	if (!json_path.empty() && !WriteJson(json_path, results)) {
+		fprintf(stderr, "cannot write %s\n", json_path.c_str());
+		return 1;
+	}
+	return status;
+}
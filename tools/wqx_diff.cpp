@@ -0,0 +1,172 @@
+/**
+ * wqx-diff
+ * runs two machines from the same state through two engines in lockstep and
+ * stops at the first point they differ, to validate a faster engine against
+ * the reference interpreter on real workloads. exits 1 on a divergence.
+ *
+ * keys of the script reach both machines at the start of the slice they
+ * fall in.
+ */
+#include "diff.h"
+#include "fleet.h"
+#include "nc1020_machine.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+static double Now(){
+	return std::chrono::duration<double>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void Usage(const char* name){
+	fprintf(stderr,
+		"usage: %s --rom <obj_lu.bin> --nor <nc1020.fls> [options]\n"
+		"  --states <file>    start from a saved state instead of a reset\n"
+		"  --engines <a,b>    engines to compare, of switch and lockstep\n"
+		"                     (default switch,lockstep)\n"
+		"  --granularity <instruction|block|slice>\n"
+		"                     compare after every step of that size\n"
+		"                     (default slice; lockstep runs whole slices)\n"
+		"  --keys <file|->    key script to play\n"
+		"  --duration <ms>    emulated time (default: script end + 1000,\n"
+		"                     10000 without a script)\n"
+		"  --slice <ms>       time slice (default 20)\n"
+		"  --context <n>      instructions shown before a divergence\n"
+		"                     (default 32)\n",
+		name);
+}
+
+int main(int argc, char** argv){
+	wqx::WqxRom rom;
+	string engine_names = "switch,lockstep";
+	string keys_path;
+	uint64_t duration_ms = 0;
+	wqx::diff_options_t options;
+	options.granularity = wqx::DIFF_SLICE;
+	options.time_slice = 20;
+	options.context = 32;
+	for (int i=1; i<argc; i++) {
+		string arg = argv[i];
+		bool has_value = i + 1 < argc;
+		if (arg == "--rom" && has_value) {
+			rom.romPath = argv[++i];
+		} else if (arg == "--nor" && has_value) {
+			rom.norFlashPath = argv[++i];
+		} else if (arg == "--states" && has_value) {
+			rom.statesPath = argv[++i];
+		} else if (arg == "--engines" && has_value) {
+			engine_names = argv[++i];
+		} else if (arg == "--granularity" && has_value) {
+			string granularity = argv[++i];
+			if (granularity == "instruction") {
+				options.granularity = wqx::DIFF_INSTRUCTION;
+			} else if (granularity == "block") {
+				options.granularity = wqx::DIFF_BLOCK;
+			} else if (granularity == "slice") {
+				options.granularity = wqx::DIFF_SLICE;
+			} else {
+				Usage(argv[0]);
+				return 2;
+			}
+		} else if (arg == "--keys" && has_value) {
+			keys_path = argv[++i];
+		} else if (arg == "--duration" && has_value) {
+			duration_ms = strtoull(argv[++i], NULL, 10);
+		} else if (arg == "--slice" && has_value) {
+			options.time_slice = strtoul(argv[++i], NULL, 10);
+		} else if (arg == "--context" && has_value) {
+			options.context = strtoul(argv[++i], NULL, 10);
+		} else {
+			Usage(argv[0]);
+			return 2;
+		}
+	}
+	size_t comma = engine_names.find(',');
+	if (rom.romPath.empty() || rom.norFlashPath.empty() ||
+		options.time_slice == 0 || comma == string::npos) {
+		Usage(argv[0]);
+		return 2;
+	}
+	wqx::DiffEngine* engines[2] = {
+		wqx::CreateDiffEngine(engine_names.substr(0, comma)),
+		wqx::CreateDiffEngine(engine_names.substr(comma + 1))
+	};
+	if (engines[0] == NULL || engines[1] == NULL) {
+		fprintf(stderr, "unknown engine in %s\n", engine_names.c_str());
+		return 2;
+	}
+	if (options.granularity != wqx::DIFF_SLICE &&
+		!(engines[0]->CanStep() && engines[1]->CanStep())) {
+		fprintf(stderr, "%s runs whole slices only, use --granularity slice\n",
+			engines[0]->CanStep() ? engines[1]->Name() : engines[0]->Name());
+		return 2;
+	}
+
+	vector<wqx::key_event_t> script;
+	if (!keys_path.empty() && !wqx::LoadKeyScript(keys_path, script)) {
+		fprintf(stderr, "cannot open key script %s\n", keys_path.c_str());
+		return 1;
+	}
+	if (duration_ms == 0) {
+		duration_ms = script.empty() ? 10000 : script.back().time_ms + 1000;
+	}
+
+	uint8_t* rom_image = wqx::LoadRomImage(rom.romPath);
+	if (rom_image == NULL) {
+		fprintf(stderr, "cannot load rom %s\n", rom.romPath.c_str());
+		return 1;
+	}
+	wqx::Machine* machines[2];
+	for (size_t i=0; i<2; i++) {
+		machines[i] = wqx::CreateMachine(rom, rom_image);
+	}
+	if (rom.statesPath.empty()) {
+		wqx::Reset(machines[0]);
+	} else {
+		wqx::LoadNC1020(machines[0]);
+	}
+
+	int status = 0;
+	double begin = Now();
+	uint64_t emulated_ms = 0;
+	{
+		wqx::DiffRunner runner(machines[0], engines[0], machines[1], engines[1], options);
+		size_t next_event = 0;
+		while (emulated_ms < duration_ms) {
+			for (; next_event < script.size() && script[next_event].time_ms <= emulated_ms;
+				next_event++) {
+				runner.ApplyKey(script[next_event].key_id, script[next_event].down_or_up);
+			}
+			if (!runner.RunSlice()) {
+				break;
+			}
+			emulated_ms += options.time_slice;
+		}
+		double seconds = Now() - begin;
+		if (!runner.Report().empty()) {
+			printf("%s", runner.Report().c_str());
+			status = 1;
+		} else {
+			printf("%s and %s agree over %llu ms, %llu steps\n",
+				engines[0]->Name(), engines[1]->Name(), (unsigned long long)emulated_ms,
+				(unsigned long long)runner.Steps());
+		}
+		printf("emulated        %llu ms in %.3f s (%.2fx real time)\n",
+			(unsigned long long)emulated_ms, seconds,
+			seconds > 0 ? emulated_ms / 1000.0 / seconds : 0);
+	}
+
+	// engines may hold machines sharing the rom image.
+	delete engines[0];
+	delete engines[1];
+	wqx::DestroyMachine(machines[0]);
+	wqx::DestroyMachine(machines[1]);
+	wqx::FreeRomImage(rom_image);
+	return status;
+}
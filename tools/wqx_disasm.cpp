@@ -0,0 +1,162 @@
+/**
+ * wqx-disasm
+ * disassembles code by physical location, so the same pc in two banks reads
+ * as the two routines it is. a whole bank from the given location on unless
+ * --count limits it, labels and operands named from symbol files.
+ *
+ * a symbol file holds "<where> <name>" lines, where being a physical
+ * location (rom185+4000, nor03+6000, ram+0456) or a cpu address, and
+ * "brk <number> <name>" lines naming BRK syscalls. # starts a comment.
+ */
+#include "disasm.h"
+#include "nc1020_machine.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+static double Now(){
+	return std::chrono::duration<double>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void Usage(const char* name){
+	fprintf(stderr,
+		"usage: %s --rom <obj_lu.bin> --nor <nc1020.fls> [options] <where>\n"
+		"  <where>            physical location (rom185+4000, nor03+6000,\n"
+		"                     ram+0456) or cpu address, in the banks the\n"
+		"                     machine has mapped\n"
+		"  --states <file>    take ram and banks from a saved state\n"
+		"  --pc <hex>         cpu address the code runs at (default: the\n"
+		"                     $4000-$BFFF window for a bank, the address\n"
+		"                     given otherwise)\n"
+		"  --count <n>        instructions to show (default: to the end of\n"
+		"                     the 32 KB bank)\n"
+		"  --symbols <file>   symbol file, may be given more than once\n"
+		"  --time             report the time to decode the bank\n",
+		name);
+}
+
+int main(int argc, char** argv){
+	wqx::WqxRom rom;
+	string where;
+	long pc = -1;
+	size_t count = 0;
+	vector<string> symbol_paths;
+	bool timing = false;
+	for (int i=1; i<argc; i++) {
+		string arg = argv[i];
+		bool has_value = i + 1 < argc;
+		if (arg == "--rom" && has_value) {
+			rom.romPath = argv[++i];
+		} else if (arg == "--nor" && has_value) {
+			rom.norFlashPath = argv[++i];
+		} else if (arg == "--states" && has_value) {
+			rom.statesPath = argv[++i];
+		} else if (arg == "--pc" && has_value) {
+			pc = strtol(argv[++i], NULL, 16) & 0xFFFF;
+		} else if (arg == "--count" && has_value) {
+			count = strtoul(argv[++i], NULL, 10);
+		} else if (arg == "--symbols" && has_value) {
+			symbol_paths.push_back(argv[++i]);
+		} else if (arg == "--time") {
+			timing = true;
+		} else if (where.empty() && arg[0] != '-') {
+			where = arg;
+		} else {
+			Usage(argv[0]);
+			return 2;
+		}
+	}
+	bool physical;
+	uint32_t address;
+	if (rom.romPath.empty() || rom.norFlashPath.empty() || where.empty()) {
+		Usage(argv[0]);
+		return 2;
+	}
+	if (!wqx::ParseLocation(where, &physical, &address)) {
+		fprintf(stderr, "bad location %s\n", where.c_str());
+		return 2;
+	}
+
+	wqx::SymbolTable symbols;
+	for (size_t i=0; i<symbol_paths.size(); i++) {
+		if (!symbols.Load(symbol_paths[i])) {
+			fprintf(stderr, "cannot open symbol file %s\n", symbol_paths[i].c_str());
+			return 1;
+		}
+	}
+
+	uint8_t* rom_image = wqx::LoadRomImage(rom.romPath);
+	if (rom_image == NULL) {
+		fprintf(stderr, "cannot load rom %s\n", rom.romPath.c_str());
+		return 1;
+	}
+	wqx::Machine* machine = wqx::CreateMachine(rom, rom_image);
+	if (rom.statesPath.empty()) {
+		wqx::Reset(machine);
+	} else {
+		wqx::LoadNC1020(machine);
+	}
+
+	uint32_t location = physical ? address : wqx::Locate(machine, (uint16_t)address);
+	if (pc < 0) {
+		if (!physical) {
+			pc = address;
+		} else if ((location & ~wqx::PHYS_OFFSET_MASK) == wqx::PHYS_RAM) {
+			pc = location & 0x7FFF;
+		} else {
+			pc = 0x4000 + (location & 0x7FFF);
+		}
+	}
+
+	wqx::Disassembler disassembler(machine);
+	disassembler.SetSymbols(&symbols);
+	double begin = Now();
+	const vector<wqx::instruction_t>& instructions =
+		disassembler.DecodeBank(location, (uint16_t)pc);
+	double seconds = Now() - begin;
+	if (instructions.empty()) {
+		fprintf(stderr, "%s is not in rom, nor or ram\n", where.c_str());
+		wqx::DestroyMachine(machine);
+		wqx::FreeRomImage(rom_image);
+		return 1;
+	}
+
+	if (count == 0 || count > instructions.size()) {
+		count = instructions.size();
+	}
+	uint32_t offset = 0;
+	for (size_t i=0; i<count; i++) {
+		const wqx::instruction_t& instruction = instructions[i];
+		const char* label = disassembler.Label(instruction, location + offset);
+		if (label) {
+			printf("%s:\n", label);
+		}
+		char bytes[16];
+		char text[96];
+		size_t used = 0;
+		for (size_t j=0; j<instruction.length && j<3; j++) {
+			used += snprintf(bytes + used, sizeof(bytes) - used, "%02X ", instruction.bytes[j]);
+		}
+		disassembler.Format(instruction, location + offset, text, sizeof(text));
+		printf("%-12s %04X  %-9s %s\n", wqx::LocationName(location + offset).c_str(),
+			instruction.pc, bytes, text);
+		offset += instruction.length;
+	}
+	if (timing) {
+		begin = Now();
+		// writable banks are compared against the copy every time.
+		disassembler.DecodeBank(location, (uint16_t)pc);
+		fprintf(stderr, "decoded %zu instructions in %.1f us, cached %.1f us\n",
+			instructions.size(), seconds * 1e6, (Now() - begin) * 1e6);
+	}
+
+	wqx::DestroyMachine(machine);
+	wqx::FreeRomImage(rom_image);
+	return 0;
+}
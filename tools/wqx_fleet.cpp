@@ -0,0 +1,151 @@
+/**
+ * wqx-fleet
+ * runs many nc1020 sessions off one rom image and reports throughput.
+ *
+ * manifest lines: "<nor_path> <states_path> [key_script_path]", '#' comments.
+ */
+#include "fleet.h"
+#include "stats_page.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+static void Usage(const char* name){
+	fprintf(stderr,
+		"usage: %s --rom <obj_lu.bin> --manifest <file> [options]\n"
+		"  --threads <n>      worker threads, 0 = one per core (default 0)\n"
+		"  --slice <ms>       time slice per tick (default 20)\n"
+		"  --duration <ms>    emulated time per session (default 10000)\n"
+		"  --realtime         pace ticks against the wall clock\n"
+		"  --no-park          keep emulating sessions that went to sleep\n"
+		"  --latency          report key to pixel latency of the scripted presses\n"
+		"  --save             save nor and states of every session at exit\n"
+		"  --worst <n>        list the n sessions with the most lag (default 10)\n"
+		"  --stats            publish live stats in /dev/shm/wqx-<pid> (see\n"
+		"                     wqx-stats)\n"
+		"  --stats-name <n>   the same under shared memory name n\n",
+		name);
+}
+
+static bool LoadManifest(const string& path, wqx::Fleet& fleet){
+	FILE* file = fopen(path.c_str(), "r");
+	if (file == NULL) {
+		fprintf(stderr, "cannot open manifest %s\n", path.c_str());
+		return false;
+	}
+	char line[1024];
+	size_t line_no = 0;
+	bool ok = true;
+	while (ok && fgets(line, sizeof(line), file)) {
+		line_no++;
+		char* comment = strchr(line, '#');
+		if (comment) {
+			*comment = 0;
+		}
+		char nor_path[512], states_path[512], script_path[512];
+		int fields = sscanf(line, "%511s %511s %511s", nor_path, states_path, script_path);
+		if (fields <= 0) {
+			continue;
+		}
+		if (fields < 2) {
+			fprintf(stderr, "%s:%zu: expected <nor_path> <states_path>\n", path.c_str(), line_no);
+			ok = false;
+			break;
+		}
+		vector<wqx::key_event_t> script;
+		if (fields == 3 && !wqx::LoadKeyScript(script_path, script)) {
+			fprintf(stderr, "%s:%zu: cannot open key script %s\n", path.c_str(), line_no, script_path);
+			ok = false;
+			break;
+		}
+		fleet.AddSession(nor_path, states_path, script);
+	}
+	fclose(file);
+	return ok;
+}
+
+int main(int argc, char** argv){
+	string rom_path;
+	string manifest_path;
+	wqx::fleet_options_t options;
+	options.threads = 0;
+	options.slice_ms = 20;
+	options.duration_ms = 10000;
+	options.realtime = false;
+	options.park_slept = true;
+	options.latency = false;
+	bool save = false;
+	size_t worst = 10;
+	bool stats = false;
+	string stats_name;
+	for (int i=1; i<argc; i++) {
+		string arg = argv[i];
+		bool has_value = i + 1 < argc;
+		if (arg == "--rom" && has_value) {
+			rom_path = argv[++i];
+		} else if (arg == "--manifest" && has_value) {
+			manifest_path = argv[++i];
+		} else if (arg == "--threads" && has_value) {
+			options.threads = strtoul(argv[++i], NULL, 10);
+		} else if (arg == "--slice" && has_value) {
+			options.slice_ms = strtoul(argv[++i], NULL, 10);
+		} else if (arg == "--duration" && has_value) {
+			options.duration_ms = strtoull(argv[++i], NULL, 10);
+		} else if (arg == "--worst" && has_value) {
+			worst = strtoul(argv[++i], NULL, 10);
+		} else if (arg == "--realtime") {
+			options.realtime = true;
+		} else if (arg == "--no-park") {
+			options.park_slept = false;
+		} else if (arg == "--latency") {
+			options.latency = true;
+		} else if (arg == "--save") {
+			save = true;
+		} else if (arg == "--stats") {
+			stats = true;
+		} else if (arg == "--stats-name" && has_value) {
+			stats = true;
+			stats_name = argv[++i];
+		} else {
+			Usage(argv[0]);
+			return 2;
+		}
+	}
+	if (rom_path.empty() || manifest_path.empty()) {
+		Usage(argv[0]);
+		return 2;
+	}
+
+	wqx::Fleet fleet(rom_path, options);
+	if (!fleet.IsRomLoaded()) {
+		fprintf(stderr, "cannot load rom %s\n", rom_path.c_str());
+		return 1;
+	}
+	if (!LoadManifest(manifest_path, fleet)) {
+		return 1;
+	}
+	if (fleet.Sessions() == 0) {
+		fprintf(stderr, "manifest %s has no sessions\n", manifest_path.c_str());
+		return 1;
+	}
+	wqx::StatsPage stats_page;
+	if (stats) {
+		if (!stats_page.Open(stats_name)) {
+			fprintf(stderr, "cannot create stats page %s\n", stats_name.c_str());
+			return 1;
+		}
+		fleet.SetStatsPage(&stats_page);
+		fprintf(stderr, "stats in %s\n", stats_page.Name().c_str());
+	}
+	fleet.Run();
+	if (save) {
+		fleet.SaveAll();
+	}
+	fleet.PrintReport(stdout, worst);
+	return 0;
+}
@@ -0,0 +1,95 @@
+/**
+ * wqx-frames
+ * inspects lcd captures written by FrameRecorder and exports them to
+ * y4m or animated png.
+ */
+#include "frame_recorder.h"
+#include "nc1020_machine.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+using std::string;
+
+static void Usage(const char* name){
+	fprintf(stderr,
+		"usage: %s <capture> [options]\n"
+		"  --info             frame count, duration and size (default)\n"
+		"  --y4m <file>       export constant rate gray video\n"
+		"  --fps <n>          y4m frame rate (default 50)\n"
+		"  --scale <n>        y4m upscaling, 1 to 8 (default 1)\n"
+		"  --apng <file>      export animated png\n",
+		name);
+}
+
+static bool PrintInfo(const string& capture){
+	wqx::FrameReader reader;
+	if (!reader.Open(capture)) {
+		return false;
+	}
+	uint8_t frame[wqx::LCD_SIZE];
+	uint64_t cycle = 0;
+	uint64_t first = 0;
+	uint64_t frames = 0;
+	while (reader.Next(frame, &cycle)) {
+		if (frames == 0) {
+			first = cycle;
+		}
+		frames++;
+	}
+	FILE* file = fopen(capture.c_str(), "rb");
+	long size = 0;
+	if (file) {
+		fseek(file, 0, SEEK_END);
+		size = ftell(file);
+		fclose(file);
+	}
+	double seconds = frames ? (double)(cycle - first) / wqx::CYCLES_SECOND : 0;
+	printf("frames          %llu\n", (unsigned long long)frames);
+	printf("duration        %.1f s\n", seconds);
+	printf("size            %ld bytes (%.1f per frame)\n", size,
+		frames ? (double)size / frames : 0);
+	return true;
+}
+
+int main(int argc, char** argv){
+	if (argc < 2) {
+		Usage(argv[0]);
+		return 2;
+	}
+	string capture = argv[1];
+	string y4m_path;
+	string apng_path;
+	size_t fps = 50;
+	size_t scale = 1;
+	for (int i=2; i<argc; i++) {
+		string arg = argv[i];
+		bool has_value = i + 1 < argc;
+		if (arg == "--info") {
+		} else if (arg == "--y4m" && has_value) {
+			y4m_path = argv[++i];
+		} else if (arg == "--fps" && has_value) {
+			fps = strtoul(argv[++i], NULL, 10);
+		} else if (arg == "--scale" && has_value) {
+			scale = strtoul(argv[++i], NULL, 10);
+		} else if (arg == "--apng" && has_value) {
+			apng_path = argv[++i];
+		} else {
+			Usage(argv[0]);
+			return 2;
+		}
+	}
+	if (!y4m_path.empty() && !wqx::ExportY4m(capture, y4m_path, fps, scale)) {
+		fprintf(stderr, "cannot export %s to %s\n", capture.c_str(), y4m_path.c_str());
+		return 1;
+	}
+	if (!apng_path.empty() && !wqx::ExportApng(capture, apng_path)) {
+		fprintf(stderr, "cannot export %s to %s\n", capture.c_str(), apng_path.c_str());
+		return 1;
+	}
+	if (y4m_path.empty() && apng_path.empty() && !PrintInfo(capture)) {
+		fprintf(stderr, "cannot read %s\n", capture.c_str());
+		return 1;
+	}
+	return 0;
+}
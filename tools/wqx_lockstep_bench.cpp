@@ -0,0 +1,143 @@
+/**
+ * wqx-lockstep-bench
+ * runs the same set of machines once through the scalar interpreter and
+ * once through LockstepGroup, checks both end in the same state and
+ * reports emulated MHz per core for each engine.
+ */
+#include "lockstep.h"
+#include "nc1020_machine.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+static double Now(){
+	return std::chrono::duration<double>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void Usage(const char* name){
+	fprintf(stderr,
+		"usage: %s --rom <obj_lu.bin> --nor <nc1020.fls> [options]\n"
+		"  --states <file>    start from a saved state instead of a reset\n"
+		"  --lanes <n>        machines per group, up to %zu (default %zu)\n"
+		"  --duration <ms>    emulated time (default 5000)\n"
+		"  --diverge          give every other lane a key press so lanes part\n",
+		name, wqx::LOCKSTEP_LANES, wqx::LOCKSTEP_LANES);
+}
+
+static vector<wqx::Machine*> CreateMachines(const wqx::WqxRom& rom, uint8_t* rom_image,
+	size_t count, bool diverge){
+	vector<wqx::Machine*> machines;
+	for (size_t i=0; i<count; i++) {
+		wqx::Machine* machine = wqx::CreateMachine(rom, rom_image);
+		if (rom.statesPath.empty()) {
+			wqx::Reset(machine);
+		} else {
+			wqx::LoadNC1020(machine);
+		}
+		if (diverge && (i & 1)) {
+			wqx::SetKey(machine, (uint8_t)(0x08 * (1 + i % 7)), true);
+		}
+		machines.push_back(machine);
+	}
+	return machines;
+}
+
+int main(int argc, char** argv){
+	wqx::WqxRom rom;
+	size_t lanes = wqx::LOCKSTEP_LANES;
+	size_t duration_ms = 5000;
+	bool diverge = false;
+	for (int i=1; i<argc; i++) {
+		string arg = argv[i];
+		bool has_value = i + 1 < argc;
+		if (arg == "--rom" && has_value) {
+			rom.romPath = argv[++i];
+		} else if (arg == "--nor" && has_value) {
+			rom.norFlashPath = argv[++i];
+		} else if (arg == "--states" && has_value) {
+			rom.statesPath = argv[++i];
+		} else if (arg == "--lanes" && has_value) {
+			lanes = strtoul(argv[++i], NULL, 10);
+		} else if (arg == "--duration" && has_value) {
+			duration_ms = strtoul(argv[++i], NULL, 10);
+		} else if (arg == "--diverge") {
+			diverge = true;
+		} else {
+			Usage(argv[0]);
+			return 2;
+		}
+	}
+	if (rom.romPath.empty() || rom.norFlashPath.empty() ||
+		lanes == 0 || lanes > wqx::LOCKSTEP_LANES) {
+		Usage(argv[0]);
+		return 2;
+	}
+	uint8_t* rom_image = wqx::LoadRomImage(rom.romPath);
+	if (rom_image == NULL) {
+		fprintf(stderr, "cannot load rom %s\n", rom.romPath.c_str());
+		return 1;
+	}
+
+	const size_t slice_ms = 20;
+	double emulated_cycles = (double)lanes * duration_ms * wqx::CYCLES_MS;
+
+	vector<wqx::Machine*> scalar = CreateMachines(rom, rom_image, lanes, diverge);
+	double begin = Now();
+	for (size_t t=0; t<duration_ms; t+=slice_ms) {
+		for (size_t i=0; i<lanes; i++) {
+			wqx::RunTimeSlice(scalar[i], slice_ms, false);
+		}
+	}
+	double scalar_seconds = Now() - begin;
+
+	vector<wqx::Machine*> lockstep = CreateMachines(rom, rom_image, lanes, diverge);
+	wqx::LockstepGroup group;
+	for (size_t i=0; i<lanes; i++) {
+		group.AddLane(lockstep[i]);
+	}
+	begin = Now();
+	for (size_t t=0; t<duration_ms; t+=slice_ms) {
+		group.RunTimeSlice(slice_ms, false);
+	}
+	double lockstep_seconds = Now() - begin;
+
+	size_t mismatches = 0;
+	for (size_t i=0; i<lanes; i++) {
+		if (memcmp(&scalar[i]->nc1020_states, &lockstep[i]->nc1020_states,
+				sizeof(wqx::nc1020_states_t)) != 0 ||
+			memcmp(scalar[i]->nor_buff, lockstep[i]->nor_buff, wqx::NOR_SIZE) != 0) {
+			fprintf(stderr, "lane %zu: lockstep state differs from scalar\n", i);
+			mismatches++;
+		}
+	}
+
+	const wqx::lockstep_stats_t& stats = group.Stats();
+	uint64_t lane_insts = stats.vector_lane_insts + stats.cohort_lane_insts + stats.scalar_insts;
+	printf("lanes           %zu x %zu ms\n", lanes, duration_ms);
+	printf("scalar          %.1f MHz\n", emulated_cycles / scalar_seconds / 1e6);
+	printf("lockstep        %.1f MHz\n", emulated_cycles / lockstep_seconds / 1e6);
+	printf("vector insts    %llu covering %llu lane insts (%.1f%% of all)\n",
+		(unsigned long long)stats.vector_insts,
+		(unsigned long long)stats.vector_lane_insts,
+		lane_insts ? 100.0 * stats.vector_lane_insts / lane_insts : 0);
+	printf("per lane insts  %llu in cohort, %llu outside\n",
+		(unsigned long long)stats.cohort_lane_insts,
+		(unsigned long long)stats.scalar_insts);
+	printf("splits / joins  %llu / %llu\n",
+		(unsigned long long)stats.splits, (unsigned long long)stats.joins);
+	printf("states          %s\n", mismatches ? "DIFFER" : "identical");
+
+	for (size_t i=0; i<lanes; i++) {
+		wqx::DestroyMachine(scalar[i]);
+		wqx::DestroyMachine(lockstep[i]);
+	}
+	wqx::FreeRomImage(rom_image);
+	return mismatches ? 1 : 0;
+}
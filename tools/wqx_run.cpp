@@ -0,0 +1,560 @@
+/**
+ * wqx-run
+ * runs one nc1020 without a ui: plays a key script, at real time or as
+ * fast as the host goes, and shows what the lcd did as pbm files or as
+ * braille in the terminal.
+ *
+ * key script lines: "<time_ms> <key_id> <down|up>", times from the start of
+ * the run, '#' comments. "-" reads the script from stdin.
+ */
+#include "debugger.h"
+#include "disasm.h"
+#include "fleet.h"
+#include "nc1020_machine.h"
+#include "pacer.h"
+#include "stats_page.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+static double Now(){
+	return std::chrono::duration<double>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void Usage(const char* name){
+	fprintf(stderr,
+		"usage: %s --rom <obj_lu.bin> --nor <nc1020.fls> [options]\n"
+		"  --states <file>    start from a saved state instead of a reset\n"
+		"  --keys <file|->    key script to play\n"
+		"  --duration <ms>    emulated time (default: script end + 1000,\n"
+		"                     10000 without a script)\n"
+		"  --slice <ms>       time slice (default 20)\n"
+		"  --realtime         run at real time instead of full speed\n"
+		"  --pbm <dir>        write every new frame as <dir>/frame_NNNNNN.pbm\n"
+		"  --screenshot <f>   write the last frame as pbm\n"
+		"  --braille          draw the lcd in the terminal, live with --realtime\n"
+		"  --save             save nor and states at exit\n"
+		"  --stats            publish live stats in /dev/shm/wqx-<pid> (see\n"
+		"                     wqx-stats)\n"
+		"  --stats-name <n>   the same under shared memory name n\n"
+		"  --latency          report key to pixel latency of the presses\n",
+		name);
+#ifdef NC1020_PROFILER
+	fprintf(stderr,
+		"  --profile <file>   profile the guest, folded stacks into file\n"
+		"  --profile-sample <cycles>\n"
+		"                     sample every that many cycles instead of\n"
+		"                     counting every instruction\n");
+#endif
+#ifdef NC1020_PHASES
+	fprintf(stderr,
+		"  --phases <file>    trace the host phases into file, chrome trace\n"
+		"                     event json\n");
+#endif
+#ifdef NC1020_COUNTERS
+	fprintf(stderr,
+		"  --counters         print the performance counters of the run\n");
+#endif
+#ifdef NC1020_TRACE
+	fprintf(stderr,
+		"  --trace <file>     record an execution trace (see wqx-trace)\n"
+		"  --trace-start <n>  skip the first n instructions\n"
+		"  --trace-count <n>  record at most n instructions\n"
+		"  --trace-start-pc <hex>, --trace-stop-pc <hex>\n"
+		"                     start at / stop before the pc\n"
+		"  --trace-peek <hex> address of the byte recorded with every\n"
+		"                     instruction (default: its opcode)\n");
+#endif
+#ifdef NC1020_DEBUGGER
+	fprintf(stderr,
+		"  --break <where>[ if <condition>]\n"
+		"                     report the pc reaching a cpu address (E123) or a\n"
+		"                     physical location (rom085+6123, nor03+1234,\n"
+		"                     ram+0456), conditions as in debugger.h\n"
+		"  --watch <where>[ if <condition>]\n"
+		"                     the same for loads and stores of a byte\n"
+		"  --watch-read <where>, --watch-write <where>\n"
+		"                     loads or stores only\n"
+		"  --stop-at-break    end the run at the first hit\n");
+#endif
+#if defined(NC1020_PROFILER) || defined(NC1020_DEBUGGER)
+	fprintf(stderr,
+		"  --symbols <file>   names for the profile and hits, as wqx-disasm\n"
+		"                     takes them\n");
+#endif
+}
+
+typedef struct {
+	string pbm_dir;
+	size_t pbm_frames;
+	bool braille_live;
+	bool failed;
+} frame_output_t;
+
+// pbm rows are msb first with 1 for black like the lcd, only the first
+// column, which carries no picture, is cleared.
+static bool WritePbm(const string& path, const uint8_t* frame){
+	FILE* file = fopen(path.c_str(), "wb");
+	if (file == NULL) {
+		return false;
+	}
+	fprintf(file, "P4\n%zu %zu\n", wqx::LCD_WIDTH, wqx::LCD_HEIGHT);
+	uint8_t row[wqx::LCD_ROW_BYTES];
+	for (size_t y=0; y<wqx::LCD_HEIGHT; y++) {
+		memcpy(row, frame + y * wqx::LCD_ROW_BYTES, wqx::LCD_ROW_BYTES);
+		row[0] &= 0x7F;
+		fwrite(row, 1, sizeof(row), file);
+	}
+	bool ok = ferror(file) == 0;
+	fclose(file);
+	return ok;
+}
+
+static bool Pixel(const uint8_t* frame, size_t x, size_t y){
+	return x > 0 && (frame[y * wqx::LCD_ROW_BYTES + x / 8] & (0x80 >> (x % 8)));
+}
+
+// 2x4 pixels per braille cell, 80 columns by 20 lines.
+static void PrintBraille(FILE* out, const uint8_t* frame){
+	static const uint8_t DOTS[4][2] = {
+		{0x01, 0x08}, {0x02, 0x10}, {0x04, 0x20}, {0x40, 0x80}
+	};
+	string text;
+	for (size_t y=0; y<wqx::LCD_HEIGHT; y+=4) {
+		for (size_t x=0; x<wqx::LCD_WIDTH; x+=2) {
+			uint32_t code = 0x2800;
+			for (size_t dy=0; dy<4; dy++) {
+				for (size_t dx=0; dx<2; dx++) {
+					if (Pixel(frame, x + dx, y + dy)) {
+						code |= DOTS[dy][dx];
+					}
+				}
+			}
+			text += (char)(0xE0 | (code >> 12));
+			text += (char)(0x80 | ((code >> 6) & 0x3F));
+			text += (char)(0x80 | (code & 0x3F));
+		}
+		text += '\n';
+	}
+	fputs(text.c_str(), out);
+}
+
+static void OnFrame(void* context, uint64_t cycle, const uint8_t* frame){
+	frame_output_t* output = (frame_output_t*)context;
+	if (!output->pbm_dir.empty()) {
+		char name[32];
+		snprintf(name, sizeof(name), "/frame_%06zu.pbm", output->pbm_frames++);
+		if (!WritePbm(output->pbm_dir + name, frame)) {
+			output->failed = true;
+		}
+	}
+	if (output->braille_live) {
+		fprintf(stdout, "\x1b[H");
+		PrintBraille(stdout, frame);
+		fprintf(stdout, "%.2f s\x1b[K\n", (double)cycle / wqx::CYCLES_SECOND);
+		fflush(stdout);
+	}
+}
+
+#ifdef NC1020_DEBUGGER
+// the hit the last slice stopped at, false when it ran to its end.
+static bool PrintBreak(wqx::Machine* machine, const wqx::Disassembler& disassembler){
+	wqx::break_hit_t hit;
+	if (!wqx::GetBreak(machine, &hit)) {
+		return false;
+	}
+	uint32_t location = wqx::Locate(machine, hit.pc);
+	wqx::instruction_t instruction = disassembler.Decode(location, hit.pc);
+	char code[64];
+	disassembler.Format(instruction, location, code, sizeof(code));
+	const char* label = disassembler.Label(instruction, location);
+	if (hit.kind == wqx::BREAK_EXEC) {
+		printf("break %d at %04X %s", hit.id, hit.pc, wqx::LocationName(hit.location).c_str());
+		if (label) {
+			printf(" %s", label);
+		}
+	} else {
+		printf("watch %d %s %02X at %04X %s by %04X", hit.id,
+			hit.kind == wqx::BREAK_READ ? "read" : "write", hit.value, hit.address,
+			wqx::LocationName(hit.location).c_str(), hit.pc);
+	}
+	printf(": %-14s a=%02X x=%02X y=%02X ps=%02X sp=%02X cycle %llu\n", code,
+		machine->reg_a, machine->reg_x, machine->reg_y, machine->reg_ps, machine->reg_sp,
+		(unsigned long long)hit.cycle);
+	return true;
+}
+#endif
+
+#ifdef NC1020_COUNTERS
+static void PrintCounters(wqx::Machine* machine){
+	wqx::perf_counters_t counters;
+	wqx::GetPerfCounters(machine, &counters);
+	printf("instructions    %llu in %llu cycles, %llu idle\n",
+		(unsigned long long)counters.insts, (unsigned long long)counters.cycles,
+		(unsigned long long)counters.idle_cycles);
+	printf("irqs            %llu, timer0 %llu, timer1 %llu\n",
+		(unsigned long long)counters.irqs, (unsigned long long)counters.timer0_events,
+		(unsigned long long)counters.timer1_events);
+	printf("bank switches   $00 %llu, $0A %llu, $0D %llu, $0F %llu\n",
+		(unsigned long long)counters.bank_switches[0],
+		(unsigned long long)counters.bank_switches[1],
+		(unsigned long long)counters.bank_switches[2],
+		(unsigned long long)counters.bank_switches[3]);
+	printf("io              %llu reads, %llu writes\n",
+		(unsigned long long)counters.io_reads, (unsigned long long)counters.io_writes);
+	for (size_t i=0; i<0x40; i++) {
+		if (counters.io_port_reads[i] || counters.io_port_writes[i]) {
+			printf("  port $%02zX      %llu reads, %llu writes\n", i,
+				(unsigned long long)counters.io_port_reads[i],
+				(unsigned long long)counters.io_port_writes[i]);
+		}
+	}
+	printf("flash commands ");
+	for (size_t i=1; i<=6; i++) {
+		printf(" %zu: %llu", i, (unsigned long long)counters.flash_commands[i]);
+	}
+	printf("\nlcd writes      %llu\n", (unsigned long long)counters.lcd_writes);
+}
+#endif
+
+int main(int argc, char** argv){
+	wqx::WqxRom rom;
+	string keys_path;
+	string screenshot_path;
+	uint64_t duration_ms = 0;
+	size_t slice_ms = 20;
+	bool realtime = false;
+	bool braille = false;
+	bool save = false;
+	bool stats = false;
+	string stats_name;
+	bool latency = false;
+#ifdef NC1020_PHASES
+	string phases_path;
+#endif
+#ifdef NC1020_COUNTERS
+	bool counters = false;
+#endif
+#ifdef NC1020_PROFILER
+	string profile_path;
+	size_t profile_sample = 0;
+#endif
+#ifdef NC1020_TRACE
+	wqx::trace_options_t trace;
+	trace.start_inst = 0;
+	trace.max_insts = 0;
+	trace.start_pc = -1;
+	trace.stop_pc = -1;
+	trace.peek_addr = -1;
+#endif
+#ifdef NC1020_DEBUGGER
+	vector<wqx::breakpoint_t> breakpoints;
+	bool stop_at_break = false;
+#endif
+#if defined(NC1020_PROFILER) || defined(NC1020_DEBUGGER)
+	vector<string> symbol_paths;
+#endif
+	frame_output_t output;
+	output.pbm_frames = 0;
+	output.braille_live = false;
+	output.failed = false;
+
+	for (int i=1; i<argc; i++) {
+		string arg = argv[i];
+		bool has_value = i + 1 < argc;
+		if (arg == "--rom" && has_value) {
+			rom.romPath = argv[++i];
+		} else if (arg == "--nor" && has_value) {
+			rom.norFlashPath = argv[++i];
+		} else if (arg == "--states" && has_value) {
+			rom.statesPath = argv[++i];
+		} else if (arg == "--keys" && has_value) {
+			keys_path = argv[++i];
+		} else if (arg == "--duration" && has_value) {
+			duration_ms = strtoull(argv[++i], NULL, 10);
+		} else if (arg == "--slice" && has_value) {
+			slice_ms = strtoul(argv[++i], NULL, 10);
+		} else if (arg == "--realtime") {
+			realtime = true;
+		} else if (arg == "--pbm" && has_value) {
+			output.pbm_dir = argv[++i];
+		} else if (arg == "--screenshot" && has_value) {
+			screenshot_path = argv[++i];
+		} else if (arg == "--braille") {
+			braille = true;
+		} else if (arg == "--save") {
+			save = true;
+		} else if (arg == "--stats") {
+			stats = true;
+		} else if (arg == "--stats-name" && has_value) {
+			stats = true;
+			stats_name = argv[++i];
+		} else if (arg == "--latency") {
+			latency = true;
+#ifdef NC1020_PHASES
+		} else if (arg == "--phases" && has_value) {
+			phases_path = argv[++i];
+#endif
+#ifdef NC1020_COUNTERS
+		} else if (arg == "--counters") {
+			counters = true;
+#endif
+#ifdef NC1020_PROFILER
+		} else if (arg == "--profile" && has_value) {
+			profile_path = argv[++i];
+		} else if (arg == "--profile-sample" && has_value) {
+			profile_sample = strtoul(argv[++i], NULL, 10);
+#endif
+#ifdef NC1020_TRACE
+		} else if (arg == "--trace" && has_value) {
+			trace.path = argv[++i];
+		} else if (arg == "--trace-start" && has_value) {
+			trace.start_inst = strtoull(argv[++i], NULL, 10);
+		} else if (arg == "--trace-count" && has_value) {
+			trace.max_insts = strtoull(argv[++i], NULL, 10);
+		} else if (arg == "--trace-start-pc" && has_value) {
+			trace.start_pc = (int32_t)strtoul(argv[++i], NULL, 16);
+		} else if (arg == "--trace-stop-pc" && has_value) {
+			trace.stop_pc = (int32_t)strtoul(argv[++i], NULL, 16);
+		} else if (arg == "--trace-peek" && has_value) {
+			trace.peek_addr = (int32_t)strtoul(argv[++i], NULL, 16);
+#endif
+#ifdef NC1020_DEBUGGER
+		} else if ((arg == "--break" || arg == "--watch" || arg == "--watch-read" ||
+			arg == "--watch-write") && has_value) {
+			int kinds = arg == "--break" ? wqx::BREAK_EXEC :
+				arg == "--watch-read" ? wqx::BREAK_READ :
+				arg == "--watch-write" ? wqx::BREAK_WRITE : wqx::BREAK_READ | wqx::BREAK_WRITE;
+			wqx::breakpoint_t breakpoint;
+			if (!wqx::ParseBreakpoint(argv[++i], kinds, &breakpoint)) {
+				fprintf(stderr, "bad location in %s\n", argv[i]);
+				return 2;
+			}
+			breakpoints.push_back(breakpoint);
+		} else if (arg == "--stop-at-break") {
+			stop_at_break = true;
+#endif
+#if defined(NC1020_PROFILER) || defined(NC1020_DEBUGGER)
+		} else if (arg == "--symbols" && has_value) {
+			symbol_paths.push_back(argv[++i]);
+#endif
+		} else {
+			Usage(argv[0]);
+			return 2;
+		}
+	}
+	if (rom.romPath.empty() || rom.norFlashPath.empty() || slice_ms == 0) {
+		Usage(argv[0]);
+		return 2;
+	}
+
+	vector<wqx::key_event_t> script;
+	if (!keys_path.empty() && !wqx::LoadKeyScript(keys_path, script)) {
+		fprintf(stderr, "cannot open key script %s\n", keys_path.c_str());
+		return 1;
+	}
+	if (duration_ms == 0) {
+		duration_ms = script.empty() ? 10000 : script.back().time_ms + 1000;
+	}
+
+	uint8_t* rom_image = wqx::LoadRomImage(rom.romPath);
+	if (rom_image == NULL) {
+		fprintf(stderr, "cannot load rom %s\n", rom.romPath.c_str());
+		return 1;
+	}
+	wqx::Machine* machine = wqx::CreateMachine(rom, rom_image);
+	if (rom.statesPath.empty()) {
+		wqx::Reset(machine);
+	} else {
+		wqx::LoadNC1020(machine);
+	}
+	// scheduled by cycle, so the run is the same at any speed.
+	uint64_t start = wqx::GetCycleCount(machine);
+	for (size_t i=0; i<script.size(); i++) {
+		wqx::ScheduleKey(machine, start + script[i].time_ms * wqx::CYCLES_MS,
+			script[i].key_id, script[i].down_or_up);
+	}
+
+	output.braille_live = braille && realtime;
+	if (!output.pbm_dir.empty() || output.braille_live) {
+		wqx::SetFrameListener(machine, &OnFrame, &output);
+	}
+	if (output.braille_live) {
+		fprintf(stdout, "\x1b[2J");
+	}
+#if defined(NC1020_PROFILER) || defined(NC1020_DEBUGGER)
+	wqx::SymbolTable symbols;
+	for (size_t i=0; i<symbol_paths.size(); i++) {
+		if (!symbols.Load(symbol_paths[i])) {
+			fprintf(stderr, "cannot open symbol file %s\n", symbol_paths[i].c_str());
+			return 1;
+		}
+	}
+#endif
+#ifdef NC1020_PROFILER
+	if (!profile_path.empty()) {
+		wqx::StartProfiler(machine, profile_sample);
+	}
+#endif
+#ifdef NC1020_TRACE
+	if (!trace.path.empty() && !wqx::StartTrace(machine, trace)) {
+		fprintf(stderr, "cannot write %s\n", trace.path.c_str());
+		return 1;
+	}
+#endif
+#ifdef NC1020_DEBUGGER
+	for (size_t i=0; i<breakpoints.size(); i++) {
+		if (wqx::AddBreakpoint(machine, breakpoints[i]) < 0) {
+			fprintf(stderr, "bad condition %s\n", breakpoints[i].condition.c_str());
+			return 2;
+		}
+	}
+	wqx::Disassembler disassembler(machine);
+	disassembler.SetSymbols(&symbols);
+#endif
+
+	wqx::SetLatencyTracking(machine, latency);
+
+	wqx::StatsPage stats_page;
+	int stats_slot = -1;
+	if (stats) {
+		if (!stats_page.Open(stats_name)) {
+			fprintf(stderr, "cannot create stats page %s\n", stats_name.c_str());
+			return 1;
+		}
+		stats_slot = stats_page.Add(machine, rom.norFlashPath.substr(
+			rom.norFlashPath.find_last_of('/') + 1));
+		fprintf(stderr, "stats in %s\n", stats_page.Name().c_str());
+	}
+#ifdef NC1020_PHASES
+	if (!phases_path.empty()) {
+		wqx::SetPhaseThreadName("emulation");
+		wqx::StartPhaseTrace();
+	}
+#endif
+
+	double begin = Now();
+	uint64_t emulated_ms = 0;
+	if (realtime) {
+		wqx::pacer_options_t options;
+		options.slice_ms = slice_ms;
+		options.max_slice_ms = slice_ms * 5;
+		options.max_catch_up_ms = 250;
+		options.speed_up = false;
+		wqx::Pacer pacer(machine, options);
+		while (emulated_ms < duration_ms) {
+			emulated_ms += pacer.Tick();
+			stats_page.Publish(stats_slot);
+#ifdef NC1020_DEBUGGER
+			// a stop cuts the slice short.
+			if (PrintBreak(machine, disassembler)) {
+				emulated_ms = (wqx::GetCycleCount(machine) - start) / wqx::CYCLES_MS;
+				if (stop_at_break) {
+					break;
+				}
+			}
+#endif
+		}
+	} else {
+		while (emulated_ms < duration_ms) {
+			wqx::RunTimeSlice(machine, slice_ms, false);
+			emulated_ms += slice_ms;
+#ifdef NC1020_DEBUGGER
+			// a stop cuts the slice short, the rest of it runs after the
+			// report.
+			uint64_t slice_end = start + emulated_ms * wqx::CYCLES_MS;
+			bool stopped = false;
+			while (!stopped && PrintBreak(machine, disassembler)) {
+				stopped = stop_at_break;
+				uint64_t now = wqx::GetCycleCount(machine);
+				if (!stopped && now < slice_end) {
+					wqx::RunCycles(machine, slice_end - now, false);
+				}
+			}
+			if (stopped) {
+				emulated_ms = (wqx::GetCycleCount(machine) - start) / wqx::CYCLES_MS;
+				break;
+			}
+#endif
+			stats_page.Publish(stats_slot);
+		}
+	}
+	double seconds = Now() - begin;
+	wqx::SetFrameListener(machine, NULL, NULL);
+#ifdef NC1020_TRACE
+	uint64_t traced = trace.path.empty() ? 0 : wqx::StopTrace(machine);
+#endif
+
+	int status = 0;
+	if (output.failed) {
+		fprintf(stderr, "cannot write frames to %s\n", output.pbm_dir.c_str());
+		status = 1;
+	}
+	uint8_t frame[wqx::LCD_SIZE];
+	bool has_frame = wqx::CopyLcdBuffer(machine, frame);
+	if (!screenshot_path.empty() &&
+		!(has_frame && WritePbm(screenshot_path, frame))) {
+		fprintf(stderr, "cannot write %s\n", screenshot_path.c_str());
+		status = 1;
+	}
+	if (braille && !output.braille_live && has_frame) {
+		PrintBraille(stdout, frame);
+	}
+	if (save) {
+		wqx::SaveNC1020(machine);
+		stats_page.Publish(stats_slot);
+	}
+	printf("emulated        %llu ms in %.3f s (%.1f MHz, %.2fx real time)\n",
+		(unsigned long long)emulated_ms, seconds,
+		seconds > 0 ? emulated_ms * wqx::CYCLES_MS / seconds / 1e6 : 0,
+		seconds > 0 ? emulated_ms / 1000.0 / seconds : 0);
+	if (!output.pbm_dir.empty() && !output.failed) {
+		printf("frames          %zu written to %s\n", output.pbm_frames, output.pbm_dir.c_str());
+	}
+	if (latency) {
+		wqx::latency_stats_t latency_stats;
+		wqx::GetLatencyStats(machine, &latency_stats);
+		wqx::PrintLatencyStats(stdout, &latency_stats);
+	}
+#ifdef NC1020_COUNTERS
+	if (counters) {
+		PrintCounters(machine);
+	}
+#endif
+#ifdef NC1020_PHASES
+	if (!phases_path.empty()) {
+		wqx::StopPhaseTrace();
+		if (!wqx::WritePhaseTrace(phases_path)) {
+			fprintf(stderr, "cannot write %s\n", phases_path.c_str());
+			status = 1;
+		}
+	}
+#endif
+#ifdef NC1020_PROFILER
+	if (!profile_path.empty()) {
+		if (!wqx::WriteProfile(machine, profile_path, &symbols)) {
+			fprintf(stderr, "cannot write %s\n", profile_path.c_str());
+			status = 1;
+		}
+		printf("profile         %s, hottest pcs:\n%s", profile_path.c_str(),
+			wqx::ProfileTop(machine, 10, &symbols).c_str());
+		wqx::StopProfiler(machine);
+	}
+#endif
+#ifdef NC1020_TRACE
+	if (!trace.path.empty()) {
+		printf("trace           %llu instructions in %s\n",
+			(unsigned long long)traced, trace.path.c_str());
+	}
+#endif
+	wqx::DestroyMachine(machine);
+	wqx::FreeRomImage(rom_image);
+	return status;
+}
@@ -0,0 +1,133 @@
+/**
+ * wqx-stats
+ * prints the live stats wqx-run and wqx-fleet publish with --stats, of one
+ * page or of every page in /dev/shm, refreshed until interrupted.
+ */
+#include "stats_page.h"
+#include <dirent.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+static void Usage(const char* name){
+	fprintf(stderr,
+		"usage: %s [name] [options]\n"
+		"  name               a page like wqx-1234 (default: every wqx-* page\n"
+		"                     in /dev/shm)\n"
+		"  --interval <ms>    refresh period (default 1000)\n"
+		"  --once             print once and exit\n",
+		name);
+}
+
+static uint64_t UnixMs(){
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return (uint64_t)now.tv_sec * 1000 + now.tv_usec / 1000;
+}
+
+static vector<string> FindPages(){
+	vector<string> names;
+	DIR* dir = opendir("/dev/shm");
+	if (dir == NULL) {
+		return names;
+	}
+	while (struct dirent* entry = readdir(dir)) {
+		string file = entry->d_name;
+		if (file.compare(0, 4, "wqx-") == 0) {
+			names.push_back("/" + file);
+		}
+	}
+	closedir(dir);
+	std::sort(names.begin(), names.end());
+	return names;
+}
+
+// returns the machines listed.
+static size_t PrintPage(const string& name){
+	wqx::StatsReader reader;
+	if (!reader.Open(name)) {
+		printf("%s: not a stats page\n", name.c_str());
+		return 0;
+	}
+	pid_t pid = (pid_t)reader.Pid();
+	bool dead = kill(pid, 0) != 0 && errno == ESRCH;
+	printf("%s  pid %d%s\n", name.c_str(), (int)pid, dead ? " (dead)" : "");
+	printf("%4s %-24s %8s %7s %5s %10s %6s %8s %7s %7s %8s\n", "slot", "name", "MHz",
+		"ratio", "sleep", "frames", "saves", "save ms", "save er", "fls err", "age ms");
+	uint64_t now = UnixMs();
+	size_t listed = 0;
+	for (size_t i=0; i<wqx::STATS_PAGE_SLOTS; i++) {
+		wqx::live_stats_t stats;
+		if (!reader.Read(i, &stats)) {
+			continue;
+		}
+		printf("%4u %-24.24s %8.2f %7.2f %5s %10llu %6llu %8.2f %7llu %7llu %8lld\n",
+			(unsigned)i, stats.name, stats.mhz, stats.realtime_ratio,
+			stats.sleeping ? "yes" : "no", (unsigned long long)stats.lcd_generation,
+			(unsigned long long)stats.saves, stats.last_save_ms,
+			(unsigned long long)stats.save_errors, (unsigned long long)stats.flash_errors,
+			(long long)(now - stats.updated_ms));
+		listed++;
+	}
+	return listed;
+}
+
+int main(int argc, char** argv){
+	string name;
+	uint64_t interval_ms = 1000;
+	bool once = false;
+	for (int i=1; i<argc; i++) {
+		string arg = argv[i];
+		bool has_value = i + 1 < argc;
+		if (arg == "--interval" && has_value) {
+			interval_ms = strtoull(argv[++i], NULL, 10);
+		} else if (arg == "--once") {
+			once = true;
+		} else if (name.empty() && arg[0] != '-') {
+			name = arg[0] == '/' ? arg : "/" + arg;
+		} else {
+			Usage(argv[0]);
+			return 2;
+		}
+	}
+	if (interval_ms == 0) {
+		Usage(argv[0]);
+		return 2;
+	}
+
+	for (;;) {
+		vector<string> names;
+		if (name.empty()) {
+			names = FindPages();
+		} else {
+			names.push_back(name);
+		}
+		if (!once) {
+			printf("\x1b[H\x1b[2J");
+		}
+		if (names.empty()) {
+			printf("no stats pages in /dev/shm\n");
+		}
+		for (size_t i=0; i<names.size(); i++) {
+			if (i) {
+				printf("\n");
+			}
+			PrintPage(names[i]);
+		}
+		fflush(stdout);
+		if (once) {
+			return names.empty() ? 1 : 0;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(interval_ms));
+	}
+}
@@ -0,0 +1,92 @@
+/**
+ * wqx-trace
+ * reads an execution trace written by a NC1020_TRACE build (wqx-run
+ * --trace): prints it as text, or converts it to the raw 8 byte records of
+ * wqxsimlogs.bin, behind the start instruction and the peek address as
+ * 32 bit words.
+ */
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+using std::string;
+
+static void Usage(const char* name){
+	fprintf(stderr,
+		"usage: %s <trace> [options]\n"
+		"  --count <n>        stop after n records\n"
+		"  --raw <file>       write wqxsimlogs.bin records instead of text\n",
+		name);
+}
+
+int main(int argc, char** argv){
+	string trace_path;
+	string raw_path;
+	uint64_t count = (uint64_t)-1;
+	for (int i=1; i<argc; i++) {
+		string arg = argv[i];
+		bool has_value = i + 1 < argc;
+		if (arg == "--count" && has_value) {
+			count = strtoull(argv[++i], NULL, 10);
+		} else if (arg == "--raw" && has_value) {
+			raw_path = argv[++i];
+		} else if (trace_path.empty() && arg[0] != '-') {
+			trace_path = arg;
+		} else {
+			Usage(argv[0]);
+			return 2;
+		}
+	}
+	if (trace_path.empty()) {
+		Usage(argv[0]);
+		return 2;
+	}
+
+	wqx::TraceReader reader;
+	if (!reader.Open(trace_path)) {
+		fprintf(stderr, "cannot read trace %s\n", trace_path.c_str());
+		return 1;
+	}
+	const wqx::trace_header_t& header = reader.Header();
+	FILE* raw = NULL;
+	if (!raw_path.empty()) {
+		raw = fopen(raw_path.c_str(), "wb");
+		uint32_t start = (uint32_t)header.start_inst;
+		if (raw == NULL || fwrite(&start, 4, 1, raw) != 1 ||
+			fwrite(&header.peek_addr, 4, 1, raw) != 1) {
+			fprintf(stderr, "cannot write %s\n", raw_path.c_str());
+			return 1;
+		}
+	} else {
+		printf("# start at instruction %llu, peeked %s",
+			(unsigned long long)header.start_inst,
+			header.peek_addr < 0 ? "opcode\n" : "");
+		if (header.peek_addr >= 0) {
+			printf("%04X\n", header.peek_addr);
+		}
+	}
+
+	wqx::trace_record_t record;
+	uint64_t records = 0;
+	while (records < count && reader.Next(&record)) {
+		if (raw) {
+			fwrite(&record, sizeof(record), 1, raw);
+		} else {
+			printf("%llu %04X a=%02X ps=%02X x=%02X y=%02X sp=%02X %02X\n",
+				(unsigned long long)(header.start_inst + records), record.reg_pc,
+				record.reg_a, record.reg_ps, record.reg_x, record.reg_y,
+				record.reg_sp, record.peeked);
+		}
+		records++;
+	}
+	if (raw) {
+		bool ok = ferror(raw) == 0;
+		if (fclose(raw) != 0 || !ok) {
+			fprintf(stderr, "cannot write %s\n", raw_path.c_str());
+			return 1;
+		}
+		fprintf(stderr, "%llu records\n", (unsigned long long)records);
+	}
+	return 0;
+}